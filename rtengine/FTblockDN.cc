@@ -37,12 +37,16 @@
 #include "opthelper.h"
 #include "cplx_wavelet_dec.h"
 #include "median.h"
+#include "fftwplans.h"
+#include "memorybudget.h"
+#include "threadbudget.h"
 #include "iccstore.h"
 #include "procparams.h"
 #ifdef _OPENMP
 #include <omp.h>
 #endif
 #include "StopWatch.h"
+#include "proctrace.h"
 
 #define TS 64       // Tile size
 #define offset 25   // shift between tiles
@@ -73,12 +77,20 @@ namespace rtengine
 
 
 extern const Settings* settings;
-extern MyMutex *fftwMutex;
 
 
 namespace
 {
 
+constexpr int minDenoiseTileSize = 256;
+
+// estimated peak memory use of the denoise of a tile: the Lab tile, the wavelet decompositions of its 3 channels,
+// the noise curves and the blocks of the DCT
+std::size_t denoiseTileMemory(int width, int height)
+{
+    return std::size_t(width) * height * 12 * sizeof(float);
+}
+
 template <bool useUpperBound>
 void do_median_denoise(float **src, float **dst, float upperBound, int width, int height, ImProcFunctions::Median medianType, int iterations, int numThreads, float **buffer)
 {
@@ -472,11 +484,12 @@ void ImProcFunctions::Tile_calc(int tilesize, int overlap, int kall, int imwidth
     //  printf("Nw=%d NH=%d tileW=%d tileH=%d\n",numtiles_W,numtiles_H,tileWskip,tileHskip);
 }
 
-int denoiseNestedLevels = 1;
 enum nrquality {QUALITY_STANDARD, QUALITY_HIGH};
 
 void ImProcFunctions::RGB_denoise(int kall, Imagefloat * src, Imagefloat * dst, Imagefloat * calclum, float * ch_M, float *max_r, float *max_b, bool isRAW, const procparams::DirPyrDenoiseParams & dnparams, const double expcomp, const NoiseCurve & noiseLCurve, const NoiseCurve & noiseCCurve, float &nresi, float &highresi)
 {
+    PROCTRACE("RGB_denoise");
+
 BENCHFUN
 //#ifdef _DEBUG
     MyTime t1e, t2e;
@@ -497,8 +510,6 @@ BENCHFUN
         return;
     }
 
-    MyMutex::MyLock lock(*fftwMutex);
-
     const nrquality nrQuality = (dnparams.smethod == "shal") ? QUALITY_STANDARD : QUALITY_HIGH;//shrink method
     const float qhighFactor = (nrQuality == QUALITY_HIGH) ? 1.f / static_cast<float>(settings->nrhigh) : 1.0f;
     const bool useNoiseCCurve = (noiseCCurve && noiseCCurve.getSum() > 5.f);
@@ -705,18 +716,65 @@ BENCHFUN
             printf("Tiled denoise processing caused by Automatic Multizone mode\n");
         }
 
+        // the whole image is processed at once only if the memory budget has room for it
+        MemoryBudget::Reservation memoryReservation;
+        bool tiled = options.rgbDenoiseThreadLimit != 0 || ponder || !memoryReservation.reserve(denoiseTileMemory(imwidth, imheight));
+        const auto tileMemory = [&]() {
+            return denoiseTileMemory(min<int>(tilesize, imwidth), min<int>(tilesize, imheight));
+        };
+
         bool memoryAllocationFailed = false;
 
         do {
             ++numTries;
 
             if (numTries == 2) {
-                printf("1st denoise pass failed due to insufficient memory, starting 2nd (tiled) pass now...\n");
+                if (tiled) {
+                    printf("denoise pass failed due to insufficient memory, starting a new pass with smaller tiles now...\n");
+                } else {
+                    printf("1st denoise pass failed due to insufficient memory, starting 2nd (tiled) pass now...\n");
+                }
+            }
+
+            // the automatic multizone mode has its noise values for the tiles of the original size
+            if (numTries > 1 && tiled && !ponder) {
+                tilesize = max(tilesize / 2, minDenoiseTileSize);
+                overlap = tilesize / 8;
+            }
+
+            tiled = tiled || numTries > 1;
+            int maxThreadsForMemory = 0; // no limit
+
+            if (tiled) {
+                // smaller tiles as long as the budget doesn't have room for two of them besides the output buffer
+                const std::size_t outputSize = std::size_t(imwidth) * imheight * 3 * sizeof(float);
+
+                while (!ponder && tilesize > minDenoiseTileSize && memoryReservation.reserveUnits(outputSize, tileMemory(), 2) < 2) {
+                    tilesize = max(tilesize / 2, minDenoiseTileSize);
+                    overlap = tilesize / 8;
+                }
+
+#ifdef _OPENMP
+                const int maxTiles = omp_get_max_threads();
+#else
+                const int maxTiles = 1;
+#endif
+                maxThreadsForMemory = memoryReservation.reserveUnits(outputSize, tileMemory(), maxTiles);
+
+                if (!maxThreadsForMemory) {
+                    // it won't get smaller, go on with one tile at a time anyway
+                    memoryReservation.reserve(outputSize + tileMemory(), true);
+                    maxThreadsForMemory = 1;
+                }
+
+                if (settings->verbose) {
+                    printf("RGB_denoise: tiles of %d pixels, at most %d at a time\n", tilesize, maxThreadsForMemory);
+                }
             }
 
             int numtiles_W, numtiles_H, tilewidth, tileheight, tileWskip, tileHskip;
 
-            Tile_calc(tilesize, overlap, (options.rgbDenoiseThreadLimit == 0 && !ponder) ? (numTries == 1 ? 0 : 2) : 2, imwidth, imheight, numtiles_W, numtiles_H, tilewidth, tileheight, tileWskip, tileHskip);
+            Tile_calc(tilesize, overlap, tiled ? 2 : 0, imwidth, imheight, numtiles_W, numtiles_H, tilewidth, tileheight, tileWskip, tileHskip);
             memoryAllocationFailed = false;
             const int numtiles = numtiles_W * numtiles_H;
 
@@ -751,76 +809,16 @@ BENCHFUN
             // calculate min size of numblox_W.
             int min_numblox_W = ceil((static_cast<float>((MIN(imwidth, ((numtiles_W - 1) * tileWskip) + tilewidth)) - ((numtiles_W - 1) * tileWskip))) / (offset)) + 2 * blkrad;
 
-            // these are needed only for creation of the plans and will be freed before entering the parallel loop
-            fftwf_plan plan_forward_blox[2];
-            fftwf_plan plan_backward_blox[2];
+            // the plans are shared with the other images of the same size and executed on the buffers of each thread
+            FFTWPlans::Plan plan_forward_blox[2];
+            FFTWPlans::Plan plan_backward_blox[2];
 
             if (denoiseLuminance) {
-                float *Lbloxtmp  = reinterpret_cast<float*>(fftwf_malloc(max_numblox_W * TS * TS * sizeof(float)));
-                float *fLbloxtmp = reinterpret_cast<float*>(fftwf_malloc(max_numblox_W * TS * TS * sizeof(float)));
-
-                int nfwd[2] = {TS, TS};
-
-                //for DCT:
-                fftw_r2r_kind fwdkind[2] = {FFTW_REDFT10, FFTW_REDFT10};
-                fftw_r2r_kind bwdkind[2] = {FFTW_REDFT01, FFTW_REDFT01};
-
-                // Creating the plans with FFTW_MEASURE instead of FFTW_ESTIMATE speeds up the execute a bit
-                plan_forward_blox[0]  = fftwf_plan_many_r2r(2, nfwd, max_numblox_W, Lbloxtmp, nullptr, 1, TS * TS, fLbloxtmp, nullptr, 1, TS * TS, fwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
-                plan_backward_blox[0] = fftwf_plan_many_r2r(2, nfwd, max_numblox_W, fLbloxtmp, nullptr, 1, TS * TS, Lbloxtmp, nullptr, 1, TS * TS, bwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
-                plan_forward_blox[1]  = fftwf_plan_many_r2r(2, nfwd, min_numblox_W, Lbloxtmp, nullptr, 1, TS * TS, fLbloxtmp, nullptr, 1, TS * TS, fwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
-                plan_backward_blox[1] = fftwf_plan_many_r2r(2, nfwd, min_numblox_W, fLbloxtmp, nullptr, 1, TS * TS, Lbloxtmp, nullptr, 1, TS * TS, bwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
-                fftwf_free(Lbloxtmp);
-                fftwf_free(fLbloxtmp);
-            }
-
-#ifndef _OPENMP
-            int numthreads = 1;
-#else
-            // Calculate number of tiles. If less than omp_get_max_threads(), then limit num_threads to number of tiles
-            int numthreads = MIN(numtiles, omp_get_max_threads());
-
-            if (options.rgbDenoiseThreadLimit > 0) {
-                numthreads = MIN(numthreads, options.rgbDenoiseThreadLimit);
-            }
-
-#ifdef _OPENMP
-            denoiseNestedLevels = omp_get_max_threads() / numthreads;
-            bool oldNested = omp_get_nested();
-
-            if (denoiseNestedLevels < 2) {
-                denoiseNestedLevels = 1;
-            } else {
-                omp_set_nested(true);
-            }
-
-            if (options.rgbDenoiseThreadLimit > 0)
-                while (denoiseNestedLevels * numthreads > options.rgbDenoiseThreadLimit) {
-                    denoiseNestedLevels--;
-                }
-
-#endif
-
-            if (settings->verbose) {
-                printf("RGB_denoise uses %d main thread(s) and up to %d nested thread(s) for each main thread\n", numthreads, denoiseNestedLevels);
-            }
-
-#endif
-            const std::size_t blox_array_size = denoiseNestedLevels * numthreads;
-
-            float *LbloxArray[blox_array_size];
-            float *fLbloxArray[blox_array_size];
-
-            for (std::size_t i = 0; i < blox_array_size; ++i) {
-                LbloxArray[i] = nullptr;
-                fLbloxArray[i] = nullptr;
-            }
-
-            if (numtiles > 1 && denoiseLuminance) {
-                for (int i = 0; i < denoiseNestedLevels * numthreads; ++i) {
-                    LbloxArray[i]  = reinterpret_cast<float*>(fftwf_malloc(max_numblox_W * TS * TS * sizeof(float)));
-                    fLbloxArray[i] = reinterpret_cast<float*>(fftwf_malloc(max_numblox_W * TS * TS * sizeof(float)));
-                }
+                FFTWPlans* const fftwPlans = FFTWPlans::getInstance();
+                plan_forward_blox[0]  = fftwPlans->getBlockDCT(TS, max_numblox_W, true);
+                plan_backward_blox[0] = fftwPlans->getBlockDCT(TS, max_numblox_W, false);
+                plan_forward_blox[1]  = fftwPlans->getBlockDCT(TS, min_numblox_W, true);
+                plan_backward_blox[1] = fftwPlans->getBlockDCT(TS, min_numblox_W, false);
             }
 
             TMatrix wiprof = ICCStore::getInstance()->workingSpaceInverseMatrix(params->icm.workingProfile);
@@ -839,139 +837,224 @@ BENCHFUN
                 {static_cast<float>(wprof[2][0]), static_cast<float>(wprof[2][1]), static_cast<float>(wprof[2][2])}
             };
 
-            // begin tile processing of image
 #ifdef _OPENMP
-            #pragma omp parallel num_threads(numthreads) if (numthreads>1)
+            // The threads are shared with the other images processed at the same time
+            const int maxThreads = options.rgbDenoiseThreadLimit > 0 ? MIN(options.rgbDenoiseThreadLimit, omp_get_max_threads()) : omp_get_max_threads();
+            // the memory is reserved per tile, so the budget limits the tiles processed at once, i.e. the outer threads
+            const int maxTilesAtOnce = maxThreadsForMemory > 0 ? MIN(maxThreads, maxThreadsForMemory) : maxThreads;
+
+            const bool oldNested = omp_get_nested();
+            // The threads are leased again for each batch of tile rows, so that the next batches use the threads
+            // given back meanwhile by the other images
+            const int rowsPerBatch = (maxTilesAtOnce + numtiles_W - 1) / numtiles_W;
+#else
+            const int rowsPerBatch = numtiles_H;
 #endif
-            {
-                int pos;
-                float* noisevarlum;
-                float* noisevarchrom;
 
-                if (numtiles == 1 && isRAW && (useNoiseCCurve || useNoiseLCurve)) {
-                    noisevarlum = lumcalcBuffer;
-                    noisevarchrom = ccalcBuffer;
-                } else {
-                    noisevarlum = new float[((tileheight + 1) / 2) * ((tilewidth + 1) / 2)];
-                    noisevarchrom = new float[((tileheight + 1) / 2) * ((tilewidth + 1) / 2)];
+            for (int firstRow = 0; firstRow < numtiles_H && !isCancelled(); firstRow += rowsPerBatch) {
+                const int batchBottom = MIN(imheight, (firstRow + rowsPerBatch) * tileHskip);
+#ifndef _OPENMP
+                int numthreads = 1;
+#else
+                ThreadBudget::Lease threadLease(maxThreads);
+                int numthreads;
+                threadLease.split(MIN(rowsPerBatch, numtiles_H - firstRow) * numtiles_W, numthreads, denoiseNestedLevels, maxTilesAtOnce);
+                omp_set_nested(oldNested || denoiseNestedLevels > 1);
+
+                if (settings->verbose) {
+                    printf("RGB_denoise uses %d main thread(s) and up to %d nested thread(s) for each main thread\n", numthreads, denoiseNestedLevels);
+                }
+
+#endif
+                const std::size_t blox_array_size = denoiseNestedLevels * numthreads;
+
+                float *LbloxArray[blox_array_size];
+                float *fLbloxArray[blox_array_size];
+
+                for (std::size_t i = 0; i < blox_array_size; ++i) {
+                    LbloxArray[i] = nullptr;
+                    fLbloxArray[i] = nullptr;
+                }
+
+                if (numtiles > 1 && denoiseLuminance) {
+                    for (int i = 0; i < denoiseNestedLevels * numthreads; ++i) {
+                        LbloxArray[i]  = reinterpret_cast<float*>(fftwf_malloc(max_numblox_W * TS * TS * sizeof(float)));
+                        fLbloxArray[i] = reinterpret_cast<float*>(fftwf_malloc(max_numblox_W * TS * TS * sizeof(float)));
+                    }
                 }
 
+                // begin tile processing of image
 #ifdef _OPENMP
-                #pragma omp for schedule(dynamic) collapse(2)
+                #pragma omp parallel num_threads(numthreads) if (numthreads>1)
 #endif
+                {
+                    int pos;
+                    float* noisevarlum;
+                    float* noisevarchrom;
 
-                for (int tiletop = 0; tiletop < imheight; tiletop += tileHskip) {
-                    for (int tileleft = 0; tileleft < imwidth ; tileleft += tileWskip) {
-                        //printf("titop=%d tileft=%d\n",tiletop/tileHskip, tileleft/tileWskip);
-                        pos = (tiletop / tileHskip) * numtiles_W + tileleft / tileWskip ;
-                        int tileright = MIN(imwidth, tileleft + tilewidth);
-                        int tilebottom = MIN(imheight, tiletop + tileheight);
-                        int width  = tileright - tileleft;
-                        int height = tilebottom - tiletop;
-                        int width2 = (width + 1) / 2;
-                        float realred, realblue;
-                        float interm_med = static_cast<float>(dnparams.chroma) / 10.0;
-                        float intermred, intermblue;
-
-                        if (dnparams.redchro > 0.) {
-                            intermred = (dnparams.redchro / 10.);
-                        } else {
-                            intermred = static_cast<float>(dnparams.redchro) / 7.0;     //increase slower than linear for more sensit
-                        }
+                    if (numtiles == 1 && isRAW && (useNoiseCCurve || useNoiseLCurve)) {
+                        noisevarlum = lumcalcBuffer;
+                        noisevarchrom = ccalcBuffer;
+                    } else {
+                        noisevarlum = new float[((tileheight + 1) / 2) * ((tilewidth + 1) / 2)];
+                        noisevarchrom = new float[((tileheight + 1) / 2) * ((tilewidth + 1) / 2)];
+                    }
 
-                        if (dnparams.bluechro > 0.) {
-                            intermblue = (dnparams.bluechro / 10.);
-                        } else {
-                            intermblue = static_cast<float>(dnparams.bluechro) / 7.0;     //increase slower than linear for more sensit
-                        }
+#ifdef _OPENMP
+                    #pragma omp for schedule(dynamic) collapse(2)
+#endif
 
-                        if (ponder && kall == 2) {
-                            interm_med = ch_M[pos] / 10.f;
-                            intermred = max_r[pos] / 10.f;
-                            intermblue = max_b[pos] / 10.f;
-                        }
+                    for (int tiletop = firstRow * tileHskip; tiletop < batchBottom; tiletop += tileHskip) {
+                        for (int tileleft = 0; tileleft < imwidth ; tileleft += tileWskip) {
+                            if (isCancelled()) {
+                                continue;
+                            }
 
-                        if (ponder && kall == 0) {
-                            interm_med = 0.01f;
-                            intermred = 0.f;
-                            intermblue = 0.f;
-                        }
+                            //printf("titop=%d tileft=%d\n",tiletop/tileHskip, tileleft/tileWskip);
+                            pos = (tiletop / tileHskip) * numtiles_W + tileleft / tileWskip ;
+                            int tileright = MIN(imwidth, tileleft + tilewidth);
+                            int tilebottom = MIN(imheight, tiletop + tileheight);
+                            int width  = tileright - tileleft;
+                            int height = tilebottom - tiletop;
+                            int width2 = (width + 1) / 2;
+                            float realred, realblue;
+                            float interm_med = static_cast<float>(dnparams.chroma) / 10.0;
+                            float intermred, intermblue;
+
+                            if (dnparams.redchro > 0.) {
+                                intermred = (dnparams.redchro / 10.);
+                            } else {
+                                intermred = static_cast<float>(dnparams.redchro) / 7.0;     //increase slower than linear for more sensit
+                            }
 
-                        realred = interm_med + intermred;
+                            if (dnparams.bluechro > 0.) {
+                                intermblue = (dnparams.bluechro / 10.);
+                            } else {
+                                intermblue = static_cast<float>(dnparams.bluechro) / 7.0;     //increase slower than linear for more sensit
+                            }
 
-                        if (realred <= 0.f) {
-                            realred = 0.001f;
-                        }
+                            if (ponder && kall == 2) {
+                                interm_med = ch_M[pos] / 10.f;
+                                intermred = max_r[pos] / 10.f;
+                                intermblue = max_b[pos] / 10.f;
+                            }
 
-                        realblue = interm_med + intermblue;
+                            if (ponder && kall == 0) {
+                                interm_med = 0.01f;
+                                intermred = 0.f;
+                                intermblue = 0.f;
+                            }
 
-                        if (realblue <= 0.f) {
-                            realblue = 0.001f;
-                        }
+                            realred = interm_med + intermred;
+
+                            if (realred <= 0.f) {
+                                realred = 0.001f;
+                            }
+
+                            realblue = interm_med + intermblue;
+
+                            if (realblue <= 0.f) {
+                                realblue = 0.001f;
+                            }
 
-                        const float noisevarab_r = SQR(realred);
-                        const float noisevarab_b = SQR(realblue);
+                            const float noisevarab_r = SQR(realred);
+                            const float noisevarab_b = SQR(realblue);
 
-                        //input L channel
-                        array2D<float> *Lin = nullptr;
-                        //wavelet denoised image
-                        LabImage * labdn = new LabImage(width, height);
+                            //input L channel
+                            array2D<float> *Lin = nullptr;
+                            //wavelet denoised image
+                            LabImage * labdn = new LabImage(width, height);
 
-                        //fill tile from image; convert RGB to "luma/chroma"
-                        const float maxNoiseVarab = max(noisevarab_b, noisevarab_r);
+                            //fill tile from image; convert RGB to "luma/chroma"
+                            const float maxNoiseVarab = max(noisevarab_b, noisevarab_r);
 
-                        if (isRAW) {//image is raw; use channel differences for chroma channels
+                            if (isRAW) {//image is raw; use channel differences for chroma channels
 
-                            if (!denoiseMethodRgb) { //lab mode
-                                //modification Jacques feb 2013 and july 2014
+                                if (!denoiseMethodRgb) { //lab mode
+                                    //modification Jacques feb 2013 and july 2014
 #ifdef _OPENMP
-                                #pragma omp parallel for num_threads(denoiseNestedLevels) if (denoiseNestedLevels>1)
+                                    #pragma omp parallel for num_threads(denoiseNestedLevels) if (denoiseNestedLevels>1)
 #endif
 
-                                for (int i = tiletop; i < tilebottom; ++i) {
-                                    int i1 = i - tiletop;
+                                    for (int i = tiletop; i < tilebottom; ++i) {
+                                        int i1 = i - tiletop;
 
-                                    for (int j = tileleft; j < tileright; ++j) {
-                                        int j1 = j - tileleft;
-                                        float R_ = gain * src->r(i, j);
-                                        float G_ = gain * src->g(i, j);
-                                        float B_ = gain * src->b(i, j);
+                                        for (int j = tileleft; j < tileright; ++j) {
+                                            int j1 = j - tileleft;
+                                            float R_ = gain * src->r(i, j);
+                                            float G_ = gain * src->g(i, j);
+                                            float B_ = gain * src->b(i, j);
 
-                                        R_ = Color::denoiseIGammaTab[R_];
-                                        G_ = Color::denoiseIGammaTab[G_];
-                                        B_ = Color::denoiseIGammaTab[B_];
+                                            R_ = Color::denoiseIGammaTab[R_];
+                                            G_ = Color::denoiseIGammaTab[G_];
+                                            B_ = Color::denoiseIGammaTab[B_];
 
-                                        //apply gamma noise standard (slider)
-                                        R_ = R_ < 65535.f ? gamcurve[R_] : (Color::gammanf(R_ / 65535.f, gam) * 32768.f);
-                                        G_ = G_ < 65535.f ? gamcurve[G_] : (Color::gammanf(G_ / 65535.f, gam) * 32768.f);
-                                        B_ = B_ < 65535.f ? gamcurve[B_] : (Color::gammanf(B_ / 65535.f, gam) * 32768.f);
+                                            //apply gamma noise standard (slider)
+                                            R_ = R_ < 65535.f ? gamcurve[R_] : (Color::gammanf(R_ / 65535.f, gam) * 32768.f);
+                                            G_ = G_ < 65535.f ? gamcurve[G_] : (Color::gammanf(G_ / 65535.f, gam) * 32768.f);
+                                            B_ = B_ < 65535.f ? gamcurve[B_] : (Color::gammanf(B_ / 65535.f, gam) * 32768.f);
 
-                                        //true conversion xyz=>Lab
-                                        float X, Y, Z;
-                                        Color::rgbxyz(R_, G_, B_, X, Y, Z, wp);
+                                            //true conversion xyz=>Lab
+                                            float X, Y, Z;
+                                            Color::rgbxyz(R_, G_, B_, X, Y, Z, wp);
 
-                                        //convert to Lab
-                                        float L, a, b;
-                                        Color::XYZ2Lab(X, Y, Z, L, a, b);
+                                            //convert to Lab
+                                            float L, a, b;
+                                            Color::XYZ2Lab(X, Y, Z, L, a, b);
 
-                                        labdn->L[i1][j1] = L;
-                                        labdn->a[i1][j1] = a;
-                                        labdn->b[i1][j1] = b;
+                                            labdn->L[i1][j1] = L;
+                                            labdn->a[i1][j1] = a;
+                                            labdn->b[i1][j1] = b;
 
-                                        if (((i1 | j1) & 1) == 0) {
-                                            if (numTries == 1) {
-                                                noisevarlum[(i1 >> 1)*width2 + (j1 >> 1)] = useNoiseLCurve ? lumcalc[i >> 1][j >> 1] : noisevarL;
-                                                noisevarchrom[(i1 >> 1)*width2 + (j1 >> 1)] = useNoiseCCurve ? maxNoiseVarab * ccalc[i >> 1][j >> 1] : 1.f;
-                                            } else {
-                                                noisevarlum[(i1 >> 1)*width2 + (j1 >> 1)] = lumcalc[i >> 1][j >> 1];
-                                                noisevarchrom[(i1 >> 1)*width2 + (j1 >> 1)] = ccalc[i >> 1][j >> 1];
+                                            if (((i1 | j1) & 1) == 0) {
+                                                if (numTries == 1) {
+                                                    noisevarlum[(i1 >> 1)*width2 + (j1 >> 1)] = useNoiseLCurve ? lumcalc[i >> 1][j >> 1] : noisevarL;
+                                                    noisevarchrom[(i1 >> 1)*width2 + (j1 >> 1)] = useNoiseCCurve ? maxNoiseVarab * ccalc[i >> 1][j >> 1] : 1.f;
+                                                } else {
+                                                    noisevarlum[(i1 >> 1)*width2 + (j1 >> 1)] = lumcalc[i >> 1][j >> 1];
+                                                    noisevarchrom[(i1 >> 1)*width2 + (j1 >> 1)] = ccalc[i >> 1][j >> 1];
+                                                }
                                             }
+
+                                            //end chroma
                                         }
+                                    }
+                                } else {//RGB mode
+#ifdef _OPENMP
+                                    #pragma omp parallel for num_threads(denoiseNestedLevels) if (denoiseNestedLevels>1)
+#endif
 
-                                        //end chroma
+                                    for (int i = tiletop; i < tilebottom; ++i) {
+                                        int i1 = i - tiletop;
+
+                                        for (int j = tileleft; j < tileright; ++j) {
+                                            int j1 = j - tileleft;
+
+                                            float X = gain * src->r(i, j);
+                                            float Y = gain * src->g(i, j);
+                                            float Z = gain * src->b(i, j);
+                                            //conversion colorspace to determine luminance with no gamma
+                                            X = X < 65535.f ? gamcurve[X] : (Color::gammaf(X / 65535.f, gam, gamthresh, gamslope) * 32768.f);
+                                            Y = Y < 65535.f ? gamcurve[Y] : (Color::gammaf(Y / 65535.f, gam, gamthresh, gamslope) * 32768.f);
+                                            Z = Z < 65535.f ? gamcurve[Z] : (Color::gammaf(Z / 65535.f, gam, gamthresh, gamslope) * 32768.f);
+                                            //end chroma
+                                            labdn->L[i1][j1] = Y;
+                                            labdn->a[i1][j1] = (X - Y);
+                                            labdn->b[i1][j1] = (Y - Z);
+
+                                            if (((i1 | j1) & 1) == 0) {
+                                                if (numTries == 1) {
+                                                    noisevarlum[(i1 >> 1)*width2 + (j1 >> 1)] = useNoiseLCurve ? lumcalc[i >> 1][j >> 1] : noisevarL;
+                                                    noisevarchrom[(i1 >> 1)*width2 + (j1 >> 1)] = useNoiseCCurve ? maxNoiseVarab * ccalc[i >> 1][j >> 1] : 1.f;
+                                                } else {
+                                                    noisevarlum[(i1 >> 1)*width2 + (j1 >> 1)] = lumcalc[i >> 1][j >> 1];
+                                                    noisevarchrom[(i1 >> 1)*width2 + (j1 >> 1)] = ccalc[i >> 1][j >> 1];
+                                                }
+                                            }
+                                        }
                                     }
                                 }
-                            } else {//RGB mode
+                            } else {//image is not raw; use Lab parametrization
 #ifdef _OPENMP
                                 #pragma omp parallel for num_threads(denoiseNestedLevels) if (denoiseNestedLevels>1)
 #endif
@@ -981,273 +1064,201 @@ BENCHFUN
 
                                     for (int j = tileleft; j < tileright; ++j) {
                                         int j1 = j - tileleft;
+                                        float L, a, b;
+                                        float rLum = src->r(i, j) ; //for denoise curves
+                                        float gLum = src->g(i, j) ;
+                                        float bLum = src->b(i, j) ;
+
+                                        //use gamma sRGB, not good if TIF (JPG) Output profil not with gamma sRGB  (eg : gamma =1.0, or 1.8...)
+                                        //very difficult to solve !
+                                        // solution ==> save TIF with gamma sRGB and re open
+                                        float rtmp = Color::igammatab_srgb[ src->r(i, j) ];
+                                        float gtmp = Color::igammatab_srgb[ src->g(i, j) ];
+                                        float btmp = Color::igammatab_srgb[ src->b(i, j) ];
+                                        //modification Jacques feb 2013
+                                        // gamma slider different from raw
+                                        rtmp = rtmp < 65535.f ? gamcurve[rtmp] : (Color::gammanf(rtmp / 65535.f, gam) * 32768.f);
+                                        gtmp = gtmp < 65535.f ? gamcurve[gtmp] : (Color::gammanf(gtmp / 65535.f, gam) * 32768.f);
+                                        btmp = btmp < 65535.f ? gamcurve[btmp] : (Color::gammanf(btmp / 65535.f, gam) * 32768.f);
 
-                                        float X = gain * src->r(i, j);
-                                        float Y = gain * src->g(i, j);
-                                        float Z = gain * src->b(i, j);
-                                        //conversion colorspace to determine luminance with no gamma
-                                        X = X < 65535.f ? gamcurve[X] : (Color::gammaf(X / 65535.f, gam, gamthresh, gamslope) * 32768.f);
-                                        Y = Y < 65535.f ? gamcurve[Y] : (Color::gammaf(Y / 65535.f, gam, gamthresh, gamslope) * 32768.f);
-                                        Z = Z < 65535.f ? gamcurve[Z] : (Color::gammaf(Z / 65535.f, gam, gamthresh, gamslope) * 32768.f);
-                                        //end chroma
-                                        labdn->L[i1][j1] = Y;
-                                        labdn->a[i1][j1] = (X - Y);
-                                        labdn->b[i1][j1] = (Y - Z);
+                                        float X, Y, Z;
+                                        Color::rgbxyz(rtmp, gtmp, btmp, X, Y, Z, wp);
+
+                                        //convert Lab
+                                        Color::XYZ2Lab(X, Y, Z, L, a, b);
+                                        labdn->L[i1][j1] = L;
+                                        labdn->a[i1][j1] = a;
+                                        labdn->b[i1][j1] = b;
 
                                         if (((i1 | j1) & 1) == 0) {
-                                            if (numTries == 1) {
-                                                noisevarlum[(i1 >> 1)*width2 + (j1 >> 1)] = useNoiseLCurve ? lumcalc[i >> 1][j >> 1] : noisevarL;
-                                                noisevarchrom[(i1 >> 1)*width2 + (j1 >> 1)] = useNoiseCCurve ? maxNoiseVarab * ccalc[i >> 1][j >> 1] : 1.f;
-                                            } else {
-                                                noisevarlum[(i1 >> 1)*width2 + (j1 >> 1)] = lumcalc[i >> 1][j >> 1];
-                                                noisevarchrom[(i1 >> 1)*width2 + (j1 >> 1)] = ccalc[i >> 1][j >> 1];
+                                            float Llum, alum, blum;
+
+                                            if (useNoiseLCurve || useNoiseCCurve) {
+                                                float XL, YL, ZL;
+                                                Color::rgbxyz(rLum, gLum, bLum, XL, YL, ZL, wp);
+                                                Color::XYZ2Lab(XL, YL, ZL, Llum, alum, blum);
                                             }
-                                        }
-                                    }
-                                }
-                            }
-                        } else {//image is not raw; use Lab parametrization
-#ifdef _OPENMP
-                            #pragma omp parallel for num_threads(denoiseNestedLevels) if (denoiseNestedLevels>1)
-#endif
 
-                            for (int i = tiletop; i < tilebottom; ++i) {
-                                int i1 = i - tiletop;
-
-                                for (int j = tileleft; j < tileright; ++j) {
-                                    int j1 = j - tileleft;
-                                    float L, a, b;
-                                    float rLum = src->r(i, j) ; //for denoise curves
-                                    float gLum = src->g(i, j) ;
-                                    float bLum = src->b(i, j) ;
-
-                                    //use gamma sRGB, not good if TIF (JPG) Output profil not with gamma sRGB  (eg : gamma =1.0, or 1.8...)
-                                    //very difficult to solve !
-                                    // solution ==> save TIF with gamma sRGB and re open
-                                    float rtmp = Color::igammatab_srgb[ src->r(i, j) ];
-                                    float gtmp = Color::igammatab_srgb[ src->g(i, j) ];
-                                    float btmp = Color::igammatab_srgb[ src->b(i, j) ];
-                                    //modification Jacques feb 2013
-                                    // gamma slider different from raw
-                                    rtmp = rtmp < 65535.f ? gamcurve[rtmp] : (Color::gammanf(rtmp / 65535.f, gam) * 32768.f);
-                                    gtmp = gtmp < 65535.f ? gamcurve[gtmp] : (Color::gammanf(gtmp / 65535.f, gam) * 32768.f);
-                                    btmp = btmp < 65535.f ? gamcurve[btmp] : (Color::gammanf(btmp / 65535.f, gam) * 32768.f);
-
-                                    float X, Y, Z;
-                                    Color::rgbxyz(rtmp, gtmp, btmp, X, Y, Z, wp);
-
-                                    //convert Lab
-                                    Color::XYZ2Lab(X, Y, Z, L, a, b);
-                                    labdn->L[i1][j1] = L;
-                                    labdn->a[i1][j1] = a;
-                                    labdn->b[i1][j1] = b;
-
-                                    if (((i1 | j1) & 1) == 0) {
-                                        float Llum, alum, blum;
-
-                                        if (useNoiseLCurve || useNoiseCCurve) {
-                                            float XL, YL, ZL;
-                                            Color::rgbxyz(rLum, gLum, bLum, XL, YL, ZL, wp);
-                                            Color::XYZ2Lab(XL, YL, ZL, Llum, alum, blum);
-                                        }
+                                            if (useNoiseLCurve) {
+                                                float kN = Llum;
+                                                float epsi = 0.01f;
 
-                                        if (useNoiseLCurve) {
-                                            float kN = Llum;
-                                            float epsi = 0.01f;
+                                                if (kN < 2.f) {
+                                                    kN = 2.f;
+                                                }
 
-                                            if (kN < 2.f) {
-                                                kN = 2.f;
-                                            }
+                                                if (kN > 32768.f) {
+                                                    kN = 32768.f;
+                                                }
 
-                                            if (kN > 32768.f) {
-                                                kN = 32768.f;
+                                                float kinterm = epsi + noiseLCurve[xdivf(kN, 15) * 500.f];
+                                                float ki = kinterm * 100.f;
+                                                ki += noiseluma;
+                                                noisevarlum[(i1 >> 1)*width2 + (j1 >> 1)] = SQR((ki / 125.f) * (1.f + ki / 25.f));
+                                            } else {
+                                                noisevarlum[(i1 >> 1)*width2 + (j1 >> 1)] = noisevarL;
                                             }
 
-                                            float kinterm = epsi + noiseLCurve[xdivf(kN, 15) * 500.f];
-                                            float ki = kinterm * 100.f;
-                                            ki += noiseluma;
-                                            noisevarlum[(i1 >> 1)*width2 + (j1 >> 1)] = SQR((ki / 125.f) * (1.f + ki / 25.f));
-                                        } else {
-                                            noisevarlum[(i1 >> 1)*width2 + (j1 >> 1)] = noisevarL;
-                                        }
+                                            if (useNoiseCCurve) {
+                                                float aN = alum;
+                                                float bN = blum;
+                                                float cN = sqrtf(SQR(aN) + SQR(bN));
 
-                                        if (useNoiseCCurve) {
-                                            float aN = alum;
-                                            float bN = blum;
-                                            float cN = sqrtf(SQR(aN) + SQR(bN));
+                                                if (cN < 100.f) {
+                                                    cN = 100.f;    //avoid divided by zero ???
+                                                }
 
-                                            if (cN < 100.f) {
-                                                cN = 100.f;    //avoid divided by zero ???
+                                                float Cinterm = 1.f + ponderCC * 4.f * noiseCCurve[cN / 60.f];
+                                                noisevarchrom[(i1 >> 1)*width2 + (j1 >> 1)] = maxNoiseVarab * SQR(Cinterm);
+                                            } else {
+                                                noisevarchrom[(i1 >> 1)*width2 + (j1 >> 1)] = 1.f;
                                             }
-
-                                            float Cinterm = 1.f + ponderCC * 4.f * noiseCCurve[cN / 60.f];
-                                            noisevarchrom[(i1 >> 1)*width2 + (j1 >> 1)] = maxNoiseVarab * SQR(Cinterm);
-                                        } else {
-                                            noisevarchrom[(i1 >> 1)*width2 + (j1 >> 1)] = 1.f;
                                         }
                                     }
                                 }
                             }
-                        }
-
-                        //now perform basic wavelet denoise
-                        //arguments 4 and 5 of wavelet decomposition are max number of wavelet decomposition levels;
-                        //and whether to subsample the image after wavelet filtering.  Subsampling is coded as
-                        //binary 1 or 0 for each level, eg subsampling = 0 means no subsampling, 1 means subsample
-                        //the first level only, 7 means subsample the first three levels, etc.
-                        //actual implementation only works with subsampling set to 1
-                        float interm_medT = static_cast<float>(dnparams.chroma) / 10.0;
-                        bool execwavelet = true;
-
-                        if (!denoiseLuminance && interm_medT < 0.05f && dnparams.median && (dnparams.methodmed == "Lab" || dnparams.methodmed == "Lonly")) {
-                            execwavelet = false;    //do not exec wavelet if sliders luminance and chroma are very small and median need
-                        }
-
-                        //we considered user don't want wavelet
-                        if (settings->leveldnautsimpl == 1 && dnparams.Cmethod != "MAN") {
-                            execwavelet = true;
-                        }
-
-                        if (settings->leveldnautsimpl == 0 && dnparams.C2method != "MANU") {
-                            execwavelet = true;
-                        }
 
-                        if (execwavelet) {//gain time if user choose only median  sliders L <=1  slider chrom master < 1
-                            wavelet_decomposition* Ldecomp;
-                            wavelet_decomposition* adecomp;
-
-                            int levwav = 5;
-                            float maxreal = max(realred, realblue);
-
-                            //increase the level of wavelet if user increase much or very much sliders
-                            if (maxreal < 8.f) {
-                                levwav = 5;
-                            } else if (maxreal < 10.f) {
-                                levwav = 6;
-                            } else if (maxreal < 15.f) {
-                                levwav = 7;
-                            } else {
-                                levwav = 8;    //maximum ==> I have increase Maxlevel in cplx_wavelet_dec.h from 8 to 9
+                            //now perform basic wavelet denoise
+                            //arguments 4 and 5 of wavelet decomposition are max number of wavelet decomposition levels;
+                            //and whether to subsample the image after wavelet filtering.  Subsampling is coded as
+                            //binary 1 or 0 for each level, eg subsampling = 0 means no subsampling, 1 means subsample
+                            //the first level only, 7 means subsample the first three levels, etc.
+                            //actual implementation only works with subsampling set to 1
+                            float interm_medT = static_cast<float>(dnparams.chroma) / 10.0;
+                            bool execwavelet = true;
+
+                            if (!denoiseLuminance && interm_medT < 0.05f && dnparams.median && (dnparams.methodmed == "Lab" || dnparams.methodmed == "Lonly")) {
+                                execwavelet = false;    //do not exec wavelet if sliders luminance and chroma are very small and median need
                             }
 
-                            if (nrQuality == QUALITY_HIGH) {
-                                levwav += settings->nrwavlevel;    //increase level for enhanced mode
+                            //we considered user don't want wavelet
+                            if (settings->leveldnautsimpl == 1 && dnparams.Cmethod != "MAN") {
+                                execwavelet = true;
                             }
 
-                            if (levwav > 8) {
-                                levwav = 8;
-                            }
-
-                            int minsizetile = min(tilewidth, tileheight);
-                            int maxlev2 = 8;
-
-                            if (minsizetile < 256) {
-                                maxlev2 = 7;
+                            if (settings->leveldnautsimpl == 0 && dnparams.C2method != "MANU") {
+                                execwavelet = true;
                             }
 
-                            if (minsizetile < 128) {
-                                maxlev2 = 6;
-                            }
+                            if (execwavelet) {//gain time if user choose only median  sliders L <=1  slider chrom master < 1
+                                wavelet_decomposition* Ldecomp;
+                                wavelet_decomposition* adecomp;
+
+                                int levwav = 5;
+                                float maxreal = max(realred, realblue);
+
+                                //increase the level of wavelet if user increase much or very much sliders
+                                if (maxreal < 8.f) {
+                                    levwav = 5;
+                                } else if (maxreal < 10.f) {
+                                    levwav = 6;
+                                } else if (maxreal < 15.f) {
+                                    levwav = 7;
+                                } else {
+                                    levwav = 8;    //maximum ==> I have increase Maxlevel in cplx_wavelet_dec.h from 8 to 9
+                                }
 
-                            if (minsizetile < 64) {
-                                maxlev2 = 5;
-                            }
+                                if (nrQuality == QUALITY_HIGH) {
+                                    levwav += settings->nrwavlevel;    //increase level for enhanced mode
+                                }
 
-                            levwav = min(maxlev2, levwav);
+                                if (levwav > 8) {
+                                    levwav = 8;
+                                }
 
-                            //  if (settings->verbose) printf("levwavelet=%i  noisevarA=%f noisevarB=%f \n",levwav, noisevarab_r, noisevarab_b);
-                            Ldecomp = new wavelet_decomposition(labdn->L[0], labdn->W, labdn->H, levwav, 1, 1, max(1, denoiseNestedLevels));
+                                int minsizetile = min(tilewidth, tileheight);
+                                int maxlev2 = 8;
 
-                            if (Ldecomp->memoryAllocationFailed) {
-                                memoryAllocationFailed = true;
-                            }
+                                if (minsizetile < 256) {
+                                    maxlev2 = 7;
+                                }
 
-                            float madL[8][3];
+                                if (minsizetile < 128) {
+                                    maxlev2 = 6;
+                                }
 
-                            if (!memoryAllocationFailed) {
-                                // precalculate madL, because it's used in adecomp and bdecomp
-                                int maxlvl = Ldecomp->maxlevel();
-#ifdef _OPENMP
-                                #pragma omp parallel for schedule(dynamic) collapse(2) num_threads(denoiseNestedLevels) if (denoiseNestedLevels>1)
-#endif
+                                if (minsizetile < 64) {
+                                    maxlev2 = 5;
+                                }
 
-                                for (int lvl = 0; lvl < maxlvl; ++lvl) {
-                                    for (int dir = 1; dir < 4; ++dir) {
-                                        // compute median absolute deviation (MAD) of detail coefficients as robust noise estimator
-                                        int Wlvl_L = Ldecomp->level_W(lvl);
-                                        int Hlvl_L = Ldecomp->level_H(lvl);
+                                levwav = min(maxlev2, levwav);
 
-                                        float ** WavCoeffs_L = Ldecomp->level_coeffs(lvl);
+                                //  if (settings->verbose) printf("levwavelet=%i  noisevarA=%f noisevarB=%f \n",levwav, noisevarab_r, noisevarab_b);
+                                Ldecomp = new wavelet_decomposition(labdn->L[0], labdn->W, labdn->H, levwav, 1, 1, max(1, denoiseNestedLevels));
 
-                                        if (!denoiseMethodRgb) {
-                                            madL[lvl][dir - 1] = SQR(Mad(WavCoeffs_L[dir], Wlvl_L * Hlvl_L));
-                                        } else {
-                                            madL[lvl][dir - 1] = SQR(MadRgb(WavCoeffs_L[dir], Wlvl_L * Hlvl_L));
-                                        }
-                                    }
+                                if (Ldecomp->memoryAllocationFailed) {
+                                    memoryAllocationFailed = true;
                                 }
-                            }
 
-                            float chresid = 0.f;
-                            float chresidtemp = 0.f;
-                            float chmaxresid = 0.f;
-                            float chmaxresidtemp = 0.f;
+                                float madL[8][3];
 
-                            adecomp = new wavelet_decomposition(labdn->a[0], labdn->W, labdn->H, levwav, 1, 1, max(1, denoiseNestedLevels));
+                                if (!memoryAllocationFailed) {
+                                    // precalculate madL, because it's used in adecomp and bdecomp
+                                    int maxlvl = Ldecomp->maxlevel();
+#ifdef _OPENMP
+                                    #pragma omp parallel for schedule(dynamic) collapse(2) num_threads(denoiseNestedLevels) if (denoiseNestedLevels>1)
+#endif
 
-                            if (adecomp->memoryAllocationFailed) {
-                                memoryAllocationFailed = true;
-                            }
+                                    for (int lvl = 0; lvl < maxlvl; ++lvl) {
+                                        for (int dir = 1; dir < 4; ++dir) {
+                                            // compute median absolute deviation (MAD) of detail coefficients as robust noise estimator
+                                            int Wlvl_L = Ldecomp->level_W(lvl);
+                                            int Hlvl_L = Ldecomp->level_H(lvl);
 
-                            if (!memoryAllocationFailed) {
-                                if (nrQuality == QUALITY_STANDARD) {
-                                    if (!WaveletDenoiseAllAB(*Ldecomp, *adecomp, noisevarchrom, madL, noisevarab_r, useNoiseCCurve, autoch, denoiseMethodRgb)) { //enhance mode
-                                        memoryAllocationFailed = true;
-                                    }
-                                } else { /*if (nrQuality==QUALITY_HIGH)*/
-                                    if (!WaveletDenoiseAll_BiShrinkAB(*Ldecomp, *adecomp, noisevarchrom, madL, noisevarab_r, useNoiseCCurve, autoch, denoiseMethodRgb)) { //enhance mode
-                                        memoryAllocationFailed = true;
-                                    }
+                                            float ** WavCoeffs_L = Ldecomp->level_coeffs(lvl);
 
-                                    if (!memoryAllocationFailed) {
-                                        if (!WaveletDenoiseAllAB(*Ldecomp, *adecomp, noisevarchrom, madL, noisevarab_r, useNoiseCCurve, autoch, denoiseMethodRgb)) {
-                                            memoryAllocationFailed = true;
+                                            if (!denoiseMethodRgb) {
+                                                madL[lvl][dir - 1] = SQR(Mad(WavCoeffs_L[dir], Wlvl_L * Hlvl_L));
+                                            } else {
+                                                madL[lvl][dir - 1] = SQR(MadRgb(WavCoeffs_L[dir], Wlvl_L * Hlvl_L));
+                                            }
                                         }
                                     }
                                 }
-                            }
-
-                            if (!memoryAllocationFailed) {
-                                if (kall == 0) {
-                                    Noise_residualAB(*adecomp, chresid, chmaxresid, denoiseMethodRgb);
-                                    chresidtemp = chresid;
-                                    chmaxresidtemp = chmaxresid;
-                                }
-
-                                adecomp->reconstruct(labdn->a[0]);
-                            }
 
-                            delete adecomp;
+                                float chresid = 0.f;
+                                float chresidtemp = 0.f;
+                                float chmaxresid = 0.f;
+                                float chmaxresidtemp = 0.f;
 
-                            if (!memoryAllocationFailed) {
-                                wavelet_decomposition* bdecomp = new wavelet_decomposition(labdn->b[0], labdn->W, labdn->H, levwav, 1, 1, max(1, denoiseNestedLevels));
+                                adecomp = new wavelet_decomposition(labdn->a[0], labdn->W, labdn->H, levwav, 1, 1, max(1, denoiseNestedLevels));
 
-                                if (bdecomp->memoryAllocationFailed) {
+                                if (adecomp->memoryAllocationFailed) {
                                     memoryAllocationFailed = true;
                                 }
 
                                 if (!memoryAllocationFailed) {
                                     if (nrQuality == QUALITY_STANDARD) {
-                                        if (!WaveletDenoiseAllAB(*Ldecomp, *bdecomp, noisevarchrom, madL, noisevarab_b, useNoiseCCurve, autoch, denoiseMethodRgb)) { //enhance mode
+                                        if (!WaveletDenoiseAllAB(*Ldecomp, *adecomp, noisevarchrom, madL, noisevarab_r, useNoiseCCurve, autoch, denoiseMethodRgb)) { //enhance mode
                                             memoryAllocationFailed = true;
                                         }
                                     } else { /*if (nrQuality==QUALITY_HIGH)*/
-                                        if (!WaveletDenoiseAll_BiShrinkAB(*Ldecomp, *bdecomp, noisevarchrom, madL, noisevarab_b, useNoiseCCurve, autoch, denoiseMethodRgb)) { //enhance mode
+                                        if (!WaveletDenoiseAll_BiShrinkAB(*Ldecomp, *adecomp, noisevarchrom, madL, noisevarab_r, useNoiseCCurve, autoch, denoiseMethodRgb)) { //enhance mode
                                             memoryAllocationFailed = true;
                                         }
 
                                         if (!memoryAllocationFailed) {
-                                            if (!WaveletDenoiseAllAB(*Ldecomp, *bdecomp, noisevarchrom, madL, noisevarab_b, useNoiseCCurve, autoch, denoiseMethodRgb)) {
+                                            if (!WaveletDenoiseAllAB(*Ldecomp, *adecomp, noisevarchrom, madL, noisevarab_r, useNoiseCCurve, autoch, denoiseMethodRgb)) {
                                                 memoryAllocationFailed = true;
                                             }
                                         }
@@ -1256,351 +1267,481 @@ BENCHFUN
 
                                 if (!memoryAllocationFailed) {
                                     if (kall == 0) {
-                                        Noise_residualAB(*bdecomp, chresid, chmaxresid, denoiseMethodRgb);
-                                        chresid += chresidtemp;
-                                        chmaxresid += chmaxresidtemp;
-                                        chresid = sqrt(chresid / (6 * (levwav)));
-                                        highresi = chresid + 0.66f * (sqrt(chmaxresid) - chresid); //evaluate sigma
-                                        nresi = chresid;
+                                        Noise_residualAB(*adecomp, chresid, chmaxresid, denoiseMethodRgb);
+                                        chresidtemp = chresid;
+                                        chmaxresidtemp = chmaxresid;
                                     }
 
-                                    bdecomp->reconstruct(labdn->b[0]);
+                                    adecomp->reconstruct(labdn->a[0]);
                                 }
 
-                                delete bdecomp;
+                                delete adecomp;
 
                                 if (!memoryAllocationFailed) {
-                                    if (denoiseLuminance) {
-                                        int edge = 0;
+                                    wavelet_decomposition* bdecomp = new wavelet_decomposition(labdn->b[0], labdn->W, labdn->H, levwav, 1, 1, max(1, denoiseNestedLevels));
+
+                                    if (bdecomp->memoryAllocationFailed) {
+                                        memoryAllocationFailed = true;
+                                    }
 
+                                    if (!memoryAllocationFailed) {
                                         if (nrQuality == QUALITY_STANDARD) {
-                                            if (!WaveletDenoiseAllL(*Ldecomp, noisevarlum, madL, nullptr, edge)) { //enhance mode
+                                            if (!WaveletDenoiseAllAB(*Ldecomp, *bdecomp, noisevarchrom, madL, noisevarab_b, useNoiseCCurve, autoch, denoiseMethodRgb)) { //enhance mode
                                                 memoryAllocationFailed = true;
                                             }
                                         } else { /*if (nrQuality==QUALITY_HIGH)*/
-                                            if (!WaveletDenoiseAll_BiShrinkL(*Ldecomp, noisevarlum, madL)) { //enhance mode
+                                            if (!WaveletDenoiseAll_BiShrinkAB(*Ldecomp, *bdecomp, noisevarchrom, madL, noisevarab_b, useNoiseCCurve, autoch, denoiseMethodRgb)) { //enhance mode
                                                 memoryAllocationFailed = true;
                                             }
 
                                             if (!memoryAllocationFailed) {
-                                                if (!WaveletDenoiseAllL(*Ldecomp, noisevarlum, madL, nullptr, edge)) {
+                                                if (!WaveletDenoiseAllAB(*Ldecomp, *bdecomp, noisevarchrom, madL, noisevarab_b, useNoiseCCurve, autoch, denoiseMethodRgb)) {
                                                     memoryAllocationFailed = true;
                                                 }
                                             }
                                         }
+                                    }
 
-                                        if (!memoryAllocationFailed) {
-                                            // copy labdn->L to Lin before it gets modified by reconstruction
-                                            Lin = new array2D<float>(width, height);
+                                    if (!memoryAllocationFailed) {
+                                        if (kall == 0) {
+                                            Noise_residualAB(*bdecomp, chresid, chmaxresid, denoiseMethodRgb);
+                                            chresid += chresidtemp;
+                                            chmaxresid += chmaxresidtemp;
+                                            chresid = sqrt(chresid / (6 * (levwav)));
+                                            highresi = chresid + 0.66f * (sqrt(chmaxresid) - chresid); //evaluate sigma
+                                            nresi = chresid;
+                                        }
+
+                                        bdecomp->reconstruct(labdn->b[0]);
+                                    }
+
+                                    delete bdecomp;
+
+                                    if (!memoryAllocationFailed) {
+                                        if (denoiseLuminance) {
+                                            int edge = 0;
+
+                                            if (nrQuality == QUALITY_STANDARD) {
+                                                if (!WaveletDenoiseAllL(*Ldecomp, noisevarlum, madL, nullptr, edge)) { //enhance mode
+                                                    memoryAllocationFailed = true;
+                                                }
+                                            } else { /*if (nrQuality==QUALITY_HIGH)*/
+                                                if (!WaveletDenoiseAll_BiShrinkL(*Ldecomp, noisevarlum, madL)) { //enhance mode
+                                                    memoryAllocationFailed = true;
+                                                }
+
+                                                if (!memoryAllocationFailed) {
+                                                    if (!WaveletDenoiseAllL(*Ldecomp, noisevarlum, madL, nullptr, edge)) {
+                                                        memoryAllocationFailed = true;
+                                                    }
+                                                }
+                                            }
+
+                                            if (!memoryAllocationFailed) {
+                                                // copy labdn->L to Lin before it gets modified by reconstruction
+                                                Lin = new array2D<float>(width, height);
 #ifdef _OPENMP
-                                            #pragma omp parallel for num_threads(denoiseNestedLevels) if (denoiseNestedLevels>1)
+                                                #pragma omp parallel for num_threads(denoiseNestedLevels) if (denoiseNestedLevels>1)
 #endif
 
-                                            for (int i = 0; i < height; ++i) {
-                                                for (int j = 0; j < width; ++j) {
-                                                    (*Lin)[i][j] = labdn->L[i][j];
+                                                for (int i = 0; i < height; ++i) {
+                                                    for (int j = 0; j < width; ++j) {
+                                                        (*Lin)[i][j] = labdn->L[i][j];
+                                                    }
                                                 }
-                                            }
 
-                                            Ldecomp->reconstruct(labdn->L[0]);
+                                                Ldecomp->reconstruct(labdn->L[0]);
+                                            }
                                         }
                                     }
                                 }
-                            }
-
-                            delete Ldecomp;
-                        }
-
-                        if (!memoryAllocationFailed) {
-                            //wavelet denoised L channel
-                            //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
-                            //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
-                            // now do detail recovery using block DCT to detect
-                            // patterns missed by wavelet denoise
-                            // blocks are not the same thing as tiles!
 
-                            // calculation for detail recovery blocks
-                            const int numblox_W = ceil((static_cast<float>(width)) / (offset)) + 2 * blkrad;
-                            const int numblox_H = ceil((static_cast<float>(height)) / (offset)) + 2 * blkrad;
+                                delete Ldecomp;
+                            }
 
+                            if (!memoryAllocationFailed) {
+                                //wavelet denoised L channel
+                                //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+                                //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+                                // now do detail recovery using block DCT to detect
+                                // patterns missed by wavelet denoise
+                                // blocks are not the same thing as tiles!
 
+                                // calculation for detail recovery blocks
+                                const int numblox_W = ceil((static_cast<float>(width)) / (offset)) + 2 * blkrad;
+                                const int numblox_H = ceil((static_cast<float>(height)) / (offset)) + 2 * blkrad;
 
-                            // end of tiling calc
 
-                            //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
-                            //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
-                            // Main detail recovery algorithm: Block loop
-                            //DCT block data storage
 
-                            if (denoiseLuminance /*&& execwavelet*/) {
-                                //residual between input and denoised L channel
-                                array2D<float> Ldetail(width, height, ARRAY2D_CLEAR_DATA);
-                                //pixel weight
-                                array2D<float> totwt(width, height, ARRAY2D_CLEAR_DATA); //weight for combining DCT blocks
+                                // end of tiling calc
 
-                                if (numtiles == 1) {
-                                    for (int i = 0; i < denoiseNestedLevels * numthreads; ++i) {
-                                        LbloxArray[i]  = reinterpret_cast<float*>(fftwf_malloc(max_numblox_W * TS * TS * sizeof(float)));
-                                        fLbloxArray[i] = reinterpret_cast<float*>(fftwf_malloc(max_numblox_W * TS * TS * sizeof(float)));
+                                //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+                                //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+                                // Main detail recovery algorithm: Block loop
+                                //DCT block data storage
+
+                                if (denoiseLuminance /*&& execwavelet*/) {
+                                    //residual between input and denoised L channel
+                                    array2D<float> Ldetail(width, height, ARRAY2D_CLEAR_DATA);
+                                    //pixel weight
+                                    array2D<float> totwt(width, height, ARRAY2D_CLEAR_DATA); //weight for combining DCT blocks
+
+                                    if (numtiles == 1) {
+                                        for (int i = 0; i < denoiseNestedLevels * numthreads; ++i) {
+                                            LbloxArray[i]  = reinterpret_cast<float*>(fftwf_malloc(max_numblox_W * TS * TS * sizeof(float)));
+                                            fLbloxArray[i] = reinterpret_cast<float*>(fftwf_malloc(max_numblox_W * TS * TS * sizeof(float)));
+                                        }
                                     }
-                                }
 
 #ifdef _OPENMP
-                                int masterThread = omp_get_thread_num();
+                                    int masterThread = omp_get_thread_num();
 #endif
 #ifdef _OPENMP
-                                #pragma omp parallel num_threads(denoiseNestedLevels) if (denoiseNestedLevels>1)
+                                    #pragma omp parallel num_threads(denoiseNestedLevels) if (denoiseNestedLevels>1)
 #endif
-                                {
+                                    {
 #ifdef _OPENMP
-                                    int subThread = masterThread * denoiseNestedLevels + omp_get_thread_num();
+                                        int subThread = masterThread * denoiseNestedLevels + omp_get_thread_num();
 #else
-                                    int subThread = 0;
+                                        int subThread = 0;
 #endif
-                                    float blurbuffer[TS * TS] ALIGNED64;
-                                    float *Lblox = LbloxArray[subThread];
-                                    float *fLblox = fLbloxArray[subThread];
-                                    float pBuf[width + TS + 2 * blkrad * offset] ALIGNED16;
-                                    float nbrwt[TS * TS] ALIGNED64;
+                                        float blurbuffer[TS * TS] ALIGNED64;
+                                        float *Lblox = LbloxArray[subThread];
+                                        float *fLblox = fLbloxArray[subThread];
+                                        float pBuf[width + TS + 2 * blkrad * offset] ALIGNED16;
+                                        float nbrwt[TS * TS] ALIGNED64;
 #ifdef _OPENMP
-                                    #pragma omp for
+                                        #pragma omp for
 #endif
 
-                                    for (int vblk = 0; vblk < numblox_H; ++vblk) {
-
-                                        int top = (vblk - blkrad) * offset;
-                                        float * datarow = pBuf + blkrad * offset;
-
-                                        for (int i = 0; i < TS; ++i) {
-                                            int row = top + i;
-                                            int rr = row;
-
-                                            if (row < 0) {
-                                                rr = MIN(-row, height - 1);
-                                            } else if (row >= height) {
-                                                rr = MAX(0, 2 * height - 2 - row);
-                                            }
-
-                                            for (int j = 0; j < labdn->W; ++j) {
-                                                datarow[j] = ((*Lin)[rr][j] - labdn->L[rr][j]);
+                                        for (int vblk = 0; vblk < numblox_H; ++vblk) {
+                                            if (isCancelled()) {
+                                                continue;
                                             }
 
-                                            for (int j = -blkrad * offset; j < 0; ++j) {
-                                                datarow[j] = datarow[MIN(-j, width - 1)];
-                                            }
+                                            int top = (vblk - blkrad) * offset;
+                                            float * datarow = pBuf + blkrad * offset;
 
-                                            for (int j = width; j < width + TS + blkrad * offset; ++j) {
-                                                datarow[j] = datarow[MAX(0, 2 * width - 2 - j)];
-                                            }//now we have a padded data row
+                                            for (int i = 0; i < TS; ++i) {
+                                                int row = top + i;
+                                                int rr = row;
 
-                                            //now fill this row of the blocks with Lab high pass data
-                                            for (int hblk = 0; hblk < numblox_W; ++hblk) {
-                                                int left = (hblk - blkrad) * offset;
-                                                int indx = (hblk) * TS; //index of block in malloc
+                                                if (row < 0) {
+                                                    rr = MIN(-row, height - 1);
+                                                } else if (row >= height) {
+                                                    rr = MAX(0, 2 * height - 2 - row);
+                                                }
 
-                                                if (top + i >= 0 && top + i < height) {
-                                                    int j;
+                                                for (int j = 0; j < labdn->W; ++j) {
+                                                    datarow[j] = ((*Lin)[rr][j] - labdn->L[rr][j]);
+                                                }
 
-                                                    for (j = 0; j < min((-left), TS); ++j) {
-                                                        Lblox[(indx + i)*TS + j] = tilemask_in[i][j] * datarow[left + j]; // luma data
-                                                    }
+                                                for (int j = -blkrad * offset; j < 0; ++j) {
+                                                    datarow[j] = datarow[MIN(-j, width - 1)];
+                                                }
 
-                                                    for (; j < min(TS, width - left); ++j) {
-                                                        Lblox[(indx + i)*TS + j] = tilemask_in[i][j] * datarow[left + j]; // luma data
-                                                        totwt[top + i][left + j] += tilemask_in[i][j] * tilemask_out[i][j];
+                                                for (int j = width; j < width + TS + blkrad * offset; ++j) {
+                                                    datarow[j] = datarow[MAX(0, 2 * width - 2 - j)];
+                                                }//now we have a padded data row
+
+                                                //now fill this row of the blocks with Lab high pass data
+                                                for (int hblk = 0; hblk < numblox_W; ++hblk) {
+                                                    int left = (hblk - blkrad) * offset;
+                                                    int indx = (hblk) * TS; //index of block in malloc
+
+                                                    if (top + i >= 0 && top + i < height) {
+                                                        int j;
+
+                                                        for (j = 0; j < min((-left), TS); ++j) {
+                                                            Lblox[(indx + i)*TS + j] = tilemask_in[i][j] * datarow[left + j]; // luma data
+                                                        }
+
+                                                        for (; j < min(TS, width - left); ++j) {
+                                                            Lblox[(indx + i)*TS + j] = tilemask_in[i][j] * datarow[left + j]; // luma data
+                                                            totwt[top + i][left + j] += tilemask_in[i][j] * tilemask_out[i][j];
+                                                        }
+
+                                                        for (; j < TS; ++j) {
+                                                            Lblox[(indx + i)*TS + j] = tilemask_in[i][j] * datarow[left + j]; // luma data
+                                                        }
+                                                    } else {
+                                                        for (int j = 0; j < TS; ++j) {
+                                                            Lblox[(indx + i)*TS + j] = tilemask_in[i][j] * datarow[left + j]; // luma data
+                                                        }
                                                     }
 
-                                                    for (; j < TS; ++j) {
-                                                        Lblox[(indx + i)*TS + j] = tilemask_in[i][j] * datarow[left + j]; // luma data
-                                                    }
-                                                } else {
-                                                    for (int j = 0; j < TS; ++j) {
-                                                        Lblox[(indx + i)*TS + j] = tilemask_in[i][j] * datarow[left + j]; // luma data
-                                                    }
                                                 }
 
+                                            }//end of filling block row
+
+                                            //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+                                            //fftwf_print_plan (plan_forward_blox);
+                                            if (numblox_W == max_numblox_W) {
+                                                fftwf_execute_r2r(plan_forward_blox[0].get(), Lblox, fLblox);    // DCT an entire row of tiles
+                                            } else {
+                                                fftwf_execute_r2r(plan_forward_blox[1].get(), Lblox, fLblox);    // DCT an entire row of tiles
                                             }
 
-                                        }//end of filling block row
+                                            //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+                                            // now process the vblk row of blocks for noise reduction
 
-                                        //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
-                                        //fftwf_print_plan (plan_forward_blox);
-                                        if (numblox_W == max_numblox_W) {
-                                            fftwf_execute_r2r(plan_forward_blox[0], Lblox, fLblox);    // DCT an entire row of tiles
-                                        } else {
-                                            fftwf_execute_r2r(plan_forward_blox[1], Lblox, fLblox);    // DCT an entire row of tiles
-                                        }
 
-                                        //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
-                                        // now process the vblk row of blocks for noise reduction
+                                            for (int hblk = 0; hblk < numblox_W; ++hblk) {
+                                                RGBtile_denoise(fLblox, hblk, noisevar_Ldetail, nbrwt, blurbuffer);
+                                            }//end of horizontal block loop
 
+                                            //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 
-                                        for (int hblk = 0; hblk < numblox_W; ++hblk) {
-                                            RGBtile_denoise(fLblox, hblk, noisevar_Ldetail, nbrwt, blurbuffer);
-                                        }//end of horizontal block loop
+                                            //now perform inverse FT of an entire row of blocks
+                                            if (numblox_W == max_numblox_W) {
+                                                fftwf_execute_r2r(plan_backward_blox[0].get(), fLblox, Lblox);    //for DCT
+                                            } else {
+                                                fftwf_execute_r2r(plan_backward_blox[1].get(), fLblox, Lblox);    //for DCT
+                                            }
 
-                                        //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+                                            int topproc = (vblk - blkrad) * offset;
 
-                                        //now perform inverse FT of an entire row of blocks
-                                        if (numblox_W == max_numblox_W) {
-                                            fftwf_execute_r2r(plan_backward_blox[0], fLblox, Lblox);    //for DCT
-                                        } else {
-                                            fftwf_execute_r2r(plan_backward_blox[1], fLblox, Lblox);    //for DCT
-                                        }
+                                            //add row of blocks to output image tile
+                                            RGBoutput_tile_row(Lblox, Ldetail, tilemask_out, height, width, topproc);
 
-                                        int topproc = (vblk - blkrad) * offset;
+                                            //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 
-                                        //add row of blocks to output image tile
-                                        RGBoutput_tile_row(Lblox, Ldetail, tilemask_out, height, width, topproc);
+                                        }//end of vertical block loop
 
                                         //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 
-                                    }//end of vertical block loop
-
+                                    }
                                     //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 
-                                }
-                                //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
-
 #ifdef _OPENMP
-                                #pragma omp parallel for num_threads(denoiseNestedLevels) if (denoiseNestedLevels>1)
+                                    #pragma omp parallel for num_threads(denoiseNestedLevels) if (denoiseNestedLevels>1)
 #endif
 
-                                for (int i = 0; i < height; ++i) {
-                                    for (int j = 0; j < width; ++j) {
-                                        //may want to include masking threshold for large hipass data to preserve edges/detail
-                                        labdn->L[i][j] += Ldetail[i][j] / totwt[i][j]; //note that labdn initially stores the denoised hipass data
+                                    for (int i = 0; i < height; ++i) {
+                                        for (int j = 0; j < width; ++j) {
+                                            //may want to include masking threshold for large hipass data to preserve edges/detail
+                                            labdn->L[i][j] += Ldetail[i][j] / totwt[i][j]; //note that labdn initially stores the denoised hipass data
+                                        }
                                     }
                                 }
-                            }
 
-                            if ((metchoice == 1 || metchoice == 2 || metchoice == 3 || metchoice == 4) && dnparams.median) {
-                                float** tmL;
-                                int wid = labdn->W;
-                                int hei = labdn->H;
-                                tmL = new float*[hei];
+                                if ((metchoice == 1 || metchoice == 2 || metchoice == 3 || metchoice == 4) && dnparams.median) {
+                                    float** tmL;
+                                    int wid = labdn->W;
+                                    int hei = labdn->H;
+                                    tmL = new float*[hei];
 
-                                for (int i = 0; i < hei; ++i) {
-                                    tmL[i] = new float[wid];
-                                }
+                                    for (int i = 0; i < hei; ++i) {
+                                        tmL[i] = new float[wid];
+                                    }
 
-                                Median medianTypeL = Median::TYPE_3X3_SOFT;
-                                Median medianTypeAB = Median::TYPE_3X3_SOFT;
+                                    Median medianTypeL = Median::TYPE_3X3_SOFT;
+                                    Median medianTypeAB = Median::TYPE_3X3_SOFT;
 
-                                if (dnparams.medmethod == "soft") {
-                                    if (metchoice != 4) {
-                                        medianTypeL = medianTypeAB = Median::TYPE_3X3_SOFT;
-                                    } else {
-                                        medianTypeL = Median::TYPE_3X3_SOFT;
-                                        medianTypeAB = Median::TYPE_3X3_SOFT;
-                                    }
-                                } else if (dnparams.medmethod == "33") {
-                                    if (metchoice != 4) {
-                                        medianTypeL = medianTypeAB = Median::TYPE_3X3_STRONG;
-                                    } else {
-                                        medianTypeL = Median::TYPE_3X3_SOFT;
-                                        medianTypeAB = Median::TYPE_3X3_STRONG;
-                                    }
-                                } else if (dnparams.medmethod == "55soft") {
-                                    if (metchoice != 4) {
-                                        medianTypeL = medianTypeAB = Median::TYPE_5X5_SOFT;
-                                    } else {
-                                        medianTypeL = Median::TYPE_3X3_SOFT;
-                                        medianTypeAB = Median::TYPE_5X5_SOFT;
+                                    if (dnparams.medmethod == "soft") {
+                                        if (metchoice != 4) {
+                                            medianTypeL = medianTypeAB = Median::TYPE_3X3_SOFT;
+                                        } else {
+                                            medianTypeL = Median::TYPE_3X3_SOFT;
+                                            medianTypeAB = Median::TYPE_3X3_SOFT;
+                                        }
+                                    } else if (dnparams.medmethod == "33") {
+                                        if (metchoice != 4) {
+                                            medianTypeL = medianTypeAB = Median::TYPE_3X3_STRONG;
+                                        } else {
+                                            medianTypeL = Median::TYPE_3X3_SOFT;
+                                            medianTypeAB = Median::TYPE_3X3_STRONG;
+                                        }
+                                    } else if (dnparams.medmethod == "55soft") {
+                                        if (metchoice != 4) {
+                                            medianTypeL = medianTypeAB = Median::TYPE_5X5_SOFT;
+                                        } else {
+                                            medianTypeL = Median::TYPE_3X3_SOFT;
+                                            medianTypeAB = Median::TYPE_5X5_SOFT;
+                                        }
+                                    } else if (dnparams.medmethod == "55") {
+                                        if (metchoice != 4) {
+                                            medianTypeL = medianTypeAB = Median::TYPE_5X5_STRONG;
+                                        } else {
+                                            medianTypeL = Median::TYPE_3X3_STRONG;
+                                            medianTypeAB = Median::TYPE_5X5_STRONG;
+                                        }
+                                    } else if (dnparams.medmethod == "77") {
+                                        if (metchoice != 4) {
+                                            medianTypeL = medianTypeAB = Median::TYPE_7X7;
+                                        } else {
+                                            medianTypeL = Median::TYPE_3X3_STRONG;
+                                            medianTypeAB = Median::TYPE_7X7;
+                                        }
+                                    } else if (dnparams.medmethod == "99") {
+                                        if (metchoice != 4) {
+                                            medianTypeL = medianTypeAB = Median::TYPE_9X9;
+                                        } else {
+                                            medianTypeL = Median::TYPE_5X5_SOFT;
+                                            medianTypeAB = Median::TYPE_9X9;
+                                        }
                                     }
-                                } else if (dnparams.medmethod == "55") {
-                                    if (metchoice != 4) {
-                                        medianTypeL = medianTypeAB = Median::TYPE_5X5_STRONG;
-                                    } else {
-                                        medianTypeL = Median::TYPE_3X3_STRONG;
-                                        medianTypeAB = Median::TYPE_5X5_STRONG;
+
+                                    if (metchoice == 1 || metchoice == 2 || metchoice == 4) {
+                                        Median_Denoise(labdn->L, labdn->L, wid, hei, medianTypeL, dnparams.passes, denoiseNestedLevels, tmL);
                                     }
-                                } else if (dnparams.medmethod == "77") {
-                                    if (metchoice != 4) {
-                                        medianTypeL = medianTypeAB = Median::TYPE_7X7;
-                                    } else {
-                                        medianTypeL = Median::TYPE_3X3_STRONG;
-                                        medianTypeAB = Median::TYPE_7X7;
+
+                                    if (metchoice == 2 || metchoice == 3 || metchoice == 4) {
+                                        Median_Denoise(labdn->a, labdn->a, wid, hei, medianTypeAB, dnparams.passes, denoiseNestedLevels, tmL);
+                                        Median_Denoise(labdn->b, labdn->b, wid, hei, medianTypeAB, dnparams.passes, denoiseNestedLevels, tmL);
                                     }
-                                } else if (dnparams.medmethod == "99") {
-                                    if (metchoice != 4) {
-                                        medianTypeL = medianTypeAB = Median::TYPE_9X9;
-                                    } else {
-                                        medianTypeL = Median::TYPE_5X5_SOFT;
-                                        medianTypeAB = Median::TYPE_9X9;
+
+                                    for (int i = 0; i < hei; ++i) {
+                                        delete[] tmL[i];
                                     }
-                                }
 
-                                if (metchoice == 1 || metchoice == 2 || metchoice == 4) {
-                                    Median_Denoise(labdn->L, labdn->L, wid, hei, medianTypeL, dnparams.passes, denoiseNestedLevels, tmL);
+                                    delete[] tmL;
                                 }
 
-                                if (metchoice == 2 || metchoice == 3 || metchoice == 4) {
-                                    Median_Denoise(labdn->a, labdn->a, wid, hei, medianTypeAB, dnparams.passes, denoiseNestedLevels, tmL);
-                                    Median_Denoise(labdn->b, labdn->b, wid, hei, medianTypeAB, dnparams.passes, denoiseNestedLevels, tmL);
-                                }
+                                //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+                                // transform denoised "Lab" to output RGB
 
-                                for (int i = 0; i < hei; ++i) {
-                                    delete[] tmL[i];
-                                }
+                                //calculate mask for feathering output tile overlaps
+                                float Vmask[height + 1] ALIGNED16;
+                                float Hmask[width + 1] ALIGNED16;
+                                float newGain;
 
-                                delete[] tmL;
-                            }
+                                if (numtiles > 1) {
+                                    for (int i = 0; i < height; ++i) {
+                                        Vmask[i] = 1;
+                                    }
 
-                            //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
-                            // transform denoised "Lab" to output RGB
+                                    newGain = 1.f;
 
-                            //calculate mask for feathering output tile overlaps
-                            float Vmask[height + 1] ALIGNED16;
-                            float Hmask[width + 1] ALIGNED16;
-                            float newGain;
+                                    if (isRAW) {
+                                        newGain = gain;
+                                    }
 
-                            if (numtiles > 1) {
-                                for (int i = 0; i < height; ++i) {
-                                    Vmask[i] = 1;
-                                }
+                                    for (int j = 0; j < width; ++j) {
+                                        Hmask[j] = 1.f / newGain;
+                                    }
 
-                                newGain = 1.f;
+                                    for (int i = 0; i < overlap; ++i) {
+                                        float mask = SQR(xsinf((rtengine::RT_PI * i) / (2 * overlap)));
 
-                                if (isRAW) {
-                                    newGain = gain;
-                                }
+                                        if (tiletop > 0) {
+                                            Vmask[i] = mask;
+                                        }
 
-                                for (int j = 0; j < width; ++j) {
-                                    Hmask[j] = 1.f / newGain;
-                                }
+                                        if (tilebottom < imheight) {
+                                            Vmask[height - i] = mask;
+                                        }
 
-                                for (int i = 0; i < overlap; ++i) {
-                                    float mask = SQR(xsinf((rtengine::RT_PI * i) / (2 * overlap)));
+                                        if (tileleft > 0) {
+                                            Hmask[i] = mask / newGain;
+                                        }
 
-                                    if (tiletop > 0) {
-                                        Vmask[i] = mask;
+                                        if (tileright < imwidth) {
+                                            Hmask[width - i] = mask / newGain;
+                                        }
                                     }
+                                } else {
+                                    newGain = isRAW ? 1.f / gain : 1.f;;
+                                }
 
-                                    if (tilebottom < imheight) {
-                                        Vmask[height - i] = mask;
-                                    }
+                                //convert back to RGB and write to destination array
+                                if (isRAW) {
+                                    if (!denoiseMethodRgb) {//Lab mode
+                                        realred /= 100.f;
+                                        realblue /= 100.f;
 
-                                    if (tileleft > 0) {
-                                        Hmask[i] = mask / newGain;
-                                    }
+#ifdef _OPENMP
+                                        #pragma omp parallel for schedule(dynamic,16) num_threads(denoiseNestedLevels)
+#endif
 
-                                    if (tileright < imwidth) {
-                                        Hmask[width - i] = mask / newGain;
-                                    }
-                                }
-                            } else {
-                                newGain = isRAW ? 1.f / gain : 1.f;;
-                            }
+                                        for (int i = tiletop; i < tilebottom; ++i) {
+                                            int i1 = i - tiletop;
+
+                                            for (int j = tileleft; j < tileright; ++j) {
+                                                int j1 = j - tileleft;
+                                                //modification Jacques feb 2013
+                                                //true conversion Lab==>xyz
+                                                float L = labdn->L[i1][j1];
+                                                float a = labdn->a[i1][j1];
+                                                float b = labdn->b[i1][j1];
+                                                float c_h = SQR(a) + SQR(b);
+
+                                                if (c_h > 9000000.f) {
+                                                    a *= 1.f + qhighFactor * realred;
+                                                    b *= 1.f + qhighFactor * realblue;
+                                                }
+
+                                                //convert XYZ
+                                                float X, Y, Z;
+                                                Color::Lab2XYZ(L, a, b, X, Y, Z);
+                                                //apply inverse gamma noise
+                                                float r_, g_, b_;
+                                                Color::xyz2rgb(X, Y, Z, r_, g_, b_, wip);
+                                                //inverse gamma standard (slider)
+                                                r_ = r_ < 32768.f ? igamcurve[r_] : (Color::gammanf(r_ / 32768.f, igam) * 65535.f);
+                                                g_ = g_ < 32768.f ? igamcurve[g_] : (Color::gammanf(g_ / 32768.f, igam) * 65535.f);
+                                                b_ = b_ < 32768.f ? igamcurve[b_] : (Color::gammanf(b_ / 32768.f, igam) * 65535.f);
+
+                                                //readapt arbitrary gamma (inverse from beginning)
+                                                r_ = Color::denoiseGammaTab[r_];
+                                                g_ = Color::denoiseGammaTab[g_];
+                                                b_ = Color::denoiseGammaTab[b_];
+
+                                                if (numtiles == 1) {
+                                                    dsttmp->r(i, j) = newGain * r_;
+                                                    dsttmp->g(i, j) = newGain * g_;
+                                                    dsttmp->b(i, j) = newGain * b_;
+                                                } else {
+                                                    float factor = Vmask[i1] * Hmask[j1];
+                                                    dsttmp->r(i, j) += factor * r_;
+                                                    dsttmp->g(i, j) += factor * g_;
+                                                    dsttmp->b(i, j) += factor * b_;
+                                                }
+                                            }
+                                        }
+                                    } else {//RGB mode
+#ifdef _OPENMP
+                                        #pragma omp parallel for num_threads(denoiseNestedLevels)
+#endif
 
-                            //convert back to RGB and write to destination array
-                            if (isRAW) {
-                                if (!denoiseMethodRgb) {//Lab mode
-                                    realred /= 100.f;
-                                    realblue /= 100.f;
+                                        for (int i = tiletop; i < tilebottom; ++i) {
+                                            int i1 = i - tiletop;
+
+                                            for (int j = tileleft; j < tileright; ++j) {
+                                                int j1 = j - tileleft;
+                                                float c_h = sqrt(SQR(labdn->a[i1][j1]) + SQR(labdn->b[i1][j1]));
+
+                                                if (c_h > 3000.f) {
+                                                    labdn->a[i1][j1] *= 1.f + qhighFactor * realred / 100.f;
+                                                    labdn->b[i1][j1] *= 1.f + qhighFactor * realblue / 100.f;
+                                                }
 
+                                                float Y = labdn->L[i1][j1];
+                                                float X = (labdn->a[i1][j1]) + Y;
+                                                float Z = Y - (labdn->b[i1][j1]);
+
+
+                                                X = X < 32768.f ? igamcurve[X] : (Color::gammaf(X / 32768.f, igam, igamthresh, igamslope) * 65535.f);
+                                                Y = Y < 32768.f ? igamcurve[Y] : (Color::gammaf(Y / 32768.f, igam, igamthresh, igamslope) * 65535.f);
+                                                Z = Z < 32768.f ? igamcurve[Z] : (Color::gammaf(Z / 32768.f, igam, igamthresh, igamslope) * 65535.f);
+
+                                                if (numtiles == 1) {
+                                                    dsttmp->r(i, j) = newGain * X;
+                                                    dsttmp->g(i, j) = newGain * Y;
+                                                    dsttmp->b(i, j) = newGain * Z;
+                                                } else {
+                                                    float factor = Vmask[i1] * Hmask[j1];
+                                                    dsttmp->r(i, j) += factor * X;
+                                                    dsttmp->g(i, j) += factor * Y;
+                                                    dsttmp->b(i, j) += factor * Z;
+                                                }
+                                            }
+                                        }
+
+                                    }
+                                } else {
 #ifdef _OPENMP
-                                    #pragma omp parallel for schedule(dynamic,16) num_threads(denoiseNestedLevels)
+                                    #pragma omp parallel for num_threads(denoiseNestedLevels)
 #endif
 
                                     for (int i = tiletop; i < tilebottom; ++i) {
@@ -1609,33 +1750,26 @@ BENCHFUN
                                         for (int j = tileleft; j < tileright; ++j) {
                                             int j1 = j - tileleft;
                                             //modification Jacques feb 2013
-                                            //true conversion Lab==>xyz
                                             float L = labdn->L[i1][j1];
                                             float a = labdn->a[i1][j1];
                                             float b = labdn->b[i1][j1];
-                                            float c_h = SQR(a) + SQR(b);
+                                            float c_h = sqrt(SQR(a) + SQR(b));
 
-                                            if (c_h > 9000000.f) {
-                                                a *= 1.f + qhighFactor * realred;
-                                                b *= 1.f + qhighFactor * realblue;
+                                            if (c_h > 3000.f) {
+                                                a *= 1.f + qhighFactor * realred / 100.f;
+                                                b *= 1.f + qhighFactor * realblue / 100.f;
                                             }
 
-                                            //convert XYZ
                                             float X, Y, Z;
                                             Color::Lab2XYZ(L, a, b, X, Y, Z);
-                                            //apply inverse gamma noise
+
                                             float r_, g_, b_;
                                             Color::xyz2rgb(X, Y, Z, r_, g_, b_, wip);
-                                            //inverse gamma standard (slider)
+                                            //gamma slider is different from Raw
                                             r_ = r_ < 32768.f ? igamcurve[r_] : (Color::gammanf(r_ / 32768.f, igam) * 65535.f);
                                             g_ = g_ < 32768.f ? igamcurve[g_] : (Color::gammanf(g_ / 32768.f, igam) * 65535.f);
                                             b_ = b_ < 32768.f ? igamcurve[b_] : (Color::gammanf(b_ / 32768.f, igam) * 65535.f);
 
-                                            //readapt arbitrary gamma (inverse from beginning)
-                                            r_ = Color::denoiseGammaTab[r_];
-                                            g_ = Color::denoiseGammaTab[g_];
-                                            b_ = Color::denoiseGammaTab[b_];
-
                                             if (numtiles == 1) {
                                                 dsttmp->r(i, j) = newGain * r_;
                                                 dsttmp->g(i, j) = newGain * g_;
@@ -1648,113 +1782,31 @@ BENCHFUN
                                             }
                                         }
                                     }
-                                } else {//RGB mode
-#ifdef _OPENMP
-                                    #pragma omp parallel for num_threads(denoiseNestedLevels)
-#endif
-
-                                    for (int i = tiletop; i < tilebottom; ++i) {
-                                        int i1 = i - tiletop;
-
-                                        for (int j = tileleft; j < tileright; ++j) {
-                                            int j1 = j - tileleft;
-                                            float c_h = sqrt(SQR(labdn->a[i1][j1]) + SQR(labdn->b[i1][j1]));
-
-                                            if (c_h > 3000.f) {
-                                                labdn->a[i1][j1] *= 1.f + qhighFactor * realred / 100.f;
-                                                labdn->b[i1][j1] *= 1.f + qhighFactor * realblue / 100.f;
-                                            }
-
-                                            float Y = labdn->L[i1][j1];
-                                            float X = (labdn->a[i1][j1]) + Y;
-                                            float Z = Y - (labdn->b[i1][j1]);
-
-
-                                            X = X < 32768.f ? igamcurve[X] : (Color::gammaf(X / 32768.f, igam, igamthresh, igamslope) * 65535.f);
-                                            Y = Y < 32768.f ? igamcurve[Y] : (Color::gammaf(Y / 32768.f, igam, igamthresh, igamslope) * 65535.f);
-                                            Z = Z < 32768.f ? igamcurve[Z] : (Color::gammaf(Z / 32768.f, igam, igamthresh, igamslope) * 65535.f);
-
-                                            if (numtiles == 1) {
-                                                dsttmp->r(i, j) = newGain * X;
-                                                dsttmp->g(i, j) = newGain * Y;
-                                                dsttmp->b(i, j) = newGain * Z;
-                                            } else {
-                                                float factor = Vmask[i1] * Hmask[j1];
-                                                dsttmp->r(i, j) += factor * X;
-                                                dsttmp->g(i, j) += factor * Y;
-                                                dsttmp->b(i, j) += factor * Z;
-                                            }
-                                        }
-                                    }
-
                                 }
-                            } else {
-#ifdef _OPENMP
-                                #pragma omp parallel for num_threads(denoiseNestedLevels)
-#endif
-
-                                for (int i = tiletop; i < tilebottom; ++i) {
-                                    int i1 = i - tiletop;
 
-                                    for (int j = tileleft; j < tileright; ++j) {
-                                        int j1 = j - tileleft;
-                                        //modification Jacques feb 2013
-                                        float L = labdn->L[i1][j1];
-                                        float a = labdn->a[i1][j1];
-                                        float b = labdn->b[i1][j1];
-                                        float c_h = sqrt(SQR(a) + SQR(b));
-
-                                        if (c_h > 3000.f) {
-                                            a *= 1.f + qhighFactor * realred / 100.f;
-                                            b *= 1.f + qhighFactor * realblue / 100.f;
-                                        }
-
-                                        float X, Y, Z;
-                                        Color::Lab2XYZ(L, a, b, X, Y, Z);
-
-                                        float r_, g_, b_;
-                                        Color::xyz2rgb(X, Y, Z, r_, g_, b_, wip);
-                                        //gamma slider is different from Raw
-                                        r_ = r_ < 32768.f ? igamcurve[r_] : (Color::gammanf(r_ / 32768.f, igam) * 65535.f);
-                                        g_ = g_ < 32768.f ? igamcurve[g_] : (Color::gammanf(g_ / 32768.f, igam) * 65535.f);
-                                        b_ = b_ < 32768.f ? igamcurve[b_] : (Color::gammanf(b_ / 32768.f, igam) * 65535.f);
-
-                                        if (numtiles == 1) {
-                                            dsttmp->r(i, j) = newGain * r_;
-                                            dsttmp->g(i, j) = newGain * g_;
-                                            dsttmp->b(i, j) = newGain * b_;
-                                        } else {
-                                            float factor = Vmask[i1] * Hmask[j1];
-                                            dsttmp->r(i, j) += factor * r_;
-                                            dsttmp->g(i, j) += factor * g_;
-                                            dsttmp->b(i, j) += factor * b_;
-                                        }
-                                    }
-                                }
+                                //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
                             }
 
-                            //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
-                        }
+                            delete labdn;
+                            delete Lin;
 
-                        delete labdn;
-                        delete Lin;
+                        }//end of tile row
+                    }//end of tile loop
 
-                    }//end of tile row
-                }//end of tile loop
+                    if (numtiles > 1 || !isRAW || (!useNoiseCCurve && !useNoiseLCurve)) {
+                        delete[] noisevarlum;
+                        delete[] noisevarchrom;
+                    }
 
-                if (numtiles > 1 || !isRAW || (!useNoiseCCurve && !useNoiseLCurve)) {
-                    delete[] noisevarlum;
-                    delete[] noisevarchrom;
                 }
 
-            }
-
-            for (size_t i = 0; i < blox_array_size; ++i) {
-                if (LbloxArray[i]) {
-                    fftwf_free(LbloxArray[i]);
-                }
-                if (fLbloxArray[i]) {
-                    fftwf_free(fLbloxArray[i]);
+                for (size_t i = 0; i < blox_array_size; ++i) {
+                    if (LbloxArray[i]) {
+                        fftwf_free(LbloxArray[i]);
+                    }
+                    if (fLbloxArray[i]) {
+                        fftwf_free(fLbloxArray[i]);
+                    }
                 }
             }
 
@@ -1786,15 +1838,7 @@ BENCHFUN
                     }
                 }
             }
-
-            if (denoiseLuminance) {
-                // destroy the plans
-                fftwf_destroy_plan(plan_forward_blox[0]);
-                fftwf_destroy_plan(plan_backward_blox[0]);
-                fftwf_destroy_plan(plan_forward_blox[1]);
-                fftwf_destroy_plan(plan_backward_blox[1]);
-            }
-        } while (memoryAllocationFailed && numTries < 2 && (options.rgbDenoiseThreadLimit == 0) && !ponder);
+        } while (memoryAllocationFailed && !ponder && (!tiled || tilesize > minDenoiseTileSize) && !isCancelled());
 
         if (memoryAllocationFailed) {
             printf("tiled denoise failed due to isufficient memory. Output is not denoised!\n");
@@ -1838,6 +1882,10 @@ BENCHFUN
         }
 
         for (int iteration = 1; iteration <= dnparams.passes; ++iteration) {
+            if (isCancelled()) {
+                break;
+            }
+
 
 #ifdef _OPENMP
             #pragma omp parallel
@@ -3179,6 +3227,8 @@ void ImProcFunctions::calcautodn_info(float &chaut, float &delta, int Nb, int le
 
 void ImProcFunctions::RGB_denoise_info(Imagefloat * src, Imagefloat * provicalc, const bool isRAW, LUTf &gamcurve, float gam, float gamthresh, float gamslope, const procparams::DirPyrDenoiseParams & dnparams, const double expcomp, float &chaut, int &Nb,  float &redaut, float &blueaut, float &maxredaut, float &maxblueaut, float &minredaut, float &minblueaut, float &chromina, float &sigma, float &lumema, float &sigma_L, float &redyel, float &skinc, float &nsknc, bool multiThread)
 {
+    PROCTRACE("RGB_denoise_info");
+
     if ((settings->leveldnautsimpl == 1 && dnparams.Cmethod == "MAN") || (settings->leveldnautsimpl == 0 && dnparams.C2method == "MANU")) {
         //nothing to do
         return;
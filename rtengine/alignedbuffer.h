@@ -23,6 +23,8 @@
 #include <cstdlib>
 #include <utility>
 
+#include "bufferpool.h"
+
 inline size_t padToAlignment(size_t size, size_t align = 16) {
     return align * ((size + align - 1) / align);
 }
@@ -54,9 +56,7 @@ public:
 
     ~AlignedBuffer ()
     {
-        if (real) {
-            free(real);
-        }
+        rtengine::BufferPool::getInstance()->release(real);
     }
 
     /** @brief Return true if there's no memory allocated
@@ -76,9 +76,7 @@ public:
         if (allocatedSize != size) {
             if (!size) {
                 // The user want to free the memory
-                if (real) {
-                    free(real);
-                }
+                rtengine::BufferPool::getInstance()->release(real);
 
                 real = nullptr;
                 data = nullptr;
@@ -87,30 +85,12 @@ public:
                 unitSize = 0;
             } else {
                 unitSize = structSize ? structSize : sizeof(T);
-                size_t oldAllocatedSize = allocatedSize;
                 allocatedSize = size * unitSize;
 
-                // realloc were used here to limit memory fragmentation, specially when the size was smaller than the previous one.
-                // But realloc copies the content to the eventually new location, which is unnecessary. To avoid this performance penalty,
-                // we're freeing the memory and allocate it again if the new size is bigger.
-
-                if (allocatedSize < oldAllocatedSize) {
-                    void *temp = realloc(real, allocatedSize + alignment);
-                    if (temp) { // realloc succeeded
-                        real = temp;
-                    } else { // realloc failed => free old buffer and allocate new one
-                        if (real) {
-                            free (real);
-                        }
-                        real = malloc(allocatedSize + alignment);
-                    }
-                } else {
-                    if (real) {
-                        free (real);
-                    }
-
-                    real = malloc(allocatedSize + alignment);
-                }
+                // realloc were used here to limit memory fragmentation. The buffer pool now does it better by recycling
+                // the large buffers, and it doesn't copy the content, which is unnecessary.
+                rtengine::BufferPool::getInstance()->release(real);
+                real = rtengine::BufferPool::getInstance()->allocate(allocatedSize + alignment);
 
                 if (real) {
                     data = (T*)( ( uintptr_t(real) + uintptr_t(alignment - 1)) / alignment * alignment);
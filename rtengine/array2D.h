@@ -65,7 +65,10 @@
 
 #include <cstring>
 #include <cstdio>
+#include <new>
+#include <type_traits>
 
+#include "bufferpool.h"
 #include "noncopyable.h"
 
 template<typename T>
@@ -79,6 +82,26 @@ private:
     T ** ptr;
     T * data;
     bool lock; // useful lock to ensure data is not changed anymore.
+
+    // the data come from the buffer pool, which doesn't construct them
+    static_assert(std::is_trivial<T>::value, "array2D only holds trivial types");
+
+    static T* allocData(size_t size)
+    {
+        T* const data = static_cast<T*>(rtengine::BufferPool::getInstance()->allocate(size * sizeof(T)));
+
+        if (!data) {
+            throw std::bad_alloc();
+        }
+
+        return data;
+    }
+
+    static void freeData(T* data)
+    {
+        rtengine::BufferPool::getInstance()->release(data);
+    }
+
     void ar_realloc(int w, int h, int offset = 0)
     {
         if ((ptr) && ((h > y) || (4 * h < y))) {
@@ -87,7 +110,7 @@ private:
         }
 
         if ((data) && (((h * w) > (x * y)) || ((h * w) < ((x * y) / 4)))) {
-            delete[] data;
+            freeData(data);
             data = nullptr;
         }
 
@@ -96,7 +119,7 @@ private:
         }
 
         if (data == nullptr) {
-            data = new T[h * w + offset];
+            data = allocData(h * w + offset);
         }
 
         x = w;
@@ -123,7 +146,7 @@ public:
     {
         flags = flgs;
         lock = flags & ARRAY2D_LOCK_DATA;
-        data = new T[h * w];
+        data = allocData(h * w);
         owner = 1;
         x = w;
         y = h;
@@ -149,7 +172,7 @@ public:
         owner = (flags & ARRAY2D_BYREFERENCE) ? 0 : 1;
 
         if (owner) {
-            data = new T[h * w];
+            data = allocData(h * w);
         } else {
             data = nullptr;
         }
@@ -180,7 +203,7 @@ public:
         }
 
         if ((owner) && (data)) {
-            delete[] data;
+            freeData(data);
         }
 
         if (ptr) {
@@ -191,7 +214,7 @@ public:
     void free()
     {
         if ((owner) && (data)) {
-            delete[] data;
+            freeData(data);
             data = nullptr;
         }
 
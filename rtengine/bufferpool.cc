@@ -0,0 +1,247 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "bufferpool.h"
+
+namespace
+{
+
+constexpr std::size_t alignment = 64;
+// below this size, buffers come from malloc and aren't kept
+constexpr std::size_t minPooledSize = std::size_t(1) << 20;
+constexpr std::size_t pageSize = 4096;
+constexpr std::size_t hugePageSize = std::size_t(2) << 20;
+// a buffer kept in the pool can be reused for an allocation up to 1/8 smaller
+constexpr std::size_t maxWasteDivisor = 8;
+
+// stored just before each buffer returned by BufferPool::allocate()
+struct Header {
+    void* real;           // start of the malloc'ed or mapped block
+    std::size_t capacity; // size of the mapped block, 0 if it has been malloc'ed
+};
+
+// room for the header and the alignment of the buffer at the start of a block
+constexpr std::size_t headerSpace = 2 * alignment;
+
+Header* getHeader(void* buffer)
+{
+    return reinterpret_cast<Header*>(static_cast<char*>(buffer) - sizeof(Header));
+}
+
+std::size_t roundUp(std::size_t size, std::size_t granularity)
+{
+    return (size + granularity - 1) / granularity * granularity;
+}
+
+void* mapBlock(std::size_t capacity)
+{
+#ifdef WIN32
+    return std::malloc(capacity);
+#else
+    void* const block = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (block == MAP_FAILED) {
+        return nullptr;
+    }
+
+#ifdef MADV_HUGEPAGE
+    if (capacity >= hugePageSize) {
+        madvise(block, capacity, MADV_HUGEPAGE);
+    }
+#endif
+
+    return block;
+#endif
+}
+
+void unmapBlock(void* block, std::size_t capacity)
+{
+#ifdef WIN32
+    std::free(block);
+#else
+    munmap(block, capacity);
+#endif
+}
+
+// faults the pages of a new block in from the threads which will most likely process them
+void firstTouch(void* block, std::size_t capacity)
+{
+    char* const bytes = static_cast<char*>(block);
+    const std::ptrdiff_t pages = capacity / pageSize;
+
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static) if(!omp_in_parallel())
+#endif
+
+    for (std::ptrdiff_t i = 0; i < pages; ++i) {
+        bytes[i * pageSize] = 0;
+    }
+}
+
+}
+
+namespace rtengine
+{
+
+BufferPool* BufferPool::getInstance()
+{
+    // never destroyed: buffers may be released by static objects after the end of main()
+    static BufferPool* const instance = new BufferPool;
+    return instance;
+}
+
+BufferPool::BufferPool() :
+    maxIdleSize(std::size_t(512) << 20),
+    idleSize(0)
+{
+}
+
+void BufferPool::init(int maxIdleSize)
+{
+    MyMutex::MyLock lock(mutex);
+
+    this->maxIdleSize = std::size_t(std::max(maxIdleSize, 0)) << 20;
+    trimTo(this->maxIdleSize);
+}
+
+void* BufferPool::allocate(std::size_t size)
+{
+    void* real;
+    std::size_t capacity = 0;
+
+    if (size < minPooledSize) {
+        // malloc only guarantees the alignment of the fundamental types
+        real = std::malloc(size + headerSpace);
+
+        if (!real) {
+            return nullptr;
+        }
+    } else {
+        const std::size_t wanted = roundUp(size + headerSpace, size >= 16 * hugePageSize ? hugePageSize : 16 * pageSize);
+        real = nullptr;
+
+        {
+            MyMutex::MyLock lock(mutex);
+
+            // the smallest idle buffer large enough, the most recently released one among equals
+            std::size_t best = idle.size();
+
+            for (std::size_t i = 0; i < idle.size(); ++i) {
+                if (idle[i].capacity >= wanted && idle[i].capacity - idle[i].capacity / maxWasteDivisor <= wanted
+                        && (best == idle.size() || idle[i].capacity <= idle[best].capacity)) {
+                    best = i;
+                }
+            }
+
+            if (best < idle.size()) {
+                real = idle[best].buffer;
+                capacity = idle[best].capacity;
+                idleSize -= capacity;
+                idle.erase(idle.begin() + best);
+            }
+        }
+
+        if (!real) {
+            real = mapBlock(wanted);
+
+            if (!real) {
+                // give the idle buffers back and try again
+                flush();
+                real = mapBlock(wanted);
+
+                if (!real) {
+                    return nullptr;
+                }
+            }
+
+            capacity = wanted;
+            firstTouch(real, capacity);
+        }
+    }
+
+    char* const buffer = reinterpret_cast<char*>(roundUp(reinterpret_cast<std::uintptr_t>(real) + sizeof(Header), alignment));
+    Header* const header = getHeader(buffer);
+    header->real = real;
+    header->capacity = capacity;
+    return buffer;
+}
+
+void BufferPool::release(void* buffer)
+{
+    if (!buffer) {
+        return;
+    }
+
+    const Header header = *getHeader(buffer);
+
+    if (!header.capacity) {
+        std::free(header.real);
+        return;
+    }
+
+    MyMutex::MyLock lock(mutex);
+
+    if (header.capacity > maxIdleSize) {
+        unmapBlock(header.real, header.capacity);
+        return;
+    }
+
+    trimTo(maxIdleSize - header.capacity);
+    idle.push_back({header.real, header.capacity});
+    idleSize += header.capacity;
+}
+
+void BufferPool::flush()
+{
+    MyMutex::MyLock lock(mutex);
+
+    trimTo(0);
+}
+
+std::size_t BufferPool::getIdleSize()
+{
+    MyMutex::MyLock lock(mutex);
+
+    return idleSize;
+}
+
+void BufferPool::trimTo(std::size_t size)
+{
+    std::size_t evicted = 0;
+
+    while (idleSize > size && evicted < idle.size()) {
+        unmapBlock(idle[evicted].buffer, idle[evicted].capacity);
+        idleSize -= idle[evicted].capacity;
+        ++evicted;
+    }
+
+    idle.erase(idle.begin(), idle.begin() + evicted);
+}
+
+}
@@ -0,0 +1,75 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "noncopyable.h"
+
+#include "../rtgui/threadutils.h"
+
+namespace rtengine
+{
+
+/**
+ * @brief Engine wide allocator of the image planes
+ *
+ * AlignedBuffer (thus the images), array2D and LabImage get their memory from here. Small buffers come from
+ * malloc. Large buffers are mapped directly, with transparent huge pages where available, and the pages of a
+ * new mapping are first touched by the OpenMP threads, in the order a static schedule over the rows gives
+ * them, so that they are local to the threads processing them. A released large buffer is kept for the next
+ * allocation of about the same size, from the same or the next image, until the idle buffers exceed the
+ * size of the pool.
+ */
+class BufferPool :
+    public NonCopyable
+{
+public:
+    static BufferPool* getInstance();
+
+    /** @param maxIdleSize in MiB, size of the released buffers kept for reuse, 0 to not keep any */
+    void init(int maxIdleSize);
+
+    /** @return a buffer of at least size bytes aligned to 64 bytes, nullptr if the allocation failed */
+    void* allocate(std::size_t size);
+    /** Releases a buffer returned by allocate(), nullptr is ignored */
+    void release(void* buffer);
+
+    /** Gives the idle buffers back to the system */
+    void flush();
+    /** @return the size of the idle buffers in bytes */
+    std::size_t getIdleSize();
+
+private:
+    struct Idle {
+        void* buffer;
+        std::size_t capacity;
+    };
+
+    BufferPool();
+
+    void trimTo(std::size_t size); // mutex must be locked
+
+    std::size_t maxIdleSize;
+    std::size_t idleSize;
+    std::vector<Idle> idle; // least recently released first
+    MyMutex mutex;
+};
+
+}
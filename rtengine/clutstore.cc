@@ -1,7 +1,9 @@
 #include <algorithm>
+#include <vector>
 
 #include "clutstore.h"
 
+#include "color.h"
 #include "iccstore.h"
 #include "imagefloat.h"
 #include "opthelper.h"
@@ -14,6 +16,10 @@
 namespace
 {
 
+// A baked table doesn't depend on the strength, so only the CLUTs of the image being edited
+// and of the one being exported are kept
+constexpr int bakedClutCacheSize = 2;
+
 bool loadFile(
     const Glib::ustring& filename,
     const Glib::ustring& working_color_space,
@@ -154,6 +160,11 @@ Glib::ustring rtengine::HaldCLUT::getProfile() const
     return clut_profile;
 }
 
+unsigned int rtengine::HaldCLUT::getLevel() const
+{
+    return clut_level;
+}
+
 void rtengine::HaldCLUT::getRGB(
     float strength,
     std::size_t line_size,
@@ -300,6 +311,179 @@ void rtengine::HaldCLUT::splitClutFilename(
     }
 }
 
+rtengine::BakedHaldCLUT::BakedHaldCLUT(const HaldCLUT& clut, const Glib::ustring& working_profile) :
+    table(std::size_t(clut.getLevel()) * clut.getLevel() * clut.getLevel() * 3 + 1),
+    level(clut.getLevel()),
+    flevel_minus_one(static_cast<float>(level - 1) / 65535.0f),
+    flevel_minus_two(static_cast<float>(level - 2))
+{
+    const bool same_profiles = clut.getProfile() == working_profile;
+
+    const TMatrix work2xyz = ICCStore::getInstance()->workingSpaceMatrix(working_profile);
+    const TMatrix xyz2work = ICCStore::getInstance()->workingSpaceInverseMatrix(working_profile);
+    const TMatrix clut2xyz = ICCStore::getInstance()->workingSpaceMatrix(clut.getProfile());
+    const TMatrix xyz2clut = ICCStore::getInstance()->workingSpaceInverseMatrix(clut.getProfile());
+
+    table.data[table.getSize() - 1] = 0.0f;
+
+#ifdef _OPENMP
+    #pragma omp parallel
+#endif
+    {
+        // one line of nodes along red at a time
+        std::vector<float> r(level);
+        std::vector<float> g(level);
+        std::vector<float> b(level);
+        AlignedBuffer<float> out_rgbx(level * 4);
+
+#ifdef _OPENMP
+        #pragma omp for schedule(dynamic, 16)
+#endif
+
+        for (unsigned int line = 0; line < level * level; ++line) {
+            const float line_green = static_cast<float>(line % level) / flevel_minus_one;
+            const float line_blue = static_cast<float>(line / level) / flevel_minus_one;
+
+            for (unsigned int i = 0; i < level; ++i) {
+                r[i] = static_cast<float>(i) / flevel_minus_one;
+                g[i] = line_green;
+                b[i] = line_blue;
+
+                if (!same_profiles) {
+                    // Convert from working to clut profile
+                    float x, y, z;
+                    Color::rgbxyz(Color::igamma_srgb(r[i]), Color::igamma_srgb(g[i]), Color::igamma_srgb(b[i]), x, y, z, work2xyz);
+                    Color::xyz2rgb(x, y, z, r[i], g[i], b[i], xyz2clut);
+
+                    r[i] = Color::gamma_srgbclipped(r[i]);
+                    g[i] = Color::gamma_srgbclipped(g[i]);
+                    b[i] = Color::gamma_srgbclipped(b[i]);
+                }
+            }
+
+            clut.getRGB(1.f, level, r.data(), g.data(), b.data(), out_rgbx.data);
+
+            float* const nodes = table.data + std::size_t(line) * level * 3;
+
+            for (unsigned int i = 0; i < level; ++i) {
+                float red = Color::igamma_srgb(out_rgbx.data[i * 4 + 0]);
+                float green = Color::igamma_srgb(out_rgbx.data[i * 4 + 1]);
+                float blue = Color::igamma_srgb(out_rgbx.data[i * 4 + 2]);
+
+                if (!same_profiles) {
+                    // Convert from clut to working profile
+                    float x, y, z;
+                    Color::rgbxyz(red, green, blue, x, y, z, clut2xyz);
+                    Color::xyz2rgb(x, y, z, red, green, blue, xyz2work);
+                }
+
+                nodes[i * 3 + 0] = red;
+                nodes[i * 3 + 1] = green;
+                nodes[i * 3 + 2] = blue;
+            }
+        }
+    }
+}
+
+void rtengine::BakedHaldCLUT::getRGB(
+    std::size_t line_size,
+    const float* r,
+    const float* g,
+    const float* b,
+    float* out_rgbx
+) const
+{
+    const std::size_t step_red = 3;
+    const std::size_t step_green = level * step_red;
+    const std::size_t step_blue = level * step_green;
+
+    for (std::size_t column = 0; column < line_size; ++column, ++r, ++g, ++b, out_rgbx += 4) {
+        const float fred = *r * flevel_minus_one;
+        const float fgreen = *g * flevel_minus_one;
+        const float fblue = *b * flevel_minus_one;
+
+        const unsigned int red = std::min(flevel_minus_two, fred);
+        const unsigned int green = std::min(flevel_minus_two, fgreen);
+        const unsigned int blue = std::min(flevel_minus_two, fblue);
+
+        const float re = fred - red;
+        const float gr = fgreen - green;
+        const float bl = fblue - blue;
+
+        // The tetrahedron of the cell holding the pixel: its corners are the first corner of the cell, the opposite one,
+        // and the two corners reached by going along the axes in decreasing order of the fractional parts
+        std::size_t second, third;
+        float w_first, w_second, w_third, w_last;
+
+        if (re >= gr) {
+            if (gr >= bl) {
+                second = step_red;
+                third = step_red + step_green;
+                w_first = 1.f - re;
+                w_second = re - gr;
+                w_third = gr - bl;
+                w_last = bl;
+            } else if (re >= bl) {
+                second = step_red;
+                third = step_red + step_blue;
+                w_first = 1.f - re;
+                w_second = re - bl;
+                w_third = bl - gr;
+                w_last = gr;
+            } else {
+                second = step_blue;
+                third = step_red + step_blue;
+                w_first = 1.f - bl;
+                w_second = bl - re;
+                w_third = re - gr;
+                w_last = gr;
+            }
+        } else {
+            if (bl >= gr) {
+                second = step_blue;
+                third = step_green + step_blue;
+                w_first = 1.f - bl;
+                w_second = bl - gr;
+                w_third = gr - re;
+                w_last = re;
+            } else if (bl >= re) {
+                second = step_green;
+                third = step_green + step_blue;
+                w_first = 1.f - gr;
+                w_second = gr - bl;
+                w_third = bl - re;
+                w_last = re;
+            } else {
+                second = step_green;
+                third = step_red + step_green;
+                w_first = 1.f - gr;
+                w_second = gr - re;
+                w_third = re - bl;
+                w_last = bl;
+            }
+        }
+
+        const float* const first = table.data + red * step_red + green * step_green + blue * step_blue;
+        const std::size_t last = step_red + step_green + step_blue;
+
+#ifdef __SSE2__
+        // the 4th float of the loads is the red of the next node, it ends up in the unused 4th float of out_rgbx
+        STVF(*out_rgbx,
+             LVFU(first[0]) * F2V(w_first)
+             + LVFU(first[second]) * F2V(w_second)
+             + LVFU(first[third]) * F2V(w_third)
+             + LVFU(first[last]) * F2V(w_last)
+        );
+#else
+
+        for (int channel = 0; channel < 3; ++channel) {
+            out_rgbx[channel] = first[channel] * w_first + first[second + channel] * w_second + first[third + channel] * w_third + first[last + channel] * w_last;
+        }
+
+#endif
+    }
+}
+
 rtengine::CLUTStore& rtengine::CLUTStore::getInstance()
 {
     static CLUTStore instance;
@@ -327,12 +511,32 @@ std::shared_ptr<rtengine::HaldCLUT> rtengine::CLUTStore::getClut(const Glib::ust
     return result;
 }
 
+std::shared_ptr<rtengine::BakedHaldCLUT> rtengine::CLUTStore::getBakedClut(const Glib::ustring& filename, const Glib::ustring& working_profile) const
+{
+    std::shared_ptr<rtengine::BakedHaldCLUT> result;
+
+    const Glib::ustring key = filename + '\n' + working_profile;
+
+    if (!baked_cache.get(key, result)) {
+        const std::shared_ptr<rtengine::HaldCLUT> clut = getClut(filename);
+
+        if (clut) {
+            result = std::make_shared<rtengine::BakedHaldCLUT>(*clut, working_profile);
+            baked_cache.insert(key, result);
+        }
+    }
+
+    return result;
+}
+
 void rtengine::CLUTStore::clearCache()
 {
     cache.clear();
+    baked_cache.clear();
 }
 
 rtengine::CLUTStore::CLUTStore() :
-    cache(options.clutCacheSize)
+    cache(options.clutCacheSize),
+    baked_cache(std::min(options.clutCacheSize, bakedClutCacheSize))
 {
 }
@@ -25,6 +25,7 @@ public:
 
     Glib::ustring getFilename() const;
     Glib::ustring getProfile() const;
+    unsigned int getLevel() const;
 
     void getRGB(
         float strength,
@@ -51,6 +52,41 @@ private:
     Glib::ustring clut_profile;
 };
 
+/**
+ * @brief HaldCLUT resampled for a working profile
+ *
+ * The nodes of the table are working space values, sRGB gamma encoded like the input of HaldCLUT::getRGB().
+ * They hold the whole film simulation of the node at full strength: the conversion to the profile of the CLUT,
+ * the CLUT lookup and the conversion back to the linear working space. Looking a pixel up only needs the
+ * interpolation of the 4 nodes of its tetrahedron. For lower strengths, the caller blends the sRGB gamma encoded
+ * result with the input, so changing the strength doesn't bake a new table. When the CLUT doesn't have the working
+ * profile, this blend is done in the working space instead of the space of the CLUT.
+ */
+class BakedHaldCLUT final :
+    public NonCopyable
+{
+public:
+    BakedHaldCLUT(const HaldCLUT& clut, const Glib::ustring& working_profile);
+
+    /**
+     * @param r, g, b sRGB gamma encoded working space values in [0 ; 65535]
+     * @param out_rgbx linear working space values, 16 bytes aligned, 4 floats per pixel
+     */
+    void getRGB(
+        std::size_t line_size,
+        const float* r,
+        const float* g,
+        const float* b,
+        float* out_rgbx
+    ) const;
+
+private:
+    AlignedBuffer<float> table; // 3 floats per node, plus one for the 4 floats loads
+    unsigned int level;
+    float flevel_minus_one;
+    float flevel_minus_two;
+};
+
 class CLUTStore final :
     public NonCopyable
 {
@@ -58,6 +94,7 @@ public:
     static CLUTStore& getInstance();
 
     std::shared_ptr<HaldCLUT> getClut(const Glib::ustring& filename) const;
+    std::shared_ptr<BakedHaldCLUT> getBakedClut(const Glib::ustring& filename, const Glib::ustring& working_profile) const;
 
     void clearCache();
 
@@ -65,6 +102,7 @@ private:
     CLUTStore();
 
     mutable Cache<Glib::ustring, std::shared_ptr<HaldCLUT>> cache;
+    mutable Cache<Glib::ustring, std::shared_ptr<BakedHaldCLUT>> baked_cache;
 };
 
 }
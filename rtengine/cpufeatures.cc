@@ -0,0 +1,73 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cpufeatures.h"
+
+namespace
+{
+
+rtengine::SimdLevel detectSimdLevel()
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    // __builtin_cpu_supports() also checks that the OS saves the AVX and AVX-512 registers
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return rtengine::SimdLevel::AVX512;
+    }
+
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return rtengine::SimdLevel::AVX2;
+    }
+#endif
+
+#ifdef __SSE2__
+    return rtengine::SimdLevel::SSE2;
+#else
+    return rtengine::SimdLevel::NONE;
+#endif
+}
+
+}
+
+namespace rtengine
+{
+
+SimdLevel getSimdLevel()
+{
+    static const SimdLevel level = detectSimdLevel();
+    return level;
+}
+
+const char* getSimdLevelName(SimdLevel level)
+{
+    switch (level) {
+        case SimdLevel::SSE2:
+            return "SSE2";
+
+        case SimdLevel::AVX2:
+            return "AVX2";
+
+        case SimdLevel::AVX512:
+            return "AVX-512";
+
+        default:
+            return "none";
+    }
+}
+
+}
@@ -0,0 +1,35 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+namespace rtengine
+{
+
+// Ordered, each level implies the previous ones
+enum class SimdLevel {
+    NONE,
+    SSE2,
+    AVX2,       // AVX2 and FMA
+    AVX512      // AVX-512F
+};
+
+/** @return the widest instruction set supported by both the cpu and the operating system, detected once */
+SimdLevel getSimdLevel();
+const char* getSimdLevelName(SimdLevel level);
+
+}
@@ -637,6 +637,73 @@ inline unsigned CLASS nikbithuff_t::operator() (int nbits, ushort *huff)
 #define nikbits(n) nikbithuff(n,0)
 #define nikhuff(h) nikbithuff(*h,h+1)
 
+inline void CLASS ljpegbits_t::fill()
+{
+  while (vbits <= 56) {
+    if (pos < end && *pos != 0xff) {
+      bitbuf = (bitbuf << 8) | *pos++;
+    } else if (pos + 1 < end && pos[1] == 0) {
+      bitbuf = (bitbuf << 8) | 0xff;
+      pos += 2;
+    } else {
+      // marker or end of data, feed zeros but don't consume the marker
+      bitbuf <<= 8;
+      padding += 8;
+    }
+    vbits += 8;
+  }
+}
+
+inline void CLASS ljpegbits_t::consume(int nbits)
+{
+  vbits -= nbits;
+  if (UNLIKELY(vbits < padding)) {
+    // read past the end of the segment
+    ++errors;
+    padding = vbits;
+  }
+}
+
+void CLASS ljpegbits_t::restart()
+{
+  bitbuf = vbits = padding = 0;
+  while (pos + 1 < end && !(pos[0] == 0xff && pos[1] >> 4 == 0xd))
+    pos++;
+  pos = pos + 1 < end ? pos + 2 : end;
+}
+
+inline unsigned CLASS ljpegbits_t::getbits(int nbits)
+{
+  if (UNLIKELY(nbits > 25)) return 0;
+  if (nbits <= 0) return 0;
+  fill();
+  const unsigned c = (bitbuf >> (vbits - nbits)) & ((1u << nbits) - 1);
+  consume(nbits);
+  return c;
+}
+
+inline unsigned CLASS ljpegbits_t::gethuff(const ushort *huff)
+{
+  fill();
+  const int max = huff[0];
+  const ushort entry = huff[1 + (max ? (bitbuf >> (vbits - max)) & ((1u << max) - 1) : 0)];
+  consume(entry >> 8);
+  return (uchar) entry;
+}
+
+inline int CLASS ljpegbits_t::diff(const ushort *huff, bool dng16)
+{
+  const int len = gethuff(huff);
+  if (len == 16 && dng16)
+    return -32768;
+  if (!len)
+    return 0;
+  int diff = getbits(len);
+  if ((diff & (1 << (len-1))) == 0)
+    diff -= (1 << len) - 1;
+  return diff;
+}
+
 /*
    Construct a decode tree according the specification in *source.
    The first 16 bytes specify how many codes should be 1-bit, 2-bit
@@ -949,6 +1016,42 @@ ushort * CLASS ljpeg_row (int jrow, struct jhead *jh)
   return row[2];
 }
 
+/*RT*/ // same as above, with a private bit reader
+ushort * CLASS ljpeg_row (int jrow, struct jhead *jh, ljpegbits_t &bits)
+{
+  int col, c, diff, pred, spred=0;
+  ushort *row[3];
+  const bool dng16 = !dng_version || dng_version >= 0x1010000;
+
+  if (jrow * jh->wide % jh->restart == 0) {
+    FORC(6) jh->vpred[c] = 1 << (jh->bits-1);
+    if (jrow)
+      bits.restart();
+  }
+  FORC3 row[c] = (jh->row + ((jrow & 1) + 1) * (jh->wide*jh->clrs*((jrow+c) & 1)));
+  for (col=0; col < jh->wide; col++)
+    FORC(jh->clrs) {
+      diff = bits.diff (jh->huff[c], dng16);
+      if (jh->sraw && c <= jh->sraw && (col | c))
+		    pred = spred;
+      else if (col) pred = row[0][-jh->clrs];
+      else	    pred = (jh->vpred[c] += diff) - diff;
+      if (jh->psv != 1 && jrow && col) switch (jh->psv) {
+	case 2: pred = row[1][0];					break;
+	case 3: pred = row[1][-jh->clrs];				break;
+	case 4: pred = pred +   row[1][0] - row[1][-jh->clrs];		break;
+	case 5: pred = pred + ((row[1][0] - row[1][-jh->clrs]) >> 1);	break;
+	case 6: pred = row[1][0] + ((pred - row[1][-jh->clrs]) >> 1);	break;
+	case 7: pred = (pred + row[1][0]) >> 1;				break;
+	default: pred = 0;
+      }
+      if (UNLIKELY((**row = pred + diff) >> jh->bits)) bits.error();
+      if (c <= jh->sraw) spred = **row;
+      row[0]++; row[1]++;
+    }
+  return row[2];
+}
+
 void CLASS lossless_jpeg_load_raw()
 {
   struct jhead jh;
@@ -956,8 +1059,10 @@ void CLASS lossless_jpeg_load_raw()
 
   if (!ljpeg_start (&jh, 0)) return;
   int jwide = jh.wide * jh.clrs;
+  /*RT*/ // decoded from memory, several bytes at a time
+  ljpegbits_t bits(fdata(0, ifp) + ftell(ifp), fdata(0, ifp) + ifp->size);
   ushort *rp[2];
-  rp[0] = ljpeg_row (0, &jh);
+  rp[0] = ljpeg_row (0, &jh, bits);
 
   for (int jrow=0; jrow < jh.high; jrow++) {
 #ifdef _OPENMP
@@ -969,7 +1074,7 @@ void CLASS lossless_jpeg_load_raw()
 #endif
     {
         if(jrow < jh.high - 1)
-            rp[(jrow + 1)&1] = ljpeg_row (jrow + 1, &jh);
+            rp[(jrow + 1)&1] = ljpeg_row (jrow + 1, &jh, bits);
     }
 #ifdef _OPENMP
      #pragma omp section
@@ -999,6 +1104,7 @@ void CLASS lossless_jpeg_load_raw()
 }
   }
   ljpeg_end (&jh);
+  if (bits.errorCount()) derror();
 }
 
 void CLASS canon_sraw_load_raw()
@@ -1011,6 +1117,7 @@ void CLASS canon_sraw_load_raw()
 
   if (!ljpeg_start (&jh, 0) || jh.clrs < 4) return;
   jwide = (jh.wide >>= 1) * jh.clrs;
+  /*RT*/ ljpegbits_t bits(fdata(0, ifp) + ftell(ifp), fdata(0, ifp) + ifp->size);
 
   for (ecol=slice=0; slice <= cr2_slice[0]; slice++) {
     scol = ecol;
@@ -1020,7 +1127,7 @@ void CLASS canon_sraw_load_raw()
       ip = (short (*)[4]) image + row*width;
       for (col=scol; col < ecol; col+=2, jcol+=jh.clrs) {
 	if ((jcol %= jwide) == 0)
-	  rp = (short *) ljpeg_row (jrow++, &jh);
+	  rp = (short *) ljpeg_row (jrow++, &jh, bits);
 	if (col >= width) continue;
 	FORC (jh.clrs-2)
 	  ip[col + (c >> 1)*width + (c & 1)][0] = rp[jcol+c];
@@ -1071,6 +1178,7 @@ void CLASS canon_sraw_load_raw()
     FORC3 rp[c] = CLIP(pix[c] * sraw_mul[c] >> 10);
   }
   ljpeg_end (&jh);
+  if (bits.errorCount()) derror();
   maximum = 0x3fff;
 }
 
@@ -1183,12 +1291,83 @@ void CLASS lossless_dnglj92_load_raw()
     }
 }
 
+/*RT*/ // Decodes the lossless JPEG tiles in parallel: all the headers are read first, then each tile
+/*RT*/ // is decoded from memory with its own bit reader. Returns false, without having decoded
+/*RT*/ // anything, if there is a tile lossless_dng_load_raw() has to handle.
+bool CLASS lossless_dng_load_tiles()
+{
+  struct tile {
+    struct jhead jh;
+    unsigned trow, tcol, jwide;
+    int pos;
+  };
+  std::vector<tile> tiles;
+  const int start = ftell(ifp);
+  unsigned trow=0, tcol=0;
+  bool lossless = true;
+
+  while (trow < raw_height) {
+    const int save = ftell(ifp);
+    if (tile_length < INT_MAX)
+      fseek (ifp, get4(), SEEK_SET);
+    tile t;
+    if (!ljpeg_start (&t.jh, 0)) break;
+    t.trow = trow;
+    t.tcol = tcol;
+    t.pos = ftell(ifp);
+    t.jwide = t.jh.wide;
+    if (filters || (colors == 1 && t.jh.clrs > 1)) t.jwide *= t.jh.clrs;
+    t.jwide /= MIN (is_raw, tiff_samples);
+    tiles.push_back(t);
+    if (t.jh.algo != 0xc3) {
+      lossless = false;
+      break;
+    }
+    fseek (ifp, save+4, SEEK_SET);
+    if ((tcol += tile_width) >= raw_width)
+      trow += tile_length + (tcol = 0);
+  }
+
+  if (!lossless) {
+    for (auto &t : tiles) ljpeg_end (&t.jh);
+    fseek (ifp, start, SEEK_SET);
+    return false;
+  }
+
+  const uchar *data = fdata(0, ifp);
+  unsigned errors = 0;
+
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic) reduction(+:errors)
+#endif
+  for (size_t i = 0; i < tiles.size(); ++i) {
+    tile &t = tiles[i];
+    ljpegbits_t bits(data + t.pos, data + ifp->size);
+    unsigned row = 0, col = 0;
+    for (int jrow = 0; jrow < t.jh.high; jrow++) {
+      ushort *rp = ljpeg_row (jrow, &t.jh, bits);
+      for (unsigned jcol = 0; jcol < t.jwide; jcol++) {
+	adobe_copy_pixel (t.trow+row, t.tcol+col, &rp);
+	if (++col >= tile_width || col >= raw_width)
+	  row += 1 + (col = 0);
+      }
+    }
+    errors += bits.errorCount();
+  }
+
+  for (auto &t : tiles) ljpeg_end (&t.jh);
+  if (errors) derror();
+  return true;
+}
+
 void CLASS lossless_dng_load_raw()
 {
   unsigned save, trow=0, tcol=0, jwide, jrow, jcol, row, col, i, j;
   struct jhead jh;
   ushort *rp;
 
+  if (lossless_dng_load_tiles()) return;
+
   while (trow < raw_height) {
     save = ftell(ifp);
     if (tile_length < INT_MAX)
@@ -22,6 +22,7 @@
 
 #include "myfile.h"
 #include <csetjmp>
+#include <cstdint>
 
 
 class DCraw
@@ -285,6 +286,29 @@ private:
 };
 nikbithuff_t nikbithuff;
 
+// Bit reader over the entropy coded data of a lossless JPEG held in memory. Unlike getbithuff it
+// has no shared state, so the tiles of a DNG file can be decoded in parallel, and it refills its
+// 64 bit buffer several bytes at a time.
+class ljpegbits_t
+{
+public:
+   ljpegbits_t(const uchar *data, const uchar *end):pos(data),end(end),bitbuf(0),vbits(0),padding(0),errors(0){}
+   void restart();
+   unsigned getbits(int nbits);
+   unsigned gethuff(const ushort *huff);
+   int diff(const ushort *huff, bool dng16);
+   void error() { ++errors; }
+   unsigned errorCount() const { return errors; }
+private:
+   void fill();
+   void consume(int nbits);
+   const uchar *pos, *end;
+   uint64_t bitbuf;
+   int vbits, padding;
+   unsigned errors;
+};
+
+
 ushort * make_decoder_ref (const uchar **source);
 ushort * make_decoder (const uchar *source);
 void crw_init_tables (unsigned table, ushort *huff[2]);
@@ -294,6 +318,7 @@ int ljpeg_start (struct jhead *jh, int info_only);
 void ljpeg_end (struct jhead *jh);
 int ljpeg_diff (ushort *huff);
 ushort * ljpeg_row (int jrow, struct jhead *jh);
+ushort * ljpeg_row (int jrow, struct jhead *jh, ljpegbits_t &bits);
 void lossless_jpeg_load_raw();
 void ljpeg_idct (struct jhead *jh);
 
@@ -301,6 +326,7 @@ void ljpeg_idct (struct jhead *jh);
 void canon_sraw_load_raw();
 void adobe_copy_pixel (unsigned row, unsigned col, ushort **rp);
 void lossless_dng_load_raw();
+bool lossless_dng_load_tiles();
 void lossless_dnglj92_load_raw();
 void packed_dng_load_raw();
 void deflate_dng_load_raw();
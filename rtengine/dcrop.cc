@@ -23,6 +23,7 @@
 #include "procparams.h"
 #include "refreshmap.h"
 #include "rt_math.h"
+#include "stagesupport.h"
 
 namespace
 {
@@ -48,7 +49,7 @@ Crop::Crop(ImProcCoordinator* parent, EditDataProvider *editDataProvider, bool i
       cropx(0), cropy(0), cropw(-1), croph(-1),
       trafx(0), trafy(0), trafw(-1), trafh(-1),
       rqcropx(0), rqcropy(0), rqcropw(-1), rqcroph(-1),
-      borderRequested(32), upperBorder(0), leftBorder(0),
+      borderRequested(maxBorder), upperBorder(0), leftBorder(0),
       cropAllocated(false),
       cropImageListener(nullptr), parent(parent), isDetailWindow(isDetailWindow)
 {
@@ -146,6 +147,9 @@ void Crop::update(int todo)
         cropImageListener->getWindow(wx, wy, ww, wh, ws);
     }
 
+    // the border only has to cover the spatial support of the enabled stages
+    borderRequested = getCropBorder(params, overrideWindow ? ws : skip, maxBorder);
+
     // re-allocate sub-images and arrays if their dimensions changed
     bool needsinitupdate = false;
 
@@ -688,88 +692,127 @@ void Crop::update(int todo)
 
     }
 
+    if (parent->ipf.isCancelled()) {
+        // the parameters changed during the denoise, the next update redoes it
+        return;
+    }
+
     // has to be called after setCropSizes! Tools prior to this point can't handle the Edit mechanism, but that shouldn't be a problem.
     createBuffer(cropw, croph);
 
-    std::unique_ptr<Imagefloat> fattalCrop;
-
     if ((todo & M_HDR) && (params.fattal.enabled || params.dehaze.enabled)) {
-        Imagefloat *f = origCrop;
-        int fw = skips(parent->fw, skip);
-        int fh = skips(parent->fh, skip);
-        bool need_cropping = false;
-        bool need_fattal = true;
-
-        if (trafx || trafy || trafw != fw || trafh != fh) {
-            need_cropping = true;
-
-            // fattal needs to work on the full image. So here we get the full
-            // image from imgsrc, and replace the denoised crop in case
-            if (!params.dirpyrDenoise.enabled && skip == 1 && parent->fattal_11_dcrop_cache) {
-                f = parent->fattal_11_dcrop_cache;
-                need_fattal = false;
+        const int fw = skips(parent->fw, skip);
+        const int fh = skips(parent->fh, skip);
+        const bool isFullImage = !trafx && !trafy && trafw == fw && trafh == fh;
+        // the ambient light of dehaze is global, it is taken from the preview
+        ImProcFunctions::DehazeStats *dehazeStats = parent->dehazeStats.valid ? &parent->dehazeStats : nullptr;
+        const int oy = trafy / skip;
+        const int ox = trafx / skip;
+
+        if (isFullImage) {
+            parent->ipf.dehaze(origCrop, dehazeStats);
+            parent->ipf.ToneMapFattal02(origCrop);
+        } else if (params.dehaze.enabled) {
+            // the patches of dehaze are laid out from the origin of the image, and its guided filter reads
+            // farther than the border of the crop, so dehaze runs on the whole image at the scale of the crop
+            std::unique_ptr<Imagefloat> dehazed;
+            const Imagefloat *full = nullptr;
+
+            if (!params.dirpyrDenoise.enabled && parent->dehaze_dcrop_cache && parent->dehaze_dcrop_cache_skip == skip) {
+                full = parent->dehaze_dcrop_cache;
             } else {
-                f = new Imagefloat(fw, fh);
-                fattalCrop.reset(f);
+                dehazed.reset(new Imagefloat(fw, fh));
                 PreviewProps pp(0, 0, parent->fw, parent->fh, skip);
                 int tr = getCoarseBitMask(params.coarse);
-                parent->imgsrc->getImage(parent->currWB, tr, f, pp, params.toneCurve, params.raw);
-                parent->imgsrc->convertColorSpace(f, params.icm, parent->currWB);
+                parent->imgsrc->getImage(parent->currWB, tr, dehazed.get(), pp, params.toneCurve, params.raw);
+                parent->imgsrc->convertColorSpace(dehazed.get(), params.icm, parent->currWB);
 
                 if (params.dirpyrDenoise.enabled) {
                     // copy the denoised crop
-                    int oy = trafy / skip;
-                    int ox = trafx / skip;
 #ifdef _OPENMP
                     #pragma omp parallel for
 #endif
 
-                    for (int y = 0; y < baseCrop->getHeight(); ++y) {
-                        int dy = oy + y;
-
-                        for (int x = 0; x < baseCrop->getWidth(); ++x) {
-                            int dx = ox + x;
-                            f->r(dy, dx) = baseCrop->r(y, x);
-                            f->g(dy, dx) = baseCrop->g(y, x);
-                            f->b(dy, dx) = baseCrop->b(y, x);
+                    for (int y = 0; y < trafh; ++y) {
+                        for (int x = 0; x < trafw; ++x) {
+                            dehazed->r(y + oy, x + ox) = origCrop->r(y, x);
+                            dehazed->g(y + oy, x + ox) = origCrop->g(y, x);
+                            dehazed->b(y + oy, x + ox) = origCrop->b(y, x);
                         }
                     }
-                } else if (skip == 1) {
-                    parent->fattal_11_dcrop_cache = f; // cache this globally
-                    fattalCrop.release();
+                }
+
+                parent->ipf.dehaze(dehazed.get(), dehazeStats);
+
+                if (parent->ipf.isCancelled()) {
+                    return;
+                }
+
+                full = dehazed.get();
+
+                if (!params.dirpyrDenoise.enabled) {
+                    // without denoise, the dehazed image is the same for all the crops of this scale
+                    delete parent->dehaze_dcrop_cache;
+                    parent->dehaze_dcrop_cache = dehazed.release();
+                    parent->dehaze_dcrop_cache_skip = skip;
                 }
             }
-        }
 
-        if (need_fattal) {
-            parent->ipf.dehaze(f);
-            parent->ipf.ToneMapFattal02(f);
+#ifdef _OPENMP
+            #pragma omp parallel for
+#endif
+
+            for (int y = 0; y < trafh; ++y) {
+                for (int x = 0; x < trafw; ++x) {
+                    origCrop->r(y, x) = full->r(y + oy, x + ox);
+                    origCrop->g(y, x) = full->g(y + oy, x + ox);
+                    origCrop->b(y, x) = full->b(y + oy, x + ox);
+                }
+            }
         }
 
-        // crop back to the size expected by the rest of the pipeline
-        if (need_cropping) {
-            Imagefloat *c = origCrop;
+        if (!isFullImage && params.fattal.enabled) {
+            // fattal needs to work on the full image. Its gain is computed once per scale on the full image
+            // from imgsrc, then the crops only apply it
+            if (!parent->fattal_dcrop_gain || parent->fattal_dcrop_gain_skip != skip) {
+                delete parent->fattal_dcrop_gain;
+                parent->fattal_dcrop_gain = nullptr;
+
+                Imagefloat f(fw, fh);
+                PreviewProps pp(0, 0, parent->fw, parent->fh, skip);
+                int tr = getCoarseBitMask(params.coarse);
+                parent->imgsrc->getImage(parent->currWB, tr, &f, pp, params.toneCurve, params.raw);
+                parent->imgsrc->convertColorSpace(&f, params.icm, parent->currWB);
+                parent->ipf.dehaze(&f, dehazeStats);
+
+                std::unique_ptr<array2D<float>> gain(new array2D<float>);
+
+                if (!parent->ipf.ToneMapFattal02Gain(&f, *gain)) {
+                    // cancelled, the next update recomputes the gain
+                    return;
+                }
 
-            int oy = trafy / skip;
-            int ox = trafx / skip;
+                parent->fattal_dcrop_gain = gain.release();
+                parent->fattal_dcrop_gain_skip = skip;
+            }
+
+            const array2D<float> &gain = *parent->fattal_dcrop_gain;
 #ifdef _OPENMP
             #pragma omp parallel for
 #endif
 
             for (int y = 0; y < trafh; ++y) {
-                int cy = y + oy;
-
                 for (int x = 0; x < trafw; ++x) {
-                    int cx = x + ox;
-                    c->r(y, x) = f->r(cy, cx);
-                    c->g(y, x) = f->g(cy, cx);
-                    c->b(y, x) = f->b(cy, cx);
+                    const float l = gain[y + oy][x + ox];
+                    origCrop->r(y, x) *= l;
+                    origCrop->g(y, x) *= l;
+                    origCrop->b(y, x) *= l;
                 }
             }
+        }
 
-            baseCrop = c;
-        } else {
-            baseCrop = f;
+        if (parent->ipf.isCancelled()) {
+            return;
         }
     }
 
@@ -987,6 +1030,10 @@ void Crop::update(int todo)
             params.wavelet.getCurves(wavCLVCurve, waOpacityCurveRG, waOpacityCurveBY, waOpacityCurveW, waOpacityCurveWL);
 
             parent->ipf.ip_wavelet(labnCrop, labnCrop, kall, WaveParams, wavCLVCurve, waOpacityCurveRG, waOpacityCurveBY, waOpacityCurveW, waOpacityCurveWL, parent->wavclCurve, skip);
+
+            if (parent->ipf.isCancelled()) {
+                return;
+            }
         }
 
         parent->ipf.softLight(labnCrop);        
@@ -1338,6 +1385,9 @@ void Crop::fullUpdate()
         parent->thread->join();
     }
 
+    // the updater thread is stopped and can't be started before the end of this update, nothing cancels it
+    parent->cancellation.reset();
+
     if (parent->plistener) {
         parent->plistener->setProgressState(true);
     }
@@ -56,7 +56,8 @@ protected:
     int cropx, cropy, cropw, croph;         /// size of the detail crop image ('skip' taken into account), with border
     int trafx, trafy, trafw, trafh;         /// the size and position to get from the imagesource that is transformed to the requested crop area
     int rqcropx, rqcropy, rqcropw, rqcroph; /// size of the requested detail crop image (the image might be smaller) (without border)
-    const int borderRequested;              /// requested extra border size for image processing
+    static constexpr int maxBorder = 32;    /// largest extra border size for image processing
+    int borderRequested;                    /// requested extra border size for image processing, depends on the enabled stages
     int upperBorder, leftBorder;            /// extra border size really allocated for image processing
 
     bool cropAllocated;
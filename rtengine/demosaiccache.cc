@@ -0,0 +1,456 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <glib/gstdio.h>
+#include <glibmm/checksum.h>
+#include <glibmm/fileutils.h>
+#include <glibmm/miscutils.h>
+#include <zlib.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "demosaiccache.h"
+
+#include "procparams.h"
+#include "settings.h"
+#include "utils.h"
+
+namespace rtengine
+{
+
+extern const Settings* settings;
+
+}
+
+namespace
+{
+
+constexpr char cacheMagic[8] = {'R', 'T', 'D', 'E', 'M', 'O', 'S', 'C'};
+constexpr std::uint32_t cacheVersion = 1;
+constexpr int stripHeight = 64;
+constexpr int batchSize = 32; // chunks (de)compressed in parallel
+constexpr gint64 staleTmpAge = 24 * 60 * 60; // seconds without a write after which a temporary file is a leftover
+
+struct Header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t width;
+    std::uint32_t height;
+    std::uint32_t stripHeight;
+    double contrastThreshold;
+};
+
+static_assert(sizeof(Header) == 32, "Unexpected padding in the demosaic cache header");
+
+// The bytes of the floats are grouped by significance before compression: the exponents and high
+// mantissa bytes of neighbouring pixels are much alike, which zlib compresses far better than raw floats
+void compressChunk(const array2D<float>& plane, int firstRow, std::vector<Bytef>& dst)
+{
+    const int width = plane.width();
+    const int lastRow = std::min(firstRow + stripHeight, plane.height());
+    const std::size_t count = static_cast<std::size_t>(lastRow - firstRow) * width;
+
+    std::vector<Bytef> src(count * sizeof(float));
+    std::size_t pos = 0;
+
+    for (int row = firstRow; row < lastRow; ++row) {
+        for (int col = 0; col < width; ++col, ++pos) {
+            Bytef bytes[sizeof(float)];
+            std::memcpy(bytes, &plane[row][col], sizeof(float));
+
+            for (std::size_t b = 0; b < sizeof(float); ++b) {
+                src[b * count + pos] = bytes[b];
+            }
+        }
+    }
+
+    uLongf dstSize = compressBound(src.size());
+    dst.resize(dstSize);
+
+    if (compress2(dst.data(), &dstSize, src.data(), src.size(), Z_BEST_SPEED) != Z_OK) {
+        dst.clear();
+    } else {
+        dst.resize(dstSize);
+    }
+}
+
+bool decompressChunk(const std::vector<Bytef>& src, int firstRow, array2D<float>& plane)
+{
+    const int width = plane.width();
+    const int lastRow = std::min(firstRow + stripHeight, plane.height());
+    const std::size_t count = static_cast<std::size_t>(lastRow - firstRow) * width;
+
+    std::vector<Bytef> dst(count * sizeof(float));
+    uLongf dstSize = dst.size();
+
+    if (uncompress(dst.data(), &dstSize, src.data(), src.size()) != Z_OK || dstSize != dst.size()) {
+        return false;
+    }
+
+    std::size_t pos = 0;
+
+    for (int row = firstRow; row < lastRow; ++row) {
+        for (int col = 0; col < width; ++col, ++pos) {
+            Bytef bytes[sizeof(float)];
+
+            for (std::size_t b = 0; b < sizeof(float); ++b) {
+                bytes[b] = dst[b * count + pos];
+            }
+
+            std::memcpy(&plane[row][col], bytes, sizeof(float));
+        }
+    }
+
+    return true;
+}
+
+std::string md5(const std::string& data)
+{
+    return Glib::Checksum::compute_checksum(Glib::Checksum::CHECKSUM_MD5, data);
+}
+
+}
+
+namespace rtengine
+{
+
+DemosaicCache* DemosaicCache::getInstance()
+{
+    static DemosaicCache instance;
+    return &instance;
+}
+
+DemosaicCache::DemosaicCache() :
+    maxSize(0)
+{
+}
+
+void DemosaicCache::init(const Glib::ustring& dirName, int maxSize)
+{
+    MyMutex::MyLock lock(mutex);
+
+    this->dirName = dirName;
+    this->maxSize = 0;
+
+    if (dirName.empty() || maxSize <= 0) {
+        return;
+    }
+
+    if (g_mkdir_with_parents(dirName.c_str(), 0755) != 0) {
+        if (settings->verbose) {
+            printf("Demosaic cache disabled, can't create %s\n", dirName.c_str());
+        }
+
+        return;
+    }
+
+    this->maxSize = static_cast<std::int64_t>(maxSize) << 20;
+
+    // Remove the leftovers of writes interrupted by a crash. Another instance may be writing into the
+    // cache right now, so only the temporary files which haven't been written to for a while are stale.
+    const gint64 staleTime = g_get_real_time() / G_USEC_PER_SEC - staleTmpAge;
+
+    try {
+        Glib::Dir dir(dirName);
+
+        for (Glib::DirIterator entry = dir.begin(); entry != dir.end(); ++entry) {
+            const Glib::ustring fileName = *entry;
+
+            if (getFileExtension(fileName) != "tmp") {
+                continue;
+            }
+
+            const Glib::ustring filePath = Glib::build_filename(dirName, fileName);
+            GStatBuf st;
+
+            if (g_stat(filePath.c_str(), &st) == 0 && static_cast<gint64>(st.st_mtime) < staleTime) {
+                g_remove(filePath.c_str());
+            }
+        }
+    } catch (Glib::Exception&) {}
+}
+
+bool DemosaicCache::isEnabled() const
+{
+    return maxSize > 0;
+}
+
+std::string DemosaicCache::getPreprocessKey(
+    const Glib::ustring& fname,
+    unsigned int frame,
+    const procparams::RAWParams& raw,
+    const procparams::LensProfParams& lensProf,
+    const procparams::CoarseTransformParams& coarse,
+    const Glib::ustring& darkFrame,
+    const Glib::ustring& flatField
+)
+{
+    GStatBuf st;
+
+    if (g_stat(fname.c_str(), &st) != 0) {
+        return std::string();
+    }
+
+    // Only the parameters used up to the demosaicing are set, the others keep their default values
+    procparams::ProcParams params;
+    params.raw = raw;
+    params.lensProf = lensProf;
+    params.coarse = coarse;
+
+    const Glib::ustring data = Glib::ustring::compose("%1\n%2\n%3\n%4\n%5\n%6\n", fname, static_cast<gint64>(st.st_size), static_cast<gint64>(st.st_mtime), frame, darkFrame, flatField) + params.toData();
+
+    return md5(data.raw());
+}
+
+std::string DemosaicCache::getDemosaicKey(const std::string& preprocessKey, int border, bool autoContrast)
+{
+    if (preprocessKey.empty()) {
+        return std::string();
+    }
+
+    return md5(preprocessKey + '/' + std::to_string(border) + '/' + (autoContrast ? '1' : '0'));
+}
+
+Glib::ustring DemosaicCache::getFileName(const std::string& key) const
+{
+    return Glib::build_filename(dirName, key + ".rtdc");
+}
+
+bool DemosaicCache::load(const std::string& key, int width, int height, array2D<float>& red, array2D<float>& green, array2D<float>& blue, double& contrastThreshold)
+{
+    if (!isEnabled() || key.empty()) {
+        return false;
+    }
+
+    const Glib::ustring fname = getFileName(key);
+    FILE* const f = g_fopen(fname.c_str(), "rb");
+
+    if (!f) {
+        return false;
+    }
+
+    Header header;
+    const int strips = (height + stripHeight - 1) / stripHeight;
+    const int chunkCount = 3 * strips;
+    std::vector<std::uint32_t> sizes(chunkCount);
+
+    bool ok =
+        fread(&header, sizeof(header), 1, f) == 1
+        && std::memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) == 0
+        && header.version == cacheVersion
+        && header.width == static_cast<std::uint32_t>(width)
+        && header.height == static_cast<std::uint32_t>(height)
+        && header.stripHeight == static_cast<std::uint32_t>(stripHeight)
+        && fread(sizes.data(), sizeof(std::uint32_t), chunkCount, f) == static_cast<std::size_t>(chunkCount);
+
+    if (ok) {
+        array2D<float>* const planes[3] = {&red, &green, &blue};
+
+        for (auto plane : planes) {
+            if (plane->width() != width || plane->height() != height) {
+                (*plane)(width, height);
+            }
+        }
+
+        std::vector<std::vector<Bytef>> buffers(batchSize);
+
+        for (int first = 0; ok && first < chunkCount; first += batchSize) {
+            const int last = std::min(first + batchSize, chunkCount);
+
+            for (int chunk = first; ok && chunk < last; ++chunk) {
+                std::vector<Bytef>& buffer = buffers[chunk - first];
+                buffer.resize(sizes[chunk]);
+                ok = fread(buffer.data(), 1, buffer.size(), f) == buffer.size();
+            }
+
+            if (!ok) {
+                break;
+            }
+
+            bool decompressed = true;
+
+#ifdef _OPENMP
+            #pragma omp parallel for schedule(dynamic) reduction(&&:decompressed)
+#endif
+
+            for (int chunk = first; chunk < last; ++chunk) {
+                decompressed = decompressChunk(buffers[chunk - first], (chunk % strips) * stripHeight, *planes[chunk / strips]) && decompressed;
+            }
+
+            ok = decompressed;
+        }
+    }
+
+    fclose(f);
+
+    if (!ok) {
+        // Stale format or damaged entry, it will be rewritten after demosaicing
+        g_remove(fname.c_str());
+        return false;
+    }
+
+    contrastThreshold = header.contrastThreshold;
+
+    // The modification time tells the eviction which entries were used recently
+    g_utime(fname.c_str(), nullptr);
+
+    return true;
+}
+
+void DemosaicCache::store(const std::string& key, const array2D<float>& red, const array2D<float>& green, const array2D<float>& blue, double contrastThreshold)
+{
+    if (!isEnabled() || key.empty()) {
+        return;
+    }
+
+    const int width = red.width();
+    const int height = red.height();
+
+    if (
+        width <= 0
+        || height <= 0
+        || green.width() != width
+        || green.height() != height
+        || blue.width() != width
+        || blue.height() != height
+    ) {
+        return;
+    }
+
+    const Glib::ustring fname = getFileName(key);
+    const Glib::ustring tmpName = Glib::ustring::compose("%1.%2.tmp", fname, g_random_int());
+    FILE* const f = g_fopen(tmpName.c_str(), "wb");
+
+    if (!f) {
+        return;
+    }
+
+    Header header;
+    std::memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+    header.version = cacheVersion;
+    header.width = width;
+    header.height = height;
+    header.stripHeight = stripHeight;
+    header.contrastThreshold = contrastThreshold;
+
+    const int strips = (height + stripHeight - 1) / stripHeight;
+    const int chunkCount = 3 * strips;
+    std::vector<std::uint32_t> sizes(chunkCount);
+
+    // The chunk sizes are only known after compression, the table is written again at the end
+    bool ok =
+        fwrite(&header, sizeof(header), 1, f) == 1
+        && fwrite(sizes.data(), sizeof(std::uint32_t), chunkCount, f) == static_cast<std::size_t>(chunkCount);
+
+    const array2D<float>* const planes[3] = {&red, &green, &blue};
+    std::vector<std::vector<Bytef>> buffers(batchSize);
+
+    for (int first = 0; ok && first < chunkCount; first += batchSize) {
+        const int last = std::min(first + batchSize, chunkCount);
+
+#ifdef _OPENMP
+        #pragma omp parallel for schedule(dynamic)
+#endif
+
+        for (int chunk = first; chunk < last; ++chunk) {
+            compressChunk(*planes[chunk / strips], (chunk % strips) * stripHeight, buffers[chunk - first]);
+        }
+
+        for (int chunk = first; ok && chunk < last; ++chunk) {
+            const std::vector<Bytef>& buffer = buffers[chunk - first];
+            sizes[chunk] = buffer.size();
+            ok = !buffer.empty() && fwrite(buffer.data(), 1, buffer.size(), f) == buffer.size();
+        }
+    }
+
+    ok = ok
+        && fseek(f, sizeof(header), SEEK_SET) == 0
+        && fwrite(sizes.data(), sizeof(std::uint32_t), chunkCount, f) == static_cast<std::size_t>(chunkCount);
+
+    if (fclose(f) || !ok) {
+        g_remove(tmpName.c_str());
+        return;
+    }
+
+    if (g_rename(tmpName.c_str(), fname.c_str())) {
+        g_remove(tmpName.c_str());
+        return;
+    }
+
+    limitSize();
+}
+
+void DemosaicCache::limitSize()
+{
+    MyMutex::MyLock lock(mutex);
+
+    struct Entry {
+        Glib::ustring fileName;
+        gint64 time;
+        gint64 size;
+    };
+
+    std::vector<Entry> entries;
+    gint64 totalSize = 0;
+
+    try {
+        Glib::Dir dir(dirName);
+
+        for (Glib::DirIterator entry = dir.begin(); entry != dir.end(); ++entry) {
+            const Glib::ustring fileName = *entry;
+
+            if (getFileExtension(fileName) != "rtdc") {
+                continue;
+            }
+
+            const Glib::ustring filePath = Glib::build_filename(dirName, fileName);
+            GStatBuf st;
+
+            if (g_stat(filePath.c_str(), &st) == 0) {
+                entries.push_back({filePath, static_cast<gint64>(st.st_mtime), static_cast<gint64>(st.st_size)});
+                totalSize += st.st_size;
+            }
+        }
+    } catch (Glib::Exception&) {
+        return;
+    }
+
+    if (totalSize <= maxSize) {
+        return;
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.time < b.time; });
+
+    for (const auto& entry : entries) {
+        if (totalSize <= maxSize) {
+            break;
+        }
+
+        if (g_remove(entry.fileName.c_str()) == 0) {
+            totalSize -= entry.size;
+        }
+    }
+}
+
+}
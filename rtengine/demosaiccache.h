@@ -0,0 +1,91 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <glibmm/ustring.h>
+
+#include "array2D.h"
+#include "noncopyable.h"
+
+#include "../rtgui/threadutils.h"
+
+namespace rtengine
+{
+
+namespace procparams
+{
+
+struct RAWParams;
+struct LensProfParams;
+struct CoarseTransformParams;
+
+}
+
+/**
+ * @brief On-disk cache of the demosaiced red, green and blue planes of raw images
+ *
+ * An entry is keyed by the identity of the raw file (name, size and modification time) and by the
+ * parameters used to preprocess and demosaic it, so reopening or re-exporting an image whose raw
+ * parameters didn't change skips the demosaicing. Each plane is stored in strips of byte shuffled
+ * floats compressed with zlib. The least recently used entries are evicted once the cache exceeds
+ * its size limit.
+ */
+class DemosaicCache :
+    public NonCopyable
+{
+public:
+    static DemosaicCache* getInstance();
+
+    /** @param maxSize in MiB, 0 disables the cache */
+    void init(const Glib::ustring& dirName, int maxSize);
+    bool isEnabled() const;
+
+    /** @return the key of the preprocessed raw data, empty if the raw file can't be identified */
+    static std::string getPreprocessKey(
+        const Glib::ustring& fname,
+        unsigned int frame,
+        const procparams::RAWParams& raw,
+        const procparams::LensProfParams& lensProf,
+        const procparams::CoarseTransformParams& coarse,
+        const Glib::ustring& darkFrame,
+        const Glib::ustring& flatField
+    );
+    /** The demosaicing parameters are part of RAWParams, thus already of the preprocessing key.
+      * @return the key of the demosaiced planes, empty if preprocessKey is empty */
+    static std::string getDemosaicKey(const std::string& preprocessKey, int border, bool autoContrast);
+
+    /** Reads the planes of the entry, which are (re)allocated to width x height.
+      * @return false if there is no valid entry of that size */
+    bool load(const std::string& key, int width, int height, array2D<float>& red, array2D<float>& green, array2D<float>& blue, double& contrastThreshold);
+    void store(const std::string& key, const array2D<float>& red, const array2D<float>& green, const array2D<float>& blue, double contrastThreshold);
+
+private:
+    DemosaicCache();
+
+    Glib::ustring getFileName(const std::string& key) const;
+    void limitSize();
+
+    Glib::ustring dirName;
+    std::int64_t maxSize;   // bytes
+    MyMutex mutex;
+};
+
+}
@@ -0,0 +1,228 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+
+#include <glib/gstdio.h>
+#include <glibmm/fileutils.h>
+#include <glibmm/keyfile.h>
+#include <glibmm/miscutils.h>
+
+#include "denoisemodelstore.h"
+
+#include "filelock.h"
+#include "procparams.h"
+#include "rtengine.h"
+#include "settings.h"
+
+namespace rtengine
+{
+
+extern const Settings* settings;
+
+namespace
+{
+
+// the exposure value given by the f-number and the shutter speed, rounded to whole stops: the bucket is 1 EV wide,
+// so two exposures less than a stop apart may still fall in neighbouring buckets
+std::string getExposureBucket(const FramesMetaData* metaData)
+{
+    const double fNumber = metaData->getFNumber();
+    const double shutter = metaData->getShutterSpeed();
+
+    if (fNumber <= 0.0 || shutter <= 0.0) {
+        return "?";
+    }
+
+    return std::to_string(std::lround(std::log2(fNumber * fNumber / shutter)));
+}
+
+std::vector<float> toFloats(const std::vector<double>& values)
+{
+    return std::vector<float>(values.begin(), values.end());
+}
+
+std::vector<double> toDoubles(const std::vector<float>& values)
+{
+    return std::vector<double>(values.begin(), values.end());
+}
+
+// adds the models of the file to models, returns false if the file is invalid
+bool loadModels(const Glib::ustring& fileName, std::map<std::string, DenoiseModelStore::Model>& models)
+{
+    std::map<std::string, DenoiseModelStore::Model> loaded;
+
+    try {
+        Glib::KeyFile keyFile;
+        keyFile.load_from_file(fileName);
+
+        for (const auto& group : keyFile.get_groups()) {
+            DenoiseModelStore::Model model;
+            model.chroma = keyFile.get_double(group, "Chroma");
+            model.redchro = keyFile.get_double(group, "RedChroma");
+            model.bluechro = keyFile.get_double(group, "BlueChroma");
+
+            if (keyFile.has_key(group, "TileChroma")) {
+                model.chM = toFloats(keyFile.get_double_list(group, "TileChroma"));
+                model.maxR = toFloats(keyFile.get_double_list(group, "TileRedChroma"));
+                model.maxB = toFloats(keyFile.get_double_list(group, "TileBlueChroma"));
+            }
+
+            if (model.chM.size() == model.maxR.size() && model.chM.size() == model.maxB.size()) {
+                loaded[group] = model;
+            }
+        }
+    } catch (Glib::Error&) {
+        return false;
+    }
+
+    models.insert(loaded.begin(), loaded.end());
+    return true;
+}
+
+}
+
+DenoiseModelStore* DenoiseModelStore::getInstance()
+{
+    static DenoiseModelStore instance;
+    return &instance;
+}
+
+void DenoiseModelStore::init(const Glib::ustring& fileName)
+{
+    MyMutex::MyLock lock(mutex);
+
+    storeFile = fileName;
+    models.clear();
+
+    if (storeFile.empty() || !Glib::file_test(storeFile, Glib::FILE_TEST_EXISTS)) {
+        return;
+    }
+
+    if (!loadModels(storeFile, models) && settings->verbose) {
+        printf("Invalid denoise model file %s, ignored\n", storeFile.c_str());
+    }
+}
+
+std::string DenoiseModelStore::getKey(const FramesMetaData* metaData, int width, int height, bool isRaw, const procparams::ProcParams& params)
+{
+    const procparams::DirPyrDenoiseParams& dn = params.dirpyrDenoise;
+
+    std::ostringstream key;
+    key << metaData->getCamera() << ";ISO " << metaData->getISOSpeed() << ";EV " << getExposureBucket(metaData)
+        << ";" << width << "x" << height << ";" << (isRaw ? "raw" : "rgb")
+        << ";" << dn.Cmethod << "," << dn.C2method << "," << dn.smethod << "," << dn.dmethod << "," << dn.gamma
+        << ";" << settings->leveldnv << "," << settings->leveldnti << "," << settings->leveldnaut << "," << settings->leveldnliss << "," << settings->leveldnautsimpl
+        << "," << settings->nrauto << "," << settings->nrautomax
+        << ";" << (params.wb.enabled ? params.wb.method : Glib::ustring("None")) << "," << params.wb.temperature << "," << params.wb.green << "," << params.wb.equal << "," << params.wb.tempBias
+        << ";" << params.icm.workingProfile << ";" << params.raw.bayersensor.method << "," << params.raw.xtranssensor.method;
+
+    // the key is a group name of the key file
+    std::string result = key.str();
+
+    for (auto& c : result) {
+        if (c == '[' || c == ']' || c == '\n' || c == '\r') {
+            c = '_';
+        }
+    }
+
+    return result;
+}
+
+bool DenoiseModelStore::get(const std::string& key, Model& model)
+{
+    MyMutex::MyLock lock(mutex);
+
+    const auto iter = models.find(key);
+
+    if (iter == models.end()) {
+        return false;
+    }
+
+    model = iter->second;
+    return true;
+}
+
+void DenoiseModelStore::put(const std::string& key, const Model& model)
+{
+    MyMutex::MyLock lock(mutex);
+
+    models[key] = model;
+    save();
+}
+
+void DenoiseModelStore::save()
+{
+    if (storeFile.empty()) {
+        return;
+    }
+
+    g_mkdir_with_parents(Glib::path_get_dirname(storeFile).c_str(), 0755);
+
+    // the lock serializes the instances from the reload to the write, so that none drops the models of another
+    FILE* const lockFile = g_fopen((storeFile + ".lock").c_str(), "ab");
+
+    if (!lockFile && settings->verbose) {
+        printf("Could not lock %s, saving it unlocked\n", storeFile.c_str());
+    }
+
+    bool saved = false;
+
+    {
+        const FileLock storeLock(lockFile);
+
+        // another instance may have added models since the store was loaded, they are kept
+        if (Glib::file_test(storeFile, Glib::FILE_TEST_EXISTS)) {
+            loadModels(storeFile, models);
+        }
+
+        Glib::KeyFile keyFile;
+
+        for (const auto& entry : models) {
+            const Model& model = entry.second;
+            keyFile.set_double(entry.first, "Chroma", model.chroma);
+            keyFile.set_double(entry.first, "RedChroma", model.redchro);
+            keyFile.set_double(entry.first, "BlueChroma", model.bluechro);
+
+            if (!model.chM.empty()) {
+                keyFile.set_double_list(entry.first, "TileChroma", toDoubles(model.chM));
+                keyFile.set_double_list(entry.first, "TileRedChroma", toDoubles(model.maxR));
+                keyFile.set_double_list(entry.first, "TileBlueChroma", toDoubles(model.maxB));
+            }
+        }
+
+        // file_set_contents() writes to a uniquely named temporary file which then replaces the store,
+        // so that the instances reading it never see a partial file
+        try {
+            Glib::file_set_contents(storeFile, keyFile.to_data());
+            saved = true;
+        } catch (Glib::Error&) {
+        }
+    }
+
+    if (lockFile) {
+        fclose(lockFile);
+    }
+
+    if (!saved && settings->verbose) {
+        printf("Could not save the denoise models to %s\n", storeFile.c_str());
+    }
+}
+
+}
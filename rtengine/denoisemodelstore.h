@@ -0,0 +1,88 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <glibmm/ustring.h>
+
+#include "noncopyable.h"
+
+#include "../rtgui/threadutils.h"
+
+namespace rtengine
+{
+
+class FramesMetaData;
+
+namespace procparams
+{
+
+class ProcParams;
+
+}
+
+/**
+ * @brief Store of the chroma noise models estimated by the automatic denoise of the batch processing
+ *
+ * The automatic modes of the chroma denoise analyse a few crops (AUT) or every tile (PON) of each image,
+ * which takes a large part of the processing of a high ISO image. The frames of a burst share their camera,
+ * ISO and exposure, hence their noise: the model estimated for the first frame of such a group is kept and
+ * reused for the next ones. The models are saved to a file, so that the next batches skip the analysis too.
+ */
+class DenoiseModelStore :
+    public NonCopyable
+{
+public:
+    struct Model {
+        // result of the AUT mode
+        double chroma;
+        double redchro;
+        double bluechro;
+        // result of the PON mode, one value per tile
+        std::vector<float> chM;
+        std::vector<float> maxR;
+        std::vector<float> maxB;
+    };
+
+    static DenoiseModelStore* getInstance();
+
+    /** Loads the models saved by a previous session, an empty fileName disables their persistence */
+    void init(const Glib::ustring& fileName);
+
+    /** @return the key of the group of the image: camera, ISO, exposure bucket, size and the parameters of the analysis */
+    static std::string getKey(const FramesMetaData* metaData, int width, int height, bool isRaw, const procparams::ProcParams& params);
+
+    /** @return true and fills model if a model has been stored for key */
+    bool get(const std::string& key, Model& model);
+    /** Stores the model of key and saves the store */
+    void put(const std::string& key, const Model& model);
+
+private:
+    DenoiseModelStore() = default;
+
+    void save(); // mutex must be locked, merges the models saved meanwhile by other instances
+
+    std::map<std::string, Model> models;
+    Glib::ustring storeFile;
+    MyMutex mutex;
+};
+
+}
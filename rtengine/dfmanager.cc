@@ -289,6 +289,8 @@ void DFManager::init( Glib::ustring pathname )
 
     } catch (Glib::Exception&) {}
 
+    MyMutex::MyLock lock(mutex);
+
     dfList.clear();
     bpList.clear();
 
@@ -413,6 +415,8 @@ dfInfo* DFManager::addFileInfo (const Glib::ustring& filename, bool pool)
 
 void DFManager::getStat( int &totFiles, int &totTemplates)
 {
+    MyMutex::MyLock lock(mutex);
+
     totFiles = 0;
     totTemplates = 0;
 
@@ -475,6 +479,8 @@ dfInfo* DFManager::find( const std::string &mak, const std::string &mod, int iso
 
 RawImage* DFManager::searchDarkFrame( const std::string &mak, const std::string &mod, int iso, double shut, time_t t )
 {
+    MyMutex::MyLock lock(mutex);
+
     dfInfo *df = find( ((Glib::ustring)mak).uppercase(), ((Glib::ustring)mod).uppercase(), iso, shut, t );
 
     if( df ) {
@@ -486,6 +492,8 @@ RawImage* DFManager::searchDarkFrame( const std::string &mak, const std::string
 
 RawImage* DFManager::searchDarkFrame( const Glib::ustring filename )
 {
+    MyMutex::MyLock lock(mutex);
+
     for ( dfList_t::iterator iter = dfList.begin(); iter != dfList.end(); ++iter ) {
         if( iter->second.pathname.compare( filename ) == 0  ) {
             return iter->second.getRawImage();
@@ -502,6 +510,8 @@ RawImage* DFManager::searchDarkFrame( const Glib::ustring filename )
 }
 std::vector<badPix> *DFManager::getHotPixels ( const Glib::ustring filename )
 {
+    MyMutex::MyLock lock(mutex);
+
     for ( dfList_t::iterator iter = dfList.begin(); iter != dfList.end(); ++iter ) {
         if( iter->second.pathname.compare( filename ) == 0  ) {
             return &iter->second.getHotPixels();
@@ -512,6 +522,8 @@ std::vector<badPix> *DFManager::getHotPixels ( const Glib::ustring filename )
 }
 std::vector<badPix> *DFManager::getHotPixels ( const std::string &mak, const std::string &mod, int iso, double shut, time_t t )
 {
+    MyMutex::MyLock lock(mutex);
+
     dfInfo *df = find( ((Glib::ustring)mak).uppercase(), ((Glib::ustring)mod).uppercase(), iso, shut, t );
 
     if( df ) {
@@ -585,6 +597,8 @@ int DFManager::scanBadPixelsFile( Glib::ustring filename )
 
 std::vector<badPix> *DFManager::getBadPixels ( const std::string &mak, const std::string &mod, const std::string &serial)
 {
+    MyMutex::MyLock lock(mutex);
+
     bpList_t::iterator iter;
     bool found = false;
 
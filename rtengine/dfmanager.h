@@ -21,6 +21,7 @@
 #include <map>
 #include <cmath>
 #include "rawimage.h"
+#include "../rtgui/threadutils.h"
 
 namespace rtengine
 {
@@ -96,6 +97,7 @@ protected:
     bpList_t bpList;
     bool initialized;
     Glib::ustring currentPath;
+    MyMutex mutex;
     dfInfo *addFileInfo(const Glib::ustring &filename, bool pool = true );
     dfInfo *find( const std::string &mak, const std::string &mod, int isospeed, double shut, time_t t );
     int scanBadPixelsFile( Glib::ustring filename );
@@ -251,6 +251,13 @@ void FFManager::init( Glib::ustring pathname )
 
     } catch (Glib::Exception&) {}
 
+    MyMutex::MyLock lock(mutex);
+    {
+        // the blurred maps are keyed by the raw images deleted below
+        MyMutex::MyLock blurLock(blurMutex);
+        blurredFlats.clear();
+    }
+
     ffList.clear();
 
     for (size_t i = 0; i < names.size(); i++) {
@@ -362,6 +369,8 @@ ffInfo* FFManager::addFileInfo (const Glib::ustring& filename, bool pool)
 
 void FFManager::getStat( int &totFiles, int &totTemplates)
 {
+    MyMutex::MyLock lock(mutex);
+
     totFiles = 0;
     totTemplates = 0;
 
@@ -424,6 +433,7 @@ ffInfo* FFManager::find( const std::string &mak, const std::string &mod, const s
 
 RawImage* FFManager::searchFlatField( const std::string &mak, const std::string &mod, const std::string &len, double focal, double apert, time_t t )
 {
+    MyMutex::MyLock lock(mutex);
     ffInfo *ff = find( mak, mod, len, focal, apert, t );
 
     if( ff ) {
@@ -435,6 +445,8 @@ RawImage* FFManager::searchFlatField( const std::string &mak, const std::string
 
 RawImage* FFManager::searchFlatField( const Glib::ustring filename )
 {
+    MyMutex::MyLock lock(mutex);
+
     for ( ffList_t::iterator iter = ffList.begin(); iter != ffList.end(); ++iter ) {
         if( iter->second.pathname.compare( filename ) == 0  ) {
             return iter->second.getRawImage();
@@ -450,6 +462,26 @@ RawImage* FFManager::searchFlatField( const Glib::ustring filename )
     return nullptr;
 }
 
+std::shared_ptr<const std::vector<float>> FFManager::getBlurredFlatField( const RawImage *ri, int boxH, int boxW, const std::function<void(float*)> &blur )
+{
+    MyMutex::MyLock lock(blurMutex);
+
+    const auto key = std::make_tuple(ri, boxH, boxW);
+    std::shared_ptr<const std::vector<float>> cached;
+
+    if( blurredFlats.get(key, cached) ) {
+        return cached;
+    }
+
+    // computed with the lock held, so that concurrent images wait for the map instead of computing it again.
+    // Images still using a map displaced from the cache hold a reference to it.
+    std::shared_ptr<std::vector<float>> blurred = std::make_shared<std::vector<float>>(static_cast<std::size_t>(ri->get_width()) * ri->get_height());
+    blur(blurred->data());
+    blurredFlats.insert(key, blurred);
+
+    return blurred;
+}
+
 
 // Global variable
 FFManager ffm;
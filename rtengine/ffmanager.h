@@ -20,7 +20,13 @@
 #include <glibmm/ustring.h>
 #include <map>
 #include <cmath>
+#include <functional>
+#include <memory>
+#include <tuple>
+#include <vector>
+#include "cache.h"
 #include "rawimage.h"
+#include "../rtgui/threadutils.h"
 
 namespace rtengine
 {
@@ -84,12 +90,21 @@ public:
     RawImage *searchFlatField( const std::string &mak, const std::string &mod, const std::string &len, double focallength, double apert, time_t t );
     RawImage *searchFlatField( const Glib::ustring filename );
 
+    /** Returns the flat field ri blurred by the box blur of size boxH x boxW. The blurred map is computed by blur()
+      * on first use and then shared by all the images corrected with that flat field and blur. The last few maps are kept.
+      * @param blur fills a width x height buffer with the blurred flat field */
+    std::shared_ptr<const std::vector<float>> getBlurredFlatField( const RawImage *ri, int boxH, int boxW, const std::function<void(float*)> &blur );
+
 protected:
     typedef std::multimap<std::string, ffInfo> ffList_t;
     typedef std::map<std::string, std::list<badPix> > bpList_t;
     ffList_t ffList;
     bool initialized;
     Glib::ustring currentPath;
+    // a batch may alternate between a few flat fields or blur sizes, each map is as large as the flat field
+    Cache<std::tuple<const RawImage*, int, int>, std::shared_ptr<const std::vector<float>>> blurredFlats{4};
+    MyMutex mutex;
+    MyMutex blurMutex;
     ffInfo *addFileInfo(const Glib::ustring &filename, bool pool = true );
     ffInfo *find( const std::string &mak, const std::string &mod, const std::string &len, double focal, double apert, time_t t );
 };
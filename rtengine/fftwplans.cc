@@ -0,0 +1,224 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+#include <glib/gstdio.h>
+#include <glibmm/fileutils.h>
+#include <glibmm/miscutils.h>
+
+#include "fftwplans.h"
+
+#include "settings.h"
+
+namespace rtengine
+{
+
+extern const Settings* settings;
+
+namespace
+{
+
+// upper bound of the alignment fftw may require, the planning buffers are offset by up to this many bytes
+constexpr int maxAlignment = 64;
+
+// the image sized plans differ for each image size, the oldest ones are dropped beyond that count
+constexpr std::size_t maxPlans = 16;
+
+}
+
+FFTWPlans* FFTWPlans::getInstance()
+{
+    static FFTWPlans instance;
+    return &instance;
+}
+
+FFTWPlans::FFTWPlans() :
+    useCount(0),
+    threadsInitialized(false)
+{
+}
+
+void FFTWPlans::init(const Glib::ustring& fileName)
+{
+    MyMutex::MyLock lock(mutex);
+
+    wisdomFile = fileName;
+
+    if (wisdomFile.empty() || !Glib::file_test(wisdomFile, Glib::FILE_TEST_EXISTS)) {
+        return;
+    }
+
+    if (!fftwf_import_wisdom_from_filename(wisdomFile.c_str())) {
+        if (settings->verbose) {
+            printf("Invalid FFTW wisdom file %s, ignored\n", wisdomFile.c_str());
+        }
+
+        fftwf_forget_wisdom();
+    }
+}
+
+void FFTWPlans::cleanup()
+{
+    // destroying a plan takes the lock, so the plans are released after it
+    std::map<Key, Entry> dropped;
+    MyMutex::MyLock lock(mutex);
+
+    dropped.swap(plans);
+}
+
+FFTWPlans::Plan FFTWPlans::getBlockDCT(int tileSize, int count, bool forward)
+{
+    // declared before the lock, so that the dropped plans are destroyed once it is released
+    std::vector<Plan> dropped;
+    MyMutex::MyLock lock(mutex);
+
+    const Key key(forward ? Kind::BLOCK_FORWARD : Kind::BLOCK_BACKWARD, tileSize, count, 1, 0, 0);
+    Plan cached = find(key);
+
+    if (cached) {
+        return cached;
+    }
+
+    float* const in = reinterpret_cast<float*>(fftwf_malloc(count * tileSize * tileSize * sizeof(float)));
+    float* const out = reinterpret_cast<float*>(fftwf_malloc(count * tileSize * tileSize * sizeof(float)));
+
+    int n[2] = {tileSize, tileSize};
+    const fftw_r2r_kind fwdkind[2] = {FFTW_REDFT10, FFTW_REDFT10};
+    const fftw_r2r_kind bwdkind[2] = {FFTW_REDFT01, FFTW_REDFT01};
+
+    // Measuring is slow, but the plan is kept and the measurements are saved in the wisdom file
+    const fftwf_plan plan = fftwf_plan_many_r2r(2, n, count, in, nullptr, 1, tileSize * tileSize, out, nullptr, 1, tileSize * tileSize, forward ? fwdkind : bwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
+
+    fftwf_free(in);
+    fftwf_free(out);
+
+    saveWisdom();
+
+    return store(key, plan, dropped);
+}
+
+FFTWPlans::Plan FFTWPlans::getDCT2D(int width, int height, const float* in, const float* out, int threads)
+{
+    std::vector<Plan> dropped;
+    MyMutex::MyLock lock(mutex);
+
+#ifndef RT_FFTW3F_OMP
+    threads = 1;
+#endif
+
+    // the plan can be executed on other buffers only if they have the same alignment
+    const int inAlignment = fftwf_alignment_of(const_cast<float*>(in));
+    const int outAlignment = fftwf_alignment_of(const_cast<float*>(out));
+
+    const Key key(Kind::DCT_2D, width, height, threads, inAlignment, outAlignment);
+    Plan cached = find(key);
+
+    if (cached) {
+        return cached;
+    }
+
+    char* const inBuffer = reinterpret_cast<char*>(fftwf_malloc(width * height * sizeof(float) + maxAlignment));
+    char* const outBuffer = reinterpret_cast<char*>(fftwf_malloc(width * height * sizeof(float) + maxAlignment));
+
+#ifdef RT_FFTW3F_OMP
+
+    if (!threadsInitialized) {
+        fftwf_init_threads();
+        threadsInitialized = true;
+    }
+
+    fftwf_plan_with_nthreads(threads);
+#endif
+
+    // FFTW_ESTIMATE doesn't touch the buffers, measuring the image sized transforms would take longer than executing them
+    const fftwf_plan plan = fftwf_plan_r2r_2d(height, width, reinterpret_cast<float*>(inBuffer + inAlignment), reinterpret_cast<float*>(outBuffer + outAlignment), FFTW_REDFT00, FFTW_REDFT00, FFTW_ESTIMATE);
+
+#ifdef RT_FFTW3F_OMP
+    fftwf_plan_with_nthreads(1);
+#endif
+
+    fftwf_free(inBuffer);
+    fftwf_free(outBuffer);
+
+    return store(key, plan, dropped);
+}
+
+FFTWPlans::Plan FFTWPlans::find(const Key& key)
+{
+    const auto iter = plans.find(key);
+
+    if (iter == plans.end()) {
+        return nullptr;
+    }
+
+    iter->second.lastUse = ++useCount;
+    return iter->second.plan;
+}
+
+FFTWPlans::Plan FFTWPlans::store(const Key& key, fftwf_plan plan, std::vector<Plan>& dropped)
+{
+    while (plans.size() >= maxPlans) {
+        const auto oldest = std::min_element(plans.begin(), plans.end(), [](const std::pair<const Key, Entry>& a, const std::pair<const Key, Entry>& b) {
+            return a.second.lastUse < b.second.lastUse;
+        });
+        dropped.push_back(std::move(oldest->second.plan));
+        plans.erase(oldest);
+    }
+
+    // fftw's planner isn't thread safe, neither is destroying a plan
+    const Plan result(plan, [](fftwf_plan p) {
+        MyMutex::MyLock lock(getInstance()->mutex);
+        fftwf_destroy_plan(p);
+    });
+
+    plans[key] = {result, ++useCount};
+
+    return result;
+}
+
+void FFTWPlans::saveWisdom()
+{
+    if (wisdomFile.empty()) {
+        return;
+    }
+
+    g_mkdir_with_parents(Glib::path_get_dirname(wisdomFile).c_str(), 0755);
+
+    // file_set_contents() writes to a uniquely named temporary file which then replaces the wisdom,
+    // so concurrent instances neither read a partial file nor mix their writes
+    char* const wisdom = fftwf_export_wisdom_to_string();
+    bool saved = false;
+
+    if (wisdom) {
+        try {
+            Glib::file_set_contents(wisdomFile, wisdom);
+            saved = true;
+        } catch (Glib::Error&) {
+        }
+
+        free(wisdom);
+    }
+
+    if (!saved && settings->verbose) {
+        printf("Could not save the FFTW wisdom to %s\n", wisdomFile.c_str());
+    }
+}
+
+}
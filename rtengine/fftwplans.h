@@ -0,0 +1,98 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include <fftw3.h>
+
+#include <glibmm/ustring.h>
+
+#include "noncopyable.h"
+
+#include "../rtgui/threadutils.h"
+
+namespace rtengine
+{
+
+/**
+ * @brief Store of the FFTW plans used by the engine
+ *
+ * A plan is created the first time a transform of a given size is needed and the last used ones are kept, so
+ * the planning isn't repeated for each image. The plans are executed with the new-array execute
+ * functions, which are thread safe, so only the planning is serialized. The wisdom gathered while
+ * measuring is saved to a file and imported at startup, hence FFTW_MEASURE runs once per machine.
+ *
+ * A plan stays valid as long as its Plan is held, even if it has been dropped from the store meanwhile.
+ */
+class FFTWPlans :
+    public NonCopyable
+{
+public:
+    typedef std::shared_ptr<std::remove_pointer<fftwf_plan>::type> Plan;
+
+    static FFTWPlans* getInstance();
+
+    /** Imports the wisdom saved by a previous session, an empty fileName disables its persistence */
+    void init(const Glib::ustring& fileName);
+    /** Drops the stored plans, they are destroyed once they aren't used anymore */
+    void cleanup();
+
+    /** @return the plan of count consecutive tileSize x tileSize DCTs (forward: REDFT10, backward: REDFT01), to
+      * be executed with fftwf_execute_r2r() on distinct buffers allocated by fftwf_malloc(). The input is destroyed. */
+    Plan getBlockDCT(int tileSize, int count, bool forward);
+    /** @return the plan of the width x height REDFT00 transform from in to out, to be executed with
+      * fftwf_execute_r2r() on distinct buffers with the same alignment as in and out */
+    Plan getDCT2D(int width, int height, const float* in, const float* out, int threads);
+
+private:
+    enum class Kind {
+        BLOCK_FORWARD,
+        BLOCK_BACKWARD,
+        DCT_2D
+    };
+    // kind, sizes, threads, alignment of in and out
+    typedef std::tuple<Kind, int, int, int, int, int> Key;
+
+    struct Entry {
+        Plan plan;
+        std::uint64_t lastUse;
+    };
+
+    FFTWPlans();
+
+    // all of these expect the mutex to be locked
+    Plan find(const Key& key);
+    /** Stores plan, the plans dropped to make room are moved to dropped, which has to be released without the lock */
+    Plan store(const Key& key, fftwf_plan plan, std::vector<Plan>& dropped);
+    void saveWisdom();
+
+    // declared first, so that it outlives the plans: destroying one takes the lock
+    MyMutex mutex;
+    std::map<Key, Entry> plans;
+    std::uint64_t useCount;
+    Glib::ustring wisdomFile;
+    bool threadsInitialized;
+};
+
+}
@@ -0,0 +1,59 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <sys/file.h>
+#endif
+
+#include "filelock.h"
+
+namespace rtengine
+{
+
+FileLock::FileLock(FILE* f) :
+    file(f)
+{
+    if (!file) {
+        return;
+    }
+
+#ifdef WIN32
+    OVERLAPPED overlapped = {};
+    LockFileEx(reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(file))), LOCKFILE_EXCLUSIVE_LOCK, 0, MAXDWORD, MAXDWORD, &overlapped);
+#else
+    flock(fileno(file), LOCK_EX);
+#endif
+}
+
+FileLock::~FileLock()
+{
+    if (!file) {
+        return;
+    }
+
+#ifdef WIN32
+    OVERLAPPED overlapped = {};
+    UnlockFileEx(reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(file))), 0, MAXDWORD, MAXDWORD, &overlapped);
+#else
+    flock(fileno(file), LOCK_UN);
+#endif
+}
+
+}
@@ -0,0 +1,45 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdio>
+
+#include "noncopyable.h"
+
+namespace rtengine
+{
+
+/**
+ * @brief Exclusive lock on a file, held from its construction to its destruction
+ *
+ * It serializes the instances of RawTherapee which update a shared file. The locked file is usually
+ * a "<file>.lock" beside the shared one, which may then be replaced while the lock is held.
+ */
+class FileLock :
+    public NonCopyable
+{
+public:
+    /** Blocks until f is locked, a nullptr f locks nothing */
+    explicit FileLock(FILE* f);
+    ~FileLock();
+
+private:
+    FILE* const file;
+};
+
+}
@@ -21,6 +21,8 @@
 #include <cstdlib>
 #include "opthelper.h"
 #include "boxblur.h"
+#include "cpufeatures.h"
+#include "gauss_wide.h"
 
 namespace
 {
@@ -313,6 +315,64 @@ template<class T> void gaussVertical3 (T** src, T** dst, int W, int H, const flo
 #endif
 
 #ifdef __SSE2__
+// Run the passes on the widest vectors supported by the cpu. They return the number of columns (rows for the
+// horizontal pass) done, 0 if only SSE is available, and have to be called by all threads of the parallel region.
+int gaussVerticalWide(float** src, float** dst, const int W, const int H, const double B, const double b1, const double b2, const double b3, const double M[3][3], bool multiply)
+{
+#if defined RT_SIMD_AVX2 || defined RT_SIMD_AVX512
+    const float Mf[3][3] = {
+        {static_cast<float>(M[0][0]), static_cast<float>(M[0][1]), static_cast<float>(M[0][2])},
+        {static_cast<float>(M[1][0]), static_cast<float>(M[1][1]), static_cast<float>(M[1][2])},
+        {static_cast<float>(M[2][0]), static_cast<float>(M[2][1]), static_cast<float>(M[2][2])}
+    };
+    const rtengine::SimdLevel level = rtengine::getSimdLevel();
+
+#ifdef RT_SIMD_AVX512
+
+    if (level >= rtengine::SimdLevel::AVX512) {
+        return rtengine::avx512::gaussVertical(src, dst, W, H, B, b1, b2, b3, Mf, multiply);
+    }
+
+#endif
+#ifdef RT_SIMD_AVX2
+
+    if (level >= rtengine::SimdLevel::AVX2) {
+        return rtengine::avx2::gaussVertical(src, dst, W, H, B, b1, b2, b3, Mf, multiply);
+    }
+
+#endif
+#endif
+    return 0;
+}
+
+int gaussHorizontalWide(float** src, float** dst, const int W, const int H, const double B, const double b1, const double b2, const double b3, const double M[3][3])
+{
+#if defined RT_SIMD_AVX2 || defined RT_SIMD_AVX512
+    const float Mf[3][3] = {
+        {static_cast<float>(M[0][0]), static_cast<float>(M[0][1]), static_cast<float>(M[0][2])},
+        {static_cast<float>(M[1][0]), static_cast<float>(M[1][1]), static_cast<float>(M[1][2])},
+        {static_cast<float>(M[2][0]), static_cast<float>(M[2][1]), static_cast<float>(M[2][2])}
+    };
+    const rtengine::SimdLevel level = rtengine::getSimdLevel();
+
+#ifdef RT_SIMD_AVX512
+
+    if (level >= rtengine::SimdLevel::AVX512) {
+        return rtengine::avx512::gaussHorizontal(src, dst, W, H, B, b1, b2, b3, Mf);
+    }
+
+#endif
+#ifdef RT_SIMD_AVX2
+
+    if (level >= rtengine::SimdLevel::AVX2) {
+        return rtengine::avx2::gaussHorizontal(src, dst, W, H, B, b1, b2, b3, Mf);
+    }
+
+#endif
+#endif
+    return 0;
+}
+
 // fast gaussian approximation if the support window is large
 template<class T> void gaussHorizontalSse (T** src, T** dst, const int W, const int H, const float sigma)
 {
@@ -335,11 +395,14 @@ template<class T> void gaussHorizontalSse (T** src, T** dst, const int W, const
     b2v = F2V(b2);
     b3v = F2V(b3);
 
+    // the rows left by the AVX2/AVX-512 kernels are done with SSE
+    const int firstRow = gaussHorizontalWide(src, dst, W, H, B, b1, b2, b3, M);
+
 #ifdef _OPENMP
     #pragma omp for nowait
 #endif
 
-    for (int i = 0; i < H - 3; i += 4) {
+    for (int i = firstRow; i < H - 3; i += 4) {
         Tv = _mm_set_ps(src[i][0], src[i + 1][0], src[i + 2][0], src[i + 3][0]);
         Tm3v = Tv * (Bv + b1v + b2v + b3v);
         STVF( tmp[0][0], Tm3v );
@@ -399,7 +462,7 @@ template<class T> void gaussHorizontalSse (T** src, T** dst, const int W, const
     #pragma omp single
 #endif
 
-    for (int i = H - (H % 4); i < H; i++) {
+    for (int i = H - ((H - firstRow) % 4); i < H; i++) {
         tmp[0][0] = src[i][0] * (B + b1 + b2 + b3);
         tmp[1][0] = B * src[i][1] + b1 * tmp[0][0]  + src[i][0] * (b2 + b3);
         tmp[2][0] = B * src[i][2] + b1 * tmp[1][0]  + b2 * tmp[0][0]  + b3 * src[i][0];
@@ -498,12 +561,15 @@ template<class T> void gaussVerticalSse (T** src, T** dst, const int W, const in
     b2v = F2V(b2);
     b3v = F2V(b3);
 
+    // the columns left by the AVX2/AVX-512 kernels are done with SSE
+    const int firstCol = gaussVerticalWide(src, dst, W, H, B, b1, b2, b3, M, false);
+
 #ifdef _OPENMP
     #pragma omp for nowait
 #endif
 
     // process 8 columns per iteration for better usage of cpu cache
-    for (int i = 0; i < W - 7; i += 8) {
+    for (int i = firstCol; i < W - 7; i += 8) {
         Tv = LVFU( src[0][i]);
         Tv1 = LVFU( src[0][i + 4]);
         Rv = Tv * (Bv + b1v + b2v + b3v);
@@ -641,12 +707,15 @@ template<class T> void gaussVerticalSsemult (T** RESTRICT src, T** RESTRICT dst,
     b2v = F2V(b2);
     b3v = F2V(b3);
 
+    // the columns left by the AVX2/AVX-512 kernels are done with SSE
+    const int firstCol = gaussVerticalWide(src, dst, W, H, B, b1, b2, b3, M, true);
+
 #ifdef _OPENMP
     #pragma omp for nowait
 #endif
 
     // process 8 columns per iteration for better usage of cpu cache
-    for (int i = 0; i < W - 7; i += 8) {
+    for (int i = firstCol; i < W - 7; i += 8) {
         Tv = LVFU( src[0][i]);
         Tv1 = LVFU( src[0][i + 4]);
         Rv = Tv * (Bv + b1v + b2v + b3v);
@@ -0,0 +1,44 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Built with -mavx2 -mfma, see rtengine/CMakeLists.txt
+
+#include "gauss_wide.h"
+#include "gauss_wide_impl.h"
+
+namespace rtengine
+{
+
+namespace avx2
+{
+
+int gaussVertical(float** src, float** dst, int W, int H, float B, float b1, float b2, float b3, const float M[3][3], bool multiply)
+{
+    return
+        multiply
+            ? gaussVerticalBlocks<16, true>(src, dst, W, H, B, b1, b2, b3, M)
+            : gaussVerticalBlocks<16, false>(src, dst, W, H, B, b1, b2, b3, M);
+}
+
+int gaussHorizontal(float** src, float** dst, int W, int H, float B, float b1, float b2, float b3, const float M[3][3])
+{
+    return gaussHorizontalBlocks<16>(src, dst, W, H, B, b1, b2, b3, M);
+}
+
+}
+
+}
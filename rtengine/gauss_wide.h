@@ -0,0 +1,47 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// Passes of the gaussian blur built for wider vectors than the rest of rtengine.
+// gauss_avx2.cc and gauss_avx512.cc compile the same kernels (gauss_wide_impl.h) with their own
+// instruction set flags, gauss.cc selects one at runtime according to getSimdLevel().
+//
+// Like the SSE version, the functions have to be called by all threads of a parallel region.
+// gaussVertical() processes the columns in blocks of 16 and returns the number of columns done,
+// gaussHorizontal() does the same with the rows. The caller has to process the remaining ones.
+
+namespace rtengine
+{
+
+namespace avx2
+{
+
+int gaussVertical(float** src, float** dst, int W, int H, float B, float b1, float b2, float b3, const float M[3][3], bool multiply);
+int gaussHorizontal(float** src, float** dst, int W, int H, float B, float b1, float b2, float b3, const float M[3][3]);
+
+}
+
+namespace avx512
+{
+
+int gaussVertical(float** src, float** dst, int W, int H, float B, float b1, float b2, float b3, const float M[3][3], bool multiply);
+int gaussHorizontal(float** src, float** dst, int W, int H, float B, float b1, float b2, float b3, const float M[3][3]);
+
+}
+
+}
@@ -0,0 +1,228 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// Only to be included by the translation units built with specific instruction set flags.
+//
+// Everything here has internal linkage and nothing is included which defines inline functions
+// or templates with external linkage: the linker would otherwise be free to keep the AVX copy
+// of such a function for the whole program, which would then crash on older cpus.
+// The loops over the lanes of a block are vectorized by the compiler.
+
+#include <cstddef>
+
+namespace
+{
+
+// Young - van Vliet recursive filter, same as gaussVerticalSse() in gauss.cc
+template<int N, bool multiply>
+int gaussVerticalBlocks(float** src, float** dst, int W, int H, float B, float b1, float b2, float b3, const float M[3][3])
+{
+    const int blocks = W / N;
+    float* const __restrict__ tmp = new float[static_cast<std::size_t>(H) * N];
+
+#ifdef _OPENMP
+    #pragma omp for nowait
+#endif
+
+    for (int block = 0; block < blocks; ++block) {
+        const int col = block * N;
+        float R[N], T[N], Tm2[N], Tm3[N];
+
+        // causal pass, top to bottom
+        for (int k = 0; k < N; ++k) {
+            T[k] = src[0][col + k];
+            R[k] = T[k] * (B + b1 + b2 + b3);
+            Tm3[k] = R[k];
+            tmp[k] = R[k];
+        }
+
+        for (int k = 0; k < N; ++k) {
+            R[k] = src[1][col + k] * B + R[k] * b1 + T[k] * (b2 + b3);
+            Tm2[k] = R[k];
+            tmp[N + k] = R[k];
+        }
+
+        for (int k = 0; k < N; ++k) {
+            R[k] = src[2][col + k] * B + R[k] * b1 + Tm3[k] * b2 + T[k] * b3;
+            tmp[2 * N + k] = R[k];
+        }
+
+        for (int j = 3; j < H; ++j) {
+            const float* const row = src[j] + col;
+            float* const __restrict__ tmpRow = tmp + static_cast<std::size_t>(j) * N;
+
+            for (int k = 0; k < N; ++k) {
+                T[k] = R[k];
+                R[k] = row[k] * B + T[k] * b1 + Tm2[k] * b2 + Tm3[k] * b3;
+                tmpRow[k] = R[k];
+                Tm3[k] = Tm2[k];
+                Tm2[k] = T[k];
+            }
+        }
+
+        // boundary conditions at the bottom (Triggs and Sdika) and anticausal pass, bottom to top
+        float out[3][N];
+
+        for (int k = 0; k < N; ++k) {
+            const float last = src[H - 1][col + k];
+            const float temp2Wp1 = last + M[2][0] * (R[k] - last) + M[2][1] * (Tm2[k] - last) + M[2][2] * (Tm3[k] - last);
+            const float temp2W = last + M[1][0] * (R[k] - last) + M[1][1] * (Tm2[k] - last) + M[1][2] * (Tm3[k] - last);
+
+            R[k] = last + M[0][0] * (R[k] - last) + M[0][1] * (Tm2[k] - last) + M[0][2] * (Tm3[k] - last);
+            Tm2[k] = B * Tm2[k] + b1 * R[k] + b2 * temp2W + b3 * temp2Wp1;
+            Tm3[k] = B * Tm3[k] + b1 * Tm2[k] + b2 * R[k] + b3 * temp2W;
+            out[0][k] = R[k];
+            out[1][k] = Tm2[k];
+            out[2][k] = Tm3[k];
+
+            T[k] = R[k];
+            R[k] = Tm3[k];
+            Tm3[k] = T[k];
+        }
+
+        for (int i = 0; i < 3; ++i) {
+            float* const row = dst[H - 1 - i] + col;
+
+            for (int k = 0; k < N; ++k) {
+                row[k] = multiply ? row[k] * out[i][k] : out[i][k];
+            }
+        }
+
+        for (int j = H - 4; j >= 0; --j) {
+            const float* const __restrict__ tmpRow = tmp + static_cast<std::size_t>(j) * N;
+            float* const row = dst[j] + col;
+
+            for (int k = 0; k < N; ++k) {
+                T[k] = R[k];
+                R[k] = tmpRow[k] * B + T[k] * b1 + Tm2[k] * b2 + Tm3[k] * b3;
+                row[k] = multiply ? row[k] * R[k] : R[k];
+                Tm3[k] = Tm2[k];
+                Tm2[k] = T[k];
+            }
+        }
+    }
+
+    delete[] tmp;
+
+    return blocks * N;
+}
+
+// Horizontal pass, N rows at a time. The rows are transposed into tmp, so that the recursion
+// runs along tmp with the N rows in the lanes of a vector, like the 4 rows of gaussHorizontalSse().
+template<int N>
+int gaussHorizontalBlocks(float** src, float** dst, int W, int H, float B, float b1, float b2, float b3, const float M[3][3])
+{
+    const int blocks = H / N;
+    float* const __restrict__ tmp = new float[static_cast<std::size_t>(W) * N];
+
+#ifdef _OPENMP
+    #pragma omp for nowait
+#endif
+
+    for (int block = 0; block < blocks; ++block) {
+        const int row = block * N;
+
+        for (int k = 0; k < N; ++k) {
+            const float* const srcRow = src[row + k];
+
+            for (int j = 0; j < W; ++j) {
+                tmp[static_cast<std::size_t>(j) * N + k] = srcRow[j];
+            }
+        }
+
+        float R[N], T[N], Tm2[N], Tm3[N], last[N];
+
+        // causal pass, left to right
+        for (int k = 0; k < N; ++k) {
+            last[k] = tmp[static_cast<std::size_t>(W - 1) * N + k];
+            T[k] = tmp[k];
+            R[k] = T[k] * (B + b1 + b2 + b3);
+            Tm3[k] = R[k];
+            tmp[k] = R[k];
+        }
+
+        for (int k = 0; k < N; ++k) {
+            R[k] = tmp[N + k] * B + R[k] * b1 + T[k] * (b2 + b3);
+            Tm2[k] = R[k];
+            tmp[N + k] = R[k];
+        }
+
+        for (int k = 0; k < N; ++k) {
+            R[k] = tmp[2 * N + k] * B + R[k] * b1 + Tm3[k] * b2 + T[k] * b3;
+            tmp[2 * N + k] = R[k];
+        }
+
+        for (int j = 3; j < W; ++j) {
+            float* const __restrict__ col = tmp + static_cast<std::size_t>(j) * N;
+
+            for (int k = 0; k < N; ++k) {
+                T[k] = R[k];
+                R[k] = col[k] * B + T[k] * b1 + Tm2[k] * b2 + Tm3[k] * b3;
+                col[k] = R[k];
+                Tm3[k] = Tm2[k];
+                Tm2[k] = T[k];
+            }
+        }
+
+        // boundary conditions at the right border (Triggs and Sdika) and anticausal pass, right to left
+        float* const __restrict__ end = tmp + static_cast<std::size_t>(W - 3) * N;
+
+        for (int k = 0; k < N; ++k) {
+            const float temp2Wp1 = last[k] + M[2][0] * (R[k] - last[k]) + M[2][1] * (Tm2[k] - last[k]) + M[2][2] * (Tm3[k] - last[k]);
+            const float temp2W = last[k] + M[1][0] * (R[k] - last[k]) + M[1][1] * (Tm2[k] - last[k]) + M[1][2] * (Tm3[k] - last[k]);
+
+            R[k] = last[k] + M[0][0] * (R[k] - last[k]) + M[0][1] * (Tm2[k] - last[k]) + M[0][2] * (Tm3[k] - last[k]);
+            Tm2[k] = B * Tm2[k] + b1 * R[k] + b2 * temp2W + b3 * temp2Wp1;
+            Tm3[k] = B * Tm3[k] + b1 * Tm2[k] + b2 * R[k] + b3 * temp2W;
+            end[2 * N + k] = R[k];
+            end[N + k] = Tm2[k];
+            end[k] = Tm3[k];
+
+            T[k] = R[k];
+            R[k] = Tm3[k];
+            Tm3[k] = T[k];
+        }
+
+        for (int j = W - 4; j >= 0; --j) {
+            float* const __restrict__ col = tmp + static_cast<std::size_t>(j) * N;
+
+            for (int k = 0; k < N; ++k) {
+                T[k] = R[k];
+                R[k] = col[k] * B + T[k] * b1 + Tm2[k] * b2 + Tm3[k] * b3;
+                col[k] = R[k];
+                Tm3[k] = Tm2[k];
+                Tm2[k] = T[k];
+            }
+        }
+
+        for (int k = 0; k < N; ++k) {
+            float* const dstRow = dst[row + k];
+
+            for (int j = 0; j < W; ++j) {
+                dstRow[j] = tmp[static_cast<std::size_t>(j) * N + k];
+            }
+        }
+    }
+
+    delete[] tmp;
+
+    return blocks * N;
+}
+
+}
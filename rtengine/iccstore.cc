@@ -28,10 +28,13 @@
 #endif
 
 #include <iostream>
+#include <memory>
+#include <tuple>
 
 #include "iccstore.h"
 
 #include "iccmatrices.h"
+#include "icctransform.h"
 
 #include "../rtgui/options.h"
 #include "../rtgui/threadutils.h"
@@ -454,6 +457,7 @@ public:
         userICCDir = usrICCDir;
         fileProfiles.clear();
         fileProfileContents.clear();
+        transforms.clear();
 
         if (loadAll) {
             loadProfiles(profilesDir, &fileProfiles, &fileProfileContents, nullptr, false);
@@ -633,6 +637,38 @@ public:
         return srgb;
     }
 
+    std::shared_ptr<const ICCTransform> getTransform(cmsHPROFILE iprof, cmsUInt32Number iformat, cmsHPROFILE oprof, cmsUInt32Number oformat, int intent, cmsUInt32Number flags) const
+    {
+        const TransformKey key(iprof, iformat, oprof, oformat, intent, flags);
+
+        {
+            MyMutex::MyLock lock(mutex);
+
+            const TransformMap::const_iterator r = transforms.find(key);
+
+            if (r != transforms.end()) {
+                return r->second;
+            }
+        }
+
+        // Created without holding the lock, lcmsMutex is taken by the constructor
+        const std::shared_ptr<const ICCTransform> transform = std::make_shared<const ICCTransform>(iprof, iformat, oprof, oformat, intent, flags);
+
+        if (!transform->isValid()) {
+            return nullptr;
+        }
+
+        MyMutex::MyLock lock(mutex);
+
+        if (transforms.size() >= maxTransforms) {
+            // The transforms still in use are kept alive by their users
+            transforms.clear();
+        }
+
+        // If another thread created the same transform meanwhile, its one is kept
+        return transforms.emplace(key, transform).first->second;
+    }
+
     std::vector<Glib::ustring> getProfiles(ProfileType type) const
     {
         std::vector<Glib::ustring> res;
@@ -1001,6 +1037,10 @@ parse_error:
     using MatrixMap = std::map<Glib::ustring, TMatrix>;
     using ContentMap = std::map<Glib::ustring, ProfileContent>;
     using NameMap = std::map<Glib::ustring, Glib::ustring>;
+    using TransformKey = std::tuple<cmsHPROFILE, cmsUInt32Number, cmsHPROFILE, cmsUInt32Number, int, cmsUInt32Number>;
+    using TransformMap = std::map<TransformKey, std::shared_ptr<const ICCTransform>>;
+
+    static constexpr std::size_t maxTransforms = 32;
 
     ProfileMap wProfiles;
     // ProfileMap wProfilesGamma;
@@ -1027,6 +1067,8 @@ parse_error:
     const cmsHPROFILE xyz;
     const cmsHPROFILE srgb;
 
+    mutable TransformMap transforms;
+
     mutable MyMutex mutex;
 };
 
@@ -1103,6 +1145,11 @@ cmsHPROFILE rtengine::ICCStore::getsRGBProfile() const
     return implementation->getsRGBProfile();
 }
 
+std::shared_ptr<const rtengine::ICCTransform> rtengine::ICCStore::getTransform(cmsHPROFILE iprof, cmsUInt32Number iformat, cmsHPROFILE oprof, cmsUInt32Number oformat, int intent, cmsUInt32Number flags) const
+{
+    return implementation->getTransform(iprof, iformat, oprof, oformat, intent, flags);
+}
+
 std::vector<Glib::ustring> rtengine::ICCStore::getProfiles(ProfileType type) const
 {
     return implementation->getProfiles(type);
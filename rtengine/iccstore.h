@@ -19,6 +19,7 @@
 #pragma once
 
 #include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -38,6 +39,8 @@ namespace procparams
 
 }
 
+class ICCTransform;
+
 typedef const double(*TMatrix)[3];
 
 class ProfileContent
@@ -87,6 +90,10 @@ public:
     std::vector<Glib::ustring> getProfiles(ProfileType type = ProfileType::MONITOR) const;
     std::vector<Glib::ustring> getProfilesFromDir(const Glib::ustring& dirName) const;
 
+    /** Returns a transform shared with the other callers asking for the same one, nullptr if it can't be created.
+      * The profiles must stay open until the next init(), use nullptr for Lab (see ICCTransform). */
+    std::shared_ptr<const ICCTransform> getTransform(cmsHPROFILE iprof, cmsUInt32Number iformat, cmsHPROFILE oprof, cmsUInt32Number oformat, int intent, cmsUInt32Number flags) const;
+
     std::uint8_t     getInputIntents(cmsHPROFILE profile) const;
     std::uint8_t     getOutputIntents(cmsHPROFILE profile) const;
     std::uint8_t     getProofIntents(cmsHPROFILE profile) const;
@@ -0,0 +1,294 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <array>
+#include <cmath>
+
+#include "icctransform.h"
+
+#include "rt_math.h"
+#include "sleef.c"
+#include "../rtgui/threadutils.h"
+
+namespace rtengine
+{
+
+extern MyMutex* lcmsMutex;
+
+namespace
+{
+
+constexpr int curveLutSize = 65536;
+constexpr float darkLimit = 1.f / 256.f;
+
+// Inverse of the L* function, as in cmsLab2XYZ()
+inline float labToXyz(float t)
+{
+    constexpr float limit = 6.f / 29.f;
+    return t > limit ? t * t * t : 108.f / 841.f * (t - 4.f / 29.f);
+}
+
+#ifdef __SSE2__
+inline vfloat labToXyz(vfloat t)
+{
+    const vfloat limitv = F2V(6.f / 29.f);
+    return vself(vmaskf_gt(t, limitv), t * t * t, F2V(108.f / 841.f) * (t - F2V(4.f / 29.f)));
+}
+#endif
+
+}
+
+ICCTransform::ICCTransform(cmsHPROFILE iprof, cmsUInt32Number iformat, cmsHPROFILE oprof, cmsUInt32Number oformat, int intent, cmsUInt32Number flags) :
+    transform(nullptr),
+    matrixShaper(false),
+    xyzToRgb{},
+    inverseCurves{}
+{
+    MyMutex::MyLock lock(*lcmsMutex);
+
+    if (!iprof && iformat == TYPE_Lab_FLT && oformat == TYPE_RGB_FLT && initMatrixShaper(oprof, intent, flags)) {
+        matrixShaper = true;
+        return;
+    }
+
+    const cmsHPROFILE labProfile = iprof ? nullptr : cmsCreateLab4Profile(nullptr);
+    transform = cmsCreateTransform(iprof ? iprof : labProfile, iformat, oprof, oformat, intent, flags | cmsFLAGS_NOCACHE);
+
+    if (labProfile) {
+        cmsCloseProfile(labProfile);
+    }
+}
+
+ICCTransform::~ICCTransform()
+{
+    if (transform) {
+        cmsDeleteTransform(transform);
+    }
+
+    for (auto curve : inverseCurves) {
+        if (curve) {
+            cmsFreeToneCurve(curve);
+        }
+    }
+}
+
+bool ICCTransform::isValid() const
+{
+    return matrixShaper || transform;
+}
+
+bool ICCTransform::isMatrixShaper() const
+{
+    return matrixShaper;
+}
+
+bool ICCTransform::initMatrixShaper(cmsHPROFILE oprof, int intent, cmsUInt32Number flags)
+{
+    // lcms uses the matrix and tone curves of the profile only if it has no LUT for the intent,
+    // the absolute colorimetric intent would also scale by the white point of the profile
+    if (
+        !oprof
+        || cmsGetColorSpace(oprof) != cmsSigRgbData
+        || !cmsIsMatrixShaper(oprof)
+        || cmsIsCLUT(oprof, intent, LCMS_USED_AS_OUTPUT)
+        || intent == INTENT_ABSOLUTE_COLORIMETRIC
+    ) {
+        return false;
+    }
+
+    // The black point compensation, forced by lcms for the perceptual and saturation intents because Lab is a V4 profile,
+    // is only an identity if the profile maps black to 0
+    if ((flags & cmsFLAGS_BLACKPOINTCOMPENSATION) || intent == INTENT_PERCEPTUAL || intent == INTENT_SATURATION) {
+        cmsCIEXYZ black;
+
+        if (!cmsDetectDestinationBlackPoint(&black, oprof, intent, 0) || black.X > 1e-6 || black.Y > 1e-6 || black.Z > 1e-6) {
+            return false;
+        }
+    }
+
+    const cmsTagSignature colorantTags[3] = {cmsSigRedColorantTag, cmsSigGreenColorantTag, cmsSigBlueColorantTag};
+    const cmsTagSignature curveTags[3] = {cmsSigRedTRCTag, cmsSigGreenTRCTag, cmsSigBlueTRCTag};
+
+    std::array<std::array<double, 3>, 3> rgbToXyz;
+
+    for (int c = 0; c < 3; ++c) {
+        const cmsCIEXYZ* const colorant = static_cast<const cmsCIEXYZ*>(cmsReadTag(oprof, colorantTags[c]));
+        const cmsToneCurve* const curve = static_cast<const cmsToneCurve*>(cmsReadTag(oprof, curveTags[c]));
+
+        if (!colorant || !curve) {
+            return false;
+        }
+
+        rgbToXyz[0][c] = colorant->X;
+        rgbToXyz[1][c] = colorant->Y;
+        rgbToXyz[2][c] = colorant->Z;
+
+        inverseCurves[c] = cmsReverseToneCurve(curve);
+
+        if (!inverseCurves[c]) {
+            return false;
+        }
+    }
+
+    std::array<std::array<double, 3>, 3> inverse;
+
+    if (!invertMatrix(rgbToXyz, inverse)) {
+        return false;
+    }
+
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            // Lab to XYZ gives XYZ relative to the D50 white of the PCS
+            xyzToRgb[i][j] = inverse[i][j] * (j == 0 ? cmsD50X : j == 1 ? cmsD50Y : cmsD50Z);
+        }
+    }
+
+    for (int c = 0; c < 3; ++c) {
+        curveLuts[c](curveLutSize);
+        darkCurveLuts[c](curveLutSize);
+
+        for (int i = 0; i < curveLutSize; ++i) {
+            curveLuts[c][i] = cmsEvalToneCurveFloat(inverseCurves[c], static_cast<float>(i) / (curveLutSize - 1));
+            darkCurveLuts[c][i] = cmsEvalToneCurveFloat(inverseCurves[c], static_cast<float>(i) / (curveLutSize - 1) * darkLimit);
+        }
+    }
+
+    return true;
+}
+
+inline float ICCTransform::shape(int channel, float value) const
+{
+    if (value >= darkLimit && value <= 1.f) {
+        return curveLuts[channel][value * (curveLutSize - 1)];
+    } else if (value >= 0.f && value < darkLimit) {
+        return darkCurveLuts[channel][value * ((curveLutSize - 1) / darkLimit)];
+    } else {
+        // out of gamut values aren't clipped by lcms either
+        return cmsEvalToneCurveFloat(inverseCurves[channel], value);
+    }
+}
+
+void ICCTransform::apply(const void* src, void* dst, int n) const
+{
+    if (!matrixShaper) {
+        cmsDoTransform(transform, src, dst, n);
+        return;
+    }
+
+    const float* const lab = static_cast<const float*>(src);
+    float* const rgb = static_cast<float*>(dst);
+
+    for (int i = 0; i < n; ++i) {
+        const float fy = (lab[3 * i] + 16.f) / 116.f;
+        const float x = labToXyz(fy + lab[3 * i + 1] / 500.f);
+        const float y = labToXyz(fy);
+        const float z = labToXyz(fy - lab[3 * i + 2] / 200.f);
+
+        for (int c = 0; c < 3; ++c) {
+            rgb[3 * i + c] = shape(c, xyzToRgb[c][0] * x + xyzToRgb[c][1] * y + xyzToRgb[c][2] * z);
+        }
+    }
+}
+
+void ICCTransform::labToRgb(const float* L, const float* a, const float* b, float* R, float* G, float* B, int n, float* buffer) const
+{
+    if (!matrixShaper) {
+        for (int i = 0; i < n; ++i) {
+            buffer[3 * i] = L[i] / 327.68f;
+            buffer[3 * i + 1] = a[i] / 327.68f;
+            buffer[3 * i + 2] = b[i] / 327.68f;
+        }
+
+        cmsDoTransform(transform, buffer, buffer, n);
+
+        for (int i = 0; i < n; ++i) {
+            R[i] = buffer[3 * i];
+            G[i] = buffer[3 * i + 1];
+            B[i] = buffer[3 * i + 2];
+        }
+
+        return;
+    }
+
+    float* const dst[3] = {R, G, B};
+    int i = 0;
+
+#ifdef __SSE2__
+    const vfloat c16v = F2V(16.f);
+    const vfloat L2fyv = F2V(1.f / (327.68f * 116.f));
+    const vfloat a2fxv = F2V(1.f / (327.68f * 500.f));
+    const vfloat b2fzv = F2V(1.f / (327.68f * 200.f));
+    const vfloat c116v = F2V(116.f);
+    const vfloat zerov = ZEROV;
+    const vfloat onev = F2V(1.f);
+    const vfloat darkLimitv = F2V(darkLimit);
+    const vfloat lutScalev = F2V(curveLutSize - 1);
+    const vfloat darkLutScalev = F2V((curveLutSize - 1) / darkLimit);
+    vfloat matrixv[3][3];
+
+    for (int c = 0; c < 3; ++c) {
+        for (int j = 0; j < 3; ++j) {
+            matrixv[c][j] = F2V(xyzToRgb[c][j]);
+        }
+    }
+
+    for (; i < n - 3; i += 4) {
+        const vfloat fyv = LVFU(L[i]) * L2fyv + c16v / c116v;
+        const vfloat xv = labToXyz(fyv + LVFU(a[i]) * a2fxv);
+        const vfloat yv = labToXyz(fyv);
+        const vfloat zv = labToXyz(fyv - LVFU(b[i]) * b2fzv);
+
+        for (int c = 0; c < 3; ++c) {
+            const vfloat valuev = matrixv[c][0] * xv + matrixv[c][1] * yv + matrixv[c][2] * zv;
+            vfloat resultv = vself(vmaskf_lt(valuev, darkLimitv), darkCurveLuts[c][valuev * darkLutScalev], curveLuts[c][valuev * lutScalev]);
+
+            const vmask outOfRange = vorm(vmaskf_lt(valuev, zerov), vmaskf_gt(valuev, onev));
+
+            if (_mm_movemask_ps(_mm_castsi128_ps(outOfRange))) {
+                float values[4];
+                float results[4];
+                STVFU(values[0], valuev);
+                STVFU(results[0], resultv);
+
+                for (int k = 0; k < 4; ++k) {
+                    if (values[k] < 0.f || values[k] > 1.f) {
+                        results[k] = cmsEvalToneCurveFloat(inverseCurves[c], values[k]);
+                    }
+                }
+
+                resultv = LVFU(results[0]);
+            }
+
+            STVFU(dst[c][i], resultv);
+        }
+    }
+
+#endif
+
+    for (; i < n; ++i) {
+        const float fy = L[i] / (327.68f * 116.f) + 16.f / 116.f;
+        const float x = labToXyz(fy + a[i] / (327.68f * 500.f));
+        const float y = labToXyz(fy);
+        const float z = labToXyz(fy - b[i] / (327.68f * 200.f));
+
+        for (int c = 0; c < 3; ++c) {
+            dst[c][i] = shape(c, xyzToRgb[c][0] * x + xyzToRgb[c][1] * y + xyzToRgb[c][2] * z);
+        }
+    }
+}
+
+}
@@ -0,0 +1,67 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <lcms2.h>
+
+#include "LUT.h"
+#include "noncopyable.h"
+
+namespace rtengine
+{
+
+/**
+ * @brief Color transform between two profiles, created and shared by ICCStore::getTransform()
+ *
+ * The transforms from Lab to a matrix/shaper RGB profile with a colorimetric result don't go through
+ * lcms: Lab is converted to XYZ, then to linear RGB by the inverse of the colorant matrix of the profile,
+ * and the inverse tone curve of each channel is read from a LUT. The other transforms are done by lcms.
+ */
+class ICCTransform :
+    public NonCopyable
+{
+public:
+    /** @param iprof nullptr for Lab (D50, TYPE_Lab_FLT)
+      * @param flags cmsFLAGS_NOCACHE is added, the transform is used by several threads */
+    ICCTransform(cmsHPROFILE iprof, cmsUInt32Number iformat, cmsHPROFILE oprof, cmsUInt32Number oformat, int intent, cmsUInt32Number flags);
+    ~ICCTransform();
+
+    /** @return false if the transform couldn't be created */
+    bool isValid() const;
+    /** @return true if the transform is done without lcms */
+    bool isMatrixShaper() const;
+
+    /** Transforms n pixels between the formats given to the constructor, in place if src == dst */
+    void apply(const void* src, void* dst, int n) const;
+    /** Transforms a row of Lab, with L, a and b scaled as in LabImage, to RGB in [0;1] (TYPE_Lab_FLT to TYPE_RGB_FLT transforms only)
+      * @param buffer 3 * n floats, only used by the lcms transforms */
+    void labToRgb(const float* L, const float* a, const float* b, float* R, float* G, float* B, int n, float* buffer) const;
+
+private:
+    bool initMatrixShaper(cmsHPROFILE oprof, int intent, cmsUInt32Number flags);
+    float shape(int channel, float value) const;
+
+    cmsHTRANSFORM transform;
+    bool matrixShaper;
+    float xyzToRgb[3][3];
+    cmsToneCurve* inverseCurves[3];
+    LUTf curveLuts[3];          // inverse tone curves on [0;1]
+    LUTf darkCurveLuts[3];      // inverse tone curves on [0;1/256], where they are the steepest
+};
+
+}
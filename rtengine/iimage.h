@@ -19,6 +19,7 @@
 #ifndef _IIMAGE_
 #define _IIMAGE_
 
+#include <cstring>
 #include <glibmm.h>
 #include <vector>
 #include "rt_math.h"
@@ -91,6 +92,12 @@ public:
     void readData  (FILE *fh) {}
     // Write a raw dump of the data
     void writeData (FILE *fh) const {}
+    // Size in bytes of the raw dump of the data
+    std::size_t getDataSize () const { return 0; }
+    // Read the raw dump of the data from memory, buffer has to hold getDataSize() bytes
+    void readData  (const char *buffer) {}
+    // Write the raw dump of the data to memory, buffer has to hold getDataSize() bytes
+    void writeData (char *buffer) const {}
 
     virtual void normalizeInt (int srcMinVal, int srcMaxVal) {};
     virtual void normalizeFloat (float srcMinVal, float srcMaxVal) {};
@@ -1176,6 +1183,33 @@ public:
         }
     }
 
+    std::size_t getDataSize () const
+    {
+        return 3 * sizeof(T) * width * height;
+    }
+
+    void readData (const char *buffer)
+    {
+        const std::size_t rowSize = sizeof(T) * width;
+
+        for (PlanarPtr<T>* plane : {&r, &g, &b}) {
+            for (int i = 0; i < height; i++, buffer += rowSize) {
+                memcpy((*plane)(i), buffer, rowSize);
+            }
+        }
+    }
+
+    void writeData (char *buffer) const
+    {
+        const std::size_t rowSize = sizeof(T) * width;
+
+        for (const PlanarPtr<T>* plane : {&r, &g, &b}) {
+            for (int i = 0; i < height; i++, buffer += rowSize) {
+                memcpy(buffer, (*plane)(i), rowSize);
+            }
+        }
+    }
+
 };
 
 // --------------------------------------------------------------------
@@ -1738,6 +1772,29 @@ public:
         }
     }
 
+    std::size_t getDataSize () const
+    {
+        return 3 * sizeof(T) * width * height;
+    }
+
+    void readData (const char *buffer)
+    {
+        const std::size_t rowSize = 3 * sizeof(T) * width;
+
+        for (int i = 0; i < height; i++, buffer += rowSize) {
+            memcpy(r(i), buffer, rowSize);
+        }
+    }
+
+    void writeData (char *buffer) const
+    {
+        const std::size_t rowSize = 3 * sizeof(T) * width;
+
+        for (int i = 0; i < height; i++, buffer += rowSize) {
+            memcpy(buffer, r(i), rowSize);
+        }
+    }
+
 };
 
 // --------------------------------------------------------------------
@@ -46,6 +46,8 @@ struct ToneCurveParams;
 
 }
 
+class CancellationToken;
+
 class ImageMatrices
 {
 
@@ -89,6 +91,8 @@ public:
     virtual bool        isRGBSourceModified () const = 0; // tracks whether cached rgb output of demosaic has been modified
 
     virtual void        setBorder (unsigned int border) {}
+    /** The retinex stops early when token is cancelled, leaving the image undefined */
+    virtual void        setCancellationToken (const CancellationToken* token) {}
     virtual void        setCurrentFrame (unsigned int frameNum) = 0;
     virtual int         getFrameCount () = 0;
     virtual int         getFlatFieldAutoClipValue () = 0;
@@ -37,12 +37,22 @@ namespace rtengine
 
 extern const Settings* settings;
 
+namespace
+{
+
+constexpr int numofphases = 14;
+
+}
+
 ImProcCoordinator::ImProcCoordinator() :
     orig_prev(nullptr),
     oprevi(nullptr),
     oprevl(nullptr),
     nprevl(nullptr),
-    fattal_11_dcrop_cache(nullptr),
+    fattal_dcrop_gain(nullptr),
+    fattal_dcrop_gain_skip(0),
+    dehaze_dcrop_cache(nullptr),
+    dehaze_dcrop_cache_skip(0),
     previmg(nullptr),
     workimg(nullptr),
     ncie (nullptr),
@@ -128,12 +138,15 @@ ImProcCoordinator::ImProcCoordinator() :
     dehaListener(nullptr),
     hListener(nullptr),
     resultValid(false),
+    labStages(LAB_STAGES),
+    labStagesValid(false),
     params(new procparams::ProcParams),
     lastOutputProfile("BADFOOD"),
     lastOutputIntent(RI__COUNT),
     lastOutputBPC(false),
     thread(nullptr),
     changeSinceLast(0),
+    droppedChanges(0),
     updaterRunning(false),
     nextParams(new procparams::ProcParams),
     destroying(false),
@@ -152,6 +165,8 @@ ImProcCoordinator::ImProcCoordinator() :
     customTransformOut(nullptr),
     ipf(params.get(), true)
 {
+    labStages.setBudget(static_cast<std::size_t>(settings->previewStageCacheSize) << 20);
+    ipf.setCancellationToken(&cancellation);
 }
 
 ImProcCoordinator::~ImProcCoordinator()
@@ -161,6 +176,7 @@ ImProcCoordinator::~ImProcCoordinator()
     updaterThreadStart.lock();
 
     if (updaterRunning && thread) {
+        cancellation.cancel();
         thread->join();
     }
 
@@ -168,9 +184,14 @@ ImProcCoordinator::~ImProcCoordinator()
     mProcessing.unlock();
     freeAll();
 
-    if (fattal_11_dcrop_cache) {
-        delete fattal_11_dcrop_cache;
-        fattal_11_dcrop_cache = nullptr;
+    if (fattal_dcrop_gain) {
+        delete fattal_dcrop_gain;
+        fattal_dcrop_gain = nullptr;
+    }
+
+    if (dehaze_dcrop_cache) {
+        delete dehaze_dcrop_cache;
+        dehaze_dcrop_cache = nullptr;
     }
 
     std::vector<Crop*> toDel = crops;
@@ -217,8 +238,9 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
 
     MyMutex::MyLock processingLock(mProcessing);
 
-    constexpr int numofphases = 14;
     int readyphase = 0;
+    bool draftPublished = false;
+    bool cancelled = false;
 
     bool highDetailNeeded = options.prevdemo == PD_Sidecar ? true : (todo & M_HIGHQUAL);
 
@@ -353,7 +375,13 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
 
             imgsrc->retinexPrepareCurves(params->retinex, cdcurve, mapcurve, dehatransmissionCurve, dehagaintransmissionCurve, dehacontlutili, mapcontlutili, useHsl, lhist16RETI, histLRETI);
             float minCD, maxCD, mini, maxi, Tmean, Tsigma, Tmin, Tmax;
+            imgsrc->setCancellationToken(&cancellation);
             imgsrc->retinex(params->icm, params->retinex,  params->toneCurve, cdcurve, mapcurve, dehatransmissionCurve, dehagaintransmissionCurve, conversionBuffer, dehacontlutili, mapcontlutili, useHsl, minCD, maxCD, mini, maxi, Tmean, Tsigma, Tmin, Tmax, histLRETI);   //enabled Retinex
+            imgsrc->setCancellationToken(nullptr);
+
+            if (dropCancelledUpdate(todo)) {
+                return;
+            }
 
             if (dehaListener) {
                 dehaListener->minmaxChanged(maxCD, minCD, mini, maxi, Tmean, Tsigma, Tmin, Tmax);
@@ -494,14 +522,24 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
         readyphase++;
 
         if ((todo & M_HDR) && (params->fattal.enabled || params->dehaze.enabled)) {
-            if (fattal_11_dcrop_cache) {
-                delete fattal_11_dcrop_cache;
-                fattal_11_dcrop_cache = nullptr;
+            if (fattal_dcrop_gain) {
+                delete fattal_dcrop_gain;
+                fattal_dcrop_gain = nullptr;
             }
 
-            ipf.dehaze(orig_prev);
+            if (dehaze_dcrop_cache) {
+                delete dehaze_dcrop_cache;
+                dehaze_dcrop_cache = nullptr;
+            }
+
+            dehazeStats.valid = false;
+            ipf.dehaze(orig_prev, &dehazeStats);
             ipf.ToneMapFattal02(orig_prev);
 
+            if (dropCancelledUpdate(todo)) {
+                return;
+            }
+
             if (oprevi != orig_prev) {
                 delete oprevi;
             }
@@ -704,6 +742,7 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
 
                 ipf.rgbProc (oprevi, oprevl, nullptr, hltonecurve, shtonecurve, tonecurve, params->toneCurve.saturation,
                             rCurve, gCurve, bCurve, colourToningSatLimit, colourToningSatLimitOpacity, ctColorCurve, ctOpacityCurve, opautili, clToningcurve, cl2Toningcurve, customToneCurve1, customToneCurve2, beforeToneCurveBW, afterToneCurveBW, rrm, ggm, bbm, bwAutoR, bwAutoG, bwAutoB, params->toneCurve.expcomp, params->toneCurve.hlcompr, params->toneCurve.hlcomprthresh, dcpProf, as, histToneCurve);
+                labStagesValid = false;
 
                 if (params->blackwhite.enabled && params->blackwhite.autoc && abwListener) {
                     if (settings->verbose) {
@@ -766,214 +805,91 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
                                           params->labCurve.lccurve, chroma_acurve, chroma_bcurve, satcurve, lhskcurve, scale == 1 ? 1 : 16);
         }
 
-        if (todo & (M_LUMINANCE + M_COLOR)) {
-            nprevl->CopyFrom(oprevl);
-
-            progress("Applying Color Boost...", 100 * readyphase / numofphases);
-
-            histCCurve.clear();
-            histLCurve.clear();
-            ipf.chromiLuminanceCurve(nullptr, pW, nprevl, nprevl, chroma_acurve, chroma_bcurve, satcurve, lhskcurve, clcurve, lumacurve, utili, autili, butili, ccutili, cclutili, clcutili, histCCurve, histLCurve);
-            ipf.vibrance(nprevl);
-            ipf.labColorCorrectionRegions(nprevl);
-
-            if ((params->colorappearance.enabled && !params->colorappearance.tonecie) || (!params->colorappearance.enabled)) {
-                ipf.EPDToneMap(nprevl, 5, scale);
-            }
-
-            // for all treatments Defringe, Sharpening, Contrast detail , Microcontrast they are activated if "CIECAM" function are disabled
-            readyphase++;
-
-            /* Issue 2785, disabled some 1:1 tools
-                    if (scale==1) {
-                        if((params->colorappearance.enabled && !settings->autocielab) || (!params->colorappearance.enabled)){
-                            progress ("Denoising luminance impulse...",100*readyphase/numofphases);
-                            ipf.impulsedenoise (nprevl);
-                            readyphase++;
-                        }
-                        if((params->colorappearance.enabled && !settings->autocielab) || (!params->colorappearance.enabled)){
-                            progress ("Defringing...",100*readyphase/numofphases);
-                            ipf.defringe (nprevl);
-                            readyphase++;
-                        }
-                        if (params->sharpenEdge.enabled) {
-                            progress ("Edge sharpening...",100*readyphase/numofphases);
-                            ipf.MLsharpen (nprevl);
-                            readyphase++;
-                        }
-                        if (params->sharpenMicro.enabled) {
-                            if(( params->colorappearance.enabled && !settings->autocielab) || (!params->colorappearance.enabled)){
-                                progress ("Microcontrast...",100*readyphase/numofphases);
-                                ipf.MLmicrocontrast (nprevl);
-                                readyphase++;
-                            }
-                        }
-                        if(((params->colorappearance.enabled && !settings->autocielab) || (!params->colorappearance.enabled)) && params->sharpening.enabled) {
-                            progress ("Sharpening...",100*readyphase/numofphases);
-
-                            float **buffer = new float*[pH];
-                            for (int i=0; i<pH; i++)
-                                buffer[i] = new float[pW];
-
-                            ipf.sharpening (nprevl, (float**)buffer);
+        // Update the monitor color transform if necessary
+        if ((todo & M_MONITOR) || (lastOutputProfile != params->icm.outputProfile) || lastOutputIntent != params->icm.outputIntent || lastOutputBPC != params->icm.outputBPC) {
+            lastOutputProfile = params->icm.outputProfile;
+            lastOutputIntent = params->icm.outputIntent;
+            lastOutputBPC = params->icm.outputBPC;
+            ipf.updateColorProfiles(monitorProfile, monitorIntent, softProof, gamutCheck);
+        }
 
-                            for (int i=0; i<pH; i++)
-                                delete [] buffer[i];
-                            delete [] buffer;
-                            readyphase++;
-                        }
+        // Only the Lab stages from the first one whose parameters changed are run again, from the kept output of the previous stage
+        const int firstChangedLabStage = (todo & (M_LUMINANCE + M_COLOR)) ? getFirstChangedLabStage() : LAB_STAGES;
+
+        if (firstChangedLabStage < LAB_STAGES) {
+            const int restartStage = labStages.getRestartStage(firstChangedLabStage);
+            labStages.invalidate(restartStage);
+            LabImage* const labStagesInput = restartStage == LAB_ADJUSTMENTS ? oprevl : labStages.getOutput(restartStage - 1);
+
+            if (settings->progressivePreview && needsLabDraft(restartStage)) {
+                // Publishes a draft processed at a quarter of the preview resolution before the final pass
+                LabImage draft(pW / 4, pH / 4);
+                CieImage* draftCie = nullptr;
+                int draftphase = readyphase;
+                ipf.Lanczos(labStagesInput, &draft, 0.25f);
+                applyLabStages(&draft, draftCie, restartStage, scale * 4, true, draftphase);
+                delete draftCie;
+
+                if (!dropCancelledUpdate(todo)) {
+                    // nprevl keeps the result of the last final pass until the next one replaces it
+                    LabImage draftPreview(pW, pH);
+                    ipf.Lanczos(&draft, &draftPreview, 4.f);
+
+                    progress("Conversion to RGB...", 100 * draftphase / numofphases);
+
+                    {
+                        MyMutex::MyLock prevImgLock(previmg->getMutex());
+                        ipf.lab2monitorRgb(&draftPreview, previmg);
                     }
-            */
-            if (params->dirpyrequalizer.cbdlMethod == "aft") {
-                if (((params->colorappearance.enabled && !settings->autocielab) || (!params->colorappearance.enabled))) {
-                    progress("Pyramid wavelet...", 100 * readyphase / numofphases);
-                    ipf.dirpyrequalizer(nprevl, scale);
-                    //ipf.Lanczoslab (ip_wavelet(LabImage * lab, LabImage * dst, const procparams::EqualizerParams & eqparams), nprevl, 1.f/scale);
-                    readyphase++;
-                }
-            }
-
-
-            wavcontlutili = false;
-            //CurveFactory::curveWavContL ( wavcontlutili,params->wavelet.lcurve, wavclCurve, LUTu & histogramwavcl, LUTu & outBeforeWavCLurveHistogram,int skip);
-            CurveFactory::curveWavContL(wavcontlutili, params->wavelet.wavclCurve, wavclCurve, scale == 1 ? 1 : 16);
-
 
-            if ((params->wavelet.enabled)) {
-                WaveletParams WaveParams = params->wavelet;
-                //      WaveParams.getCurves(wavCLVCurve, waOpacityCurveRG, waOpacityCurveBY);
-                WaveParams.getCurves(wavCLVCurve, waOpacityCurveRG, waOpacityCurveBY, waOpacityCurveW, waOpacityCurveWL);
+                    if (!resultValid) {
+                        resultValid = true;
 
-                int kall = 0;
-                progress("Wavelet...", 100 * readyphase / numofphases);
-                //  ipf.ip_wavelet(nprevl, nprevl, kall, WaveParams, wavCLVCurve, waOpacityCurveRG, waOpacityCurveBY, scale);
-                ipf.ip_wavelet(nprevl, nprevl, kall, WaveParams, wavCLVCurve, waOpacityCurveRG, waOpacityCurveBY, waOpacityCurveW, waOpacityCurveWL, wavclCurve, scale);
-
-            }
-
-        ipf.softLight(nprevl);
-
-            if (params->colorappearance.enabled) {
-                //L histo  and Chroma histo for ciecam
-                // histogram well be for Lab (Lch) values, because very difficult to do with J,Q, M, s, C
-                int x1, y1, x2, y2;
-                params->crop.mapToResized(pW, pH, scale, x1, x2,  y1, y2);
-                lhist16CAM.clear();
-                lhist16CCAM.clear();
-
-                if (!params->colorappearance.datacie) {
-                    for (int x = 0; x < pH; x++)
-                        for (int y = 0; y < pW; y++) {
-                            int pos = CLIP((int)(nprevl->L[x][y]));
-                            int posc = CLIP((int)sqrt(nprevl->a[x][y] * nprevl->a[x][y] + nprevl->b[x][y] * nprevl->b[x][y]));
-                            lhist16CAM[pos]++;
-                            lhist16CCAM[posc]++;
+                        if (imageListener) {
+                            imageListener->setImage(previmg, scale, params->crop);
                         }
-                }
-
-                CurveFactory::curveLightBrightColor(params->colorappearance.curve, params->colorappearance.curve2, params->colorappearance.curve3,
-                                                    lhist16CAM, histLCAM, lhist16CCAM, histCCAM,
-                                                    customColCurve1, customColCurve2, customColCurve3, 1);
-
-                const FramesMetaData* metaData = imgsrc->getMetaData();
-                int imgNum = 0;
-
-                if (imgsrc->isRAW()) {
-                    if (imgsrc->getSensorType() == ST_BAYER) {
-                        imgNum = rtengine::LIM<unsigned int>(params->raw.bayersensor.imageNum, 0, metaData->getFrameCount() - 1);
-                    } else if (imgsrc->getSensorType() == ST_FUJI_XTRANS) {
-                        //imgNum = rtengine::LIM<unsigned int>(params->raw.xtranssensor.imageNum, 0, metaData->getFrameCount() - 1);
                     }
-                }
-
-                float fnum = metaData->getFNumber(imgNum);          // F number
-                float fiso = metaData->getISOSpeed(imgNum) ;        // ISO
-                float fspeed = metaData->getShutterSpeed(imgNum) ;  // Speed
-                double fcomp = metaData->getExpComp(imgNum);        // Compensation +/-
-                double adap;
-
-                if (fnum < 0.3f || fiso < 5.f || fspeed < 0.00001f) { //if no exif data or wrong
-                    adap = 2000.;
-                } else {
-                    double E_V = fcomp + log2(double ((fnum * fnum) / fspeed / (fiso / 100.f)));
-                    E_V += params->toneCurve.expcomp;// exposure compensation in tonecurve ==> direct EV
-                    E_V += log2(params->raw.expos);  // exposure raw white point ; log2 ==> linear to EV
-                    adap = powf(2.f, E_V - 3.f);  // cd / m2
-                    // end calculation adaptation scene luminosity
-                }
-
-                float d, dj, yb;
-                bool execsharp = false;
-
-                if (!ncie) {
-                    ncie = new CieImage(pW, pH);
-                }
-
-                if (!CAMBrightCurveJ && (params->colorappearance.algo == "JC" || params->colorappearance.algo == "JS" || params->colorappearance.algo == "ALL")) {
-                    CAMBrightCurveJ(32768, 0);
-                }
-
-                if (!CAMBrightCurveQ && (params->colorappearance.algo == "QM" || params->colorappearance.algo == "ALL")) {
-                    CAMBrightCurveQ(32768, 0);
-                }
 
-                // Issue 2785, only float version of ciecam02 for navigator and pan background
-                CAMMean = NAN;
-                CAMBrightCurveJ.dirty = true;
-                CAMBrightCurveQ.dirty = true;
-
-                ipf.ciecam_02float(ncie, float (adap), pW, 2, nprevl, params.get(), customColCurve1, customColCurve2, customColCurve3, histLCAM, histCCAM, CAMBrightCurveJ, CAMBrightCurveQ, CAMMean, 5, scale, execsharp, d, dj, yb, 1);
+                    if (imageListener) {
+                        imageListener->imageReady(params->crop);
+                    }
 
-                if ((params->colorappearance.autodegree || params->colorappearance.autodegreeout) && acListener && params->colorappearance.enabled) {
-                    acListener->autoCamChanged(100.* (double)d, 100.* (double)dj);
+                    draftPublished = true;
                 }
 
-                if (params->colorappearance.autoadapscen && acListener && params->colorappearance.enabled) {
-                    acListener->adapCamChanged(adap);    //real value of adapt scene
-                }
+                // The final pass is dropped if the parameters changed meanwhile, the next update does it for the new ones
+                cancelled = dropCancelledUpdate(todo);
+            }
 
-                if (params->colorappearance.autoybscen && acListener && params->colorappearance.enabled) {
-                    acListener->ybCamChanged((int) yb);    //real value Yb scene
-                }
+            if (!cancelled) {
+                nprevl->CopyFrom(labStagesInput);
+                applyLabStages(nprevl, ncie, restartStage, scale, false, readyphase);
+                cancelled = dropCancelledUpdate(todo);
+            }
 
-                readyphase++;
+            if (!cancelled) {
+                labStageParams = *params;
+                labStagesValid = true;
             } else {
-                // CIECAM is disabled, we free up its image buffer to save some space
-                if (ncie) {
-                    delete ncie;
-                }
-
-                ncie = nullptr;
-
-                if (CAMBrightCurveJ) {
-                    CAMBrightCurveJ.reset();
-                }
-
-                if (CAMBrightCurveQ) {
-                    CAMBrightCurveQ.reset();
-                }
+                // the stages from restartStage on are missing or hold outputs of the dropped parameters,
+                // while labStageParams still holds the ones of the last complete run
+                labStages.invalidate();
+                labStagesValid = false;
             }
         }
-
-        // Update the monitor color transform if necessary
-        if ((todo & M_MONITOR) || (lastOutputProfile != params->icm.outputProfile) || lastOutputIntent != params->icm.outputIntent || lastOutputBPC != params->icm.outputBPC) {
-            lastOutputProfile = params->icm.outputProfile;
-            lastOutputIntent = params->icm.outputIntent;
-            lastOutputBPC = params->icm.outputBPC;
-            ipf.updateColorProfiles(monitorProfile, monitorIntent, softProof, gamutCheck);
-        }
     }
 
     // process crop, if needed
-    for (size_t i = 0; i < crops.size(); i++)
+    for (size_t i = 0; i < crops.size() && !cancelled; i++)
         if (crops[i]->hasListener() && (panningRelatedChange || (highDetailNeeded && options.prevdemo != PD_Sidecar) || (todo & (M_MONITOR | M_RGBCURVE | M_LUMACURVE)) || crops[i]->get_skip() == 1)) {
             crops[i]->update(todo);     // may call ourselves
+            cancelled = dropCancelledUpdate(todo);
         }
 
-    if (panningRelatedChange || (todo & M_MONITOR)) {
+    if ((panningRelatedChange || (todo & M_MONITOR) || draftPublished) && !cancelled) {
         progress("Conversion to RGB...", 100 * readyphase / numofphases);
 
-        if ((todo != CROP && todo != MINUPDATE) || (todo & M_MONITOR)) {
+        if ((todo != CROP && todo != MINUPDATE) || (todo & M_MONITOR) || draftPublished) {
             MyMutex::MyLock prevImgLock(previmg->getMutex());
 
             try {
@@ -1019,6 +935,344 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
 }
 
 
+/** @brief Runs the Lab stages from restartStage on lab
+ *
+ * @param skip scale at which lab is processed
+ * @param draft true for the draft of the progressive preview: the outputs of the stages aren't kept,
+ *        the histograms and listeners aren't updated, and CIECAM runs on its own curves and histograms
+ */
+void ImProcCoordinator::applyLabStages(LabImage* lab, CieImage*& cie, int restartStage, int skip, bool draft, int& readyphase)
+{
+    if (restartStage <= LAB_ADJUSTMENTS) {
+        progress("Applying Color Boost...", 100 * readyphase / numofphases);
+
+        if (!draft) {
+            histCCurve.clear();
+            histLCurve.clear();
+        }
+
+        ipf.chromiLuminanceCurve(nullptr, draft ? 1 : lab->W, lab, lab, chroma_acurve, chroma_bcurve, satcurve, lhskcurve, clcurve, lumacurve, utili, autili, butili, ccutili, cclutili, clcutili, histCCurve, histLCurve);
+        ipf.vibrance(lab);
+        ipf.labColorCorrectionRegions(lab);
+
+        if ((params->colorappearance.enabled && !params->colorappearance.tonecie) || (!params->colorappearance.enabled)) {
+            ipf.EPDToneMap(lab, 5, skip);
+        }
+
+        if (!draft) {
+            labStages.store(LAB_ADJUSTMENTS, lab);
+        }
+    }
+
+    // for all treatments Defringe, Sharpening, Contrast detail , Microcontrast they are activated if "CIECAM" function are disabled
+    readyphase++;
+
+    /* Issue 2785, disabled some 1:1 tools
+            if (scale==1) {
+                if((params->colorappearance.enabled && !settings->autocielab) || (!params->colorappearance.enabled)){
+                    progress ("Denoising luminance impulse...",100*readyphase/numofphases);
+                    ipf.impulsedenoise (nprevl);
+                    readyphase++;
+                }
+                if((params->colorappearance.enabled && !settings->autocielab) || (!params->colorappearance.enabled)){
+                    progress ("Defringing...",100*readyphase/numofphases);
+                    ipf.defringe (nprevl);
+                    readyphase++;
+                }
+                if (params->sharpenEdge.enabled) {
+                    progress ("Edge sharpening...",100*readyphase/numofphases);
+                    ipf.MLsharpen (nprevl);
+                    readyphase++;
+                }
+                if (params->sharpenMicro.enabled) {
+                    if(( params->colorappearance.enabled && !settings->autocielab) || (!params->colorappearance.enabled)){
+                        progress ("Microcontrast...",100*readyphase/numofphases);
+                        ipf.MLmicrocontrast (nprevl);
+                        readyphase++;
+                    }
+                }
+                if(((params->colorappearance.enabled && !settings->autocielab) || (!params->colorappearance.enabled)) && params->sharpening.enabled) {
+                    progress ("Sharpening...",100*readyphase/numofphases);
+
+                    float **buffer = new float*[pH];
+                    for (int i=0; i<pH; i++)
+                        buffer[i] = new float[pW];
+
+                    ipf.sharpening (nprevl, (float**)buffer);
+
+                    for (int i=0; i<pH; i++)
+                        delete [] buffer[i];
+                    delete [] buffer;
+                    readyphase++;
+                }
+            }
+    */
+    if (restartStage <= LAB_CBDL && params->dirpyrequalizer.cbdlMethod == "aft" && params->dirpyrequalizer.enabled) {
+        if (((params->colorappearance.enabled && !settings->autocielab) || (!params->colorappearance.enabled))) {
+            progress("Pyramid wavelet...", 100 * readyphase / numofphases);
+            ipf.dirpyrequalizer(lab, skip);
+            //ipf.Lanczoslab (ip_wavelet(LabImage * lab, LabImage * dst, const procparams::EqualizerParams & eqparams), lab, 1.f/skip);
+
+            if (!draft) {
+                labStages.store(LAB_CBDL, lab);
+            }
+
+            readyphase++;
+        }
+    }
+
+
+    wavcontlutili = false;
+    //CurveFactory::curveWavContL ( wavcontlutili,params->wavelet.lcurve, wavclCurve, LUTu & histogramwavcl, LUTu & outBeforeWavCLurveHistogram,int skip);
+    CurveFactory::curveWavContL(wavcontlutili, params->wavelet.wavclCurve, wavclCurve, scale == 1 ? 1 : 16);
+
+
+    if (restartStage <= LAB_WAVELETS && params->wavelet.enabled) {
+        WaveletParams WaveParams = params->wavelet;
+        //      WaveParams.getCurves(wavCLVCurve, waOpacityCurveRG, waOpacityCurveBY);
+        WaveParams.getCurves(wavCLVCurve, waOpacityCurveRG, waOpacityCurveBY, waOpacityCurveW, waOpacityCurveWL);
+
+        int kall = 0;
+        progress("Wavelet...", 100 * readyphase / numofphases);
+        //  ipf.ip_wavelet(lab, lab, kall, WaveParams, wavCLVCurve, waOpacityCurveRG, waOpacityCurveBY, skip);
+        ipf.ip_wavelet(lab, lab, kall, WaveParams, wavCLVCurve, waOpacityCurveRG, waOpacityCurveBY, waOpacityCurveW, waOpacityCurveWL, wavclCurve, skip);
+
+        if (ipf.isCancelled()) {
+            // lab is dropped by the caller
+            return;
+        }
+
+        if (!draft) {
+            labStages.store(LAB_WAVELETS, lab);
+        }
+    }
+
+    if (restartStage <= LAB_SOFTLIGHT && params->softlight.enabled) {
+        ipf.softLight(lab);
+
+        if (!draft) {
+            labStages.store(LAB_SOFTLIGHT, lab);
+        }
+    }
+
+    if (params->colorappearance.enabled) {
+        // The draft works on its own curves and histograms, the detail crops keep using the ones of the last final pass
+        LUTu draftLhist16CAM, draftLhist16CCAM, draftHistLCAM, draftHistCCAM;
+        LUTf draftBrightCurveJ, draftBrightCurveQ;
+        float draftMean = NAN;
+
+        if (draft) {
+            draftLhist16CAM(lhist16CAM.getSize());
+            draftLhist16CCAM(lhist16CCAM.getSize());
+            draftHistLCAM(histLCAM.getSize());
+            draftHistCCAM(histCCAM.getSize());
+        }
+
+        LUTu& camLhist16 = draft ? draftLhist16CAM : lhist16CAM;
+        LUTu& camLhist16C = draft ? draftLhist16CCAM : lhist16CCAM;
+        LUTu& camHistL = draft ? draftHistLCAM : histLCAM;
+        LUTu& camHistC = draft ? draftHistCCAM : histCCAM;
+        LUTf& camBrightCurveJ = draft ? draftBrightCurveJ : CAMBrightCurveJ;
+        LUTf& camBrightCurveQ = draft ? draftBrightCurveQ : CAMBrightCurveQ;
+        float& camMean = draft ? draftMean : CAMMean;
+
+        //L histo  and Chroma histo for ciecam
+        // histogram well be for Lab (Lch) values, because very difficult to do with J,Q, M, s, C
+        int x1, y1, x2, y2;
+        params->crop.mapToResized(lab->W, lab->H, skip, x1, x2,  y1, y2);
+        camLhist16.clear();
+        camLhist16C.clear();
+
+        if (!params->colorappearance.datacie) {
+            for (int x = 0; x < lab->H; x++)
+                for (int y = 0; y < lab->W; y++) {
+                    int pos = CLIP((int)(lab->L[x][y]));
+                    int posc = CLIP((int)sqrt(lab->a[x][y] * lab->a[x][y] + lab->b[x][y] * lab->b[x][y]));
+                    camLhist16[pos]++;
+                    camLhist16C[posc]++;
+                }
+        }
+
+        CurveFactory::curveLightBrightColor(params->colorappearance.curve, params->colorappearance.curve2, params->colorappearance.curve3,
+                                            camLhist16, camHistL, camLhist16C, camHistC,
+                                            customColCurve1, customColCurve2, customColCurve3, 1);
+
+        const FramesMetaData* metaData = imgsrc->getMetaData();
+        int imgNum = 0;
+
+        if (imgsrc->isRAW()) {
+            if (imgsrc->getSensorType() == ST_BAYER) {
+                imgNum = rtengine::LIM<unsigned int>(params->raw.bayersensor.imageNum, 0, metaData->getFrameCount() - 1);
+            } else if (imgsrc->getSensorType() == ST_FUJI_XTRANS) {
+                //imgNum = rtengine::LIM<unsigned int>(params->raw.xtranssensor.imageNum, 0, metaData->getFrameCount() - 1);
+            }
+        }
+
+        float fnum = metaData->getFNumber(imgNum);          // F number
+        float fiso = metaData->getISOSpeed(imgNum) ;        // ISO
+        float fspeed = metaData->getShutterSpeed(imgNum) ;  // Speed
+        double fcomp = metaData->getExpComp(imgNum);        // Compensation +/-
+        double adap;
+
+        if (fnum < 0.3f || fiso < 5.f || fspeed < 0.00001f) { //if no exif data or wrong
+            adap = 2000.;
+        } else {
+            double E_V = fcomp + log2(double ((fnum * fnum) / fspeed / (fiso / 100.f)));
+            E_V += params->toneCurve.expcomp;// exposure compensation in tonecurve ==> direct EV
+            E_V += log2(params->raw.expos);  // exposure raw white point ; log2 ==> linear to EV
+            adap = powf(2.f, E_V - 3.f);  // cd / m2
+            // end calculation adaptation scene luminosity
+        }
+
+        float d, dj, yb;
+        bool execsharp = false;
+
+        if (!cie) {
+            cie = new CieImage(lab->W, lab->H);
+        }
+
+        if (!camBrightCurveJ && (params->colorappearance.algo == "JC" || params->colorappearance.algo == "JS" || params->colorappearance.algo == "ALL")) {
+            camBrightCurveJ(32768, 0);
+        }
+
+        if (!camBrightCurveQ && (params->colorappearance.algo == "QM" || params->colorappearance.algo == "ALL")) {
+            camBrightCurveQ(32768, 0);
+        }
+
+        // Issue 2785, only float version of ciecam02 for navigator and pan background
+        camMean = NAN;
+        camBrightCurveJ.dirty = true;
+        camBrightCurveQ.dirty = true;
+
+        ipf.ciecam_02float(cie, float (adap), draft ? 1 : lab->W, 2, lab, params.get(), customColCurve1, customColCurve2, customColCurve3, camHistL, camHistC, camBrightCurveJ, camBrightCurveQ, camMean, 5, skip, execsharp, d, dj, yb, 1);
+
+        // the listeners only get the values of the final pass
+        if ((params->colorappearance.autodegree || params->colorappearance.autodegreeout) && acListener && params->colorappearance.enabled && !draft) {
+            acListener->autoCamChanged(100.* (double)d, 100.* (double)dj);
+        }
+
+        if (params->colorappearance.autoadapscen && acListener && params->colorappearance.enabled && !draft) {
+            acListener->adapCamChanged(adap);    //real value of adapt scene
+        }
+
+        if (params->colorappearance.autoybscen && acListener && params->colorappearance.enabled && !draft) {
+            acListener->ybCamChanged((int) yb);    //real value Yb scene
+        }
+
+        readyphase++;
+    } else {
+        // CIECAM is disabled, we free up its image buffer to save some space
+        if (cie) {
+            delete cie;
+        }
+
+        cie = nullptr;
+
+        if (CAMBrightCurveJ && !draft) {
+            CAMBrightCurveJ.reset();
+        }
+
+        if (CAMBrightCurveQ && !draft) {
+            CAMBrightCurveQ.reset();
+        }
+    }
+}
+
+bool ImProcCoordinator::needsLabDraft(int restartStage) const
+{
+    // The draft only saves time with the slow stages and large enough previews
+    return
+        pW >= 256 && pH >= 256
+        && (
+            (restartStage <= LAB_ADJUSTMENTS && params->epd.enabled)
+            || (restartStage <= LAB_WAVELETS && params->wavelet.enabled)
+            || params->colorappearance.enabled
+        );
+}
+
+/** @brief Checks whether the running update was cancelled for newer parameters
+ *
+ * @return true if it was, its work is then redone by the next update
+ */
+bool ImProcCoordinator::dropCancelledUpdate(int todo)
+{
+    if (!cancellation.isCancelled()) {
+        return false;
+    }
+
+    MyMutex::MyLock updateLock(paramsUpdateMutex);
+    droppedChanges |= todo;
+
+    return true;
+}
+
+/** @brief Compares the parameters consumed by each Lab stage with the ones of their last run
+ *
+ * @return the first stage to run again, LAB_STAGES if none
+ */
+int ImProcCoordinator::getFirstChangedLabStage() const
+{
+    const ProcParams& last = labStageParams;
+
+    if (
+        !labStagesValid
+        || params->icm.workingProfile != last.icm.workingProfile
+        || params->toneCurve.hrenabled != last.toneCurve.hrenabled
+        || params->ppVersion != last.ppVersion
+    ) {
+        return LAB_ADJUSTMENTS;
+    }
+
+    if (
+        params->labCurve != last.labCurve
+        || params->vibrance != last.vibrance
+        || params->colorToning != last.colorToning
+        || params->epd != last.epd
+        || params->blackwhite.enabled != last.blackwhite.enabled
+        || params->blackwhite.method != last.blackwhite.method
+        || params->dirpyrDenoise.enabled != last.dirpyrDenoise.enabled
+        || params->dirpyrDenoise.chroma != last.dirpyrDenoise.chroma
+        || params->colorappearance.enabled != last.colorappearance.enabled
+        || params->colorappearance.tonecie != last.colorappearance.tonecie
+        || params->colorappearance.gamut != last.colorappearance.gamut
+        || params->wavelet.enabled != last.wavelet.enabled
+        || params->wavelet.tmrs != last.wavelet.tmrs
+    ) {
+        return LAB_ADJUSTMENTS;
+    }
+
+    // The parameters of a disabled stage don't matter
+    if ((params->dirpyrequalizer.enabled || last.dirpyrequalizer.enabled) && params->dirpyrequalizer != last.dirpyrequalizer) {
+        return LAB_CBDL;
+    }
+
+    if ((params->wavelet.enabled || last.wavelet.enabled) && params->wavelet != last.wavelet) {
+        return LAB_WAVELETS;
+    }
+
+    if ((params->softlight.enabled || last.softlight.enabled) && params->softlight != last.softlight) {
+        return LAB_SOFTLIGHT;
+    }
+
+    if (
+        (params->colorappearance.enabled || last.colorappearance.enabled)
+        && (
+            params->colorappearance != last.colorappearance
+            || params->toneCurve != last.toneCurve
+            || params->raw.expos != last.raw.expos
+            || params->wb != last.wb
+            || params->sharpening != last.sharpening
+            || params->sharpenMicro != last.sharpenMicro
+            || params->impulseDenoise != last.impulseDenoise
+            || params->defringe != last.defringe
+        )
+    ) {
+        return LAB_CIECAM;
+    }
+
+    return LAB_STAGES;
+}
+
 void ImProcCoordinator::freeAll()
 {
 
@@ -1092,6 +1346,8 @@ void ImProcCoordinator::setScale(int prevscale)
         workimg = new Image8(pW, pH);
 
         allocated = true;
+        labStages.invalidate();
+        labStagesValid = false;
     }
 
     scale = prevscale;
@@ -1432,6 +1688,7 @@ void ImProcCoordinator::stopProcessing()
 
     if (updaterRunning && thread) {
         changeSinceLast = 0;
+        cancellation.cancel();
         thread->join();
     }
 
@@ -1462,6 +1719,11 @@ void ImProcCoordinator::startProcessing(int changeCode)
 {
     paramsUpdateMutex.lock();
     changeSinceLast |= changeCode;
+
+    if (updaterRunning && (changeCode & (M_VOID - 1))) {
+        cancellation.cancel();
+    }
+
     paramsUpdateMutex.unlock();
 
     startProcessing();
@@ -1477,7 +1739,8 @@ void ImProcCoordinator::process()
 
     while (changeSinceLast) {
         const bool panningRelatedChange =
-               params->toneCurve != nextParams->toneCurve
+               droppedChanges != 0
+            || params->toneCurve != nextParams->toneCurve
             || params->labCurve != nextParams->labCurve
             || params->localContrast != nextParams->localContrast
             || params->rgbCurves != nextParams->rgbCurves
@@ -1512,8 +1775,10 @@ void ImProcCoordinator::process()
             || params->dehaze != nextParams->dehaze;
 
         *params = *nextParams;
-        int change = changeSinceLast;
+        int change = changeSinceLast | droppedChanges;
         changeSinceLast = 0;
+        droppedChanges = 0;
+        cancellation.reset();
         paramsUpdateMutex.unlock();
 
         // M_VOID means no update, and is a bit higher that the rest
@@ -1549,6 +1814,11 @@ void ImProcCoordinator::endUpdateParams(int changeFlags)
 {
     changeSinceLast |= changeFlags;
 
+    if (updaterRunning && (changeFlags & (M_VOID - 1))) {
+        // the running update is stale, its work is merged into the next one
+        cancellation.cancel();
+    }
+
     paramsUpdateMutex.unlock();
     startProcessing();
 }
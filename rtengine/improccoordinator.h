@@ -22,12 +22,14 @@
 #include <memory>
 
 #include "rtengine.h"
+#include "cancellation.h"
 #include "improcfun.h"
 #include "image8.h"
 #include "image16.h"
 #include "imagesource.h"
 #include "procevents.h"
 #include "dcrop.h"
+#include "labstagecache.h"
 #include "LUT.h"
 #include "../rtgui/threadutils.h"
 
@@ -59,7 +61,11 @@ protected:
     Imagefloat *oprevi;
     LabImage *oprevl;
     LabImage *nprevl;
-    Imagefloat *fattal_11_dcrop_cache; // global cache for ToneMapFattal02 used in 1:1 detail windows (except when denoise is active)
+    array2D<float> *fattal_dcrop_gain; // global cache of the ToneMapFattal02 gain of the whole image, used by the detail windows
+    int fattal_dcrop_gain_skip;        // scale of fattal_dcrop_gain
+    Imagefloat *dehaze_dcrop_cache;    // global cache of the dehazed whole image without denoise, used by the detail windows
+    int dehaze_dcrop_cache_skip;       // scale of dehaze_dcrop_cache
+    ImProcFunctions::DehazeStats dehazeStats; // estimated on the preview, used by the detail windows
     Image8 *previmg;  // displayed image in monitor color space, showing the output profile as well (soft-proofing enabled, which then correspond to workimg) or not
     Image8 *workimg;  // internal image in output color space for analysis
     CieImage *ncie;
@@ -178,11 +184,29 @@ protected:
 
     MyMutex minit;  // to gain mutually exclusive access to ... to what exactly?
 
+    // Stages of the Lab part of the preview pipeline, from oprevl to nprevl
+    enum LabStage {
+        LAB_ADJUSTMENTS,    // Lab curves, vibrance, Lab regions and edge preserving tone mapping
+        LAB_CBDL,           // contrast by detail levels applied after the black and white conversion
+        LAB_WAVELETS,
+        LAB_SOFTLIGHT,
+        LAB_CIECAM,
+        LAB_STAGES
+    };
+
+    LabStageCache labStages;    // outputs of the Lab stages, to restart from the first stage whose parameters changed
+    ProcParams labStageParams;  // parameters of the last run of the Lab stages
+    bool labStagesValid;        // false when oprevl changed since the last run of the Lab stages
+
     void progress (Glib::ustring str, int pr);
     void reallocAll ();
     void updateLRGBHistograms ();
     void setScale (int prevscale);
     void updatePreviewImage (int todo, bool panningRelatedChange);
+    int getFirstChangedLabStage () const;
+    void applyLabStages (LabImage* lab, CieImage*& cie, int restartStage, int skip, bool draft, int& readyphase);
+    bool needsLabDraft (int restartStage) const;
+    bool dropCancelledUpdate (int todo);
 
     MyMutex mProcessing;
     const std::unique_ptr<ProcParams> params;
@@ -199,6 +223,8 @@ protected:
     MyMutex updaterThreadStart;
     MyMutex paramsUpdateMutex;
     int  changeSinceLast;
+    int  droppedChanges; // work of the updates cancelled for newer parameters, redone by the next update
+    CancellationToken cancellation; // cancelled when the parameters change during an update
     bool updaterRunning;
     const std::unique_ptr<ProcParams> nextParams;
     bool destroying;
@@ -24,6 +24,7 @@
 #endif
 
 #include "alignedbuffer.h"
+#include "cancellation.h"
 #include "rtengine.h"
 #include "improcfun.h"
 #include "curves.h"
@@ -44,6 +45,7 @@
 #include "procparams.h"
 #include "../rtgui/ppversion.h"
 #include "../rtgui/guiutils.h"
+#include "proctrace.h"
 
 #undef CLIPD
 #define CLIPD(a) ((a)>0.0f?((a)<1.0f?(a):1.0f):0.0f)
@@ -255,6 +257,18 @@ void fillEditFloat(float *editIFloatTmpR, float *editIFloatTmpG, float *editIFlo
         }
     }
 }
+// tools of rgbProc() which can be compiled out of its kernel, see ImProcFunctions::rgbProcKernel()
+enum RGBProcTool : unsigned int {
+    RGBPROC_MIXER = 1 << 0,       // channel mixer
+    RGBPROC_PIPETTE = 1 << 1,     // filling of the pipette buffers
+    RGBPROC_RGBCURVES = 1 << 2,   // RGB curves
+    RGBPROC_HSV = 1 << 3,         // saturation and HSV equalizer
+    RGBPROC_COLORTONING = 1 << 4, // color toning
+    RGBPROC_BLACKWHITE = 1 << 5,  // black and white
+    RGBPROC_FILMSIM = 1 << 6,     // film simulation
+    RGBPROC_ALL = (1 << 7) - 1
+};
+
 // end of helper function for rgbProc()
 
 }
@@ -278,6 +292,16 @@ void ImProcFunctions::setScale (double iscale)
     scale = iscale;
 }
 
+void ImProcFunctions::setCancellationToken (const CancellationToken* token)
+{
+    cancellation = token;
+}
+
+bool ImProcFunctions::isCancelled() const
+{
+    return cancellation && cancellation->isCancelled();
+}
+
 
 void ImProcFunctions::updateColorProfiles (const Glib::ustring& monitorProfile, RenderingIntent monitorIntent, bool softProof, bool gamutCheck)
 {
@@ -489,6 +513,8 @@ void ImProcFunctions::ciecam_02float (CieImage* ncie, float adap, int pW, int pw
                                       LUTu & histLCAM, LUTu & histCCAM, LUTf & CAMBrightCurveJ, LUTf & CAMBrightCurveQ, float &mean, int Iterates, int scale, bool execsharp, float &d, float &dj, float &yb, int rtt,
                                       bool showSharpMask)
 {
+    PROCTRACE("ciecam_02float");
+
     if (params->colorappearance.enabled) {
 
 #ifdef _DEBUG
@@ -2061,7 +2087,67 @@ void ImProcFunctions::rgbProc (Imagefloat* working, LabImage* lab, PipetteBuffer
                                int sat, LUTf & rCurve, LUTf & gCurve, LUTf & bCurve, float satLimit, float satLimitOpacity, const ColorGradientCurve & ctColorCurve, const OpacityCurve & ctOpacityCurve, bool opautili, LUTf & clToningcurve, LUTf & cl2Toningcurve,
                                const ToneCurve & customToneCurve1, const ToneCurve & customToneCurve2,  const ToneCurve & customToneCurvebw1, const ToneCurve & customToneCurvebw2, double &rrm, double &ggm, double &bbm, float &autor, float &autog, float &autob, double expcomp, int hlcompr, int hlcomprthresh, DCPProfile *dcpProf, const DCPProfile::ApplyState &asIn, LUTu &histToneCurve, size_t chunkSize, bool measure)
 {
+    PROCTRACE("rgbProc");
+
+    // the tools which may be used on this image
+    unsigned int tools = 0;
+
+    if (params->chmixer.enabled) {
+        tools |= RGBPROC_MIXER;
+    }
+
+    if (pipetteBuffer && pipetteBuffer->getEditID() != EUID_None) {
+        tools |= RGBPROC_PIPETTE;
+    }
+
+    if (params->rgbCurves.enabled) {
+        tools |= RGBPROC_RGBCURVES;
+    }
+
+    if (sat != 0 || params->hsvequalizer.enabled) {
+        tools |= RGBPROC_HSV;
+    }
+
+    if (params->colorToning.enabled) {
+        tools |= RGBPROC_COLORTONING;
+    }
+
+    if (params->blackwhite.enabled) {
+        tools |= RGBPROC_BLACKWHITE;
+    }
 
+    if (params->filmSimulation.enabled) {
+        tools |= RGBPROC_FILMSIM;
+    }
+
+    // the kernels compiled for the most common combinations, from the most specialized one to the generic one
+    typedef decltype(&ImProcFunctions::rgbProcKernel<RGBPROC_ALL>) Kernel;
+    static const std::pair<unsigned int, Kernel> kernels[] = {
+        {0, &ImProcFunctions::rgbProcKernel<0>},
+        {RGBPROC_HSV, &ImProcFunctions::rgbProcKernel<RGBPROC_HSV>},
+        {RGBPROC_HSV | RGBPROC_RGBCURVES, &ImProcFunctions::rgbProcKernel<RGBPROC_HSV | RGBPROC_RGBCURVES>},
+        {RGBPROC_HSV | RGBPROC_FILMSIM, &ImProcFunctions::rgbProcKernel<RGBPROC_HSV | RGBPROC_FILMSIM>},
+        {RGBPROC_ALL, &ImProcFunctions::rgbProcKernel<RGBPROC_ALL>}
+    };
+
+    Kernel kernel = nullptr;
+
+    for (const auto& entry : kernels) {
+        if (!(tools & ~entry.first)) {
+            kernel = entry.second;
+            break;
+        }
+    }
+
+    (this->*kernel) (working, lab, pipetteBuffer, hltonecurve, shtonecurve, tonecurve, sat, rCurve, gCurve, bCurve, satLimit, satLimitOpacity, ctColorCurve, ctOpacityCurve, opautili, clToningcurve, cl2Toningcurve, customToneCurve1, customToneCurve2, customToneCurvebw1, customToneCurvebw2, rrm, ggm, bbm, autor, autog, autob, expcomp, hlcompr, hlcomprthresh, dcpProf, asIn, histToneCurve, chunkSize, measure);
+}
+
+// Body of rgbProc(): the tools which aren't in the tools mask are compiled out
+template<unsigned int tools>
+void ImProcFunctions::rgbProcKernel (Imagefloat* working, LabImage* lab, PipetteBuffer *pipetteBuffer, LUTf & hltonecurve, LUTf & shtonecurve, LUTf & tonecurve,
+                                     int sat, LUTf & rCurve, LUTf & gCurve, LUTf & bCurve, float satLimit, float satLimitOpacity, const ColorGradientCurve & ctColorCurve, const OpacityCurve & ctOpacityCurve, bool opautili, LUTf & clToningcurve, LUTf & cl2Toningcurve,
+                                     const ToneCurve & customToneCurve1, const ToneCurve & customToneCurve2,  const ToneCurve & customToneCurvebw1, const ToneCurve & customToneCurvebw2, double &rrm, double &ggm, double &bbm, float &autor, float &autog, float &autob, double expcomp, int hlcompr, int hlcomprthresh, DCPProfile *dcpProf, const DCPProfile::ApplyState &asIn, LUTu &histToneCurve, size_t chunkSize, bool measure)
+{
     std::unique_ptr<StopWatch> stop;
 
     if (measure) {
@@ -2073,7 +2159,7 @@ void ImProcFunctions::rgbProc (Imagefloat* working, LabImage* lab, PipetteBuffer
 
     Imagefloat* editImgFloat = nullptr;
     PlanarWhateverData<float>* editWhatever = nullptr;
-    EditUniqueID editID = pipetteBuffer ? pipetteBuffer->getEditID() : EUID_None;
+    const EditUniqueID editID = (tools & RGBPROC_PIPETTE) && pipetteBuffer ? pipetteBuffer->getEditID() : EUID_None;
 
     if (editID != EUID_None) {
         switch  (pipetteBuffer->getDataProvider()->getCurrSubscriber()->getPipetteBufferType()) {
@@ -2126,7 +2212,7 @@ void ImProcFunctions::rgbProc (Imagefloat* working, LabImage* lab, PipetteBuffer
         {wprof[2][0], wprof[2][1], wprof[2][2]}
     };
 
-    bool mixchannels = params->chmixer.enabled &&
+    const bool mixchannels = (tools & RGBPROC_MIXER) && params->chmixer.enabled &&
         (params->chmixer.red[0] != 100 || params->chmixer.red[1] != 0     || params->chmixer.red[2] != 0   ||
                         params->chmixer.green[0] != 0 || params->chmixer.green[1] != 100 || params->chmixer.green[2] != 0 ||
                         params->chmixer.blue[0] != 0  || params->chmixer.blue[1] != 0    || params->chmixer.blue[2] != 100);
@@ -2140,9 +2226,9 @@ void ImProcFunctions::rgbProc (Imagefloat* working, LabImage* lab, PipetteBuffer
     FlatCurveType sCurveType = (FlatCurveType)params->hsvequalizer.scurve.at (0);
     FlatCurveType vCurveType = (FlatCurveType)params->hsvequalizer.vcurve.at (0);
     FlatCurveType bwlCurveType = (FlatCurveType)params->blackwhite.luminanceCurve.at (0);
-    bool hCurveEnabled = params->hsvequalizer.enabled && hCurveType > FCT_Linear;
-    bool sCurveEnabled = params->hsvequalizer.enabled && sCurveType > FCT_Linear;
-    bool vCurveEnabled = params->hsvequalizer.enabled && vCurveType > FCT_Linear;
+    bool hCurveEnabled = (tools & RGBPROC_HSV) && params->hsvequalizer.enabled && hCurveType > FCT_Linear;
+    bool sCurveEnabled = (tools & RGBPROC_HSV) && params->hsvequalizer.enabled && sCurveType > FCT_Linear;
+    bool vCurveEnabled = (tools & RGBPROC_HSV) && params->hsvequalizer.enabled && vCurveType > FCT_Linear;
     bool bwlCurveEnabled = bwlCurveType > FCT_Linear;
 
     // TODO: We should create a 'skip' value like for CurveFactory::complexsgnCurve (rtengine/curves.cc)
@@ -2186,45 +2272,14 @@ void ImProcFunctions::rgbProc (Imagefloat* working, LabImage* lab, PipetteBuffer
         }
     }
 
-    std::shared_ptr<HaldCLUT> hald_clut;
-    bool clutAndWorkingProfilesAreSame = false;
-    TMatrix xyz2clut = {}, clut2xyz = {};
-#ifdef __SSE2__
-    vfloat v_work2xyz[3][3] ALIGNED16;
-    vfloat v_xyz2clut[3][3] ALIGNED16;
-    vfloat v_clut2xyz[3][3] ALIGNED16;
-    vfloat v_xyz2work[3][3] ALIGNED16;
-#endif
-
-    if ( params->filmSimulation.enabled && !params->filmSimulation.clutFilename.empty() ) {
-        hald_clut = CLUTStore::getInstance().getClut ( params->filmSimulation.clutFilename );
-
-        if ( hald_clut ) {
-            clutAndWorkingProfilesAreSame = hald_clut->getProfile() == params->icm.workingProfile;
-
-            if ( !clutAndWorkingProfilesAreSame ) {
-                xyz2clut = ICCStore::getInstance()->workingSpaceInverseMatrix ( hald_clut->getProfile() );
-                clut2xyz = ICCStore::getInstance()->workingSpaceMatrix ( hald_clut->getProfile() );
-
-#ifdef __SSE2__
-
-                for (int i = 0; i < 3; ++i) {
-                    for (int j = 0; j < 3; ++j) {
-                        v_work2xyz[i][j] = F2V (wprof[i][j]);
-                        v_xyz2clut[i][j] = F2V (xyz2clut[i][j]);
-                        v_xyz2work[i][j] = F2V (wiprof[i][j]);
-                        v_clut2xyz[i][j] = F2V (clut2xyz[i][j]);
-                    }
-                }
-
-#endif
+    // the CLUT with the profile conversions baked in, the strength is applied to its output
+    std::shared_ptr<BakedHaldCLUT> hald_clut;
+    const float film_simulation_strength = static_cast<float> (params->filmSimulation.strength) / 100.0f;
 
-            }
-        }
+    if ( (tools & RGBPROC_FILMSIM) && params->filmSimulation.enabled && !params->filmSimulation.clutFilename.empty() ) {
+        hald_clut = CLUTStore::getInstance().getBakedClut ( params->filmSimulation.clutFilename, params->icm.workingProfile );
     }
 
-    const float film_simulation_strength = static_cast<float> (params->filmSimulation.strength) / 100.0f;
-
     const float exp_scale = pow (2.0, expcomp);
     const float comp = (max (0.0, expcomp) + 1.0) * hlcompr / 100.0;
     const float shoulder = ((65536.0 / max (1.0f, exp_scale)) * (hlcomprthresh / 200.0)) + 0.1;
@@ -2254,8 +2309,8 @@ void ImProcFunctions::rgbProc (Imagefloat* working, LabImage* lab, PipetteBuffer
         userToneCurve.initApplyState (ptc2ApplyState, params->icm.workingProfile);
     }
 
-    bool hasColorToning = params->colorToning.enabled && bool (ctOpacityCurve) &&  bool (ctColorCurve) && params->colorToning.method != "LabGrid";
-    bool hasColorToningLabGrid = params->colorToning.enabled && params->colorToning.method == "LabGrid";
+    const bool hasColorToning = (tools & RGBPROC_COLORTONING) && params->colorToning.enabled && bool (ctOpacityCurve) &&  bool (ctColorCurve) && params->colorToning.method != "LabGrid";
+    const bool hasColorToningLabGrid = (tools & RGBPROC_COLORTONING) && params->colorToning.enabled && params->colorToning.method == "LabGrid";
     //  float satLimit = float(params->colorToning.satProtectionThreshold)/100.f*0.7f+0.3f;
     //  float satLimitOpacity = 1.f-(float(params->colorToning.saturatedOpacity)/100.f);
     float strProtect = (float (params->colorToning.strength) / 100.f);
@@ -2314,7 +2369,7 @@ void ImProcFunctions::rgbProc (Imagefloat* working, LabImage* lab, PipetteBuffer
     float chMixBG = float (params->chmixer.blue[1])/10.f;
     float chMixBB = float (params->chmixer.blue[2])/10.f;
 
-    bool blackwhite = params->blackwhite.enabled;
+    const bool blackwhite = (tools & RGBPROC_BLACKWHITE) && params->blackwhite.enabled;
     bool complem = params->blackwhite.enabledcc;
     float bwr = float (params->blackwhite.mixerRed);
     float bwg = float (params->blackwhite.mixerGreen);
@@ -2577,7 +2632,7 @@ void ImProcFunctions::rgbProc (Imagefloat* working, LabImage* lab, PipetteBuffer
                     }
                 }
 
-                if (params->rgbCurves.enabled && (rCurve || gCurve || bCurve)) { // if any of the RGB curves is engaged
+                if ((tools & RGBPROC_RGBCURVES) && params->rgbCurves.enabled && (rCurve || gCurve || bCurve)) { // if any of the RGB curves is engaged
                     if (!params->rgbCurves.lumamode) { // normal RGB mode
 
                         for (int i = istart, ti = 0; i < tH; i++, ti++) {
@@ -2690,7 +2745,7 @@ void ImProcFunctions::rgbProc (Imagefloat* working, LabImage* lab, PipetteBuffer
                     }
                 }
 
-                if (sat != 0 || hCurveEnabled || sCurveEnabled || vCurveEnabled) {
+                if ((tools & RGBPROC_HSV) && (sat != 0 || hCurveEnabled || sCurveEnabled || vCurveEnabled)) {
                     const float satby100 = sat / 100.f;
                     for (int i = istart, ti = 0; i < tH; i++, ti++) {
                         for (int j = jstart, tj = 0; j < tW; j++, tj++) {
@@ -3105,62 +3160,17 @@ void ImProcFunctions::rgbProc (Imagefloat* working, LabImage* lab, PipetteBuffer
 
 
                 // Film Simulations
-                if (hald_clut) {
+                if ((tools & RGBPROC_FILMSIM) && hald_clut) {
 
                     for (int i = istart, ti = 0; i < tH; i++, ti++) {
-                        if (!clutAndWorkingProfilesAreSame) {
-                            // Convert from working to clut profile
-                            int j = jstart;
-                            int tj = 0;
-
-#ifdef __SSE2__
-
-                            for (; j < tW - 3; j += 4, tj += 4) {
-                                vfloat sourceR = LVF (rtemp[ti * TS + tj]);
-                                vfloat sourceG = LVF (gtemp[ti * TS + tj]);
-                                vfloat sourceB = LVF (btemp[ti * TS + tj]);
-
-                                vfloat x;
-                                vfloat y;
-                                vfloat z;
-                                Color::rgbxyz (sourceR, sourceG, sourceB, x, y, z, v_work2xyz);
-                                Color::xyz2rgb (x, y, z, sourceR, sourceG, sourceB, v_xyz2clut);
-
-                                STVF (clutr[tj], sourceR);
-                                STVF (clutg[tj], sourceG);
-                                STVF (clutb[tj], sourceB);
-                            }
-
-#endif
-
-                            for (; j < tW; j++, tj++) {
-                                float sourceR = rtemp[ti * TS + tj];
-                                float sourceG = gtemp[ti * TS + tj];
-                                float sourceB = btemp[ti * TS + tj];
-
-                                float x, y, z;
-                                Color::rgbxyz ( sourceR, sourceG, sourceB, x, y, z, wprof );
-                                Color::xyz2rgb (x, y, z, clutr[tj], clutg[tj], clutb[tj], xyz2clut);
-                            }
-                        } else {
-                            memcpy(clutr, &rtemp[ti * TS], sizeof(float) * TS);
-                            memcpy(clutg, &gtemp[ti * TS], sizeof(float) * TS);
-                            memcpy(clutb, &btemp[ti * TS], sizeof(float) * TS);
-                        }
-
                         for (int j = jstart, tj = 0; j < tW; j++, tj++) {
-                            float &sourceR = clutr[tj];
-                            float &sourceG = clutg[tj];
-                            float &sourceB = clutb[tj];
-
                             // Apply gamma sRGB (default RT)
-                            sourceR = Color::gamma_srgbclipped (sourceR);
-                            sourceG = Color::gamma_srgbclipped (sourceG);
-                            sourceB = Color::gamma_srgbclipped (sourceB);
+                            clutr[tj] = Color::gamma_srgbclipped (rtemp[ti * TS + tj]);
+                            clutg[tj] = Color::gamma_srgbclipped (gtemp[ti * TS + tj]);
+                            clutb[tj] = Color::gamma_srgbclipped (btemp[ti * TS + tj]);
                         }
 
                         hald_clut->getRGB (
-                            film_simulation_strength,
                             std::min (TS, tW - jstart),
                             clutr,
                             clutg,
@@ -3168,56 +3178,21 @@ void ImProcFunctions::rgbProc (Imagefloat* working, LabImage* lab, PipetteBuffer
                             out_rgbx
                         );
 
-                        for (int j = jstart, tj = 0; j < tW; j++, tj++) {
-                            float &sourceR = clutr[tj];
-                            float &sourceG = clutg[tj];
-                            float &sourceB = clutb[tj];
-
-                            // Apply inverse gamma sRGB
-                            sourceR = Color::igamma_srgb (out_rgbx[tj * 4 + 0]);
-                            sourceG = Color::igamma_srgb (out_rgbx[tj * 4 + 1]);
-                            sourceB = Color::igamma_srgb (out_rgbx[tj * 4 + 2]);
-                        }
-
-                        if (!clutAndWorkingProfilesAreSame) {
-                            // Convert from clut to working profile
-                            int j = jstart;
-                            int tj = 0;
-
-#ifdef __SSE2__
-
-                            for (; j < tW - 3; j += 4, tj += 4) {
-                                vfloat sourceR = LVF (clutr[tj]);
-                                vfloat sourceG = LVF (clutg[tj]);
-                                vfloat sourceB = LVF (clutb[tj]);
-
-                                vfloat x;
-                                vfloat y;
-                                vfloat z;
-                                Color::rgbxyz (sourceR, sourceG, sourceB, x, y, z, v_clut2xyz);
-                                Color::xyz2rgb (x, y, z, sourceR, sourceG, sourceB, v_xyz2work);
-
-                                STVF (clutr[tj], sourceR);
-                                STVF (clutg[tj], sourceG);
-                                STVF (clutb[tj], sourceB);
+                        if (film_simulation_strength < 1.f) {
+                            // blended sRGB gamma encoded with the input of the lookup, like HaldCLUT::getRGB() does.
+                            // Same result as before when the CLUT has the working profile, else the blend is done
+                            // in the working space instead of the space of the CLUT.
+                            for (int j = jstart, tj = 0; j < tW; j++, tj++) {
+                                const float r = Color::igamma_srgb(intp(film_simulation_strength, Color::gamma_srgbclipped(out_rgbx[tj * 4 + 0]), clutr[tj]));
+                                const float g = Color::igamma_srgb(intp(film_simulation_strength, Color::gamma_srgbclipped(out_rgbx[tj * 4 + 1]), clutg[tj]));
+                                const float b = Color::igamma_srgb(intp(film_simulation_strength, Color::gamma_srgbclipped(out_rgbx[tj * 4 + 2]), clutb[tj]));
+                                setUnlessOOG(rtemp[ti * TS + tj], gtemp[ti * TS + tj], btemp[ti * TS + tj], r, g, b);
                             }
-
-#endif
-
-                            for (; j < tW; j++, tj++) {
-                                float &sourceR = clutr[tj];
-                                float &sourceG = clutg[tj];
-                                float &sourceB = clutb[tj];
-
-                                float x, y, z;
-                                Color::rgbxyz (sourceR, sourceG, sourceB, x, y, z, clut2xyz);
-                                Color::xyz2rgb ( x, y, z, sourceR, sourceG, sourceB, wiprof );
+                        } else {
+                            for (int j = jstart, tj = 0; j < tW; j++, tj++) {
+                                setUnlessOOG(rtemp[ti * TS + tj], gtemp[ti * TS + tj], btemp[ti * TS + tj], out_rgbx[tj * 4 + 0], out_rgbx[tj * 4 + 1], out_rgbx[tj * 4 + 2]);
                             }
                         }
-
-                        for (int j = jstart, tj = 0; j < tW; j++, tj++) {
-                            setUnlessOOG(rtemp[ti * TS + tj], gtemp[ti * TS + tj], btemp[ti * TS + tj], clutr[tj], clutg[tj], clutb[tj]);
-                        }
                     }
                 }
 
@@ -4160,6 +4135,7 @@ void ImProcFunctions::luminanceCurve (LabImage* lold, LabImage* lnew, LUTf & cur
 
 void ImProcFunctions::chromiLuminanceCurve (PipetteBuffer *pipetteBuffer, int pW, LabImage* lold, LabImage* lnew, LUTf & acurve, LUTf & bcurve, LUTf & satcurve, LUTf & lhskcurve, LUTf & clcurve, LUTf & curve, bool utili, bool autili, bool butili, bool ccutili, bool cclutili, bool clcutili, LUTu &histCCurve, LUTu &histLCurve)
 {
+    PROCTRACE("chromiLuminanceCurve");
 
     int W = lold->W;
     int H = lold->H;
@@ -5231,6 +5207,8 @@ void ImProcFunctions::EPDToneMapCIE (CieImage *ncie, float a_w, float c_, int Wi
 //#include "EdgePreservingDecomposition.cc"
 void ImProcFunctions::EPDToneMap (LabImage *lab, unsigned int Iterates, int skip)
 {
+    PROCTRACE("EPDToneMap");
+
     //Hasten access to the parameters.
 //  EPDParams *p = (EPDParams *)(&params->epd);
 
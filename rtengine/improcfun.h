@@ -34,6 +34,7 @@
 #include "cplx_wavelet_dec.h"
 #include "pipettebuffer.h"
 #include "gamutwarning.h"
+#include "array2D.h"
 
 namespace rtengine
 {
@@ -52,6 +53,9 @@ struct WaveletParams;
 
 enum RenderingIntent : int;
 
+class CancellationToken;
+struct WarpMapKey;
+
 class ImProcFunctions
 {
     cmsHTRANSFORM monitorTransform;
@@ -60,12 +64,21 @@ class ImProcFunctions
     const ProcParams* params;
     double scale;
     bool multiThread;
+    int denoiseNestedLevels; // threads of each nested team of RGB_denoise
+    int wavNestedLevels; // threads of each nested team of ip_wavelet
+    const CancellationToken* cancellation; // checked by the long running stages, nullptr if they can't be cancelled
 
     void calcVignettingParams(int oW, int oH, const procparams::VignettingParams& vignetting, double &w2, double &h2, double& maxRadius, double &v, double &b, double &mul);
 
     void transformLuminanceOnly(Imagefloat* original, Imagefloat* transformed, int cx, int cy, int oW, int oH, int fW, int fH);
-    void transformGeneral(bool highQuality, Imagefloat *original, Imagefloat *transformed, int cx, int cy, int sx, int sy, int oW, int oH, int fW, int fH, const LensCorrection *pLCPMap);
-    void transformLCPCAOnly(Imagefloat *original, Imagefloat *transformed, int cx, int cy, const LensCorrection *pLCPMap);
+    void transformGeneral(bool highQuality, Imagefloat *original, Imagefloat *transformed, int cx, int cy, int sx, int sy, int oW, int oH, int fW, int fH, const LensCorrection *pLCPMap, WarpMapKey warpKey);
+    void transformLCPCAOnly(Imagefloat *original, Imagefloat *transformed, int cx, int cy, const LensCorrection *pLCPMap, WarpMapKey warpKey);
+    // rgbProc() compiled for a subset of its tools, see RGBProcTool in improcfun.cc
+    template<unsigned int tools>
+    void rgbProcKernel(Imagefloat* working, LabImage* lab, PipetteBuffer *pipetteBuffer, LUTf & hltonecurve, LUTf & shtonecurve, LUTf & tonecurve,
+                       int sat, LUTf & rCurve, LUTf & gCurve, LUTf & bCurve, float satLimit, float satLimitOpacity, const ColorGradientCurve & ctColorCurve, const OpacityCurve & ctOpacityCurve, bool opautili, LUTf & clcurve, LUTf & cl2curve, const ToneCurve & customToneCurve1, const ToneCurve & customToneCurve2,
+                       const ToneCurve & customToneCurvebw1, const ToneCurve & customToneCurvebw2, double &rrm, double &ggm, double &bbm, float &autor, float &autog, float &autob,
+                       double expcomp, int hlcompr, int hlcomprthresh, DCPProfile *dcpProf, const DCPProfile::ApplyState &asIn, LUTu &histToneCurve, size_t chunkSize, bool measure);
 
     bool needsCA();
     bool needsDistortion();
@@ -201,13 +214,16 @@ public:
     double lumimul[3];
 
     ImProcFunctions(const ProcParams* iparams, bool imultiThread = true)
-        : monitorTransform(nullptr), params(iparams), scale(1), multiThread(imultiThread), lumimul{} {}
+        : monitorTransform(nullptr), params(iparams), scale(1), multiThread(imultiThread), denoiseNestedLevels(1), wavNestedLevels(1), cancellation(nullptr), lumimul{} {}
     ~ImProcFunctions();
     bool needsLuminanceOnly()
     {
         return !(needsCA() || needsDistortion() || needsRotation() || needsPerspective() || needsLCP() || needsLensfun()) && (needsVignetting() || needsPCVignetting() || needsGradient());
     }
     void setScale(double iscale);
+    /** RGB_denoise, ip_wavelet and ToneMapFattal02 stop early when token is cancelled, leaving their output undefined */
+    void setCancellationToken(const CancellationToken* token);
+    bool isCancelled() const;
 
     bool needsTransform();
     bool needsPCVignetting();
@@ -247,6 +263,8 @@ public:
     void resize(Imagefloat* src, Imagefloat* dst, float dScale);
     void Lanczos(const LabImage* src, LabImage* dst, float scale);
     void Lanczos(const Imagefloat* src, Imagefloat* dst, float scale);
+    /** Resizes src to several sizes, given as pairs of the output image and its scale, the smaller ones from the larger ones */
+    void Lanczos(const LabImage* src, const std::vector<std::pair<LabImage*, float>>& dsts);
 
     void deconvsharpening(float** luminance, float** buffer, int W, int H, const procparams::SharpeningParams &sharpenParam);
     void MLsharpen(LabImage* lab); // Manuel's clarity / sharpening
@@ -348,8 +366,20 @@ public:
     void Badpixelscam(CieImage * ncie, double radius, int thresh, int mode, float chrom, bool hotbad);
     void BadpixelsLab(LabImage * lab, double radius, int thresh, float chrom);
 
-    void dehaze(Imagefloat *rgb);
+    /** Global statistics of dehaze, which a detail crop takes from the preview */
+    struct DehazeStats {
+        DehazeStats() : valid(false), fulldim(0), ambient{}, max_t(0.f) {}
+        bool valid;
+        int fulldim; // largest dimension of the image at full scale
+        float ambient[3];
+        float max_t;
+    };
+    /** If stats is valid, uses it instead of estimating the ambient light on rgb. Otherwise fills it, if not nullptr. */
+    void dehaze(Imagefloat *rgb, DehazeStats *stats = nullptr);
     void ToneMapFattal02(Imagefloat *rgb);
+    /** Computes the factor ToneMapFattal02 multiplies the pixels of rgb by, without applying it. gain is resized to rgb.
+      * @return false if fattal is disabled or the computation has been cancelled */
+    bool ToneMapFattal02Gain(const Imagefloat *rgb, array2D<float> &gain);
     void localContrast(LabImage *lab);
     void colorToningLabGrid(LabImage *lab, int xstart, int xend, int ystart, int yend, bool MultiThread);
     void shadowsHighlights(LabImage *lab);
@@ -26,12 +26,19 @@
 #include "rawimagesource.h"
 #include "improcfun.h"
 #include "improccoordinator.h"
+#include "memorybudget.h"
+#include "bufferpool.h"
+#include "cpufeatures.h"
+#include "demosaiccache.h"
+#include "denoisemodelstore.h"
+#include "fftwplans.h"
 #include "dfmanager.h"
 #include "ffmanager.h"
 #include "rtthumbnail.h"
 #include "profilestore.h"
 #include "../rtgui/threadutils.h"
 #include "rtlensfun.h"
+#include "threadbudget.h"
 #include "procparams.h"
 
 namespace rtengine
@@ -40,7 +47,6 @@ namespace rtengine
 const Settings* settings;
 
 MyMutex* lcmsMutex = nullptr;
-MyMutex *fftwMutex = nullptr;
 
 int init (const Settings* s, Glib::ustring baseDir, Glib::ustring userSettingsDir, bool loadAll)
 {
@@ -49,6 +55,10 @@ int init (const Settings* s, Glib::ustring baseDir, Glib::ustring userSettingsDi
     PerceptualToneCurve::init();
     RawImageSource::init();
 
+    if (settings->verbose) {
+        printf("SIMD instruction set: %s\n", getSimdLevelName(getSimdLevel()));
+    }
+
 #ifdef _OPENMP
 #pragma omp parallel sections if (!settings->verbose)
 #endif
@@ -101,10 +111,16 @@ int init (const Settings* s, Glib::ustring baseDir, Glib::ustring userSettingsDi
 }
 }
 
+    DemosaicCache::getInstance()->init(s->demosaicCacheDirectory, s->demosaicCacheSize);
+    FFTWPlans::getInstance()->init(s->fftwWisdomFile);
+    ThreadBudget::getInstance()->init(s->threadBudget);
+    BufferPool::getInstance()->init(s->bufferPoolSize);
+    MemoryBudget::getInstance()->init(s->memoryBudget);
+    DenoiseModelStore::getInstance()->init(s->denoiseModelFile);
+
     Color::init ();
     delete lcmsMutex;
     lcmsMutex = new MyMutex;
-    fftwMutex = new MyMutex;
     return 0;
 }
 
@@ -113,6 +129,7 @@ void cleanup ()
     ProcParams::cleanup ();
     Color::cleanup ();
     RawImageSource::cleanup ();
+    FFTWPlans::getInstance()->cleanup ();
 #ifdef RT_FFTW3F_OMP
     fftwf_cleanup_threads();
 #else
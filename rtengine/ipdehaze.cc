@@ -36,6 +36,7 @@
 #include "procparams.h"
 #include "rt_algo.h"
 #include "rt_math.h"
+#include "proctrace.h"
 
 extern Options options;
 
@@ -209,12 +210,14 @@ void extract_channels(Imagefloat *img, array2D<float> &r, array2D<float> &g, arr
 } // namespace
 
 
-void ImProcFunctions::dehaze(Imagefloat *img)
+void ImProcFunctions::dehaze(Imagefloat *img, DehazeStats *stats)
 {
     if (!params->dehaze.enabled) {
         return;
     }
 
+    PROCTRACE("dehaze");
+
     img->normalizeFloatTo1();
     
     const int W = img->getWidth();
@@ -238,12 +241,30 @@ void ImProcFunctions::dehaze(Imagefloat *img)
         array2D<float> G(W, H);
         array2D<float> B(W, H);
         extract_channels(img, R, G, B, patchsize, 1e-1, multiThread);
-    
-        patchsize = max(max(W, H) / 600, 2);
-        npatches = get_dark_channel(R, G, B, dark, patchsize, nullptr, false, multiThread);
-        DEBUG_DUMP(dark);
 
-        max_t = estimate_ambient_light(R, G, B, dark, patchsize, npatches, ambient);
+        if (stats && stats->valid) {
+            // img is a part of the image, whose ambient light has been estimated on the whole
+            patchsize = max(int(stats->fulldim / scale) / 600, 2);
+            ambient[0] = stats->ambient[0];
+            ambient[1] = stats->ambient[1];
+            ambient[2] = stats->ambient[2];
+            max_t = stats->max_t;
+        } else {
+            patchsize = max(max(W, H) / 600, 2);
+            npatches = get_dark_channel(R, G, B, dark, patchsize, nullptr, false, multiThread);
+            DEBUG_DUMP(dark);
+
+            max_t = estimate_ambient_light(R, G, B, dark, patchsize, npatches, ambient);
+
+            if (stats) {
+                stats->valid = true;
+                stats->fulldim = max(W, H) * scale;
+                stats->ambient[0] = ambient[0];
+                stats->ambient[1] = ambient[1];
+                stats->ambient[2] = ambient[2];
+                stats->max_t = max_t;
+            }
+        }
 
         if (options.rtSettings.verbose) {
             std::cout << "dehaze: ambient light is "
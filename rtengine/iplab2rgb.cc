@@ -21,12 +21,14 @@
 #include <glibmm.h>
 #include "iccstore.h"
 #include "iccmatrices.h"
+#include "icctransform.h"
 #include "../rtgui/options.h"
 #include "settings.h"
 #include "curves.h"
 #include "alignedbuffer.h"
 #include "color.h"
 #include "procparams.h"
+#include "proctrace.h"
 
 namespace rtengine
 {
@@ -208,48 +210,46 @@ Image8* ImProcFunctions::lab2rgb(LabImage* lab, int cx, int cy, int cw, int ch,
             flags |= cmsFLAGS_BLACKPOINTCOMPENSATION;
         }
 
-        lcmsMutex->lock();
-        cmsHPROFILE LabIProf  = cmsCreateLab4Profile(nullptr);
-        cmsHTRANSFORM hTransform = cmsCreateTransform (LabIProf, TYPE_Lab_DBL, oprofG, TYPE_RGB_FLT, icm.outputIntent, flags);  // NOCACHE is important for thread safety
-        cmsCloseProfile(LabIProf);
-        lcmsMutex->unlock();
+        // The profiles made by makeStdGammaProfile() are closed below, so their transforms can't be shared
+        const std::shared_ptr<const ICCTransform> transform =
+            oprofG == oprof
+            ? ICCStore::getInstance()->getTransform(nullptr, TYPE_Lab_FLT, oprof, TYPE_RGB_FLT, icm.outputIntent, flags)
+            : std::make_shared<const ICCTransform>(nullptr, TYPE_Lab_FLT, oprofG, TYPE_RGB_FLT, icm.outputIntent, flags);
 
         unsigned char *data = image->data;
 
-        // cmsDoTransform is relatively expensive
+        if (transform && transform->isValid()) {
 #ifdef _OPENMP
-        #pragma omp parallel
+            #pragma omp parallel
 #endif
-        {
-            AlignedBuffer<double> pBuf(3 * cw);
-            AlignedBuffer<float> oBuf(3 * cw);
-            double *buffer = pBuf.data;
-            float *outbuffer = oBuf.data;
-            int condition = cy + ch;
+            {
+                AlignedBuffer<float> rgbBuf(3 * cw);
+                AlignedBuffer<float> oBuf(3 * cw);
+                float* const R = rgbBuf.data;
+                float* const G = R + cw;
+                float* const B = G + cw;
+                float* const outbuffer = oBuf.data;
+                int condition = cy + ch;
 
 #ifdef _OPENMP
-            #pragma omp for firstprivate(lab) schedule(dynamic,16)
+                #pragma omp for firstprivate(lab) schedule(dynamic,16)
 #endif
 
-            for (int i = cy; i < condition; i++) {
-                const int ix = i * 3 * cw;
-                int iy = 0;
-                float* rL = lab->L[i];
-                float* ra = lab->a[i];
-                float* rb = lab->b[i];
+                for (int i = cy; i < condition; i++) {
+                    const int ix = i * 3 * cw;
 
-                for (int j = cx; j < cx + cw; j++) {
-                    buffer[iy++] = rL[j] / 327.68f;
-                    buffer[iy++] = ra[j] / 327.68f;
-                    buffer[iy++] = rb[j] / 327.68f;
-                }
+                    transform->labToRgb(lab->L[i] + cx, lab->a[i] + cx, lab->b[i] + cx, R, G, B, cw, outbuffer);
 
-                cmsDoTransform (hTransform, buffer, outbuffer, cw);
-                copyAndClampLine(outbuffer, data + ix, cw);
-            }
-        } // End of parallelization
+                    for (int j = 0; j < cw; ++j) {
+                        outbuffer[3 * j] = R[j];
+                        outbuffer[3 * j + 1] = G[j];
+                        outbuffer[3 * j + 2] = B[j];
+                    }
 
-        cmsDeleteTransform(hTransform);
+                    copyAndClampLine(outbuffer, data + ix, cw);
+                }
+            } // End of parallelization
+        }
 
         if (oprofG != oprof) {
             cmsCloseProfile(oprofG);
@@ -280,6 +280,7 @@ Image8* ImProcFunctions::lab2rgb(LabImage* lab, int cx, int cy, int cw, int ch,
  */
 Imagefloat* ImProcFunctions::lab2rgbOut(LabImage* lab, int cx, int cy, int cw, int ch, const procparams::ColorManagementParams &icm)
 {
+    PROCTRACE("lab2rgbOut");
 
     if (cx < 0) {
         cx = 0;
@@ -307,13 +308,25 @@ Imagefloat* ImProcFunctions::lab2rgbOut(LabImage* lab, int cx, int cy, int cw, i
             flags |= cmsFLAGS_BLACKPOINTCOMPENSATION;
         }
 
-        lcmsMutex->lock();
-        cmsHPROFILE iprof = cmsCreateLab4Profile(nullptr);
-        cmsHTRANSFORM hTransform = cmsCreateTransform(iprof, TYPE_Lab_FLT, oprof, TYPE_RGB_FLT, icm.outputIntent, flags);
-        lcmsMutex->unlock();
+        const std::shared_ptr<const ICCTransform> transform = ICCStore::getInstance()->getTransform(nullptr, TYPE_Lab_FLT, oprof, TYPE_RGB_FLT, icm.outputIntent, flags);
+
+        if (transform) {
+#ifdef _OPENMP
+            #pragma omp parallel if (multiThread)
+#endif
+            {
+                AlignedBuffer<float> buffer(transform->isMatrixShaper() ? 0 : 3 * cw);
+
+#ifdef _OPENMP
+                #pragma omp for schedule(static)
+#endif
+
+                for (int i = cy; i < cy + ch; i++) {
+                    transform->labToRgb(lab->L[i] + cx, lab->a[i] + cx, lab->b[i] + cx, image->r(i - cy), image->g(i - cy), image->b(i - cy), cw, buffer.data);
+                }
+            }
+        }
 
-        image->ExecCMSTransform(hTransform, *lab, cx, cy);
-        cmsDeleteTransform(hTransform);
         image->normalizeFloatTo65535();
     } else {
         
@@ -28,6 +28,7 @@
 //#define BENCHMARK
 #include "StopWatch.h"
 #include "sleef.c"
+#include "proctrace.h"
 
 namespace {
 
@@ -55,6 +56,8 @@ namespace rtengine {
 
 void ImProcFunctions::labColorCorrectionRegions(LabImage *lab)
 {
+    PROCTRACE("labColorCorrectionRegions");
+
     if (!params->colorToning.enabled || params->colorToning.method != "LabRegions") {
         return;
     }
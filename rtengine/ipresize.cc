@@ -17,6 +17,12 @@
  *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <list>
+#include <memory>
+#include <tuple>
+#include <vector>
+
 #include "improcfun.h"
 
 #include "alignedbuffer.h"
@@ -24,6 +30,9 @@
 #include "rt_math.h"
 #include "procparams.h"
 #include "sleef.c"
+#include "proctrace.h"
+
+#include "../rtgui/threadutils.h"
 
 //#define PROFILE
 
@@ -35,7 +44,12 @@
 namespace rtengine
 {
 
-static inline float Lanc (float x, float a)
+namespace
+{
+
+constexpr float lanczosA = 3.0f;
+
+inline float Lanc (float x, float a)
 {
     if (x * x < 1e-6f) {
         return 1.0f;
@@ -47,293 +61,249 @@ static inline float Lanc (float x, float a)
     }
 }
 
-void ImProcFunctions::Lanczos (const Imagefloat* src, Imagefloat* dst, float scale)
+// Normalized weights of the Lanczos filter for the pixels of one dimension of the output. The window of each
+// output pixel only covers the source pixels of the filter: the pixels beyond it never enter the sums, so that
+// a non-finite pixel does not turn the neighbouring outputs into NaN through a zero weight.
+struct LanczosBank {
+    int support;                // maximum size of a window, the stride of weights
+    std::vector<int> start;     // first source pixel of the window of each output pixel
+    std::vector<int> taps;      // size of the window of each output pixel
+    std::vector<float> weights; // support weights per output pixel
+};
+
+std::shared_ptr<const LanczosBank> buildLanczosBank (int srcSize, int dstSize, float scale)
 {
-
     const float delta = 1.0f / scale;
-    const float a = 3.0f;
     const float sc = min (scale, 1.0f);
-    const int support = static_cast<int> (2.0f * a / sc) + 1;
+    const int taps = static_cast<int> (2.0f * lanczosA / sc) + 1;
 
-#ifdef _OPENMP
-    #pragma omp parallel
-#endif
-    {
-        // storage for precomputed parameters for horisontal interpolation
-        float * wwh = new float[support * dst->getWidth()];
-        int * jj0 = new int[dst->getWidth()];
-        int * jj1 = new int[dst->getWidth()];
+    const std::shared_ptr<LanczosBank> bank = std::make_shared<LanczosBank>();
+    bank->support = min (taps, srcSize);
+    bank->start.resize (dstSize);
+    bank->taps.resize (dstSize);
+    bank->weights.assign (dstSize * bank->support, 0.0f);
 
-        // temporal storage for vertically-interpolated row of pixels
-        float * lr = new float[src->getWidth()];
-        float * lg = new float[src->getWidth()];
-        float * lb = new float[src->getWidth()];
+    for (int j = 0; j < dstSize; j++) {
 
-        // Phase 1: precompute coefficients for horisontal interpolation
+        // coord of the center of pixel on src image
+        float x0 = (static_cast<float> (j) + 0.5f) * delta - 0.5f;
 
-        for (int j = 0; j < dst->getWidth(); j++) {
+        const int jj0 = max (0, static_cast<int> (floorf (x0 - lanczosA / sc)) + 1);
+        const int jj1 = min (srcSize, static_cast<int> (floorf (x0 + lanczosA / sc)) + 1);
+        bank->start[j] = jj0;
+        bank->taps[j] = jj1 - jj0;
 
-            // x coord of the center of pixel on src image
-            float x0 = (static_cast<float> (j) + 0.5f) * delta - 0.5f;
+        float* const w = &bank->weights[j * bank->support];
 
-            // weights for interpolation in horisontal direction
-            float * w = wwh + j * support;
+        // sum of weights used for normalization
+        float ws = 0.0f;
 
-            // sum of weights used for normalization
-            float ws = 0.0f;
+        for (int jj = jj0; jj < jj1; jj++) {
+            const float z = sc * (x0 - static_cast<float> (jj));
+            w[jj - jj0] = Lanc (z, lanczosA);
+            ws += w[jj - jj0];
+        }
 
-            jj0[j] = max (0, static_cast<int> (floorf (x0 - a / sc)) + 1);
-            jj1[j] = min (src->getWidth(), static_cast<int> (floorf (x0 + a / sc)) + 1);
+        for (int k = 0; k < jj1 - jj0; k++) {
+            w[k] /= ws;
+        }
+    }
 
-            // calculate weights
-            for (int jj = jj0[j]; jj < jj1[j]; jj++) {
-                int k = jj - jj0[j];
-                float z = sc * (x0 - static_cast<float> (jj));
-                w[k] = Lanc (z, a);
-                ws += w[k];
-            }
+    return bank;
+}
 
-            // normalize weights
-            for (int k = 0; k < support; k++) {
-                w[k] /= ws;
-            }
-        }
+// the banks of the last resizes, reused by the next images of the same size and by the export of several sizes
+std::shared_ptr<const LanczosBank> getLanczosBank (int srcSize, int dstSize, float scale)
+{
+    typedef std::tuple<int, int, float> Key;
+    constexpr std::size_t maxBanks = 16;
 
-        // Phase 2: do actual interpolation
-#ifdef _OPENMP
-        #pragma omp for
-#endif
+    static MyMutex mutex;
+    static std::list<std::pair<Key, std::shared_ptr<const LanczosBank>>> banks; // most recently used first
 
-        for (int i = 0; i < dst->getHeight(); i++) {
+    const Key key (srcSize, dstSize, scale);
 
-            // y coord of the center of pixel on src image
-            float y0 = (static_cast<float> (i) + 0.5f) * delta - 0.5f;
+    {
+        MyMutex::MyLock lock (mutex);
 
-            // weights for interpolation in y direction
-            float w[support];
-            for (auto& f : w) {
-                f = 0.f;
+        for (auto iter = banks.begin(); iter != banks.end(); ++iter) {
+            if (iter->first == key) {
+                banks.splice (banks.begin(), banks, iter);
+                return banks.front().second;
             }
+        }
+    }
 
-            // sum of weights used for normalization
-            float ws = 0.0f;
+    const std::shared_ptr<const LanczosBank> bank = buildLanczosBank (srcSize, dstSize, scale);
 
-            int ii0 = max (0, static_cast<int> (floorf (y0 - a / sc)) + 1);
-            int ii1 = min (src->getHeight(), static_cast<int> (floorf (y0 + a / sc)) + 1);
+    MyMutex::MyLock lock (mutex);
 
-            // calculate weights for vertical interpolation
-            for (int ii = ii0; ii < ii1; ii++) {
-                int k = ii - ii0;
-                float z = sc * (y0 - static_cast<float> (ii));
-                w[k] = Lanc (z, a);
-                ws += w[k];
-            }
+    banks.emplace_front (key, bank);
 
-            // normalize weights
-            for (int k = 0; k < support; k++) {
-                w[k] /= ws;
-            }
+    if (banks.size() > maxBanks) {
+        banks.pop_back();
+    }
 
-            // Do vertical interpolation. Store results.
-            for (int j = 0; j < src->getWidth(); j++) {
+    return bank;
+}
 
-                float r = 0.0f, g = 0.0f, b = 0.0f;
+// Separable Lanczos resize of the planes of src (given by their row pointers) into dst: each row of the output
+// is first interpolated vertically over the whole source width, then horizontally.
+template<int planes>
+void lanczosPlanes (float** const (&src)[planes], float** const (&dst)[planes], int srcW, int srcH, int dstW, int dstH, float scale)
+{
+    const std::shared_ptr<const LanczosBank> hBank = getLanczosBank (srcW, dstW, scale);
+    const std::shared_ptr<const LanczosBank> vBank = getLanczosBank (srcH, dstH, scale);
+    const int hSupport = hBank->support;
+    const int vSupport = vBank->support;
 
-                for (int ii = ii0; ii < ii1; ii++) {
-                    int k = ii - ii0;
+#ifdef _OPENMP
+    #pragma omp parallel
+#endif
+    {
+        // temporal storage for a vertically-interpolated row of pixels
+        AlignedBuffer<float> aligned_buffer_row (srcW);
+        float* const row = aligned_buffer_row.data;
 
-                    r += w[k] * src->r (ii, j);
-                    g += w[k] * src->g (ii, j);
-                    b += w[k] * src->b (ii, j);
-                }
+#ifdef _OPENMP
+        #pragma omp for
+#endif
 
-                lr[j] = r;
-                lg[j] = g;
-                lb[j] = b;
-            }
+        for (int i = 0; i < dstH; i++) {
+            const int ii0 = vBank->start[i];
+            const int vTaps = vBank->taps[i];
+            const float* const wv = &vBank->weights[i * vSupport];
 
-            // Do horizontal interpolation
-            for (int j = 0; j < dst->getWidth(); j++) {
+            for (int p = 0; p < planes; p++) {
+                float** const in = src[p];
 
-                float * wh = wwh + support * j;
+                // Do vertical interpolation
+                int j = 0;
+#ifdef __SSE2__
 
-                float r = 0.0f, g = 0.0f, b = 0.0f;
+                for (; j < srcW - 3; j += 4) {
+                    vfloat sumv = ZEROV;
 
-                for (int jj = jj0[j]; jj < jj1[j]; jj++) {
-                    int k = jj - jj0[j];
+                    for (int k = 0; k < vTaps; k++) {
+                        sumv += F2V (wv[k]) * LVFU (in[ii0 + k][j]);
+                    }
 
-                    r += wh[k] * lr[jj];
-                    g += wh[k] * lg[jj];
-                    b += wh[k] * lb[jj];
+                    STVF (row[j], sumv);
                 }
 
-                dst->r (i, j) = /*CLIP*/ (r);//static_cast<int> (r));
-                dst->g (i, j) = /*CLIP*/ (g);//static_cast<int> (g));
-                dst->b (i, j) = /*CLIP*/ (b);//static_cast<int> (b));
-            }
-        }
-
-        delete[] wwh;
-        delete[] jj0;
-        delete[] jj1;
-        delete[] lr;
-        delete[] lg;
-        delete[] lb;
-    }
-}
-
+#endif
 
-void ImProcFunctions::Lanczos (const LabImage* src, LabImage* dst, float scale)
-{
-    const float delta = 1.0f / scale;
-    const float a = 3.0f;
-    const float sc = min (scale, 1.0f);
-    const int support = static_cast<int> (2.0f * a / sc) + 1;
+                for (; j < srcW; j++) {
+                    float sum = 0.0f;
 
-    // storage for precomputed parameters for horizontal interpolation
-    float* const wwh = new float[support * dst->W];
-    int* const jj0 = new int[dst->W];
-    int* const jj1 = new int[dst->W];
+                    for (int k = 0; k < vTaps; k++) {
+                        sum += wv[k] * in[ii0 + k][j];
+                    }
 
-    // Phase 1: precompute coefficients for horizontal interpolation
-    for (int j = 0; j < dst->W; j++) {
+                    row[j] = sum;
+                }
 
-        // x coord of the center of pixel on src image
-        float x0 = (static_cast<float> (j) + 0.5f) * delta - 0.5f;
+                // Do horizontal interpolation
+                float* const out = dst[p][i];
 
-        // weights for interpolation in horizontal direction
-        float * w = wwh + j * support;
+                for (j = 0; j < dstW; j++) {
+                    const float* const wh = &hBank->weights[j * hSupport];
+                    const float* const pixels = row + hBank->start[j];
+                    const int hTaps = hBank->taps[j];
+                    int k = 0;
+#ifdef __SSE2__
+                    vfloat sumv = ZEROV;
 
-        // sum of weights used for normalization
-        float ws = 0.0f;
+                    for (; k < hTaps - 3; k += 4) {
+                        sumv += LVFU (wh[k]) * LVFU (pixels[k]);
+                    }
 
-        jj0[j] = max (0, static_cast<int> (floorf (x0 - a / sc)) + 1);
-        jj1[j] = min (src->W, static_cast<int> (floorf (x0 + a / sc)) + 1);
+                    float sum = vhadd (sumv);
+#else
+                    float sum = 0.0f;
+#endif
 
-        // calculate weights
-        for (int jj = jj0[j]; jj < jj1[j]; jj++) {
-            int k = jj - jj0[j];
-            float z = sc * (x0 - static_cast<float> (jj));
-            w[k] = Lanc (z, a);
-            ws += w[k];
-        }
+                    for (; k < hTaps; k++) {
+                        sum += wh[k] * pixels[k];
+                    }
 
-        // normalize weights
-        for (int k = 0; k < support; k++) {
-            w[k] /= ws;
+                    out[j] = sum;
+                }
+            }
         }
     }
+}
 
-#ifdef _OPENMP
-    #pragma omp parallel
-#endif
-    {
-        // temporal storage for vertically-interpolated row of pixels
-        AlignedBuffer<float> aligned_buffer_ll(src->W);
-        AlignedBuffer<float> aligned_buffer_la(src->W);
-        AlignedBuffer<float> aligned_buffer_lb(src->W);
-        float* const lL = aligned_buffer_ll.data;
-        float* const la = aligned_buffer_la.data;
-        float* const lb = aligned_buffer_lb.data;
-        // weights for interpolation in y direction
-        float w[support] ALIGNED64;
-        memset(w, 0, sizeof(w));
-
-        // Phase 2: do actual interpolation
-#ifdef _OPENMP
-        #pragma omp for
-#endif
+// Order in which the outputs of a multiple resize are computed, the largest first, and their sources: each
+// output is resized from the smallest already computed one at least twice as large, -1 for the source image.
+// The lower resolution source is much cheaper to filter, and the downscale by at least 2 of the last step
+// keeps the sharpness of a direct resize.
+std::vector<std::pair<int, int>> getPyramid (const std::vector<float>& scales)
+{
+    std::vector<int> order (scales.size());
 
-        for (int i = 0; i < dst->H; i++) {
-            // y coord of the center of pixel on src image
-            float y0 = (static_cast<float> (i) + 0.5f) * delta - 0.5f;
+    for (std::size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
 
-            // sum of weights used for normalization
-            float ws = 0.0f;
+    std::stable_sort (order.begin(), order.end(), [&scales] (int a, int b) {
+        return scales[a] > scales[b];
+    });
 
-            int ii0 = max (0, static_cast<int> (floorf (y0 - a / sc)) + 1);
-            int ii1 = min (src->H, static_cast<int> (floorf (y0 + a / sc)) + 1);
+    std::vector<std::pair<int, int>> pyramid;
 
-            // calculate weights for vertical interpolation
-            for (int ii = ii0; ii < ii1; ii++) {
-                int k = ii - ii0;
-                float z = sc * (y0 - static_cast<float> (ii));
-                w[k] = Lanc (z, a);
-                ws += w[k];
-            }
+    for (std::size_t i = 0; i < order.size(); i++) {
+        int from = -1;
 
-            // normalize weights
-            for (int k = 0; k < support; k++) {
-                w[k] /= ws;
+        for (std::size_t j = 0; j < i; j++) {
+            if (scales[order[j]] >= 2.0f * scales[order[i]]) {
+                from = order[j];
             }
+        }
 
-            // Do vertical interpolation. Store results.
-#ifdef __SSE2__
-            int j;
-            __m128 Lv, av, bv, wkv;
-
-            for (j = 0; j < src->W - 3; j += 4) {
-                Lv = _mm_setzero_ps();
-                av = _mm_setzero_ps();
-                bv = _mm_setzero_ps();
-
-                for (int ii = ii0; ii < ii1; ii++) {
-                    int k = ii - ii0;
-                    wkv = _mm_set1_ps (w[k]);
-                    Lv += wkv * LVFU (src->L[ii][j]);
-                    av += wkv * LVFU (src->a[ii][j]);
-                    bv += wkv * LVFU (src->b[ii][j]);
-                }
+        pyramid.emplace_back (order[i], from);
+    }
 
-                STVF (lL[j], Lv);
-                STVF (la[j], av);
-                STVF (lb[j], bv);
-            }
+    return pyramid;
+}
 
-#else
-            int j = 0;
-#endif
+}
 
-            for (; j < src->W; j++) {
-                float L = 0.0f, a = 0.0f, b = 0.0f;
+void ImProcFunctions::Lanczos (const Imagefloat* src, Imagefloat* dst, float scale)
+{
+    PROCTRACE("Lanczos");
 
-                for (int ii = ii0; ii < ii1; ii++) {
-                    int k = ii - ii0;
+    float** const srcPlanes[3] = {src->r.ptrs, src->g.ptrs, src->b.ptrs};
+    float** const dstPlanes[3] = {dst->r.ptrs, dst->g.ptrs, dst->b.ptrs};
 
-                    L += w[k] * src->L[ii][j];
-                    a += w[k] * src->a[ii][j];
-                    b += w[k] * src->b[ii][j];
-                }
+    lanczosPlanes (srcPlanes, dstPlanes, src->getWidth(), src->getHeight(), dst->getWidth(), dst->getHeight(), scale);
+}
 
-                lL[j] = L;
-                la[j] = a;
-                lb[j] = b;
-            }
 
-            // Do horizontal interpolation
-            for (int j = 0; j < dst->W; j++) {
+void ImProcFunctions::Lanczos (const LabImage* src, LabImage* dst, float scale)
+{
+    PROCTRACE("Lanczos");
 
-                float * wh = wwh + support * j;
+    float** const srcPlanes[3] = {src->L, src->a, src->b};
+    float** const dstPlanes[3] = {dst->L, dst->a, dst->b};
 
-                float L = 0.0f, a = 0.0f, b = 0.0f;
+    lanczosPlanes (srcPlanes, dstPlanes, src->W, src->H, dst->W, dst->H, scale);
+}
 
-                for (int jj = jj0[j]; jj < jj1[j]; jj++) {
-                    int k = jj - jj0[j];
 
-                    L += wh[k] * lL[jj];
-                    a += wh[k] * la[jj];
-                    b += wh[k] * lb[jj];
-                }
+void ImProcFunctions::Lanczos (const LabImage* src, const std::vector<std::pair<LabImage*, float>>& dsts)
+{
+    std::vector<float> scales;
 
-                dst->L[i][j] = L;
-                dst->a[i][j] = a;
-                dst->b[i][j] = b;
-            }
-        }
+    for (const auto& dst : dsts) {
+        scales.push_back (dst.second);
+    }
+
+    for (const auto& step : getPyramid (scales)) {
+        const LabImage* const from = step.second < 0 ? src : dsts[step.second].first;
+        const float fromScale = step.second < 0 ? 1.0f : scales[step.second];
+        Lanczos (from, dsts[step.first].first, scales[step.first] / fromScale);
     }
-    delete[] jj0;
-    delete[] jj1;
-    delete[] wwh;
 }
 
 float ImProcFunctions::resizeScale (const ProcParams* params, int fw, int fh, int &imw, int &imh)
@@ -408,6 +378,8 @@ float ImProcFunctions::resizeScale (const ProcParams* params, int fw, int fh, in
 
 void ImProcFunctions::resize (Imagefloat* src, Imagefloat* dst, float dScale)
 {
+    PROCTRACE("resize");
+
 #ifdef PROFILE
     time_t t1 = clock();
 #endif
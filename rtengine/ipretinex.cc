@@ -201,6 +201,10 @@ void RawImageSource::MSR(float** luminance, float** originalLuminance, float **e
         constexpr float bbhi = 1.f - aahi;
 
         for(int it = 1; it < iter + 1; it++) { //iter nb max of iterations
+            if (isCancelled()) {
+                break;
+            }
+
             float high = bbhi + aahi * (float) deh.highl;
 
             float grad = 1.f;
@@ -400,6 +404,10 @@ void RawImageSource::MSR(float** luminance, float** originalLuminance, float **e
             float *buffer = new float[W_L * H_L];;
 
             for ( int scale = scal - 1; scale >= 0; scale-- ) {
+                if (isCancelled()) {
+                    break;
+                }
+
 #ifdef _OPENMP
                 #pragma omp parallel
 #endif
@@ -28,6 +28,7 @@
 //#define BENCHMARK
 #include "StopWatch.h"
 #include "rt_algo.h"
+#include "proctrace.h"
 using namespace std;
 
 namespace {
@@ -247,6 +248,7 @@ BENCHFUN
 
 void ImProcFunctions::sharpening (LabImage* lab, const SharpeningParams &sharpenParam, bool showMask)
 {
+    PROCTRACE("sharpening");
 
     if ((!sharpenParam.enabled) || sharpenParam.amount < 1 || lab->W < 8 || lab->H < 8) {
         return;
@@ -26,6 +26,8 @@
 #include "rt_math.h"
 #include "sleef.c"
 #include "rtlensfun.h"
+#include "proctrace.h"
+#include "warpmap.h"
 
 
 using namespace std;
@@ -300,6 +302,8 @@ void ImProcFunctions::transform (Imagefloat* original, Imagefloat* transformed,
                                  const FramesMetaData *metadata,
                                  int rawRotationDeg, bool fullImage)
 {
+    PROCTRACE("transform");
+
     double focalLen = metadata->getFocalLen();
     double focalLen35mm = metadata->getFocalLen35mm();
     float focusDist = metadata->getFocusDist();
@@ -323,6 +327,20 @@ void ImProcFunctions::transform (Imagefloat* original, Imagefloat* transformed,
         }
     }
 
+    // identifies the lens correction and the geometry of the image in the warp map cache
+    WarpMapKey warpKey;
+
+    if (pLCPMap) {
+        warpKey.lens = std::to_string(int(params->lensProf.lcMode)) + ";" + params->lensProf.lcpFile.raw() + ";" + params->lensProf.lfCameraMake.raw() + ";"
+                       + params->lensProf.lfCameraModel.raw() + ";" + params->lensProf.lfLens.raw() + ";" + metadata->getCamera() + ";" + metadata->getLens();
+        warpKey.values = {focalLen, focalLen35mm, focusDist, fNumber, double(params->lensProf.useDist), double(params->lensProf.useCA)};
+    }
+
+    warpKey.values.insert(warpKey.values.end(), {
+        double(oW), double(oH), double(fW), double(fH), double(rawRotationDeg),
+        double(params->coarse.rotate), double(params->coarse.hflip), double(params->coarse.vflip)
+    });
+
     if (! (needsCA() || needsDistortion() || needsRotation() || needsPerspective() || needsLCP() || needsLensfun()) && (needsVignetting() || needsPCVignetting() || needsGradient())) {
         transformLuminanceOnly (original, transformed, cx, cy, oW, oH, fW, fH);
     } else {
@@ -346,10 +364,10 @@ void ImProcFunctions::transform (Imagefloat* original, Imagefloat* transformed,
                 dest = tmpimg.get();
             }
         }
-        transformGeneral(highQuality, original, dest, cx, cy, sx, sy, oW, oH, fW, fH, pLCPMap.get());
+        transformGeneral(highQuality, original, dest, cx, cy, sx, sy, oW, oH, fW, fH, pLCPMap.get(), warpKey);
         
         if (highQuality && dest != transformed) {
-            transformLCPCAOnly(dest, transformed, cx, cy, pLCPMap.get());
+            transformLCPCAOnly(dest, transformed, cx, cy, pLCPMap.get(), warpKey);
         }
     }
 }
@@ -743,7 +761,7 @@ void ImProcFunctions::transformLuminanceOnly (Imagefloat* original, Imagefloat*
 }
 
 
-void ImProcFunctions::transformGeneral(bool highQuality, Imagefloat *original, Imagefloat *transformed, int cx, int cy, int sx, int sy, int oW, int oH, int fW, int fH, const LensCorrection *pLCPMap)
+void ImProcFunctions::transformGeneral(bool highQuality, Imagefloat *original, Imagefloat *transformed, int cx, int cy, int sx, int sy, int oW, int oH, int fW, int fH, const LensCorrection *pLCPMap, WarpMapKey warpKey)
 {
     // set up stuff, depending on the mode we are
     bool enableLCPDist = pLCPMap && params->lensProf.useDist;
@@ -788,166 +806,206 @@ void ImProcFunctions::transformGeneral(bool highQuality, Imagefloat *original, I
     chDist[1] = 0.0;
     chDist[2] = enableCA ? params->cacorrection.blue : 0.0;
 
-    // auxiliary variables for distortion correction
-    double distAmount = params->distortion.amount;
+    // the x and y source coordinates of each channel, then the vignetting correction
+    const int channels = enableCA ? 3 : 1;
+    const int vignettingPlane = 2 * channels;
+    const int width = transformed->getWidth();
+    const int height = transformed->getHeight();
 
-    // auxiliary variables for rotation
-    double cost = cos (params->rotate.degree * rtengine::RT_PI / 180.0);
-    double sint = sin (params->rotate.degree * rtengine::RT_PI / 180.0);
+    warpKey.values.insert(warpKey.values.end(), {
+        0.0, // general transform
+        double(enableLCPDist), double(enableCA), double(enablePerspective), double(enableDistortion), double(enableVignetting),
+        double(params->commonTrans.autofill), params->rotate.degree, params->perspective.horizontal, params->perspective.vertical,
+        params->distortion.amount, chDist[0], chDist[2],
+        double(params->vignetting.amount), double(params->vignetting.radius), double(params->vignetting.strength),
+        double(params->vignetting.centerX), double(params->vignetting.centerY)
+    });
 
-    // auxiliary variables for vertical perspective correction
-    double vpdeg = params->perspective.vertical / 100.0 * 45.0;
-    double vpalpha = (90.0 - vpdeg) / 180.0 * rtengine::RT_PI;
-    double vpteta  = fabs (vpalpha - rtengine::RT_PI / 2) < 3e-4 ? 0.0 : acos ((vpdeg > 0 ? 1.0 : -1.0) * sqrt ((-SQR (oW * tan (vpalpha)) + (vpdeg > 0 ? 1.0 : -1.0) *
-                     oW * tan (vpalpha) * sqrt (SQR (4 * maxRadius) + SQR (oW * tan (vpalpha)))) / (SQR (maxRadius) * 8)));
-    double vpcospt = (vpdeg >= 0 ? 1.0 : -1.0) * cos (vpteta), vptanpt = tan (vpteta);
+    std::shared_ptr<const WarpMap> warpMap = WarpMapCache::getInstance()->get(warpKey, cx, cy, width, height);
 
-    // auxiliary variables for horizontal perspective correction
-    double hpdeg = params->perspective.horizontal / 100.0 * 45.0;
-    double hpalpha = (90.0 - hpdeg) / 180.0 * rtengine::RT_PI;
-    double hpteta  = fabs (hpalpha - rtengine::RT_PI / 2) < 3e-4 ? 0.0 : acos ((hpdeg > 0 ? 1.0 : -1.0) * sqrt ((-SQR (oH * tan (hpalpha)) + (hpdeg > 0 ? 1.0 : -1.0) *
-                     oH * tan (hpalpha) * sqrt (SQR (4 * maxRadius) + SQR (oH * tan (hpalpha)))) / (SQR (maxRadius) * 8)));
-    double hpcospt = (hpdeg >= 0 ? 1.0 : -1.0) * cos (hpteta), hptanpt = tan (hpteta);
+    if (!warpMap) {
+        // auxiliary variables for distortion correction
+        double distAmount = params->distortion.amount;
 
-    double ascale = params->commonTrans.autofill ? getTransformAutoFill (oW, oH, pLCPMap) : 1.0;
+        // auxiliary variables for rotation
+        double cost = cos (params->rotate.degree * rtengine::RT_PI / 180.0);
+        double sint = sin (params->rotate.degree * rtengine::RT_PI / 180.0);
 
-#if defined( __GNUC__ ) && __GNUC__ >= 7// silence warning
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wimplicit-fallthrough"
-#endif
-#if defined( __GNUC__ ) && __GNUC__ >= 7
-#pragma GCC diagnostic pop
-#endif
-    // main cycle
-    bool darkening = (params->vignetting.amount <= 0.0);
+        // auxiliary variables for vertical perspective correction
+        double vpdeg = params->perspective.vertical / 100.0 * 45.0;
+        double vpalpha = (90.0 - vpdeg) / 180.0 * rtengine::RT_PI;
+        double vpteta  = fabs (vpalpha - rtengine::RT_PI / 2) < 3e-4 ? 0.0 : acos ((vpdeg > 0 ? 1.0 : -1.0) * sqrt ((-SQR (oW * tan (vpalpha)) + (vpdeg > 0 ? 1.0 : -1.0) *
+                         oW * tan (vpalpha) * sqrt (SQR (4 * maxRadius) + SQR (oW * tan (vpalpha)))) / (SQR (maxRadius) * 8)));
+        double vpcospt = (vpdeg >= 0 ? 1.0 : -1.0) * cos (vpteta), vptanpt = tan (vpteta);
+
+        // auxiliary variables for horizontal perspective correction
+        double hpdeg = params->perspective.horizontal / 100.0 * 45.0;
+        double hpalpha = (90.0 - hpdeg) / 180.0 * rtengine::RT_PI;
+        double hpteta  = fabs (hpalpha - rtengine::RT_PI / 2) < 3e-4 ? 0.0 : acos ((hpdeg > 0 ? 1.0 : -1.0) * sqrt ((-SQR (oH * tan (hpalpha)) + (hpdeg > 0 ? 1.0 : -1.0) *
+                         oH * tan (hpalpha) * sqrt (SQR (4 * maxRadius) + SQR (oH * tan (hpalpha)))) / (SQR (maxRadius) * 8)));
+        double hpcospt = (hpdeg >= 0 ? 1.0 : -1.0) * cos (hpteta), hptanpt = tan (hpteta);
+
+        double ascale = params->commonTrans.autofill ? getTransformAutoFill (oW, oH, pLCPMap) : 1.0;
+
+        bool darkening = (params->vignetting.amount <= 0.0);
+
+        const std::shared_ptr<WarpMap> map = std::make_shared<WarpMap>(cx, cy, width, height, enableVignetting ? vignettingPlane + 1 : vignettingPlane);
+
+        // evaluates the mapping on the nodes of the grid, in absolute coordinates
 #ifdef _OPENMP
-    #pragma omp parallel for if (multiThread)
+        #pragma omp parallel for if (multiThread)
 #endif
 
-    for (int y = 0; y < transformed->getHeight(); y++) {
-        for (int x = 0; x < transformed->getWidth(); x++) {
-            double x_d = x, y_d = y;
+        for (int j = 0; j < map->getGridHeight(); j++) {
+            for (int i = 0; i < map->getGridWidth(); i++) {
+                const int x = map->getNodeX(i);
+                const int y = map->getNodeY(j);
+                double x_d = x, y_d = y;
 
-            if (enableLCPDist) {
-                pLCPMap->correctDistortion(x_d, y_d, cx, cy, ascale); // must be first transform
-            } else {
-                x_d *= ascale;
-                y_d *= ascale;
-            }
+                if (enableLCPDist) {
+                    pLCPMap->correctDistortion(x_d, y_d, 0, 0, ascale); // must be first transform
+                } else {
+                    x_d *= ascale;
+                    y_d *= ascale;
+                }
 
-            x_d += ascale * (cx - w2);     // centering x coord & scale
-            y_d += ascale * (cy - h2);     // centering y coord & scale
+                x_d -= ascale * w2;     // centering x coord & scale
+                y_d -= ascale * h2;     // centering y coord & scale
 
-            double vig_x_d = 0., vig_y_d = 0.;
+                double vig_x_d = 0., vig_y_d = 0.;
 
-            if (enableVignetting) {
-                vig_x_d = ascale * (x + cx - vig_w2);       // centering x coord & scale
-                vig_y_d = ascale * (y + cy - vig_h2);       // centering y coord & scale
-            }
+                if (enableVignetting) {
+                    vig_x_d = ascale * (x - vig_w2);       // centering x coord & scale
+                    vig_y_d = ascale * (y - vig_h2);       // centering y coord & scale
+                }
 
-            if (enablePerspective) {
-                // horizontal perspective transformation
-                y_d *= maxRadius / (maxRadius + x_d * hptanpt);
-                x_d *= maxRadius * hpcospt / (maxRadius + x_d * hptanpt);
+                if (enablePerspective) {
+                    // horizontal perspective transformation
+                    y_d *= maxRadius / (maxRadius + x_d * hptanpt);
+                    x_d *= maxRadius * hpcospt / (maxRadius + x_d * hptanpt);
 
-                // vertical perspective transformation
-                x_d *= maxRadius / (maxRadius - y_d * vptanpt);
-                y_d *= maxRadius * vpcospt / (maxRadius - y_d * vptanpt);
-            }
+                    // vertical perspective transformation
+                    x_d *= maxRadius / (maxRadius - y_d * vptanpt);
+                    y_d *= maxRadius * vpcospt / (maxRadius - y_d * vptanpt);
+                }
 
-            // rotate
-            double Dxc = x_d * cost - y_d * sint;
-            double Dyc = x_d * sint + y_d * cost;
+                // rotate
+                double Dxc = x_d * cost - y_d * sint;
+                double Dyc = x_d * sint + y_d * cost;
 
-            // distortion correction
-            double s = 1;
+                // distortion correction
+                double s = 1;
 
-            if (enableDistortion) {
-                double r = sqrt (Dxc * Dxc + Dyc * Dyc) / maxRadius; // sqrt is slow
-                s = 1.0 - distAmount + distAmount * r ;
-            }
+                if (enableDistortion) {
+                    double r = sqrt (Dxc * Dxc + Dyc * Dyc) / maxRadius; // sqrt is slow
+                    s = 1.0 - distAmount + distAmount * r ;
+                }
+
+                if (enableVignetting) {
+                    double vig_Dx = vig_x_d * cost - vig_y_d * sint;
+                    double vig_Dy = vig_x_d * sint + vig_y_d * cost;
+                    double r2 = sqrt (vig_Dx * vig_Dx + vig_Dy * vig_Dy);
 
-            double r2 = 0.;
+                    // multiplier for vignetting correction
+                    if (darkening) {
+                        *map->getNode(vignettingPlane, i, j) = 1.0 / std::max (v + mul * tanh (b * (maxRadius - s * r2) / maxRadius), 0.001);
+                    } else {
+                        *map->getNode(vignettingPlane, i, j) = v + mul * tanh (b * (maxRadius - s * r2) / maxRadius);
+                    }
+                }
 
-            if (enableVignetting) {
-                double vig_Dx = vig_x_d * cost - vig_y_d * sint;
-                double vig_Dy = vig_x_d * sint + vig_y_d * cost;
-                r2 = sqrt (vig_Dx * vig_Dx + vig_Dy * vig_Dy);
+                for (int c = 0; c < channels; c++) {
+                    // de-center
+                    *map->getNode(2 * c, i, j) = Dxc * (s + chDist[c]) + w2;
+                    *map->getNode(2 * c + 1, i, j) = Dyc * (s + chDist[c]) + h2;
+                }
             }
+        }
+
+        WarpMapCache::getInstance()->put(warpKey, map);
+        warpMap = map;
+    }
+
+    // main cycle
+#ifdef _OPENMP
+    #pragma omp parallel if (multiThread)
+#endif
+    {
+        // source coordinates and vignetting correction of the pixels of a row, interpolated from the warp map
+        std::vector<float> rows((vignettingPlane + 1) * width, 1.f);
 
-            for (int c = 0; c < (enableCA ? 3 : 1); c++) {
-                double Dx = Dxc * (s + chDist[c]);
-                double Dy = Dyc * (s + chDist[c]);
+#ifdef _OPENMP
+        #pragma omp for
+#endif
 
-                // de-center
-                Dx += w2;
-                Dy += h2;
+        for (int y = 0; y < height; y++) {
+            for (int plane = 0; plane < (enableVignetting ? vignettingPlane + 1 : vignettingPlane); plane++) {
+                warpMap->getRow(plane, cx, cy + y, width, &rows[plane * width]);
+            }
 
-                // Extract integer and fractions of source screen coordinates
-                int xc = (int)Dx;
-                Dx -= (double)xc;
-                xc -= sx;
-                int yc = (int)Dy;
-                Dy -= (double)yc;
-                yc -= sy;
+            for (int x = 0; x < width; x++) {
+                for (int c = 0; c < channels; c++) {
+                    double Dx = rows[2 * c * width + x];
+                    double Dy = rows[(2 * c + 1) * width + x];
 
-                // Convert only valid pixels
-                if (yc >= 0 && yc < original->getHeight() && xc >= 0 && xc < original->getWidth()) {
+                    // Extract integer and fractions of source screen coordinates
+                    int xc = (int)Dx;
+                    Dx -= (double)xc;
+                    xc -= sx;
+                    int yc = (int)Dy;
+                    Dy -= (double)yc;
+                    yc -= sy;
 
-                    // multiplier for vignetting correction
-                    double vignmul = 1.0;
+                    // Convert only valid pixels
+                    if (yc >= 0 && yc < original->getHeight() && xc >= 0 && xc < original->getWidth()) {
 
-                    if (enableVignetting) {
-                        if (darkening) {
-                            vignmul /= std::max (v + mul * tanh (b * (maxRadius - s * r2) / maxRadius), 0.001);
-                        } else {
-                            vignmul *= (v + mul * tanh (b * (maxRadius - s * r2) / maxRadius));
-                        }
-                    }
+                        // multiplier for vignetting correction
+                        double vignmul = rows[vignettingPlane * width + x];
 
-                    if (enableGradient) {
-                        vignmul *= calcGradientFactor (gp, cx + x, cy + y);
-                    }
+                        if (enableGradient) {
+                            vignmul *= calcGradientFactor (gp, cx + x, cy + y);
+                        }
 
-                    if (enablePCVignetting) {
-                        vignmul *= calcPCVignetteFactor (pcv, cx + x, cy + y);
-                    }
+                        if (enablePCVignetting) {
+                            vignmul *= calcPCVignetteFactor (pcv, cx + x, cy + y);
+                        }
 
-                    if (yc > 0 && yc < original->getHeight() - 2 && xc > 0 && xc < original->getWidth() - 2) {
-                        // all interpolation pixels inside image
-                        if (enableCA) {
-                            interpolateTransformChannelsCubic (chOrig[c], xc - 1, yc - 1, Dx, Dy, & (chTrans[c][y][x]), vignmul);
-                        } else if (!highQuality) {
-                            transformed->r (y, x) = vignmul * (original->r (yc, xc) * (1.0 - Dx) * (1.0 - Dy) + original->r (yc, xc + 1) * Dx * (1.0 - Dy) + original->r (yc + 1, xc) * (1.0 - Dx) * Dy + original->r (yc + 1, xc + 1) * Dx * Dy);
-                            transformed->g (y, x) = vignmul * (original->g (yc, xc) * (1.0 - Dx) * (1.0 - Dy) + original->g (yc, xc + 1) * Dx * (1.0 - Dy) + original->g (yc + 1, xc) * (1.0 - Dx) * Dy + original->g (yc + 1, xc + 1) * Dx * Dy);
-                            transformed->b (y, x) = vignmul * (original->b (yc, xc) * (1.0 - Dx) * (1.0 - Dy) + original->b (yc, xc + 1) * Dx * (1.0 - Dy) + original->b (yc + 1, xc) * (1.0 - Dx) * Dy + original->b (yc + 1, xc + 1) * Dx * Dy);
+                        if (yc > 0 && yc < original->getHeight() - 2 && xc > 0 && xc < original->getWidth() - 2) {
+                            // all interpolation pixels inside image
+                            if (enableCA) {
+                                interpolateTransformChannelsCubic (chOrig[c], xc - 1, yc - 1, Dx, Dy, & (chTrans[c][y][x]), vignmul);
+                            } else if (!highQuality) {
+                                transformed->r (y, x) = vignmul * (original->r (yc, xc) * (1.0 - Dx) * (1.0 - Dy) + original->r (yc, xc + 1) * Dx * (1.0 - Dy) + original->r (yc + 1, xc) * (1.0 - Dx) * Dy + original->r (yc + 1, xc + 1) * Dx * Dy);
+                                transformed->g (y, x) = vignmul * (original->g (yc, xc) * (1.0 - Dx) * (1.0 - Dy) + original->g (yc, xc + 1) * Dx * (1.0 - Dy) + original->g (yc + 1, xc) * (1.0 - Dx) * Dy + original->g (yc + 1, xc + 1) * Dx * Dy);
+                                transformed->b (y, x) = vignmul * (original->b (yc, xc) * (1.0 - Dx) * (1.0 - Dy) + original->b (yc, xc + 1) * Dx * (1.0 - Dy) + original->b (yc + 1, xc) * (1.0 - Dx) * Dy + original->b (yc + 1, xc + 1) * Dx * Dy);
+                            } else {
+                                interpolateTransformCubic (original, xc - 1, yc - 1, Dx, Dy, & (transformed->r (y, x)), & (transformed->g (y, x)), & (transformed->b (y, x)), vignmul);
+                            }
                         } else {
-                            interpolateTransformCubic (original, xc - 1, yc - 1, Dx, Dy, & (transformed->r (y, x)), & (transformed->g (y, x)), & (transformed->b (y, x)), vignmul);
+                            // edge pixels
+                            int y1 = LIM (yc,   0, original->getHeight() - 1);
+                            int y2 = LIM (yc + 1, 0, original->getHeight() - 1);
+                            int x1 = LIM (xc,   0, original->getWidth() - 1);
+                            int x2 = LIM (xc + 1, 0, original->getWidth() - 1);
+
+                            if (enableCA) {
+                                chTrans[c][y][x] = vignmul * (chOrig[c][y1][x1] * (1.0 - Dx) * (1.0 - Dy) + chOrig[c][y1][x2] * Dx * (1.0 - Dy) + chOrig[c][y2][x1] * (1.0 - Dx) * Dy + chOrig[c][y2][x2] * Dx * Dy);
+                            } else {
+                                transformed->r (y, x) = vignmul * (original->r (y1, x1) * (1.0 - Dx) * (1.0 - Dy) + original->r (y1, x2) * Dx * (1.0 - Dy) + original->r (y2, x1) * (1.0 - Dx) * Dy + original->r (y2, x2) * Dx * Dy);
+                                transformed->g (y, x) = vignmul * (original->g (y1, x1) * (1.0 - Dx) * (1.0 - Dy) + original->g (y1, x2) * Dx * (1.0 - Dy) + original->g (y2, x1) * (1.0 - Dx) * Dy + original->g (y2, x2) * Dx * Dy);
+                                transformed->b (y, x) = vignmul * (original->b (y1, x1) * (1.0 - Dx) * (1.0 - Dy) + original->b (y1, x2) * Dx * (1.0 - Dy) + original->b (y2, x1) * (1.0 - Dx) * Dy + original->b (y2, x2) * Dx * Dy);
+                            }
                         }
                     } else {
-                        // edge pixels
-                        int y1 = LIM (yc,   0, original->getHeight() - 1);
-                        int y2 = LIM (yc + 1, 0, original->getHeight() - 1);
-                        int x1 = LIM (xc,   0, original->getWidth() - 1);
-                        int x2 = LIM (xc + 1, 0, original->getWidth() - 1);
-
                         if (enableCA) {
-                            chTrans[c][y][x] = vignmul * (chOrig[c][y1][x1] * (1.0 - Dx) * (1.0 - Dy) + chOrig[c][y1][x2] * Dx * (1.0 - Dy) + chOrig[c][y2][x1] * (1.0 - Dx) * Dy + chOrig[c][y2][x2] * Dx * Dy);
+                            // not valid (source pixel x,y not inside source image, etc.)
+                            chTrans[c][y][x] = 0;
                         } else {
-                            transformed->r (y, x) = vignmul * (original->r (y1, x1) * (1.0 - Dx) * (1.0 - Dy) + original->r (y1, x2) * Dx * (1.0 - Dy) + original->r (y2, x1) * (1.0 - Dx) * Dy + original->r (y2, x2) * Dx * Dy);
-                            transformed->g (y, x) = vignmul * (original->g (y1, x1) * (1.0 - Dx) * (1.0 - Dy) + original->g (y1, x2) * Dx * (1.0 - Dy) + original->g (y2, x1) * (1.0 - Dx) * Dy + original->g (y2, x2) * Dx * Dy);
-                            transformed->b (y, x) = vignmul * (original->b (y1, x1) * (1.0 - Dx) * (1.0 - Dy) + original->b (y1, x2) * Dx * (1.0 - Dy) + original->b (y2, x1) * (1.0 - Dx) * Dy + original->b (y2, x2) * Dx * Dy);
+                            transformed->r (y, x) = 0;
+                            transformed->g (y, x) = 0;
+                            transformed->b (y, x) = 0;
                         }
                     }
-                } else {
-                    if (enableCA) {
-                        // not valid (source pixel x,y not inside source image, etc.)
-                        chTrans[c][y][x] = 0;
-                    } else {
-                        transformed->r (y, x) = 0;
-                        transformed->g (y, x) = 0;
-                        transformed->b (y, x) = 0;
-                    }
                 }
             }
         }
@@ -955,7 +1013,7 @@ void ImProcFunctions::transformGeneral(bool highQuality, Imagefloat *original, I
 }
 
 
-void ImProcFunctions::transformLCPCAOnly(Imagefloat *original, Imagefloat *transformed, int cx, int cy, const LensCorrection *pLCPMap)
+void ImProcFunctions::transformLCPCAOnly(Imagefloat *original, Imagefloat *transformed, int cx, int cy, const LensCorrection *pLCPMap, WarpMapKey warpKey)
 {
     assert(pLCPMap && params->lensProf.useCA && pLCPMap->isCACorrectionAvailable());
 
@@ -969,43 +1027,86 @@ void ImProcFunctions::transformLCPCAOnly(Imagefloat *original, Imagefloat *trans
     chTrans[1] = transformed->g.ptrs;
     chTrans[2] = transformed->b.ptrs;
 
+    const int width = transformed->getWidth();
+    const int height = transformed->getHeight();
+
+    warpKey.values.push_back(1.0); // CA correction only
+
+    std::shared_ptr<const WarpMap> warpMap = WarpMapCache::getInstance()->get(warpKey, cx, cy, width, height);
+
+    if (!warpMap) {
+        // the x and y source coordinates of each channel
+        const std::shared_ptr<WarpMap> map = std::make_shared<WarpMap>(cx, cy, width, height, 6);
+
 #ifdef _OPENMP
-    #pragma omp parallel for if (multiThread)
+        #pragma omp parallel for if (multiThread)
 #endif
 
-    for (int y = 0; y < transformed->getHeight(); y++) {
-        for (int x = 0; x < transformed->getWidth(); x++) {
-            for (int c = 0; c < 3; c++) {
-                double Dx = x;
-                double Dy = y;
-                
-                pLCPMap->correctCA(Dx, Dy, cx, cy, c);
+        for (int j = 0; j < map->getGridHeight(); j++) {
+            for (int i = 0; i < map->getGridWidth(); i++) {
+                for (int c = 0; c < 3; c++) {
+                    double Dx = map->getNodeX(i);
+                    double Dy = map->getNodeY(j);
 
-                // Extract integer and fractions of coordinates
-                int xc = (int)Dx;
-                Dx -= (double)xc;
-                int yc = (int)Dy;
-                Dy -= (double)yc;
+                    pLCPMap->correctCA(Dx, Dy, 0, 0, c);
 
-                // Convert only valid pixels
-                if (yc >= 0 && yc < original->getHeight() && xc >= 0 && xc < original->getWidth()) {
+                    *map->getNode(2 * c, i, j) = Dx;
+                    *map->getNode(2 * c + 1, i, j) = Dy;
+                }
+            }
+        }
 
-                    // multiplier for vignetting correction
-                    if (yc > 0 && yc < original->getHeight() - 2 && xc > 0 && xc < original->getWidth() - 2) {
-                        // all interpolation pixels inside image
-                        interpolateTransformChannelsCubic (chOrig[c], xc - 1, yc - 1, Dx, Dy, & (chTrans[c][y][x]), 1.0);
-                    } else {
-                        // edge pixels
-                        int y1 = LIM (yc,   0, original->getHeight() - 1);
-                        int y2 = LIM (yc + 1, 0, original->getHeight() - 1);
-                        int x1 = LIM (xc,   0, original->getWidth() - 1);
-                        int x2 = LIM (xc + 1, 0, original->getWidth() - 1);
+        WarpMapCache::getInstance()->put(warpKey, map);
+        warpMap = map;
+    }
+
+#ifdef _OPENMP
+    #pragma omp parallel if (multiThread)
+#endif
+    {
+        // source coordinates of the pixels of a row, interpolated from the warp map
+        std::vector<float> rows(6 * width);
+
+#ifdef _OPENMP
+        #pragma omp for
+#endif
 
-                        chTrans[c][y][x] = (chOrig[c][y1][x1] * (1.0 - Dx) * (1.0 - Dy) + chOrig[c][y1][x2] * Dx * (1.0 - Dy) + chOrig[c][y2][x1] * (1.0 - Dx) * Dy + chOrig[c][y2][x2] * Dx * Dy);
+        for (int y = 0; y < height; y++) {
+            for (int plane = 0; plane < 6; plane++) {
+                warpMap->getRow(plane, cx, cy + y, width, &rows[plane * width]);
+            }
+
+            for (int x = 0; x < width; x++) {
+                for (int c = 0; c < 3; c++) {
+                    double Dx = rows[2 * c * width + x] - cx;
+                    double Dy = rows[(2 * c + 1) * width + x] - cy;
+
+                    // Extract integer and fractions of coordinates
+                    int xc = (int)Dx;
+                    Dx -= (double)xc;
+                    int yc = (int)Dy;
+                    Dy -= (double)yc;
+
+                    // Convert only valid pixels
+                    if (yc >= 0 && yc < original->getHeight() && xc >= 0 && xc < original->getWidth()) {
+
+                        // multiplier for vignetting correction
+                        if (yc > 0 && yc < original->getHeight() - 2 && xc > 0 && xc < original->getWidth() - 2) {
+                            // all interpolation pixels inside image
+                            interpolateTransformChannelsCubic (chOrig[c], xc - 1, yc - 1, Dx, Dy, & (chTrans[c][y][x]), 1.0);
+                        } else {
+                            // edge pixels
+                            int y1 = LIM (yc,   0, original->getHeight() - 1);
+                            int y2 = LIM (yc + 1, 0, original->getHeight() - 1);
+                            int x1 = LIM (xc,   0, original->getWidth() - 1);
+                            int x2 = LIM (xc + 1, 0, original->getWidth() - 1);
+
+                            chTrans[c][y][x] = (chOrig[c][y1][x1] * (1.0 - Dx) * (1.0 - Dy) + chOrig[c][y1][x2] * Dx * (1.0 - Dy) + chOrig[c][y2][x1] * (1.0 - Dx) * Dy + chOrig[c][y2][x2] * Dx * Dy);
+                        }
+                    } else {
+                        // not valid (source pixel x,y not inside source image, etc.)
+                        chTrans[c][y][x] = 0;
                     }
-                } else {
-                    // not valid (source pixel x,y not inside source image, etc.)
-                    chTrans[c][y][x] = 0;
                 }
             }
         }
@@ -47,6 +47,9 @@
 #endif
 
 #include "cplx_wavelet_dec.h"
+#include "proctrace.h"
+#include "threadbudget.h"
+#include "memorybudget.h"
 
 #define TS 64       // Tile size
 #define offset 25   // shift between tiles
@@ -61,6 +64,20 @@ namespace rtengine
 
 extern const Settings* settings;
 
+namespace
+{
+
+constexpr int minWaveletRealTile = 4; // tiles of 512 pixels
+
+// estimated peak memory use of the wavelets of a tile: the Lab tile and its copy, the decompositions of its
+// 3 channels and the hue and chroma buffers
+std::size_t waveletTileMemory(int width, int height)
+{
+    return std::size_t(width) * height * 12 * sizeof(float);
+}
+
+}
+
 struct cont_params {
     float mul[10];
     int chrom;
@@ -138,13 +155,13 @@ struct cont_params {
     bool lipp;
 };
 
-int wavNestedLevels = 1;
-
 
 void ImProcFunctions::ip_wavelet(LabImage * lab, LabImage * dst, int kall, const procparams::WaveletParams & waparams, const WavCurve & wavCLVCcurve, const WavOpacityCurveRG & waOpacityCurveRG, const WavOpacityCurveBY & waOpacityCurveBY,  const WavOpacityCurveW & waOpacityCurveW, const WavOpacityCurveWL & waOpacityCurveWL, LUTf &wavclCurve, int skip)
 
 
 {
+    PROCTRACE("ip_wavelet");
+
 #ifdef _DEBUG
     // init variables to display Munsell corrections
     MunsellDebugInfo* MunsDebugInfo = new MunsellDebugInfo();
@@ -556,6 +573,43 @@ void ImProcFunctions::ip_wavelet(LabImage * lab, LabImage * dst, int kall, const
         kall = 0;
     }
 
+    // the whole image is processed at once only if the memory budget has room for it, and the tiles get smaller
+    // as long as it doesn't have room for one of them besides the output buffer
+    MemoryBudget::Reservation memoryReservation;
+    const std::size_t outputSize = std::size_t(imwidth) * imheight * 3 * sizeof(float);
+    const auto tileMemory = [&]() {
+        return waveletTileMemory(min<int>(tilesize, imwidth), min<int>(tilesize, imheight));
+    };
+
+    if(kall == 0 && !memoryReservation.reserve(waveletTileMemory(imwidth, imheight))) {
+        kall = 2;
+        realtile = max(realtile, 22);
+        tilesize = 128 * realtile;
+        overlap = (int) tilesize * 0.125f;
+    }
+
+    int maxThreadsForMemory = 0; // no limit
+
+    if(kall != 0) {
+        while(realtile > minWaveletRealTile && memoryReservation.reserveUnits(outputSize, tileMemory(), 1) < 1) {
+            realtile = max(realtile / 2, minWaveletRealTile);
+            tilesize = 128 * realtile;
+            overlap = (int) tilesize * 0.125f;
+        }
+
+#ifdef _OPENMP
+        maxThreadsForMemory = memoryReservation.reserveUnits(outputSize, tileMemory(), omp_get_max_threads());
+#else
+        maxThreadsForMemory = memoryReservation.reserveUnits(outputSize, tileMemory(), 1);
+#endif
+
+        if(!maxThreadsForMemory) {
+            // it won't get smaller, go on with one tile at a time anyway
+            memoryReservation.reserve(outputSize + tileMemory(), true);
+            maxThreadsForMemory = 1;
+        }
+    }
+
     Tile_calc (tilesize, overlap, kall, imwidth, imheight, numtiles_W, numtiles_H, tilewidth, tileheight, tileWskip, tileHskip);
 
     const int numtiles = numtiles_W * numtiles_H;
@@ -640,612 +694,615 @@ void ImProcFunctions::ip_wavelet(LabImage * lab, LabImage * dst, int kall, const
         maxnumberofthreadsforwavelet = min(max(options.rgbDenoiseThreadLimit / 2, 1), maxnumberofthreadsforwavelet);
     }
 
-    numthreads = MIN(numtiles, omp_get_max_threads());
-
-    if(maxnumberofthreadsforwavelet > 0) {
-        numthreads = MIN(numthreads, maxnumberofthreadsforwavelet);
-    }
+    // The threads are shared with the other images processed at the same time
+    const int maxThreads = maxnumberofthreadsforwavelet > 0 ? MIN(maxnumberofthreadsforwavelet, omp_get_max_threads()) : omp_get_max_threads();
+    // the memory budget limits the number of tiles processed at once, i.e. the outer threads
+    const int maxTilesAtOnce = maxThreadsForMemory > 0 ? min(maxThreads, maxThreadsForMemory) : maxThreads;
+    const bool oldNested = omp_get_nested();
+    // The threads are leased again for each batch of tile rows, so that the next batches use the threads
+    // given back meanwhile by the other images
+    const int rowsPerBatch = (maxTilesAtOnce + numtiles_W - 1) / numtiles_W;
+#else
+    const int rowsPerBatch = numtiles_H;
+#endif
 
+    for (int firstRow = 0; firstRow < numtiles_H && !isCancelled(); firstRow += rowsPerBatch) {
+        const int batchBottom = min(imheight, (firstRow + rowsPerBatch) * tileHskip);
 #ifdef _OPENMP
-    wavNestedLevels = omp_get_max_threads() / numthreads;
-    bool oldNested = omp_get_nested();
+        ThreadBudget::Lease threadLease(maxThreads);
+        threadLease.split(min(rowsPerBatch, numtiles_H - firstRow) * numtiles_W, numthreads, wavNestedLevels, maxTilesAtOnce);
+        // WaveletDenoiseAllL() is shared with the denoise
+        denoiseNestedLevels = wavNestedLevels;
+        omp_set_nested(oldNested || wavNestedLevels > 1);
 
-    if(wavNestedLevels < 2) {
-        wavNestedLevels = 1;
-    } else {
-        omp_set_nested(true);
-    }
-
-    if(maxnumberofthreadsforwavelet > 0)
-        while(wavNestedLevels * numthreads > maxnumberofthreadsforwavelet) {
-            wavNestedLevels--;
+        if(settings->verbose) {
+            printf("Ip Wavelet uses %d main thread(s) and up to %d nested thread(s) for each main thread\n", numthreads, wavNestedLevels);
         }
 
+        #pragma omp parallel num_threads(numthreads)
 #endif
+        {
+            float mean[10];
+            float meanN[10];
+            float sigma[10];
+            float sigmaN[10];
+            float MaxP[10];
+            float MaxN[10];
 
-    if(settings->verbose) {
-        printf("Ip Wavelet uses %d main thread(s) and up to %d nested thread(s) for each main thread\n", numthreads, wavNestedLevels);
-    }
-
-    #pragma omp parallel num_threads(numthreads)
-#endif
-    {
-        float mean[10];
-        float meanN[10];
-        float sigma[10];
-        float sigmaN[10];
-        float MaxP[10];
-        float MaxN[10];
-
-        float** varhue = new float*[tileheight];
+            float** varhue = new float*[tileheight];
 
-        for (int i = 0; i < tileheight; i++) {
-            varhue[i] = new float[tilewidth];
-        }
+            for (int i = 0; i < tileheight; i++) {
+                varhue[i] = new float[tilewidth];
+            }
 
-        float** varchro = new float*[tileheight];
+            float** varchro = new float*[tileheight];
 
-        for (int i = 0; i < tileheight; i++) {
-            varchro[i] = new float[tilewidth];
-        }
+            for (int i = 0; i < tileheight; i++) {
+                varchro[i] = new float[tilewidth];
+            }
 
 #ifdef _OPENMP
-        #pragma omp for schedule(dynamic) collapse(2)
+            #pragma omp for schedule(dynamic) collapse(2)
 #endif
 
-        for (int tiletop = 0; tiletop < imheight; tiletop += tileHskip) {
-            for (int tileleft = 0; tileleft < imwidth ; tileleft += tileWskip) {
-                int tileright = MIN(imwidth, tileleft + tilewidth);
-                int tilebottom = MIN(imheight, tiletop + tileheight);
-                int width  = tileright - tileleft;
-                int height = tilebottom - tiletop;
-                LabImage * labco;
-                float **Lold = nullptr;
-                float *LoldBuffer = nullptr;
-
-                if(numtiles == 1) { // untiled processing => we can use output buffer for labco
-                    labco = dst;
-
-                    if(cp.avoi) { // we need a buffer to hold a copy of the L channel
-                        Lold = new float*[tileheight];
-                        LoldBuffer = new float[tilewidth * tileheight];
-                        memcpy(LoldBuffer, lab->L[0], tilewidth * tileheight * sizeof(float));
-
-                        for (int i = 0; i < tileheight; i++) {
-                            Lold[i] = LoldBuffer + i * tilewidth;
-                        }
+            for (int tiletop = firstRow * tileHskip; tiletop < batchBottom; tiletop += tileHskip) {
+                for (int tileleft = 0; tileleft < imwidth ; tileleft += tileWskip) {
+                    if (isCancelled()) {
+                        continue;
                     }
 
-                } else {
-                    labco = new LabImage(width, height);
-                    Lold = lab->L;
-                }
+                    int tileright = MIN(imwidth, tileleft + tilewidth);
+                    int tilebottom = MIN(imheight, tiletop + tileheight);
+                    int width  = tileright - tileleft;
+                    int height = tilebottom - tiletop;
+                    LabImage * labco;
+                    float **Lold = nullptr;
+                    float *LoldBuffer = nullptr;
+
+                    if(numtiles == 1) { // untiled processing => we can use output buffer for labco
+                        labco = dst;
+
+                        if(cp.avoi) { // we need a buffer to hold a copy of the L channel
+                            Lold = new float*[tileheight];
+                            LoldBuffer = new float[tilewidth * tileheight];
+                            memcpy(LoldBuffer, lab->L[0], tilewidth * tileheight * sizeof(float));
+
+                            for (int i = 0; i < tileheight; i++) {
+                                Lold[i] = LoldBuffer + i * tilewidth;
+                            }
+                        }
+
+                    } else {
+                        labco = new LabImage(width, height);
+                        Lold = lab->L;
+                    }
 
 #ifdef _OPENMP
-                #pragma omp parallel for num_threads(wavNestedLevels) if(wavNestedLevels>1)
+                    #pragma omp parallel for num_threads(wavNestedLevels) if(wavNestedLevels>1)
 #endif
 
-                for (int i = tiletop; i < tilebottom; i++) {
-                    int i1 = i - tiletop;
-                    int j;
+                    for (int i = tiletop; i < tilebottom; i++) {
+                        int i1 = i - tiletop;
+                        int j;
 #ifdef __SSE2__
-                    __m128 c327d68v = _mm_set1_ps(327.68f);
-                    __m128 av, bv, huev, chrov;
-
-                    for (j = tileleft; j < tileright - 3; j += 4) {
-                        int j1 = j - tileleft;
-                        av = LVFU(lab->a[i][j]);
-                        bv = LVFU(lab->b[i][j]);
-                        huev = xatan2f(bv, av);
-                        chrov = vsqrtf(SQRV(av) + SQRV(bv)) / c327d68v;
-                        _mm_storeu_ps(&varhue[i1][j1], huev);
-                        _mm_storeu_ps(&varchro[i1][j1], chrov);
-
-                        if(labco != lab) {
-                            _mm_storeu_ps(&(labco->L[i1][j1]), LVFU(lab->L[i][j]));
-                            _mm_storeu_ps(&(labco->a[i1][j1]), av);
-                            _mm_storeu_ps(&(labco->b[i1][j1]), bv);
+                        __m128 c327d68v = _mm_set1_ps(327.68f);
+                        __m128 av, bv, huev, chrov;
+
+                        for (j = tileleft; j < tileright - 3; j += 4) {
+                            int j1 = j - tileleft;
+                            av = LVFU(lab->a[i][j]);
+                            bv = LVFU(lab->b[i][j]);
+                            huev = xatan2f(bv, av);
+                            chrov = vsqrtf(SQRV(av) + SQRV(bv)) / c327d68v;
+                            _mm_storeu_ps(&varhue[i1][j1], huev);
+                            _mm_storeu_ps(&varchro[i1][j1], chrov);
+
+                            if(labco != lab) {
+                                _mm_storeu_ps(&(labco->L[i1][j1]), LVFU(lab->L[i][j]));
+                                _mm_storeu_ps(&(labco->a[i1][j1]), av);
+                                _mm_storeu_ps(&(labco->b[i1][j1]), bv);
+                            }
                         }
-                    }
 
 #else
-                    j = tileleft;
+                        j = tileleft;
 #endif
 
-                    for (; j < tileright; j++) {
-                        int j1 = j - tileleft;
-                        float a = lab->a[i][j];
-                        float b = lab->b[i][j];
-                        varhue[i1][j1] = xatan2f(b, a);
-                        varchro[i1][j1] = (sqrtf(a * a + b * b)) / 327.68f;
-
-                        if(labco != lab) {
-                            labco->L[i1][j1] = lab->L[i][j];
-                            labco->a[i1][j1] = a;
-                            labco->b[i1][j1] = b;
+                        for (; j < tileright; j++) {
+                            int j1 = j - tileleft;
+                            float a = lab->a[i][j];
+                            float b = lab->b[i][j];
+                            varhue[i1][j1] = xatan2f(b, a);
+                            varchro[i1][j1] = (sqrtf(a * a + b * b)) / 327.68f;
+
+                            if(labco != lab) {
+                                labco->L[i1][j1] = lab->L[i][j];
+                                labco->a[i1][j1] = a;
+                                labco->b[i1][j1] = b;
+                            }
                         }
                     }
-                }
 
-                //to avoid artifacts in blue sky
-                if(params->wavelet.median) {
-                    float** tmL;
-                    int wid = labco->W;
-                    int hei = labco->H;
-                    int borderL = 1;
-                    tmL = new float*[hei];
+                    //to avoid artifacts in blue sky
+                    if(params->wavelet.median) {
+                        float** tmL;
+                        int wid = labco->W;
+                        int hei = labco->H;
+                        int borderL = 1;
+                        tmL = new float*[hei];
 
-                    for (int i = 0; i < hei; i++) {
-                        tmL[i] = new float[wid];
-                    }
+                        for (int i = 0; i < hei; i++) {
+                            tmL[i] = new float[wid];
+                        }
 
-                    for(int i = borderL; i < hei - borderL; i++ ) {
-                        for(int j = borderL; j < wid - borderL; j++) {
-                            tmL[i][j] = labco->L[i][j];
+                        for(int i = borderL; i < hei - borderL; i++ ) {
+                            for(int j = borderL; j < wid - borderL; j++) {
+                                tmL[i][j] = labco->L[i][j];
+                            }
                         }
-                    }
 
 #ifdef _OPENMP
-                    #pragma omp parallel for num_threads(wavNestedLevels) if(wavNestedLevels>1)
+                        #pragma omp parallel for num_threads(wavNestedLevels) if(wavNestedLevels>1)
 #endif
 
-                    for (int i = 1; i < hei - 1; i++) {
-                        for (int j = 1; j < wid - 1; j++) {
-                            if((varhue[i][j] < -1.3f && varhue[i][j] > - 2.5f)  && (varchro[i][j] > 15.f && varchro[i][j] < 55.f) && labco->L[i][j] > 6000.f) { //blue sky + med3x3  ==> after for more effect use denoise
-                                tmL[i][j] = median(labco->L[i][j] , labco->L[i - 1][j], labco->L[i + 1][j] , labco->L[i][j + 1], labco->L[i][j - 1], labco->L[i - 1][j - 1], labco->L[i - 1][j + 1], labco->L[i + 1][j - 1], labco->L[i + 1][j + 1]);    //3x3
+                        for (int i = 1; i < hei - 1; i++) {
+                            for (int j = 1; j < wid - 1; j++) {
+                                if((varhue[i][j] < -1.3f && varhue[i][j] > - 2.5f)  && (varchro[i][j] > 15.f && varchro[i][j] < 55.f) && labco->L[i][j] > 6000.f) { //blue sky + med3x3  ==> after for more effect use denoise
+                                    tmL[i][j] = median(labco->L[i][j] , labco->L[i - 1][j], labco->L[i + 1][j] , labco->L[i][j + 1], labco->L[i][j - 1], labco->L[i - 1][j - 1], labco->L[i - 1][j + 1], labco->L[i + 1][j - 1], labco->L[i + 1][j + 1]);    //3x3
+                                }
                             }
                         }
-                    }
 
-                    for(int i = borderL; i < hei - borderL; i++ ) {
-                        for(int j = borderL; j < wid - borderL; j++) {
-                            labco->L[i][j] = tmL[i][j];
+                        for(int i = borderL; i < hei - borderL; i++ ) {
+                            for(int j = borderL; j < wid - borderL; j++) {
+                                labco->L[i][j] = tmL[i][j];
+                            }
+                        }
+
+                        for (int i = 0; i < hei; i++) {
+                            delete [] tmL[i];
                         }
-                    }
 
-                    for (int i = 0; i < hei; i++) {
-                        delete [] tmL[i];
+                        delete [] tmL;
+                        // end blue sky
                     }
 
-                    delete [] tmL;
-                    // end blue sky
-                }
+                    if(numtiles == 1) {
+                        // reduce the varhue array to get faster access in following processing and reduce peak memory usage
+                        float temphue[(tilewidth + 1) / 2] ALIGNED64;
 
-                if(numtiles == 1) {
-                    // reduce the varhue array to get faster access in following processing and reduce peak memory usage
-                    float temphue[(tilewidth + 1) / 2] ALIGNED64;
+                        for (int i = 0; i < (tileheight + 1) / 2; i++) {
+                            for (int j = 0; j < (tilewidth + 1) / 2; j++) {
+                                temphue[j] = varhue[i * 2][j * 2];
+                            }
 
-                    for (int i = 0; i < (tileheight + 1) / 2; i++) {
-                        for (int j = 0; j < (tilewidth + 1) / 2; j++) {
-                            temphue[j] = varhue[i * 2][j * 2];
+                            delete [] varhue[i];
+                            varhue[i] = new float[(tilewidth + 1) / 2];
+                            memcpy(varhue[i], temphue, ((tilewidth + 1) / 2) * sizeof(float));
                         }
 
-                        delete [] varhue[i];
-                        varhue[i] = new float[(tilewidth + 1) / 2];
-                        memcpy(varhue[i], temphue, ((tilewidth + 1) / 2) * sizeof(float));
-                    }
-
-                    for(int i = (tileheight + 1) / 2; i < tileheight; i++) {
-                        delete [] varhue[i];
-                        varhue[i] = nullptr;
-                    }
-                } else { // reduce the varhue array to get faster access in following processing
-                    for (int i = 0; i < (tileheight + 1) / 2; i++) {
-                        for (int j = 0; j < (tilewidth + 1) / 2; j++) {
-                            varhue[i][j] = varhue[i * 2][j * 2];
+                        for(int i = (tileheight + 1) / 2; i < tileheight; i++) {
+                            delete [] varhue[i];
+                            varhue[i] = nullptr;
+                        }
+                    } else { // reduce the varhue array to get faster access in following processing
+                        for (int i = 0; i < (tileheight + 1) / 2; i++) {
+                            for (int j = 0; j < (tilewidth + 1) / 2; j++) {
+                                varhue[i][j] = varhue[i * 2][j * 2];
+                            }
                         }
                     }
-                }
 
-                int datalen = labco->W * labco->H;
+                    int datalen = labco->W * labco->H;
 
-                int levwavL = levwav;
-                bool ref0 = false;
+                    int levwavL = levwav;
+                    bool ref0 = false;
 
-                if((cp.lev0s > 0.f || cp.lev1s > 0.f || cp.lev2s > 0.f || cp.lev3s > 0.f) && cp.noiseena) {
-                    ref0 = true;
-                }
+                    if((cp.lev0s > 0.f || cp.lev1s > 0.f || cp.lev2s > 0.f || cp.lev3s > 0.f) && cp.noiseena) {
+                        ref0 = true;
+                    }
 
-                //  printf("LevwavL before: %d\n",levwavL);
-                if(cp.contrast == 0.f && !cp.tonemap && cp.conres == 0.f && cp.conresH == 0.f && cp.val == 0  && !ref0 && params->wavelet.CLmethod == "all") { // no processing of residual L  or edge=> we probably can reduce the number of levels
-                    while(levwavL > 0 && cp.mul[levwavL - 1] == 0.f) { // cp.mul[level] == 0.f means no changes to level
-                        levwavL--;
+                    //  printf("LevwavL before: %d\n",levwavL);
+                    if(cp.contrast == 0.f && !cp.tonemap && cp.conres == 0.f && cp.conresH == 0.f && cp.val == 0  && !ref0 && params->wavelet.CLmethod == "all") { // no processing of residual L  or edge=> we probably can reduce the number of levels
+                        while(levwavL > 0 && cp.mul[levwavL - 1] == 0.f) { // cp.mul[level] == 0.f means no changes to level
+                            levwavL--;
+                        }
                     }
-                }
 
-                //  printf("LevwavL after: %d\n",levwavL);
-                //  if(cp.noiseena){
-                if(levwavL < 4 ) {
-                    levwavL = 4;    //to allow edge  => I always allocate 3 (4) levels..because if user select wavelet it is to do something !!
-                }
+                    //  printf("LevwavL after: %d\n",levwavL);
+                    //  if(cp.noiseena){
+                    if(levwavL < 4 ) {
+                        levwavL = 4;    //to allow edge  => I always allocate 3 (4) levels..because if user select wavelet it is to do something !!
+                    }
 
-                //  }
-                //  else {
-                //      if(levwavL < 3) levwavL=3;//to allow edge  => I always allocate 3 (4) levels..because if user select wavelet it is to do something !!
-                //  }
-                if(levwavL > 0) {
-                    wavelet_decomposition* Ldecomp = new wavelet_decomposition (labco->data, labco->W, labco->H, levwavL, 1, skip, max(1, wavNestedLevels), DaubLen );
+                    //  }
+                    //  else {
+                    //      if(levwavL < 3) levwavL=3;//to allow edge  => I always allocate 3 (4) levels..because if user select wavelet it is to do something !!
+                    //  }
+                    if(levwavL > 0) {
+                        wavelet_decomposition* Ldecomp = new wavelet_decomposition (labco->data, labco->W, labco->H, levwavL, 1, skip, max(1, wavNestedLevels), DaubLen );
 
-                    if(!Ldecomp->memoryAllocationFailed) {
+                        if(!Ldecomp->memoryAllocationFailed) {
 
-                        float madL[8][3];
+                            float madL[8][3];
 #ifdef _OPENMP
-                        #pragma omp parallel for schedule(dynamic) collapse(2) num_threads(wavNestedLevels) if(wavNestedLevels>1)
+                            #pragma omp parallel for schedule(dynamic) collapse(2) num_threads(wavNestedLevels) if(wavNestedLevels>1)
 #endif
 
-                        for (int lvl = 0; lvl < 4; lvl++) {
-                            for (int dir = 1; dir < 4; dir++) {
-                                int Wlvl_L = Ldecomp->level_W(lvl);
-                                int Hlvl_L = Ldecomp->level_H(lvl);
+                            for (int lvl = 0; lvl < 4; lvl++) {
+                                for (int dir = 1; dir < 4; dir++) {
+                                    int Wlvl_L = Ldecomp->level_W(lvl);
+                                    int Hlvl_L = Ldecomp->level_H(lvl);
 
-                                float ** WavCoeffs_L = Ldecomp->level_coeffs(lvl);
+                                    float ** WavCoeffs_L = Ldecomp->level_coeffs(lvl);
 
-                                madL[lvl][dir - 1] = SQR(Mad(WavCoeffs_L[dir], Wlvl_L * Hlvl_L));
+                                    madL[lvl][dir - 1] = SQR(Mad(WavCoeffs_L[dir], Wlvl_L * Hlvl_L));
+                                }
                             }
-                        }
-
-                        bool ref = false;
-
-                        if((cp.lev0s > 0.f || cp.lev1s > 0.f || cp.lev2s > 0.f || cp.lev3s > 0.f) && cp.noiseena) {
-                            ref = true;
-                        }
 
-                        bool contr = false;
+                            bool ref = false;
 
-                        for(int f = 0; f < levwavL; f++) {
-                            if(cp.mul[f] != 0.f) {
-                                contr = true;
+                            if((cp.lev0s > 0.f || cp.lev1s > 0.f || cp.lev2s > 0.f || cp.lev3s > 0.f) && cp.noiseena) {
+                                ref = true;
                             }
-                        }
 
-                        if(cp.val > 0 || ref || contr) {//edge
-                            Evaluate2(*Ldecomp, mean, meanN, sigma, sigmaN, MaxP, MaxN);
-                        }
+                            bool contr = false;
 
-                        //init for edge and denoise
-                        float vari[4];
+                            for(int f = 0; f < levwavL; f++) {
+                                if(cp.mul[f] != 0.f) {
+                                    contr = true;
+                                }
+                            }
 
-                        vari[0] = 8.f * SQR((cp.lev0n / 125.0) * (1.0 + cp.lev0n / 25.0));
-                        vari[1] = 8.f * SQR((cp.lev1n / 125.0) * (1.0 + cp.lev1n / 25.0));
-                        vari[2] = 8.f * SQR((cp.lev2n / 125.0) * (1.0 + cp.lev2n / 25.0));
-                        vari[3] = 8.f * SQR((cp.lev3n / 125.0) * (1.0 + cp.lev3n / 25.0));
+                            if(cp.val > 0 || ref || contr) {//edge
+                                Evaluate2(*Ldecomp, mean, meanN, sigma, sigmaN, MaxP, MaxN);
+                            }
 
-                        if((cp.lev0n > 0.1f || cp.lev1n > 0.1f || cp.lev2n > 0.1f || cp.lev3n > 0.1f) && cp.noiseena) {
-                            int edge = 1;
-                            vari[0] = max(0.0001f, vari[0]);
-                            vari[1] = max(0.0001f, vari[1]);
-                            vari[2] = max(0.0001f, vari[2]);
-                            vari[3] = max(0.0001f, vari[3]);
-                            float* noisevarlum = nullptr;  // we need a dummy to pass it to WaveletDenoiseAllL
+                            //init for edge and denoise
+                            float vari[4];
 
-                            WaveletDenoiseAllL(*Ldecomp, noisevarlum, madL, vari, edge);
-                        }
+                            vari[0] = 8.f * SQR((cp.lev0n / 125.0) * (1.0 + cp.lev0n / 25.0));
+                            vari[1] = 8.f * SQR((cp.lev1n / 125.0) * (1.0 + cp.lev1n / 25.0));
+                            vari[2] = 8.f * SQR((cp.lev2n / 125.0) * (1.0 + cp.lev2n / 25.0));
+                            vari[3] = 8.f * SQR((cp.lev3n / 125.0) * (1.0 + cp.lev3n / 25.0));
 
-                        //Flat curve for Contrast=f(H) in levels
-                        FlatCurve* ChCurve = new FlatCurve(params->wavelet.Chcurve); //curve C=f(H)
-                        bool Chutili = false;
+                            if((cp.lev0n > 0.1f || cp.lev1n > 0.1f || cp.lev2n > 0.1f || cp.lev3n > 0.1f) && cp.noiseena) {
+                                int edge = 1;
+                                vari[0] = max(0.0001f, vari[0]);
+                                vari[1] = max(0.0001f, vari[1]);
+                                vari[2] = max(0.0001f, vari[2]);
+                                vari[3] = max(0.0001f, vari[3]);
+                                float* noisevarlum = nullptr;  // we need a dummy to pass it to WaveletDenoiseAllL
 
-                        if (!ChCurve || ChCurve->isIdentity()) {
-                            if (ChCurve) {
-                                delete ChCurve;
-                                ChCurve = nullptr;
+                                WaveletDenoiseAllL(*Ldecomp, noisevarlum, madL, vari, edge);
                             }
-                        } else {
-                            Chutili = true;
-                        }
 
+                            //Flat curve for Contrast=f(H) in levels
+                            FlatCurve* ChCurve = new FlatCurve(params->wavelet.Chcurve); //curve C=f(H)
+                            bool Chutili = false;
 
-                        WaveletcontAllL(labco, varhue, varchro, *Ldecomp, cp, skip, mean, sigma, MaxP, MaxN, wavCLVCcurve, waOpacityCurveW, ChCurve, Chutili);
+                            if (!ChCurve || ChCurve->isIdentity()) {
+                                if (ChCurve) {
+                                    delete ChCurve;
+                                    ChCurve = nullptr;
+                                }
+                            } else {
+                                Chutili = true;
+                            }
 
-                        if(cp.val > 0 || ref || contr  || cp.diagcurv) {//edge
-                            Evaluate2(*Ldecomp, mean, meanN, sigma, sigmaN, MaxP, MaxN);
-                        }
 
-                        WaveletcontAllLfinal(*Ldecomp, cp, mean, sigma, MaxP, waOpacityCurveWL);
-                        //Evaluate2(*Ldecomp, cp, ind, mean, meanN, sigma, sigmaN, MaxP, MaxN, madL);
+                            WaveletcontAllL(labco, varhue, varchro, *Ldecomp, cp, skip, mean, sigma, MaxP, MaxN, wavCLVCcurve, waOpacityCurveW, ChCurve, Chutili);
 
-                        Ldecomp->reconstruct(labco->data, cp.strength);
-                    }
+                            if(cp.val > 0 || ref || contr  || cp.diagcurv) {//edge
+                                Evaluate2(*Ldecomp, mean, meanN, sigma, sigmaN, MaxP, MaxN);
+                            }
 
-                    delete Ldecomp;
-                }
+                            WaveletcontAllLfinal(*Ldecomp, cp, mean, sigma, MaxP, waOpacityCurveWL);
+                            //Evaluate2(*Ldecomp, cp, ind, mean, meanN, sigma, sigmaN, MaxP, MaxN, madL);
 
-                //Flat curve for H=f(H) in residual image
-                FlatCurve* hhCurve = new FlatCurve(params->wavelet.hhcurve); //curve H=f(H)
-                bool hhutili = false;
+                            Ldecomp->reconstruct(labco->data, cp.strength);
+                        }
 
-                if (!hhCurve || hhCurve->isIdentity()) {
-                    if (hhCurve) {
-                        delete hhCurve;
-                        hhCurve = nullptr;
+                        delete Ldecomp;
                     }
-                } else {
-                    hhutili = true;
-                }
 
+                    //Flat curve for H=f(H) in residual image
+                    FlatCurve* hhCurve = new FlatCurve(params->wavelet.hhcurve); //curve H=f(H)
+                    bool hhutili = false;
 
-                if(!hhutili) {//always a or b
-                    int levwava = levwav;
-
-                    //  printf("Levwava before: %d\n",levwava);
-                    if(cp.chrores == 0.f && params->wavelet.CLmethod == "all" && !cp.cbena) { // no processing of residual ab => we probably can reduce the number of levels
-                        while(levwava > 0 && !cp.diag && (((cp.CHmet == 2 && (cp.chro == 0.f || cp.mul[levwava - 1] == 0.f )) || (cp.CHmet != 2 && (levwava == 10 || (!cp.curv  || cp.mulC[levwava - 1] == 0.f))))) && (!cp.opaRG || levwava == 10 || (cp.opaRG && cp.mulopaRG[levwava - 1] == 0.f)) && ((levwava == 10 || (cp.CHSLmet == 1 && cp.mulC[levwava - 1] == 0.f)))) {
-                            levwava--;
+                    if (!hhCurve || hhCurve->isIdentity()) {
+                        if (hhCurve) {
+                            delete hhCurve;
+                            hhCurve = nullptr;
                         }
+                    } else {
+                        hhutili = true;
                     }
 
-                    //printf("Levwava after: %d\n",levwava);
-                    if(levwava > 0) {
-                        wavelet_decomposition* adecomp = new wavelet_decomposition (labco->data + datalen, labco->W, labco->H, levwava, 1, skip, max(1, wavNestedLevels), DaubLen );
 
-                        if(!adecomp->memoryAllocationFailed) {
-                            WaveletcontAllAB(labco, varhue, varchro, *adecomp, waOpacityCurveW, cp, true);
-                            adecomp->reconstruct(labco->data + datalen, cp.strength);
-                        }
+                    if(!hhutili) {//always a or b
+                        int levwava = levwav;
 
-                        delete adecomp;
-                    }
-
-                    int levwavb = levwav;
-
-                    //printf("Levwavb before: %d\n",levwavb);
-                    if(cp.chrores == 0.f && params->wavelet.CLmethod == "all" && !cp.cbena) { // no processing of residual ab => we probably can reduce the number of levels
-                        while(levwavb > 0 &&  !cp.diag && (((cp.CHmet == 2 && (cp.chro == 0.f || cp.mul[levwavb - 1] == 0.f )) || (cp.CHmet != 2 && (levwavb == 10 || (!cp.curv || cp.mulC[levwavb - 1] == 0.f))))) && (!cp.opaBY || levwavb == 10 || (cp.opaBY && cp.mulopaBY[levwavb - 1] == 0.f)) && ((levwavb == 10 || (cp.CHSLmet == 1 && cp.mulC[levwavb - 1] == 0.f)))) {
-                            levwavb--;
+                        //  printf("Levwava before: %d\n",levwava);
+                        if(cp.chrores == 0.f && params->wavelet.CLmethod == "all" && !cp.cbena) { // no processing of residual ab => we probably can reduce the number of levels
+                            while(levwava > 0 && !cp.diag && (((cp.CHmet == 2 && (cp.chro == 0.f || cp.mul[levwava - 1] == 0.f )) || (cp.CHmet != 2 && (levwava == 10 || (!cp.curv  || cp.mulC[levwava - 1] == 0.f))))) && (!cp.opaRG || levwava == 10 || (cp.opaRG && cp.mulopaRG[levwava - 1] == 0.f)) && ((levwava == 10 || (cp.CHSLmet == 1 && cp.mulC[levwava - 1] == 0.f)))) {
+                                levwava--;
+                            }
                         }
-                    }
 
-                    //  printf("Levwavb after: %d\n",levwavb);
-                    if(levwavb > 0) {
-                        wavelet_decomposition* bdecomp = new wavelet_decomposition (labco->data + 2 * datalen, labco->W, labco->H, levwavb, 1, skip, max(1, wavNestedLevels), DaubLen );
+                        //printf("Levwava after: %d\n",levwava);
+                        if(levwava > 0 && !isCancelled()) {
+                            wavelet_decomposition* adecomp = new wavelet_decomposition (labco->data + datalen, labco->W, labco->H, levwava, 1, skip, max(1, wavNestedLevels), DaubLen );
 
-                        if(!bdecomp->memoryAllocationFailed) {
-                            WaveletcontAllAB(labco, varhue, varchro, *bdecomp, waOpacityCurveW, cp, false);
-                            bdecomp->reconstruct(labco->data + 2 * datalen, cp.strength);
+                            if(!adecomp->memoryAllocationFailed) {
+                                WaveletcontAllAB(labco, varhue, varchro, *adecomp, waOpacityCurveW, cp, true);
+                                adecomp->reconstruct(labco->data + datalen, cp.strength);
+                            }
+
+                            delete adecomp;
                         }
 
-                        delete bdecomp;
-                    }
-                } else {// a and b
-                    int levwavab = levwav;
+                        int levwavb = levwav;
 
-                    //  printf("Levwavab before: %d\n",levwavab);
-                    if(cp.chrores == 0.f && !hhutili && params->wavelet.CLmethod == "all") { // no processing of residual ab => we probably can reduce the number of levels
-                        while(levwavab > 0 && (((cp.CHmet == 2 && (cp.chro == 0.f || cp.mul[levwavab - 1] == 0.f )) || (cp.CHmet != 2 && (levwavab == 10 || (!cp.curv  || cp.mulC[levwavab - 1] == 0.f))))) && (!cp.opaRG || levwavab == 10 || (cp.opaRG && cp.mulopaRG[levwavab - 1] == 0.f)) && ((levwavab == 10 || (cp.CHSLmet == 1 && cp.mulC[levwavab - 1] == 0.f)))) {
-                            levwavab--;
+                        //printf("Levwavb before: %d\n",levwavb);
+                        if(cp.chrores == 0.f && params->wavelet.CLmethod == "all" && !cp.cbena) { // no processing of residual ab => we probably can reduce the number of levels
+                            while(levwavb > 0 &&  !cp.diag && (((cp.CHmet == 2 && (cp.chro == 0.f || cp.mul[levwavb - 1] == 0.f )) || (cp.CHmet != 2 && (levwavb == 10 || (!cp.curv || cp.mulC[levwavb - 1] == 0.f))))) && (!cp.opaBY || levwavb == 10 || (cp.opaBY && cp.mulopaBY[levwavb - 1] == 0.f)) && ((levwavb == 10 || (cp.CHSLmet == 1 && cp.mulC[levwavb - 1] == 0.f)))) {
+                                levwavb--;
+                            }
                         }
-                    }
 
-                    //  printf("Levwavab after: %d\n",levwavab);
-                    if(levwavab > 0) {
-                        wavelet_decomposition* adecomp = new wavelet_decomposition (labco->data + datalen, labco->W, labco->H, levwavab, 1, skip, max(1, wavNestedLevels), DaubLen );
-                        wavelet_decomposition* bdecomp = new wavelet_decomposition (labco->data + 2 * datalen, labco->W, labco->H, levwavab, 1, skip, max(1, wavNestedLevels), DaubLen );
+                        //  printf("Levwavb after: %d\n",levwavb);
+                        if(levwavb > 0 && !isCancelled()) {
+                            wavelet_decomposition* bdecomp = new wavelet_decomposition (labco->data + 2 * datalen, labco->W, labco->H, levwavb, 1, skip, max(1, wavNestedLevels), DaubLen );
 
-                        if(!adecomp->memoryAllocationFailed && !bdecomp->memoryAllocationFailed) {
-                            WaveletcontAllAB(labco, varhue, varchro, *adecomp, waOpacityCurveW, cp, true);
-                            WaveletcontAllAB(labco, varhue, varchro, *bdecomp, waOpacityCurveW, cp, false);
-                            WaveletAandBAllAB(*adecomp, *bdecomp, cp, hhCurve, hhutili );
+                            if(!bdecomp->memoryAllocationFailed) {
+                                WaveletcontAllAB(labco, varhue, varchro, *bdecomp, waOpacityCurveW, cp, false);
+                                bdecomp->reconstruct(labco->data + 2 * datalen, cp.strength);
+                            }
 
-                            adecomp->reconstruct(labco->data + datalen, cp.strength);
-                            bdecomp->reconstruct(labco->data + 2 * datalen, cp.strength);
+                            delete bdecomp;
+                        }
+                    } else {// a and b
+                        int levwavab = levwav;
 
+                        //  printf("Levwavab before: %d\n",levwavab);
+                        if(cp.chrores == 0.f && !hhutili && params->wavelet.CLmethod == "all") { // no processing of residual ab => we probably can reduce the number of levels
+                            while(levwavab > 0 && (((cp.CHmet == 2 && (cp.chro == 0.f || cp.mul[levwavab - 1] == 0.f )) || (cp.CHmet != 2 && (levwavab == 10 || (!cp.curv  || cp.mulC[levwavab - 1] == 0.f))))) && (!cp.opaRG || levwavab == 10 || (cp.opaRG && cp.mulopaRG[levwavab - 1] == 0.f)) && ((levwavab == 10 || (cp.CHSLmet == 1 && cp.mulC[levwavab - 1] == 0.f)))) {
+                                levwavab--;
+                            }
                         }
 
-                        delete adecomp;
-                        delete bdecomp;
-                    }
-                }
+                        //  printf("Levwavab after: %d\n",levwavab);
+                        if(levwavab > 0 && !isCancelled()) {
+                            wavelet_decomposition* adecomp = new wavelet_decomposition (labco->data + datalen, labco->W, labco->H, levwavab, 1, skip, max(1, wavNestedLevels), DaubLen );
+                            wavelet_decomposition* bdecomp = new wavelet_decomposition (labco->data + 2 * datalen, labco->W, labco->H, levwavab, 1, skip, max(1, wavNestedLevels), DaubLen );
 
-                if (hhCurve) {
-                    delete hhCurve;
-                }
+                            if(!adecomp->memoryAllocationFailed && !bdecomp->memoryAllocationFailed) {
+                                WaveletcontAllAB(labco, varhue, varchro, *adecomp, waOpacityCurveW, cp, true);
+                                WaveletcontAllAB(labco, varhue, varchro, *bdecomp, waOpacityCurveW, cp, false);
+                                WaveletAandBAllAB(*adecomp, *bdecomp, cp, hhCurve, hhutili );
 
-                if(numtiles > 1 || (numtiles == 1 /*&& cp.avoi*/)) {//in all case since I add contrast curve
-                    //calculate mask for feathering output tile overlaps
-                    float Vmask[height + overlap] ALIGNED16;
-                    float Hmask[width + overlap] ALIGNED16;
+                                adecomp->reconstruct(labco->data + datalen, cp.strength);
+                                bdecomp->reconstruct(labco->data + 2 * datalen, cp.strength);
 
-                    if(numtiles > 1) {
-                        for (int i = 0; i < height; i++) {
-                            Vmask[i] = 1;
-                        }
+                            }
 
-                        for (int j = 0; j < width; j++) {
-                            Hmask[j] = 1;
+                            delete adecomp;
+                            delete bdecomp;
                         }
+                    }
 
-                        for (int i = 0; i < overlap; i++) {
-                            float mask = SQR(sin((rtengine::RT_PI * i) / (2 * overlap)));
+                    if (hhCurve) {
+                        delete hhCurve;
+                    }
 
-                            if (tiletop > 0) {
-                                Vmask[i] = mask;
-                            }
+                    if(numtiles > 1 || (numtiles == 1 /*&& cp.avoi*/)) {//in all case since I add contrast curve
+                        //calculate mask for feathering output tile overlaps
+                        float Vmask[height + overlap] ALIGNED16;
+                        float Hmask[width + overlap] ALIGNED16;
 
-                            if (tilebottom < imheight) {
-                                Vmask[height - i] = mask;
+                        if(numtiles > 1) {
+                            for (int i = 0; i < height; i++) {
+                                Vmask[i] = 1;
                             }
 
-                            if (tileleft > 0) {
-                                Hmask[i] = mask;
+                            for (int j = 0; j < width; j++) {
+                                Hmask[j] = 1;
                             }
 
-                            if (tileright < imwidth) {
-                                Hmask[width - i] = mask;
+                            for (int i = 0; i < overlap; i++) {
+                                float mask = SQR(sin((rtengine::RT_PI * i) / (2 * overlap)));
+
+                                if (tiletop > 0) {
+                                    Vmask[i] = mask;
+                                }
+
+                                if (tilebottom < imheight) {
+                                    Vmask[height - i] = mask;
+                                }
+
+                                if (tileleft > 0) {
+                                    Hmask[i] = mask;
+                                }
+
+                                if (tileright < imwidth) {
+                                    Hmask[width - i] = mask;
+                                }
                             }
                         }
-                    }
 
-                    bool highlight = params->toneCurve.hrenabled;
+                        bool highlight = params->toneCurve.hrenabled;
 
 #ifdef _OPENMP
-                    #pragma omp parallel for schedule(dynamic,16) num_threads(wavNestedLevels) if(wavNestedLevels>1)
+                        #pragma omp parallel for schedule(dynamic,16) num_threads(wavNestedLevels) if(wavNestedLevels>1)
 #endif
 
-                    for (int i = tiletop; i < tilebottom; i++) {
-                        int i1 = i - tiletop;
-                        float L, a, b;
+                        for (int i = tiletop; i < tilebottom; i++) {
+                            int i1 = i - tiletop;
+                            float L, a, b;
 #ifdef __SSE2__
-                        int rowWidth = tileright - tileleft;
-                        float atan2Buffer[rowWidth] ALIGNED64;
-                        float chprovBuffer[rowWidth] ALIGNED64;
-                        float xBuffer[rowWidth] ALIGNED64;
-                        float yBuffer[rowWidth] ALIGNED64;
-
-                        if(cp.avoi) {
-                            int col;
-                            __m128 av, bv;
-                            __m128 cv, yv, xv;
-                            __m128 zerov = _mm_setzero_ps();
-                            __m128 onev = _mm_set1_ps(1.f);
-                            __m128 c327d68v = _mm_set1_ps(327.68f);
-                            vmask xyMask;
-
-                            for(col = 0; col < rowWidth - 3; col += 4) {
-                                av = LVFU(labco->a[i1][col]);
-                                bv = LVFU(labco->b[i1][col]);
-                                STVF(atan2Buffer[col], xatan2f(bv, av));
-
-                                cv = vsqrtf(SQRV(av) + SQRV(bv));
-                                yv = av / cv;
-                                xv = bv / cv;
-                                xyMask = vmaskf_eq(zerov, cv);
-                                yv = vself(xyMask, onev, yv);
-                                xv = vself(xyMask, zerov, xv);
-                                STVF(yBuffer[col], yv);
-                                STVF(xBuffer[col], xv);
-                                STVF(chprovBuffer[col], cv / c327d68v);
+                            int rowWidth = tileright - tileleft;
+                            float atan2Buffer[rowWidth] ALIGNED64;
+                            float chprovBuffer[rowWidth] ALIGNED64;
+                            float xBuffer[rowWidth] ALIGNED64;
+                            float yBuffer[rowWidth] ALIGNED64;
+
+                            if(cp.avoi) {
+                                int col;
+                                __m128 av, bv;
+                                __m128 cv, yv, xv;
+                                __m128 zerov = _mm_setzero_ps();
+                                __m128 onev = _mm_set1_ps(1.f);
+                                __m128 c327d68v = _mm_set1_ps(327.68f);
+                                vmask xyMask;
+
+                                for(col = 0; col < rowWidth - 3; col += 4) {
+                                    av = LVFU(labco->a[i1][col]);
+                                    bv = LVFU(labco->b[i1][col]);
+                                    STVF(atan2Buffer[col], xatan2f(bv, av));
+
+                                    cv = vsqrtf(SQRV(av) + SQRV(bv));
+                                    yv = av / cv;
+                                    xv = bv / cv;
+                                    xyMask = vmaskf_eq(zerov, cv);
+                                    yv = vself(xyMask, onev, yv);
+                                    xv = vself(xyMask, zerov, xv);
+                                    STVF(yBuffer[col], yv);
+                                    STVF(xBuffer[col], xv);
+                                    STVF(chprovBuffer[col], cv / c327d68v);
 
-                            }
+                                }
 
-                            for(; col < rowWidth; col++) {
-                                float a = labco->a[i1][col];
-                                float b = labco->b[i1][col];
-                                atan2Buffer[col] = xatan2f(b, a);
-                                float Chprov1 = sqrtf(SQR(a) + SQR(b));
-                                yBuffer[col] = (Chprov1 == 0.f) ? 1.f : a / Chprov1;
-                                xBuffer[col] = (Chprov1 == 0.f) ? 0.f : b / Chprov1;
-                                chprovBuffer[col] = Chprov1 / 327.68;
+                                for(; col < rowWidth; col++) {
+                                    float a = labco->a[i1][col];
+                                    float b = labco->b[i1][col];
+                                    atan2Buffer[col] = xatan2f(b, a);
+                                    float Chprov1 = sqrtf(SQR(a) + SQR(b));
+                                    yBuffer[col] = (Chprov1 == 0.f) ? 1.f : a / Chprov1;
+                                    xBuffer[col] = (Chprov1 == 0.f) ? 0.f : b / Chprov1;
+                                    chprovBuffer[col] = Chprov1 / 327.68;
+                                }
                             }
-                        }
 
 #endif
 
-                        for (int j = tileleft; j < tileright; j++) {
-                            int j1 = j - tileleft;
+                            for (int j = tileleft; j < tileright; j++) {
+                                int j1 = j - tileleft;
 
-                            if(cp.avoi) { //Gamut and Munsell
+                                if(cp.avoi) { //Gamut and Munsell
 #ifdef __SSE2__
-                                float HH = atan2Buffer[j1];
-                                float Chprov1 = chprovBuffer[j1];
-                                float2 sincosv;
-                                sincosv.y = yBuffer[j1];
-                                sincosv.x = xBuffer[j1];
+                                    float HH = atan2Buffer[j1];
+                                    float Chprov1 = chprovBuffer[j1];
+                                    float2 sincosv;
+                                    sincosv.y = yBuffer[j1];
+                                    sincosv.x = xBuffer[j1];
 #else
-                                a = labco->a[i1][j1];
-                                b = labco->b[i1][j1];
-                                float HH = xatan2f(b, a);
-                                float Chprov1 = sqrtf(SQR(a) + SQR(b));
-                                float2 sincosv;
-                                sincosv.y = (Chprov1 == 0.0f) ? 1.f : a / (Chprov1);
-                                sincosv.x = (Chprov1 == 0.0f) ? 0.f : b / (Chprov1);
-                                Chprov1 /= 327.68f;
+                                    a = labco->a[i1][j1];
+                                    b = labco->b[i1][j1];
+                                    float HH = xatan2f(b, a);
+                                    float Chprov1 = sqrtf(SQR(a) + SQR(b));
+                                    float2 sincosv;
+                                    sincosv.y = (Chprov1 == 0.0f) ? 1.f : a / (Chprov1);
+                                    sincosv.x = (Chprov1 == 0.0f) ? 0.f : b / (Chprov1);
+                                    Chprov1 /= 327.68f;
 #endif
-                                L = labco->L[i1][j1];
-                                const float Lin = labco->L[i1][j1];
+                                    L = labco->L[i1][j1];
+                                    const float Lin = labco->L[i1][j1];
 
-                                if(wavclCurve  && cp.finena) {
-                                    labco->L[i1][j1] = (0.5f * Lin  + 1.5f * wavclCurve[Lin]) / 2.f;   //apply contrast curve
-                                }
+                                    if(wavclCurve  && cp.finena) {
+                                        labco->L[i1][j1] = (0.5f * Lin  + 1.5f * wavclCurve[Lin]) / 2.f;   //apply contrast curve
+                                    }
 
-                                L = labco->L[i1][j1];
+                                    L = labco->L[i1][j1];
 
-                                float Lprov1 = L / 327.68f;
-                                float Lprov2 = Lold[i][j] / 327.68f;
-                                float memChprov = varchro[i1][j1];
-                                float R, G, B;
+                                    float Lprov1 = L / 327.68f;
+                                    float Lprov2 = Lold[i][j] / 327.68f;
+                                    float memChprov = varchro[i1][j1];
+                                    float R, G, B;
 #ifdef _DEBUG
-                                bool neg = false;
-                                bool more_rgb = false;
-                                Color::gamutLchonly(HH, sincosv, Lprov1, Chprov1, R, G, B, wip, highlight, 0.15f, 0.96f, neg, more_rgb);
+                                    bool neg = false;
+                                    bool more_rgb = false;
+                                    Color::gamutLchonly(HH, sincosv, Lprov1, Chprov1, R, G, B, wip, highlight, 0.15f, 0.96f, neg, more_rgb);
 #else
-                                Color::gamutLchonly(HH, sincosv, Lprov1, Chprov1, R, G, B, wip, highlight, 0.15f, 0.96f);
+                                    Color::gamutLchonly(HH, sincosv, Lprov1, Chprov1, R, G, B, wip, highlight, 0.15f, 0.96f);
 #endif
-                                L = Lprov1 * 327.68f;
-
-                                a = 327.68f * Chprov1 * sincosv.y; //gamut
-                                b = 327.68f * Chprov1 * sincosv.x; //gamut
-                                float correctionHue = 0.0f; // Munsell's correction
-                                float correctlum = 0.0f;
-                                Lprov1 = L / 327.68f;
-                                float Chprov = sqrtf(SQR(a) + SQR(b)) / 327.68f;
+                                    L = Lprov1 * 327.68f;
+
+                                    a = 327.68f * Chprov1 * sincosv.y; //gamut
+                                    b = 327.68f * Chprov1 * sincosv.x; //gamut
+                                    float correctionHue = 0.0f; // Munsell's correction
+                                    float correctlum = 0.0f;
+                                    Lprov1 = L / 327.68f;
+                                    float Chprov = sqrtf(SQR(a) + SQR(b)) / 327.68f;
 #ifdef _DEBUG
-                                Color::AllMunsellLch(true, Lprov1, Lprov2, HH, Chprov, memChprov, correctionHue, correctlum, MunsDebugInfo);
+                                    Color::AllMunsellLch(true, Lprov1, Lprov2, HH, Chprov, memChprov, correctionHue, correctlum, MunsDebugInfo);
 #else
-                                Color::AllMunsellLch(true, Lprov1, Lprov2, HH, Chprov, memChprov, correctionHue, correctlum);
+                                    Color::AllMunsellLch(true, Lprov1, Lprov2, HH, Chprov, memChprov, correctionHue, correctlum);
 #endif
 
-                                if(correctionHue != 0.f || correctlum != 0.f) { // only calculate sin and cos if HH changed
-                                    if(fabs(correctionHue) < 0.015f) {
-                                        HH += correctlum;    // correct only if correct Munsell chroma very little.
+                                    if(correctionHue != 0.f || correctlum != 0.f) { // only calculate sin and cos if HH changed
+                                        if(fabs(correctionHue) < 0.015f) {
+                                            HH += correctlum;    // correct only if correct Munsell chroma very little.
+                                        }
+
+                                        sincosv = xsincosf(HH + correctionHue);
                                     }
 
-                                    sincosv = xsincosf(HH + correctionHue);
-                                }
+                                    a = 327.68f * Chprov * sincosv.y; // apply Munsell
+                                    b = 327.68f * Chprov * sincosv.x; //aply Munsell
+                                } else {//general case
+                                    L = labco->L[i1][j1];
+                                    const float Lin = labco->L[i1][j1];
 
-                                a = 327.68f * Chprov * sincosv.y; // apply Munsell
-                                b = 327.68f * Chprov * sincosv.x; //aply Munsell
-                            } else {//general case
-                                L = labco->L[i1][j1];
-                                const float Lin = labco->L[i1][j1];
+                                    if(wavclCurve  && cp.finena) {
+                                        labco->L[i1][j1] = (0.5f * Lin + 1.5f * wavclCurve[Lin]) / 2.f;   //apply contrast curve
+                                    }
 
-                                if(wavclCurve  && cp.finena) {
-                                    labco->L[i1][j1] = (0.5f * Lin + 1.5f * wavclCurve[Lin]) / 2.f;   //apply contrast curve
+                                    L = labco->L[i1][j1];
+                                    a = labco->a[i1][j1];
+                                    b = labco->b[i1][j1];
                                 }
 
-                                L = labco->L[i1][j1];
-                                a = labco->a[i1][j1];
-                                b = labco->b[i1][j1];
-                            }
-
-                            if(numtiles > 1) {
-                                float factor = Vmask[i1] * Hmask[j1];
-                                dsttmp->L[i][j] += factor * L;
-                                dsttmp->a[i][j] += factor * a;
-                                dsttmp->b[i][j] += factor * b;
-                            } else {
-                                dsttmp->L[i][j] = L;
-                                dsttmp->a[i][j] = a;
-                                dsttmp->b[i][j] = b;
+                                if(numtiles > 1) {
+                                    float factor = Vmask[i1] * Hmask[j1];
+                                    dsttmp->L[i][j] += factor * L;
+                                    dsttmp->a[i][j] += factor * a;
+                                    dsttmp->b[i][j] += factor * b;
+                                } else {
+                                    dsttmp->L[i][j] = L;
+                                    dsttmp->a[i][j] = a;
+                                    dsttmp->b[i][j] = b;
 
+                                }
                             }
                         }
                     }
-                }
 
-                if(LoldBuffer != nullptr) {
-                    delete [] LoldBuffer;
-                    delete [] Lold;
-                }
+                    if(LoldBuffer != nullptr) {
+                        delete [] LoldBuffer;
+                        delete [] Lold;
+                    }
 
-                if(numtiles > 1) {
-                    delete labco;
+                    if(numtiles > 1) {
+                        delete labco;
+                    }
                 }
             }
-        }
 
-        for (int i = 0; i < tileheight; i++)
-            if(varhue[i] != nullptr) {
-                delete [] varhue[i];
-            }
+            for (int i = 0; i < tileheight; i++)
+                if(varhue[i] != nullptr) {
+                    delete [] varhue[i];
+                }
 
-        delete [] varhue;
+            delete [] varhue;
 
-        for (int i = 0; i < tileheight; i++) {
-            delete [] varchro[i];
-        }
+            for (int i = 0; i < tileheight; i++) {
+                delete [] varchro[i];
+            }
 
-        delete [] varchro;
+            delete [] varchro;
 
+        }
     }
 #ifdef _OPENMP
     omp_set_nested(oldNested);
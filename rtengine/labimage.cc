@@ -19,9 +19,12 @@
 
 #include <cstring>
 #include <memory>
+#include <new>
 
 #include "labimage.h"
 
+#include "bufferpool.h"
+
 namespace rtengine
 {
 
@@ -70,7 +73,12 @@ void LabImage::allocLab(size_t w, size_t h)
     a = new float*[h];
     b = new float*[h];
 
-    data = new float [w * h * 3];
+    data = static_cast<float*>(BufferPool::getInstance()->allocate(w * h * 3 * sizeof(float)));
+
+    if (!data) {
+        throw std::bad_alloc();
+    }
+
     float * index = data;
 
     for (size_t i = 0; i < h; i++) {
@@ -95,7 +103,7 @@ void LabImage::deleteLab()
     delete [] L;
     delete [] a;
     delete [] b;
-    delete [] data;
+    BufferPool::getInstance()->release(data);
 }
 
 void LabImage::reallocLab()
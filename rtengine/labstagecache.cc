@@ -0,0 +1,132 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "labstagecache.h"
+
+#include "labimage.h"
+
+namespace rtengine
+{
+
+namespace
+{
+
+std::size_t getSize(const LabImage* image)
+{
+    return static_cast<std::size_t>(image->W) * image->H * 3 * sizeof(float);
+}
+
+}
+
+LabStageCache::LabStageCache(int numStages) :
+    entries(numStages),
+    budget(0)
+{
+    for (auto& entry : entries) {
+        entry.valid = false;
+    }
+}
+
+LabStageCache::~LabStageCache() = default;
+
+void LabStageCache::setBudget(std::size_t bytes)
+{
+    budget = bytes;
+
+    for (auto& entry : entries) {
+        if (entry.image && getUsedBytes() > budget) {
+            entry.image.reset();
+            entry.valid = false;
+        }
+    }
+}
+
+void LabStageCache::invalidate(int stage)
+{
+    for (std::size_t i = stage; i < entries.size(); ++i) {
+        entries[i].valid = false;
+    }
+}
+
+int LabStageCache::getRestartStage(int stage) const
+{
+    for (int i = stage - 1; i >= 0; --i) {
+        if (entries[i].valid) {
+            return i + 1;
+        }
+    }
+
+    return 0;
+}
+
+LabImage* LabStageCache::getOutput(int stage) const
+{
+    return entries[stage].valid ? entries[stage].image.get() : nullptr;
+}
+
+void LabStageCache::store(int stage, LabImage* output)
+{
+    Entry& entry = entries[stage];
+    const std::size_t size = getSize(output);
+
+    if (entry.image && (entry.image->W != output->W || entry.image->H != output->H)) {
+        entry.image.reset();
+    }
+
+    entry.valid = false;
+
+    if (size > budget) {
+        entry.image.reset();
+        return;
+    }
+
+    if (!entry.image) {
+        // Make room, first with the buffers of the invalid outputs, then with the outputs of the earliest stages
+        for (int pass = 0; pass < 2 && getUsedBytes() + size > budget; ++pass) {
+            for (auto& other : entries) {
+                if (other.image && (pass == 1 || !other.valid)) {
+                    other.image.reset();
+                    other.valid = false;
+
+                    if (getUsedBytes() + size <= budget) {
+                        break;
+                    }
+                }
+            }
+        }
+
+        entry.image.reset(new LabImage(output->W, output->H));
+    }
+
+    entry.image->CopyFrom(output);
+    entry.valid = true;
+}
+
+std::size_t LabStageCache::getUsedBytes() const
+{
+    std::size_t used = 0;
+
+    for (const auto& entry : entries) {
+        if (entry.image) {
+            used += getSize(entry.image.get());
+        }
+    }
+
+    return used;
+}
+
+}
@@ -0,0 +1,70 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "noncopyable.h"
+
+namespace rtengine
+{
+
+class LabImage;
+
+/**
+ * @brief Outputs of the stages of a Lab pipeline, kept to restart it from the first stage whose parameters changed
+ *
+ * The outputs are kept within a memory budget. When it is exceeded, the outputs of the earliest stages are dropped:
+ * the parameters of the last stages are the ones changed the most often, and their inputs are the most useful to keep.
+ */
+class LabStageCache :
+    public NonCopyable
+{
+public:
+    explicit LabStageCache(int numStages);
+    ~LabStageCache();
+
+    /** @param bytes memory the outputs may use, 0 to keep none */
+    void setBudget(std::size_t bytes);
+
+    /** Drops the outputs of stage and of the following stages */
+    void invalidate(int stage = 0);
+
+    /** @return the first stage to run to recompute stage, its input is getOutput(restart - 1) or the input of the pipeline if restart is 0 */
+    int getRestartStage(int stage) const;
+    /** @return the output of stage, nullptr if it isn't kept */
+    LabImage* getOutput(int stage) const;
+
+    /** Keeps a copy of the output of stage if the budget allows it */
+    void store(int stage, LabImage* output);
+
+private:
+    struct Entry {
+        std::unique_ptr<LabImage> image;
+        bool valid;
+    };
+
+    std::size_t getUsedBytes() const;
+
+    std::vector<Entry> entries;
+    std::size_t budget;
+};
+
+}
@@ -0,0 +1,111 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+
+#include "memorybudget.h"
+
+#include "bufferpool.h"
+
+namespace rtengine
+{
+
+MemoryBudget* MemoryBudget::getInstance()
+{
+    static MemoryBudget instance;
+    return &instance;
+}
+
+MemoryBudget::MemoryBudget() :
+    size(0),
+    used(0)
+{
+}
+
+void MemoryBudget::init(int size)
+{
+    MyMutex::MyLock lock(mutex);
+
+    // the reservations in progress stay accounted for in the new budget
+    this->size = std::size_t(std::max(size, 0)) << 20;
+}
+
+bool MemoryBudget::acquire(std::size_t bytes, bool force)
+{
+    {
+        MyMutex::MyLock lock(mutex);
+
+        if (!size || force || used + bytes <= size) {
+            used += bytes;
+            return true;
+        }
+    }
+
+    // the stage will work with less memory, don't keep more of it than needed in the idle buffers
+    BufferPool::getInstance()->flush();
+    return false;
+}
+
+void MemoryBudget::release(std::size_t bytes)
+{
+    MyMutex::MyLock lock(mutex);
+
+    used -= bytes;
+}
+
+MemoryBudget::Reservation::Reservation() :
+    bytes(0)
+{
+}
+
+MemoryBudget::Reservation::~Reservation()
+{
+    release();
+}
+
+bool MemoryBudget::Reservation::reserve(std::size_t bytes, bool force)
+{
+    release();
+
+    if (!MemoryBudget::getInstance()->acquire(bytes, force)) {
+        return false;
+    }
+
+    this->bytes = bytes;
+    return true;
+}
+
+int MemoryBudget::Reservation::reserveUnits(std::size_t base, std::size_t perUnit, int maxUnits)
+{
+    for (int units = maxUnits; units > 0; --units) {
+        if (reserve(base + units * perUnit)) {
+            return units;
+        }
+    }
+
+    return 0;
+}
+
+void MemoryBudget::Reservation::release()
+{
+    if (bytes) {
+        MemoryBudget::getInstance()->release(bytes);
+        bytes = 0;
+    }
+}
+
+}
@@ -0,0 +1,77 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+#include "noncopyable.h"
+
+#include "../rtgui/threadutils.h"
+
+namespace rtengine
+{
+
+/**
+ * @brief Engine wide budget of the memory of the large temporary buffers
+ *
+ * The stages with a large working set (denoise, wavelets) reserve their estimated peak use from this budget
+ * before allocating. When the budget doesn't have it, because it is small or because other images processed at
+ * the same time use it, they work on smaller tiles or with fewer threads instead of failing.
+ */
+class MemoryBudget :
+    public NonCopyable
+{
+public:
+    class Reservation;
+
+    static MemoryBudget* getInstance();
+
+    /** @param size in MiB, 0 for no limit */
+    void init(int size);
+
+private:
+    MemoryBudget();
+
+    bool acquire(std::size_t bytes, bool force);
+    void release(std::size_t bytes);
+
+    std::size_t size; // 0 for no limit
+    std::size_t used;
+    MyMutex mutex;
+};
+
+class MemoryBudget::Reservation :
+    public NonCopyable
+{
+public:
+    Reservation();
+    ~Reservation();
+
+    /** Replaces the reservation by bytes. If the budget doesn't have them, nothing is reserved and false is
+      * returned, unless force is set, in which case the budget is exceeded. */
+    bool reserve(std::size_t bytes, bool force = false);
+    /** Replaces the reservation by base + n * perUnit bytes, for the largest n <= maxUnits the budget has.
+      * @return n, 0 if even base + perUnit don't fit, nothing is reserved then */
+    int reserveUnits(std::size_t base, std::size_t perUnit, int maxUnits);
+    void release();
+
+private:
+    std::size_t bytes;
+};
+
+}
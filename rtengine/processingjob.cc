@@ -39,5 +39,19 @@ void ProcessingJob::destroy (ProcessingJob* job)
     delete static_cast<ProcessingJobImpl*>(job);
 }
 
+procparams::ProcParams ProcessingJob::getOutputParams (const procparams::ProcParams& params, const procparams::ProcParams& output)
+{
+    procparams::ProcParams result = params;
+    result.resize = output.resize;
+    result.prsharpening = output.prsharpening;
+    result.icm.outputProfile = output.icm.outputProfile;
+    result.icm.outputIntent = output.icm.outputIntent;
+    result.icm.outputBPC = output.icm.outputBPC;
+    result.metadata = output.metadata;
+    result.exif = output.exif;
+    result.iptc = output.iptc;
+    return result;
+}
+
 }
 
@@ -34,6 +34,7 @@ public:
     InitialImage* initialImage;
     procparams::ProcParams pparams;
     bool fast;
+    std::vector<procparams::ProcParams> outputs; // additional outputs, see addOutput()
 
     ProcessingJobImpl (const Glib::ustring& fn, bool iR, const procparams::ProcParams& pp, bool ff)
         : fname(fn), isRaw(iR), initialImage(nullptr), pparams(pp), fast(ff) {}
@@ -52,6 +53,11 @@ public:
     }
 
     bool fastPipeline() const override { return fast; }
+
+    void addOutput (const procparams::ProcParams& params) override
+    {
+        outputs.push_back (params);
+    }
 };
 
 }
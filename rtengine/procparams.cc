@@ -2845,6 +2845,27 @@ int ProcParams::save(const Glib::ustring& fname, const Glib::ustring& fname2, bo
         return 0;
     }
 
+    const Glib::ustring sPParams = toData(fname, fnameAbsolute, pedited);
+
+    if (sPParams.empty()) {
+        return 1;
+    }
+
+    int error1, error2;
+    error1 = write(fname, sPParams);
+
+    if (!fname2.empty()) {
+
+        error2 = write(fname2, sPParams);
+        // If at least one file has been saved, it's a success
+        return error1 & error2;
+    } else {
+        return error1;
+    }
+}
+
+Glib::ustring ProcParams::toData(const Glib::ustring& fname, bool fnameAbsolute, ParamsEdited* pedited)
+{
     Glib::ustring sPParams;
 
     try {
@@ -3585,21 +3606,7 @@ int ProcParams::save(const Glib::ustring& fname, const Glib::ustring& fname2, bo
 
     } catch (Glib::KeyFileError&) {}
 
-    if (sPParams.empty()) {
-        return 1;
-    }
-
-    int error1, error2;
-    error1 = write(fname, sPParams);
-
-    if (!fname2.empty()) {
-
-        error2 = write(fname2, sPParams);
-        // If at least one file has been saved, it's a success
-        return error1 & error2;
-    } else {
-        return error1;
-    }
+    return sPParams;
 }
 
 int ProcParams::load(const Glib::ustring& fname, ParamsEdited* pedited)
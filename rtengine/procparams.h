@@ -1578,6 +1578,13 @@ public:
       * @return Error code (=0 if all supplied filenames where created correctly)
       */
     int save(const Glib::ustring& fname, const Glib::ustring& fname2 = Glib::ustring(), bool fnameAbsolute = true, ParamsEdited* pedited = nullptr);
+    /**
+      * Returns the parameters in the format of the pp3 files, empty on error.
+      * @param fname the name of the file the text is meant for, used to make the embedded filenames relative (can be an empty string)
+      * @param fnameAbsolute see save()
+      * @param pedited see save()
+      */
+    Glib::ustring toData(const Glib::ustring& fname = Glib::ustring(), bool fnameAbsolute = true, ParamsEdited* pedited = nullptr);
     /**
       * Loads the parameters from a file.
       * @param fname the name of the file
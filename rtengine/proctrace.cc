@@ -0,0 +1,230 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+#include <glib/gstdio.h>
+
+#ifdef WIN32
+#include <windows.h>
+#include <psapi.h>
+#elif defined __APPLE__
+#include <mach/mach.h>
+#include <ctime>
+#else
+#include <ctime>
+#include <unistd.h>
+#endif
+
+#include "proctrace.h"
+
+namespace
+{
+
+thread_local rtengine::ProcessingTrace* currentTrace = nullptr;
+
+int64_t getWallTime()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int64_t getCpuTime()
+{
+#ifdef WIN32
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+
+    if (!GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime)) {
+        return 0;
+    }
+
+    // FILETIME unit is 100 ns
+    const auto toInt = [](const FILETIME& time) -> int64_t
+    {
+        return (static_cast<int64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+    };
+
+    return (toInt(kernelTime) + toInt(userTime)) / 10;
+#else
+    timespec t;
+
+    if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t)) {
+        return 0;
+    }
+
+    return static_cast<int64_t>(t.tv_sec) * 1000000 + t.tv_nsec / 1000;
+#endif
+}
+
+std::string escape(const Glib::ustring& str)
+{
+    std::string res;
+
+    for (const char c : str.raw()) {
+        switch (c) {
+            case '"':
+                res += "\\\"";
+                break;
+
+            case '\\':
+                res += "\\\\";
+                break;
+
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    res += buf;
+                } else {
+                    res += c;
+                }
+        }
+    }
+
+    return res;
+}
+
+}
+
+namespace rtengine
+{
+
+ProcessingTrace::Attach::Attach(ProcessingTrace& trace) :
+    previous(currentTrace)
+{
+    currentTrace = &trace;
+}
+
+ProcessingTrace::Attach::~Attach()
+{
+    currentTrace = previous;
+}
+
+ProcessingTrace::Scope::Scope(const char* name) :
+    trace(currentTrace),
+    index(trace ? trace->begin(name) : 0)
+{
+}
+
+ProcessingTrace::Scope::~Scope()
+{
+    if (trace) {
+        trace->end(index);
+    }
+}
+
+ProcessingTrace::ProcessingTrace() :
+    origin(getWallTime())
+{
+    events.reserve(128);
+}
+
+const std::vector<ProcessingTrace::Event>& ProcessingTrace::getEvents() const
+{
+    return events;
+}
+
+std::size_t ProcessingTrace::begin(const char* name)
+{
+    const std::size_t mem = getProcessMemory();
+    // until the scope ends, start and cpuTime hold the absolute times
+    events.push_back({name, static_cast<unsigned int>(openEvents.size()), getWallTime(), 0, getCpuTime(), mem, mem, mem});
+    openEvents.push_back(events.size() - 1);
+    return events.size() - 1;
+}
+
+void ProcessingTrace::end(std::size_t index)
+{
+    Event& event = events[index];
+    event.cpuTime = getCpuTime() - event.cpuTime;
+    event.wallTime = getWallTime() - event.start;
+    event.start -= origin;
+    event.memEnd = getProcessMemory();
+    event.memPeak = std::max(event.memPeak, event.memEnd);
+
+    // scopes are strictly nested, so the event is the last opened one
+    openEvents.pop_back();
+
+    if (!openEvents.empty()) {
+        Event& parent = events[openEvents.back()];
+        parent.memPeak = std::max(parent.memPeak, event.memPeak);
+    }
+}
+
+int ProcessingTrace::save(const Glib::ustring& fname, const Glib::ustring& imageName) const
+{
+    FILE* const f = g_fopen(fname.c_str(), "wt");
+
+    if (!f) {
+        return 1;
+    }
+
+    fprintf(f, "{\"otherData\":{\"image\":\"%s\",\"note\":\"process_* values are totals of the process, including the images processed concurrently\"},"
+            "\"displayTimeUnit\":\"ms\",\"traceEvents\":[", escape(imageName).c_str());
+
+    for (std::size_t i = 0; i < events.size(); ++i) {
+        const Event& event = events[i];
+        fprintf(f, "%s\n{\"name\":\"%s\",\"cat\":\"rtengine\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%lld,\"dur\":%lld,"
+                "\"args\":{\"depth\":%u,\"process_cpu_us\":%lld,\"process_mem_begin\":%llu,\"process_mem_end\":%llu,\"process_mem_peak\":%llu}}",
+                i ? "," : "", escape(event.name).c_str(),
+                static_cast<long long>(event.start), static_cast<long long>(event.wallTime),
+                event.depth, static_cast<long long>(event.cpuTime),
+                static_cast<unsigned long long>(event.memBegin), static_cast<unsigned long long>(event.memEnd), static_cast<unsigned long long>(event.memPeak));
+    }
+
+    fprintf(f, "\n]}\n");
+
+    return fclose(f) ? 1 : 0;
+}
+
+std::size_t ProcessingTrace::getProcessMemory()
+{
+#ifdef WIN32
+    PROCESS_MEMORY_COUNTERS_EX counters;
+
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), reinterpret_cast<PROCESS_MEMORY_COUNTERS*>(&counters), sizeof(counters))) {
+        return 0;
+    }
+
+    return counters.PrivateUsage;
+#elif defined __APPLE__
+    mach_task_basic_info info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, reinterpret_cast<task_info_t>(&info), &count) != KERN_SUCCESS) {
+        return 0;
+    }
+
+    return info.resident_size;
+#else
+    FILE* const f = fopen("/proc/self/statm", "r");
+
+    if (!f) {
+        return 0;
+    }
+
+    unsigned long size, resident;
+    const bool ok = fscanf(f, "%lu %lu", &size, &resident) == 2;
+    fclose(f);
+
+    return ok ? static_cast<std::size_t>(resident) * sysconf(_SC_PAGESIZE) : 0;
+#endif
+}
+
+}
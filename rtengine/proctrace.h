@@ -0,0 +1,101 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glibmm/ustring.h>
+
+#include "noncopyable.h"
+
+// Records the enclosing block as a step of the processing trace attached to the current thread, if any
+#define PROCTRACE(name) rtengine::ProcessingTrace::Scope procTraceScope(name)
+
+namespace rtengine
+{
+
+/**
+ * @brief Wall time, CPU time and memory use of the processing steps of one image
+ *
+ * A trace is attached to a thread with ProcessingTrace::Attach. Each ProcessingTrace::Scope
+ * (see PROCTRACE) opened on that thread then adds an event to the trace. On threads without
+ * an attached trace (preview processing, OpenMP workers...) a scope only costs a thread local lookup.
+ */
+class ProcessingTrace :
+    public NonCopyable
+{
+public:
+    struct Event {
+        const char* name;
+        unsigned int depth;     // nesting level, 0 for the outermost scope
+        int64_t start;          // wall clock time in us since the creation of the trace
+        int64_t wallTime;       // us
+        // The CPU time and memory are totals of the process: they include the worker threads of the scope, but also
+        // anything else running meanwhile, such as the other images of rawtherapee-cli -m<N>
+        int64_t cpuTime;        // us of CPU time of the whole process
+        std::size_t memBegin;   // memory used by the process in bytes when entering the scope
+        std::size_t memEnd;     // ... and when leaving it
+        std::size_t memPeak;    // highest memory use seen at the boundaries of the scope and of its nested scopes
+    };
+
+    class Attach :
+        public NonCopyable
+    {
+    public:
+        explicit Attach(ProcessingTrace& trace);
+        ~Attach();
+
+    private:
+        ProcessingTrace* const previous;
+    };
+
+    class Scope :
+        public NonCopyable
+    {
+    public:
+        explicit Scope(const char* name);
+        ~Scope();
+
+    private:
+        ProcessingTrace* const trace;
+        std::size_t index;
+    };
+
+    ProcessingTrace();
+
+    const std::vector<Event>& getEvents() const;
+
+    /** Saves the events in the Trace Event Format (JSON) understood by chrome://tracing and Perfetto.
+      * @return 0 on success */
+    int save(const Glib::ustring& fname, const Glib::ustring& imageName) const;
+
+    /** @return the memory currently used by the process in bytes, 0 if unknown on this platform */
+    static std::size_t getProcessMemory();
+
+private:
+    std::size_t begin(const char* name);
+    void end(std::size_t index);
+
+    const int64_t origin;
+    std::vector<Event> events;
+    std::vector<std::size_t> openEvents;
+};
+
+}
@@ -823,6 +823,47 @@ void RawImage::getXtransMatrix( int XtransMatrix[6][6])
         }
 }
 
+#ifdef RT_BENCH_HOOKS
+void RawImage::setSyntheticLayout(int w, int h, bool xtrans)
+{
+    static const int xtransLayout[6][6] = {
+        {1, 1, 0, 1, 1, 2},
+        {1, 1, 2, 1, 1, 0},
+        {2, 0, 1, 0, 2, 1},
+        {1, 1, 2, 1, 1, 0},
+        {1, 1, 0, 1, 1, 2},
+        {0, 2, 1, 2, 0, 1}
+    };
+
+    raw_width = width = iwidth = w;
+    raw_height = height = iheight = h;
+    top_margin = left_margin = fuji_width = 0;
+    colors = 3;
+    is_raw = 1;
+    is_foveon = 0;
+    maximum = 65535;
+    make[0] = model[0] = '\0';
+    filters = prefilters = xtrans ? 9 : 0x94949494;
+
+    for (int row = 0; row < 6; ++row) {
+        for (int col = 0; col < 6; ++col) {
+            this->xtrans[row][col] = xtransLayout[row][col];
+        }
+    }
+
+    for (int i = 0; i < 4; ++i) {
+        cblack[i] = 0;
+        pre_mul[i] = cam_mul[i] = 1.f;
+    }
+
+    for (int row = 0; row < 3; ++row) {
+        for (int col = 0; col < 4; ++col) {
+            rgb_cam[row][col] = row == col;
+        }
+    }
+}
+#endif
+
 void RawImage::getRgbCam (float rgbcam[3][4])
 {
     for(int row = 0; row < 3; row++)
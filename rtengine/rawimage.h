@@ -331,6 +331,11 @@ public:
         return float_raw_image;
     }
 
+#ifdef RT_BENCH_HOOKS
+    // sets up the sensor description of a w x h RGGB Bayer or X-Trans sensor without loading a file (used by rawtherapee-bench)
+    void setSyntheticLayout(int w, int h, bool xtrans);
+#endif
+
 public:
     // dcraw functions
     void pre_interpolate()
@@ -20,6 +20,7 @@
 #include <iostream>
 
 #include "rtengine.h"
+#include "cancellation.h"
 #include "rawimagesource.h"
 #include "rawimagesource_i.h"
 #include "jaggedarray.h"
@@ -31,6 +32,7 @@
 #include "dfmanager.h"
 #include "ffmanager.h"
 #include "dcp.h"
+#include "demosaiccache.h"
 #include "rt_math.h"
 #include "improcfun.h"
 #include "rtlensfun.h"
@@ -41,6 +43,7 @@
 #include <omp.h>
 #endif
 #include "opthelper.h"
+#include "proctrace.h"
 #define clipretinex( val, minv, maxv )    (( val = (val < minv ? minv : val ) ) > maxv ? maxv : val )
 #undef CLIPD
 #define CLIPD(a) ((a)>0.0f?((a)<1.0f?(a):1.0f):0.0f)
@@ -48,6 +51,27 @@
 namespace
 {
 
+// Only the methods slower than reading the cache are worth caching. Pixelshift also depends on the other frames.
+bool isDemosaicCacheable(rtengine::RawImage* ri, const rtengine::procparams::RAWParams& raw)
+{
+    using rtengine::procparams::RAWParams;
+
+    if (ri->getSensorType() == rtengine::ST_BAYER) {
+        return
+            raw.bayersensor.method != RAWParams::BayerSensor::getMethodString(RAWParams::BayerSensor::Method::PIXELSHIFT)
+            && raw.bayersensor.method != RAWParams::BayerSensor::getMethodString(RAWParams::BayerSensor::Method::FAST)
+            && raw.bayersensor.method != RAWParams::BayerSensor::getMethodString(RAWParams::BayerSensor::Method::MONO)
+            && raw.bayersensor.method != RAWParams::BayerSensor::getMethodString(RAWParams::BayerSensor::Method::NONE);
+    } else if (ri->getSensorType() == rtengine::ST_FUJI_XTRANS) {
+        return
+            raw.xtranssensor.method != RAWParams::XTransSensor::getMethodString(RAWParams::XTransSensor::Method::FAST)
+            && raw.xtranssensor.method != RAWParams::XTransSensor::getMethodString(RAWParams::XTransSensor::Method::MONO)
+            && raw.xtranssensor.method != RAWParams::XTransSensor::getMethodString(RAWParams::XTransSensor::Method::NONE);
+    }
+
+    return false;
+}
+
 void rotateLine (const float* const line, rtengine::PlanarPtr<float> &channel, const int tran, const int i, const int w, const int h)
 {
     switch(tran & TR_ROT) {
@@ -492,6 +516,61 @@ RawImageSource::~RawImageSource ()
 
 //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 
+#ifdef RT_BENCH_HOOKS
+void RawImageSource::setSyntheticRaw (const array2D<float> &mosaic, bool xtrans)
+{
+    for (size_t i = 0; i < numFrames; ++i) {
+        delete riFrames[i];
+        riFrames[i] = nullptr;
+    }
+
+    W = mosaic.width();
+    H = mosaic.height();
+
+    ri = new RawImage("");
+    ri->setSyntheticLayout(W, H, xtrans);
+    riFrames[0] = ri;
+    numFrames = 1;
+    currFrame = 0;
+
+    rawData(W, H);
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+
+    for (int i = 0; i < H; ++i) {
+        for (int j = 0; j < W; ++j) {
+            rawData[i][j] = mosaic[i][j];
+        }
+    }
+
+    red(W, H);
+    green(W, H);
+    blue(W, H);
+
+    border = xtrans ? 7 : 4;
+    initialGain = 1.0;
+
+    for (int i = 0; i < 4; ++i) {
+        scale_mul[i] = 1.f;
+        c_black[i] = 0.f;
+        c_white[i] = 65535.f;
+    }
+
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            imatrices.rgb_cam[i][j] = imatrices.cam_rgb[i][j] = i == j;
+            imatrices.xyz_cam[i][j] = xyz_sRGB[i][j];
+        }
+    }
+
+    inverse33 (imatrices.xyz_cam, imatrices.cam_xyz);
+    rawDirty = false;
+}
+#endif
+
+//%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
 void RawImageSource::transformRect (const PreviewProps &pp, int tran, int &ssx1, int &ssy1, int &width, int &height, int &fw)
 {
     int pp_x = pp.getX() + border;
@@ -611,6 +690,8 @@ float calculate_scale_mul(float scale_mul[4], const float pre_mul_[4], const flo
 
 void RawImageSource::getImage (const ColorTemp &ctemp, int tran, Imagefloat* image, const PreviewProps &pp, const ToneCurveParams &hrp, const RAWParams &raw )
 {
+    PROCTRACE("getImage");
+
     MyMutex::MyLock lock(getImageMutex);
 
     tran = defTransform (tran);
@@ -926,6 +1007,8 @@ DCPProfile *RawImageSource::getDCP(const ColorManagementParams &cmp, DCPProfile:
 
 void RawImageSource::convertColorSpace(Imagefloat* image, const ColorManagementParams &cmp, const ColorTemp &wb)
 {
+    PROCTRACE("convertColorSpace");
+
     double pre_mul[3] = { ri->get_pre_mul(0), ri->get_pre_mul(1), ri->get_pre_mul(2) };
     colorSpaceConversion (image, cmp, wb, pre_mul, embProfile, camProfile, imatrices.xyz_cam, (static_cast<const FramesData*>(getMetaData()))->getCamera());
 }
@@ -1517,6 +1600,7 @@ void RawImageSource::vflip (Imagefloat* image)
 
 int RawImageSource::load (const Glib::ustring &fname, bool firstFrameOnly)
 {
+    PROCTRACE("load");
 
     MyTime t1, t2;
     t1.set();
@@ -1720,6 +1804,8 @@ int RawImageSource::load (const Glib::ustring &fname, bool firstFrameOnly)
 
 void RawImageSource::preprocess  (const RAWParams &raw, const LensProfParams &lensProf, const CoarseTransformParams& coarse, bool prepareDenoise)
 {
+    PROCTRACE("preprocess");
+
 //    BENCHFUN
     MyTime t1, t2;
     t1.set();
@@ -1780,6 +1866,11 @@ void RawImageSource::preprocess  (const RAWParams &raw, const LensProfParams &le
         printf( "Flat Field Correction:%s\n", rif->get_filename().c_str());
     }
 
+    demosaicCacheKey =
+        DemosaicCache::getInstance()->isEnabled()
+            ? DemosaicCache::getPreprocessKey(ri->get_filename(), currFrame, raw, lensProf, coarse, rid ? rid->get_filename() : "", rif ? rif->get_filename() : "")
+            : std::string();
+
     if(numFrames == 4) {
         int bufferNumber = 0;
         for(unsigned int i=0; i<4; ++i) {
@@ -2069,9 +2160,32 @@ void RawImageSource::preprocess  (const RAWParams &raw, const LensProfParams &le
 
 void RawImageSource::demosaic(const RAWParams &raw, bool autoContrast, double &contrastThreshold)
 {
+    PROCTRACE("demosaic");
+
     MyTime t1, t2;
     t1.set();
 
+    const std::string cacheKey = isDemosaicCacheable(ri, raw) ? DemosaicCache::getDemosaicKey(demosaicCacheKey, border, autoContrast) : std::string();
+
+    if (!cacheKey.empty()) {
+        double cachedThreshold;
+
+        if (DemosaicCache::getInstance()->load(cacheKey, W, H, red, green, blue, cachedThreshold)) {
+            if (autoContrast) {
+                contrastThreshold = cachedThreshold;
+            }
+
+            rgbSourceModified = false;
+            t2.set();
+
+            if (settings->verbose) {
+                printf("Demosaiced data read from the cache - %d usec\n", t2.etime(t1));
+            }
+
+            return;
+        }
+    }
+
     if (ri->getSensorType() == ST_BAYER) {
         if ( raw.bayersensor.method == RAWParams::BayerSensor::getMethodString(RAWParams::BayerSensor::Method::HPHD) ) {
             hphd_demosaic ();
@@ -2133,6 +2247,10 @@ void RawImageSource::demosaic(const RAWParams &raw, bool autoContrast, double &c
         nodemosaic(true);
     }
 
+    if (!cacheKey.empty()) {
+        DemosaicCache::getInstance()->store(cacheKey, red, green, blue, autoContrast ? contrastThreshold : 0.0);
+    }
+
     t2.set();
 
 
@@ -2421,6 +2539,8 @@ void RawImageSource::retinexPrepareCurves(const RetinexParams &retinexParams, LU
 
 void RawImageSource::retinex(const ColorManagementParams& cmp, const RetinexParams &deh, const ToneCurveParams& Tc, LUTf & cdcurve, LUTf & mapcurve, const RetinextransmissionCurve & dehatransmissionCurve, const RetinexgaintransmissionCurve & dehagaintransmissionCurve, multi_array2D<float, 4> &conversionBuffer, bool dehacontlutili, bool mapcontlutili, bool useHsl, float &minCD, float &maxCD, float &mini, float &maxi, float &Tmean, float &Tsigma, float &Tmin, float &Tmax, LUTu &histLRETI)
 {
+    PROCTRACE("retinex");
+
     MyTime t4, t5;
     t4.set();
 
@@ -2576,6 +2696,12 @@ void RawImageSource::retinex(const ColorManagementParams& cmp, const RetinexPara
 
     MSR(LBuffer, conversionBuffer[2], conversionBuffer[3], mapcurve, mapcontlutili, WNew, HNew, deh, dehatransmissionCurve, dehagaintransmissionCurve, minCD, maxCD, mini, maxi, Tmean, Tsigma, Tmin, Tmax);
 
+    if (isCancelled()) {
+        // red, green and blue keep the previous result, the next run starts again from conversionBuffer
+        delete chcurve;
+        return;
+    }
+
     if(useHsl) {
         if(chutili) {
 #ifdef _OPENMP
@@ -2854,22 +2980,31 @@ void RawImageSource::HLRecovery_Global(const ToneCurveParams &hrp)
 void RawImageSource::processFlatField(const RAWParams &raw, RawImage *riFlatFile, unsigned short black[4])
 {
 //    BENCHFUN
-    float *cfablur = (float (*)) malloc (H * W * sizeof * cfablur);
     int BS = raw.ff_BlurRadius;
     BS += BS & 1;
 
-    //function call to cfabloxblur
+    // the blurred flat field only depends on the flat field and the blur, so it is shared by all the images it is applied to
+    const auto getBlurredFlat = [this, riFlatFile](int boxH, int boxW) {
+        return ffm.getBlurredFlatField(riFlatFile, boxH, boxW, [this, riFlatFile, boxH, boxW](float* dst) {
+            cfaboxblur(riFlatFile, dst, boxH, boxW);
+        });
+    };
+
+    std::shared_ptr<const std::vector<float>> cfablurMap;
+
     if (raw.ff_BlurType == RAWParams::getFlatFieldBlurTypeString(RAWParams::FlatFieldBlurType::V)) {
-        cfaboxblur(riFlatFile, cfablur, 2 * BS, 0);
+        cfablurMap = getBlurredFlat(2 * BS, 0);
     } else if (raw.ff_BlurType == RAWParams::getFlatFieldBlurTypeString(RAWParams::FlatFieldBlurType::H)) {
-        cfaboxblur(riFlatFile, cfablur, 0, 2 * BS);
+        cfablurMap = getBlurredFlat(0, 2 * BS);
     } else if (raw.ff_BlurType == RAWParams::getFlatFieldBlurTypeString(RAWParams::FlatFieldBlurType::VH)) {
         //slightly more complicated blur if trying to correct both vertical and horizontal anomalies
-        cfaboxblur(riFlatFile, cfablur, BS, BS);    //first do area blur to correct vignette
+        cfablurMap = getBlurredFlat(BS, BS);    //first do area blur to correct vignette
     } else { //(raw.ff_BlurType == RAWParams::getFlatFieldBlurTypeString(RAWParams::area_ff))
-        cfaboxblur(riFlatFile, cfablur, BS, BS);
+        cfablurMap = getBlurredFlat(BS, BS);
     }
 
+    const float* const cfablur = cfablurMap->data();
+
     if(ri->getSensorType() == ST_BAYER || ri->get_colors() == 1) {
         float refcolor[2][2];
 
@@ -3077,11 +3212,11 @@ void RawImageSource::processFlatField(const RAWParams &raw, RawImage *riFlatFile
     }
 
     if (raw.ff_BlurType == RAWParams::getFlatFieldBlurTypeString(RAWParams::FlatFieldBlurType::VH)) {
-        float *cfablur1 = (float (*)) malloc (H * W * sizeof * cfablur1);
-        float *cfablur2 = (float (*)) malloc (H * W * sizeof * cfablur2);
         //slightly more complicated blur if trying to correct both vertical and horizontal anomalies
-        cfaboxblur(riFlatFile, cfablur1, 0, 2 * BS); //now do horizontal blur
-        cfaboxblur(riFlatFile, cfablur2, 2 * BS, 0); //now do vertical blur
+        const auto cfablur1Map = getBlurredFlat(0, 2 * BS); //now do horizontal blur
+        const auto cfablur2Map = getBlurredFlat(2 * BS, 0); //now do vertical blur
+        const float* const cfablur1 = cfablur1Map->data();
+        const float* const cfablur2 = cfablur2Map->data();
 
         if(ri->getSensorType() == ST_BAYER || ri->get_colors() == 1) {
             unsigned int c[2][2] {};
@@ -3145,12 +3280,7 @@ void RawImageSource::processFlatField(const RAWParams &raw, RawImage *riFlatFile
             }
 
         }
-
-        free (cfablur1);
-        free (cfablur2);
     }
-
-    free (cfablur);
 }
 
 //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
@@ -4886,6 +5016,11 @@ void RawImageSource::getRAWHistogram (LUTu & histRedRaw, LUTu & histGreenRaw, LU
 
 //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 
+bool RawImageSource::isCancelled () const
+{
+    return cancellation && cancellation->isCancelled();
+}
+
 void RawImageSource::getRowStartEnd (int x, int &start, int &end)
 {
     if (fuji) {
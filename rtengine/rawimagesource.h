@@ -78,6 +78,7 @@ protected:
     unsigned int currFrame = 0;
     unsigned int numFrames = 0;
     int flatFieldAutoClipValue = 0;
+    const CancellationToken* cancellation = nullptr;
     array2D<float> rawData;  // holds preprocessed pixel values, rowData[i][j] corresponds to the ith row and jth column
     array2D<float> *rawDataFrames[4] = {nullptr};
     array2D<float> *rawDataBuffer[3] = {nullptr};
@@ -89,6 +90,7 @@ protected:
     // the interpolated blue plane:
     array2D<float> blue;
     bool rawDirty;
+    std::string demosaicCacheKey; // key of the preprocessed data in the demosaic cache, empty when not cacheable
     float psRedBrightness[4];
     float psGreenBrightness[4];
     float psBlueBrightness[4];
@@ -106,6 +108,7 @@ protected:
         return ri->FC(row, col);
     }
     inline void getRowStartEnd (int x, int &start, int &end);
+    bool isCancelled () const;
     static void getProfilePreprocParams(cmsHPROFILE in, float& gammafac, float& lineFac, float& lineSum);
 
 
@@ -126,6 +129,10 @@ public:
     void        refinement_lassus (int PassCount);
     void        refinement(int PassCount);
     void        setBorder(unsigned int rawBorder) override {border = rawBorder;}
+    void        setCancellationToken(const CancellationToken* token) override {cancellation = token;}
+#ifdef RT_BENCH_HOOKS
+    void        setSyntheticRaw (const array2D<float> &mosaic, bool xtrans); // uses a preprocessed synthetic mosaic instead of a raw file (used by rawtherapee-bench)
+#endif
     bool        isRGBSourceModified() const override
     {
         return rgbSourceModified;   // tracks whether cached rgb output of demosaic has been modified
@@ -64,6 +64,7 @@ class IImage8;
 class IImage16;
 class IImagefloat;
 class ImageSource;
+class CancellationToken;
 
 /**
   * This class provides functions to obtain exif and IPTC metadata information
@@ -579,6 +580,16 @@ public:
     static void destroy (ProcessingJob* job);
 
     virtual bool fastPipeline() const = 0;
+
+    /** Adds an output to the job, processed from the same run of the pipeline as the main one. Only the resize, post-resize
+      * sharpening, output profile (profile, intent and black point compensation) and metadata settings of params are
+      * used, they replace those of the job for this output. The demosaic, denoise and the whole Lab pipeline are shared.
+      * @param params is the processing parameters of the output */
+    virtual void addOutput (const procparams::ProcParams& params) = 0;
+
+    /** @return params with the settings of output that addOutput() uses replacing its own, i.e. the parameters
+      * the additional output is processed with */
+    static procparams::ProcParams getOutputParams (const procparams::ProcParams& params, const procparams::ProcParams& output);
 };
 
 /** This function performs all the image processing steps corresponding to the given ProcessingJob. It returns when it is ready, so it can be slow.
@@ -586,8 +597,15 @@ public:
    * @param job the ProcessingJob to cancel.
    * @param errorCode is the error code if an error occurred (e.g. the input image could not be loaded etc.)
    * @param pl is an optional ProgressListener if you want to keep track of the progress
-   * @return the resulting image, with the output profile applied, exif and iptc data set. You have to save it or you can access the pixel data directly.  */
-IImagefloat* processImage (ProcessingJob* job, int& errorCode, ProgressListener* pl = nullptr, bool flush = false);
+   * @param cancellation is an optional token to stop the processing early
+   * @return the resulting image, with the output profile applied, exif and iptc data set. You have to save it or you can access the pixel data directly.
+   *         nullptr with errorCode set to 0 if the processing has been cancelled. */
+IImagefloat* processImage (ProcessingJob* job, int& errorCode, ProgressListener* pl = nullptr, bool flush = false, const CancellationToken* cancellation = nullptr);
+
+/** Same as processImage(), for the jobs with additional outputs (see ProcessingJob::addOutput()).
+   * @return the image of the job followed by the images of its additional outputs, in the order they have been added.
+   *         Empty if the processing failed (with errorCode set) or has been cancelled. */
+std::vector<IImagefloat*> processImageOutputs (ProcessingJob* job, int& errorCode, ProgressListener* pl = nullptr, bool flush = false, const CancellationToken* cancellation = nullptr);
 
 /** This class is used to control the batch processing. The class implementing this interface will be called when the full processing of an
    * image is ready and the next job to process is needed. */
@@ -596,7 +614,7 @@ class BatchProcessingListener : public ProgressListener
 public:
     /** This function is called when an image gets ready during the batch processing. It has to return with the next job, or with NULL if
                    * there is no jobs left.
-                   * @param img is the result of the last ProcessingJob
+                   * @param img is the result of the last ProcessingJob, nullptr if it has been cancelled
                    * @return the next ProcessingJob to process */
     virtual ProcessingJob* imageReady(IImagefloat* img) = 0;
 };
@@ -606,8 +624,9 @@ public:
    * The ProcessingJob passed becomes invalid, you can not use it any more.
    * @param job the ProcessingJob to cancel.
    * @param bpl is the BatchProcessingListener that is called when the image is ready or the next job is needed. It also acts as a ProgressListener.
+   * @param cancellation is an optional token to stop the job being processed, it must outlive the processing
    **/
-void startBatchProcessing (ProcessingJob* job, BatchProcessingListener* bpl);
+void startBatchProcessing (ProcessingJob* job, BatchProcessingListener* bpl, const CancellationToken* cancellation = nullptr);
 
 
 extern MyMutex* lcmsMutex;
@@ -181,6 +181,45 @@ void scale_colors (rtengine::RawImage *ri, float scale_mul[4], float cblack[4],
     }
 }
 
+template<class T>
+void writeImageData (const T* image, std::string& buffer, std::size_t headerSize)
+{
+    buffer.resize (headerSize + image->getDataSize ());
+    image->writeData (&buffer[headerSize]);
+}
+
+template<class T>
+struct SampleSize;
+
+template<>
+struct SampleSize<rtengine::Image8> {
+    static constexpr std::size_t value = sizeof (unsigned char);
+};
+
+template<>
+struct SampleSize<rtengine::Image16> {
+    static constexpr std::size_t value = sizeof (unsigned short);
+};
+
+template<>
+struct SampleSize<rtengine::Imagefloat> {
+    static constexpr std::size_t value = sizeof (float);
+};
+
+template<class T>
+T* readImageData (guint32 width, guint32 height, const char* data, std::size_t size)
+{
+    // checked before allocating the image, as the dimensions come from the cache
+    if (static_cast<std::size_t> (width) * height > size / (3 * SampleSize<T>::value)) {
+        // truncated data
+        return nullptr;
+    }
+
+    T* image = new T (width, height);
+    image->readData (data);
+    return image;
+}
+
 }
 
 extern Options options;
@@ -1894,45 +1933,42 @@ unsigned char* Thumbnail::getGrayscaleHistEQ (int trim_width)
     return tmpdata;
 }
 
-bool Thumbnail::writeImage (const Glib::ustring& fname)
+bool Thumbnail::writeImage (std::string& buffer)
 {
 
+    buffer.clear ();
+
     if (!thumbImg) {
         return false;
     }
 
-    Glib::ustring fullFName = fname + ".rtti";
+    // image type, '\n', width, height and the raw dump of the data, as in the former .rtti files
+    const char* const imgType = thumbImg->getType();
+    const std::size_t typeLength = strlen (imgType);
+    const std::size_t headerSize = typeLength + 1 + 2 * sizeof (guint32);
 
-    FILE* f = g_fopen (fullFName.c_str (), "wb");
-
-    if (!f) {
+    if (imgType == sImage8) {
+        writeImageData (static_cast<Image8*> (thumbImg), buffer, headerSize);
+    } else if (imgType == sImage16) {
+        writeImageData (static_cast<Image16*> (thumbImg), buffer, headerSize);
+    } else if (imgType == sImagefloat) {
+        writeImageData (static_cast<Imagefloat*> (thumbImg), buffer, headerSize);
+    } else {
         return false;
     }
 
-    fwrite (thumbImg->getType(), sizeof (char), strlen (thumbImg->getType()), f);
-    fputc ('\n', f);
-    guint32 w = guint32 (thumbImg->getWidth());
-    guint32 h = guint32 (thumbImg->getHeight());
-    fwrite (&w, sizeof (guint32), 1, f);
-    fwrite (&h, sizeof (guint32), 1, f);
+    const guint32 w = guint32 (thumbImg->getWidth());
+    const guint32 h = guint32 (thumbImg->getHeight());
+    char* const header = &buffer[0];
+    memcpy (header, imgType, typeLength);
+    header[typeLength] = '\n';
+    memcpy (header + typeLength + 1, &w, sizeof (guint32));
+    memcpy (header + typeLength + 1 + sizeof (guint32), &h, sizeof (guint32));
 
-    if (thumbImg->getType() == sImage8) {
-        Image8 *image = static_cast<Image8*> (thumbImg);
-        image->writeData (f);
-    } else if (thumbImg->getType() == sImage16) {
-        Image16 *image = static_cast<Image16*> (thumbImg);
-        image->writeData (f);
-    } else if (thumbImg->getType() == sImagefloat) {
-        Imagefloat *image = static_cast<Imagefloat*> (thumbImg);
-        image->writeData (f);
-    }
-
-    //thumbImg->writeData(f);
-    fclose (f);
     return true;
 }
 
-bool Thumbnail::readImage (const Glib::ustring& fname)
+bool Thumbnail::readImage (const char* buffer, std::size_t size)
 {
 
     if (thumbImg) {
@@ -1940,59 +1976,47 @@ bool Thumbnail::readImage (const Glib::ustring& fname)
         thumbImg = nullptr;
     }
 
-    Glib::ustring fullFName = fname + ".rtti";
-
-    if (!Glib::file_test(fullFName, Glib::FILE_TEST_EXISTS)) {
+    if (!buffer) {
         return false;
     }
 
-    FILE* f = g_fopen(fullFName.c_str (), "rb");
+    // 30 -> arbitrary size, but should be enough for all image type's name
+    const char* const typeEnd = static_cast<const char*> (memchr (buffer, '\n', std::min<std::size_t> (size, 30)));
 
-    if (!f) {
+    if (!typeEnd) {
         return false;
     }
 
-    char imgType[31];  // 30 -> arbitrary size, but should be enough for all image type's name
-    fgets(imgType, 30, f);
-    imgType[strlen(imgType) - 1] = '\0'; // imgType has a \n trailing character, so we overwrite it by the \0 char
-
-    guint32 width, height;
-
-    if (fread(&width, 1, sizeof(guint32), f) < sizeof(guint32)) {
-        width = 0;
-    }
+    const std::string imgType (buffer, typeEnd);
+    const std::size_t headerSize = typeEnd - buffer + 1 + 2 * sizeof (guint32);
 
-    if (fread(&height, 1, sizeof(guint32), f) < sizeof(guint32)) {
-        height = 0;
+    if (size < headerSize) {
+        return false;
     }
 
-    bool success = false;
+    guint32 width, height;
+    memcpy (&width, typeEnd + 1, sizeof (guint32));
+    memcpy (&height, typeEnd + 1 + sizeof (guint32), sizeof (guint32));
 
     if (std::min(width , height) > 0) {
-        if (!strcmp(imgType, sImage8)) {
-            Image8 *image = new Image8(width, height);
-            image->readData(f);
-            thumbImg = image;
-            success = true;
-        } else if (!strcmp(imgType, sImage16)) {
-            Image16 *image = new Image16(width, height);
-            image->readData(f);
-            thumbImg = image;
-            success = true;
-        } else if (!strcmp(imgType, sImagefloat)) {
-            Imagefloat *image = new Imagefloat(width, height);
-            image->readData(f);
-            thumbImg = image;
-            success = true;
+        const char* const data = buffer + headerSize;
+        const std::size_t dataSize = size - headerSize;
+
+        if (imgType == sImage8) {
+            thumbImg = readImageData<Image8> (width, height, data, dataSize);
+        } else if (imgType == sImage16) {
+            thumbImg = readImageData<Image16> (width, height, data, dataSize);
+        } else if (imgType == sImagefloat) {
+            thumbImg = readImageData<Imagefloat> (width, height, data, dataSize);
         } else {
-            printf ("readImage: Unsupported image type \"%s\"!\n", imgType);
+            printf ("readImage: Unsupported image type \"%s\"!\n", imgType.c_str());
         }
     }
-    fclose(f);
-    return success;
+
+    return thumbImg != nullptr;
 }
 
-bool Thumbnail::readData  (const Glib::ustring& fname)
+bool Thumbnail::readData  (const std::string& keyData)
 {
     setlocale (LC_NUMERIC, "C"); // to set decimal point to "."
     Glib::KeyFile keyFile;
@@ -2001,7 +2025,7 @@ bool Thumbnail::readData  (const Glib::ustring& fname)
         MyMutex::MyLock thmbLock (thumbMutex);
 
         try {
-            keyFile.load_from_file (fname);
+            keyFile.load_from_data (keyData);
         } catch (Glib::Error&) {
             return false;
         }
@@ -2109,31 +2133,27 @@ bool Thumbnail::readData  (const Glib::ustring& fname)
         return true;
     } catch (Glib::Error &err) {
         if (options.rtSettings.verbose) {
-            printf ("Thumbnail::readData / Error code %d while reading values from \"%s\":\n%s\n", err.code(), fname.c_str(), err.what().c_str());
+            printf ("Thumbnail::readData / Error code %d while reading values:\n%s\n", err.code(), err.what().c_str());
         }
     } catch (...) {
         if (options.rtSettings.verbose) {
-            printf ("Thumbnail::readData / Unknown exception while trying to load \"%s\"!\n", fname.c_str());
+            printf ("Thumbnail::readData / Unknown exception while trying to load the values!\n");
         }
     }
 
     return false;
 }
 
-bool Thumbnail::writeData  (const Glib::ustring& fname)
+bool Thumbnail::writeData  (std::string& keyData)
 {
     MyMutex::MyLock thmbLock (thumbMutex);
 
-    Glib::ustring keyData;
+    keyData.clear ();
 
     try {
 
         Glib::KeyFile keyFile;
 
-        try {
-            keyFile.load_from_file (fname);
-        } catch (Glib::Error&) {}
-
         keyFile.set_double  ("LiveThumbData", "CamWBRed", camwbRed);
         keyFile.set_double  ("LiveThumbData", "CamWBGreen", camwbGreen);
         keyFile.set_double  ("LiveThumbData", "CamWBBlue", camwbBlue);
@@ -2156,118 +2176,74 @@ bool Thumbnail::writeData  (const Glib::ustring& fname)
         Glib::ArrayHandle<double> cm ((double*)colorMatrix, 9, Glib::OWNERSHIP_NONE);
         keyFile.set_double_list ("LiveThumbData", "ColorMatrix", cm);
 
-        keyData = keyFile.to_data ();
+        keyData = keyFile.to_data ().raw ();
 
     } catch (Glib::Error& err) {
         if (options.rtSettings.verbose) {
-            printf ("Thumbnail::writeData / Error code %d while reading values from \"%s\":\n%s\n", err.code(), fname.c_str(), err.what().c_str());
+            printf ("Thumbnail::writeData / Error code %d while writing values:\n%s\n", err.code(), err.what().c_str());
         }
     } catch (...) {
         if (options.rtSettings.verbose) {
-            printf ("Thumbnail::writeData / Unknown exception while trying to save \"%s\"!\n", fname.c_str());
+            printf ("Thumbnail::writeData / Unknown exception while trying to save the values!\n");
         }
     }
 
-    if (keyData.empty ()) {
-        return false;
-    }
-
-    FILE *f = g_fopen (fname.c_str (), "wt");
-
-    if (!f) {
-        if (options.rtSettings.verbose) {
-            printf ("Thumbnail::writeData / Error: unable to open file \"%s\" with write access!\n", fname.c_str());
-        }
-
-        return false;
-    } else {
-        fprintf (f, "%s", keyData.c_str ());
-        fclose (f);
-    }
-
-    return true;
+    return !keyData.empty ();
 }
 
-bool Thumbnail::readEmbProfile  (const Glib::ustring& fname)
+bool Thumbnail::readEmbProfile  (const char* buffer, std::size_t size)
 {
 
     embProfileData = nullptr;
     embProfile = nullptr;
     embProfileLength = 0;
 
-    FILE* f = g_fopen (fname.c_str (), "rb");
-
-    if (f) {
-        if (!fseek (f, 0, SEEK_END)) {
-            int profileLength = ftell (f);
-
-            if (profileLength > 0) {
-                embProfileLength = profileLength;
-
-                if (!fseek (f, 0, SEEK_SET)) {
-                    embProfileData = new unsigned char[embProfileLength];
-                    embProfileLength = fread (embProfileData, 1, embProfileLength, f);
-                    embProfile = cmsOpenProfileFromMem (embProfileData, embProfileLength);
-                }
-            }
-        }
-
-        fclose (f);
-        return embProfile != nullptr;
+    if (buffer && size > 0) {
+        embProfileLength = static_cast<int> (size);
+        embProfileData = new unsigned char[embProfileLength];
+        memcpy (embProfileData, buffer, embProfileLength);
+        embProfile = cmsOpenProfileFromMem (embProfileData, embProfileLength);
     }
 
-    return false;
+    return embProfile != nullptr;
 }
 
-bool Thumbnail::writeEmbProfile (const Glib::ustring& fname)
+bool Thumbnail::writeEmbProfile (std::string& buffer)
 {
 
-    if (embProfileData) {
-        FILE* f = g_fopen (fname.c_str (), "wb");
+    buffer.clear ();
 
-        if (f) {
-            fwrite (embProfileData, 1, embProfileLength, f);
-            fclose (f);
-            return true;
-        }
+    if (embProfileData) {
+        buffer.assign (reinterpret_cast<const char*> (embProfileData), embProfileLength);
+        return true;
     }
 
     return false;
 }
 
-bool Thumbnail::readAEHistogram  (const Glib::ustring& fname)
+bool Thumbnail::readAEHistogram  (const char* buffer, std::size_t size)
 {
 
-    FILE* f = g_fopen(fname.c_str(), "rb");
+    const size_t histoBytes = (65536 >> aeHistCompression) * sizeof(aeHistogram[0]);
 
-    if (!f) {
+    if (!buffer || size != histoBytes) {
         aeHistogram.reset();
-    } else {
-        aeHistogram(65536 >> aeHistCompression);
-        const size_t histoBytes = (65536 >> aeHistCompression) * sizeof(aeHistogram[0]);
-        const size_t bytesRead = fread(&aeHistogram[0], 1, histoBytes, f);
-        fclose (f);
-        if (bytesRead != histoBytes) {
-            aeHistogram.reset();
-            return false;
-        }
-        return true;
+        return false;
     }
 
-    return false;
+    aeHistogram(65536 >> aeHistCompression);
+    memcpy (&aeHistogram[0], buffer, histoBytes);
+    return true;
 }
 
-bool Thumbnail::writeAEHistogram (const Glib::ustring& fname)
+bool Thumbnail::writeAEHistogram (std::string& buffer)
 {
 
-    if (aeHistogram) {
-        FILE* f = g_fopen (fname.c_str (), "wb");
+    buffer.clear ();
 
-        if (f) {
-            fwrite (&aeHistogram[0], 1, (65536 >> aeHistCompression)*sizeof (aeHistogram[0]), f);
-            fclose (f);
-            return true;
-        }
+    if (aeHistogram) {
+        buffer.assign (reinterpret_cast<const char*> (&aeHistogram[0]), (65536 >> aeHistCompression) * sizeof (aeHistogram[0]));
+        return true;
     }
 
     return false;
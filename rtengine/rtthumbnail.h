@@ -19,6 +19,7 @@
 #ifndef _THUMBPROCESSINGPARAMETERS_
 #define _THUMBPROCESSINGPARAMETERS_
 
+#include <string>
 #include "rawmetadatalocation.h"
 #include <glibmm.h>
 #include <lcms2.h>
@@ -94,17 +95,19 @@ public:
     void applyAutoExp (procparams::ProcParams& pparams);
 
     unsigned char* getGrayscaleHistEQ (int trim_width);
-    bool writeImage (const Glib::ustring& fname);
-    bool readImage (const Glib::ustring& fname);
 
-    bool readData  (const Glib::ustring& fname);
-    bool writeData  (const Glib::ustring& fname);
+    // Serialization of the cached data to/from memory, the write functions replace the content of the buffer
+    bool writeImage (std::string& buffer);
+    bool readImage (const char* buffer, std::size_t size);
 
-    bool readEmbProfile  (const Glib::ustring& fname);
-    bool writeEmbProfile (const Glib::ustring& fname);
+    bool readData  (const std::string& keyData);
+    bool writeData  (std::string& keyData);
 
-    bool readAEHistogram  (const Glib::ustring& fname);
-    bool writeAEHistogram (const Glib::ustring& fname);
+    bool readEmbProfile  (const char* buffer, std::size_t size);
+    bool writeEmbProfile (std::string& buffer);
+
+    bool readAEHistogram  (const char* buffer, std::size_t size);
+    bool writeAEHistogram (std::string& buffer);
 
     bool isAeValid() { return aeValid; };
     unsigned char* getImage8Data();  // accessor to the 8bit image if it is one, which should be the case for the "Inspector" mode.
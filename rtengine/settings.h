@@ -89,6 +89,19 @@ public:
     };
     ThumbnailInspectorMode thumbnail_inspector_mode;
 
+    Glib::ustring   processingTraceDirectory; ///< When not empty, a trace of the processing steps of each exported image is saved in this directory
+    int             exportStripHeight; ///< When > 0, the end of the export pipeline is processed in strips of this many rows to bound the memory use (only when all the enabled tools allow it)
+    Glib::ustring   demosaicCacheDirectory; ///< Directory of the on-disk cache of the demosaiced raw data
+    int             demosaicCacheSize; ///< Size limit of the demosaic cache in MiB, 0 disables it
+    Glib::ustring   fftwWisdomFile; ///< File in which the FFTW wisdom is kept between sessions, empty to not keep it
+    int             threadBudget; ///< Threads shared by the tiled stages (denoise, wavelets) of all the images processed at the same time, 0 for all the cores
+    int             previewStageCacheSize; ///< Memory in MiB each editor may use to keep the outputs of the Lab stages of the preview, 0 to keep none
+    bool            progressivePreview; ///< Publishes a draft of the preview processed at a quarter of its resolution before the slow Lab stages (wavelets, CIECAM, tone mapping)
+    int             bufferPoolSize; ///< Memory in MiB kept by the buffer pool in released image planes for reuse, 0 to keep none
+    int             memoryBudget; ///< Memory in MiB the large stages (denoise, wavelets) of all the images processed at the same time may use, 0 for no limit
+    bool            reuseDenoiseModels; ///< The batch processing reuses the chroma noise estimated by the automatic denoise for the images of the same camera, ISO and exposure
+    Glib::ustring   denoiseModelFile; ///< File in which the reused chroma noise estimations are kept between sessions, empty to not keep them
+
     /** Creates a new instance of Settings.
       * @return a pointer to the new Settings instance. */
     static Settings* create();
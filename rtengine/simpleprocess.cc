@@ -17,15 +17,20 @@
  *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "rtengine.h"
+#include "cancellation.h"
 #include "colortemp.h"
 #include "imagesource.h"
 #include "improcfun.h"
 #include "curves.h"
+#include "denoisemodelstore.h"
 #include "iccstore.h"
 #include "clutstore.h"
 #include "processingjob.h"
 #include "procparams.h"
+#include "proctrace.h"
 #include <glibmm.h>
+#include <algorithm>
+#include <cmath>
 #include "../rtgui/options.h"
 #include "rawimagesource.h"
 #include "../rtgui/multilangmgr.h"
@@ -54,12 +59,14 @@ public:
         ProcessingJob* pjob,
         int& errorCode,
         ProgressListener* pl,
-        bool flush
+        bool flush,
+        const CancellationToken* cancellation
     ) :
         job (static_cast<ProcessingJobImpl*> (pjob)),
         errorCode (errorCode),
         pl (pl),
         flush (flush),
+        cancellation (cancellation),
         // internal state
         ii(nullptr),
         imgsrc(nullptr),
@@ -97,28 +104,66 @@ public:
 
     Imagefloat *operator()()
     {
-        if (!job->fast) {
-            return normal_pipeline();
-        } else {
-            return fast_pipeline();
+        Imagefloat* const result = !job->fast ? normal_pipeline() : fast_pipeline();
+
+        if (result && isCancelled()) {
+            // the last stages don't check the token, their result is dropped here
+            delete result;
+
+            for (auto output : extraOutputs) {
+                delete output;
+            }
+
+            extraOutputs.clear();
+            return nullptr;
         }
+
+        return result;
+    }
+
+    // the images of the additional outputs of the job, in the order they have been added, after operator()
+    std::vector<Imagefloat*> takeExtraOutputs()
+    {
+        std::vector<Imagefloat*> outputs;
+        outputs.swap (extraOutputs);
+        return outputs;
     }
 
 private:
+    bool isCancelled() const
+    {
+        return cancellation && cancellation->isCancelled();
+    }
+
     Imagefloat *normal_pipeline()
     {
         if (!stage_init()) {
             return nullptr;
         }
 
+        if (isCancelled()) {
+            return stage_cancel();
+        }
+
         stage_denoise();
+
+        if (isCancelled()) {
+            return stage_cancel();
+        }
+
         stage_transform();
+
+        if (isCancelled()) {
+            return stage_cancel();
+        }
+
         return stage_finish();
     }
 
     Imagefloat *fast_pipeline()
     {
-        if (!job->pparams.resize.enabled) {
+        // the early resize would be shared by the additional outputs
+        if (!job->pparams.resize.enabled || !job->outputs.empty()) {
             return normal_pipeline();
         }
 
@@ -129,13 +174,24 @@ private:
         }
 
         stage_transform();
+
+        if (isCancelled()) {
+            return stage_cancel();
+        }
+
         stage_early_resize();
         stage_denoise();
+
+        if (isCancelled()) {
+            return stage_cancel();
+        }
+
         return stage_finish();
     }
 
     bool stage_init()
     {
+        PROCTRACE ("stage_init");
         errorCode = 0;
 
         if (pl) {
@@ -205,6 +261,7 @@ private:
 
         ipf_p.reset (new ImProcFunctions (&params, true));
         ImProcFunctions &ipf = * (ipf_p.get());
+        ipf.setCancellationToken (cancellation);
 
         imgsrc->setCurrentFrame (params.raw.bayersensor.imageNum);
         imgsrc->preprocess ( params.raw, params.lensProf, params.coarse, params.dirpyrDenoise.enabled);
@@ -237,7 +294,9 @@ private:
             imgsrc->retinexPrepareBuffers (params.icm, params.retinex, conversionBuffer, dummy);
             imgsrc->retinexPrepareCurves (params.retinex, cdcurve, mapcurve, dehatransmissionCurve, dehagaintransmissionCurve, dehacontlutili, mapcontlutili, useHsl, dummy, dummy );
             float minCD, maxCD, mini, maxi, Tmean, Tsigma, Tmin, Tmax;
+            imgsrc->setCancellationToken (cancellation);
             imgsrc->retinex ( params.icm, params.retinex, params.toneCurve, cdcurve, mapcurve, dehatransmissionCurve, dehagaintransmissionCurve, conversionBuffer, dehacontlutili, mapcontlutili, useHsl, minCD, maxCD, mini, maxi, Tmean, Tsigma, Tmin, Tmax, dummy);
+            imgsrc->setCancellationToken (nullptr);
         }
 
         if (pl) {
@@ -301,6 +360,36 @@ private:
         pcsk = new float [nbtl];
 
         //  printf("expert=%d\n",settings->leveldnautsimpl);
+
+        // the frames of a burst share their noise, the estimation of the first one is reused for the next ones
+        const bool autoChroma = (settings->leveldnautsimpl == 1 && params.dirpyrDenoise.Cmethod == "AUT") || (settings->leveldnautsimpl == 0 && params.dirpyrDenoise.C2method == "AUTO");
+        const bool ponderChroma = settings->leveldnautsimpl == 1 && params.dirpyrDenoise.Cmethod == "PON";
+        std::string denoiseModelKey;
+        bool denoiseModelReused = false;
+
+        if (settings->reuseDenoiseModels && params.dirpyrDenoise.enabled && (autoChroma || ponderChroma)) {
+            denoiseModelKey = DenoiseModelStore::getKey(imgsrc->getMetaData(), fw, fh, imgsrc->isRAW(), params);
+            DenoiseModelStore::Model model;
+
+            if (DenoiseModelStore::getInstance()->get(denoiseModelKey, model)) {
+                if (ponderChroma && model.chM.size() == static_cast<size_t>(nbtl)) {
+                    std::copy(model.chM.begin(), model.chM.end(), ch_M);
+                    std::copy(model.maxR.begin(), model.maxR.end(), max_r);
+                    std::copy(model.maxB.begin(), model.maxB.end(), max_b);
+                    denoiseModelReused = true;
+                } else if (autoChroma) {
+                    params.dirpyrDenoise.chroma = model.chroma;
+                    params.dirpyrDenoise.redchro = model.redchro;
+                    params.dirpyrDenoise.bluechro = model.bluechro;
+                    denoiseModelReused = true;
+                }
+            }
+
+            if (denoiseModelReused && settings->verbose) {
+                printf ("Info denoise: reused the chroma noise of %s\n", denoiseModelKey.c_str());
+            }
+        }
+
         if (settings->leveldnautsimpl == 1 && params.dirpyrDenoise.Cmethod == "PON") {
             MyTime t1pone, t2pone;
             t1pone.set();
@@ -334,7 +423,7 @@ private:
             //  int crH=tileHskip-10;//crop noise height
 //      Imagefloat *origCropPart;//init auto noise
 //          origCropPart = new Imagefloat (crW, crH);//allocate memory
-            if (params.dirpyrDenoise.enabled) {//evaluate Noise
+            if (params.dirpyrDenoise.enabled && !denoiseModelReused) {//evaluate Noise
                 LUTf gamcurve (65536, 0);
                 float gam, gamthresh, gamslope;
                 ipf.RGB_denoise_infoGamCurve (params.dirpyrDenoise, imgsrc->isRAW(), gamcurve, gam, gamthresh, gamslope);
@@ -507,6 +596,11 @@ private:
                     }
                 }
 
+                if (!denoiseModelKey.empty()) {
+                    DenoiseModelStore::getInstance()->put(denoiseModelKey, {params.dirpyrDenoise.chroma, params.dirpyrDenoise.redchro, params.dirpyrDenoise.bluechro,
+                                                                            std::vector<float>(ch_M, ch_M + nbtl), std::vector<float>(max_r, max_r + nbtl), std::vector<float>(max_b, max_b + nbtl)});
+                }
+
                 if (settings->verbose) {
                     t2pone.set();
                     printf ("Info denoise ponderated performed in %d usec:\n", t2pone.etime (t1pone));
@@ -549,7 +643,7 @@ private:
                 lowdenoise = 0.7f;
             }
 
-            if (params.dirpyrDenoise.enabled) {//evaluate Noise
+            if (params.dirpyrDenoise.enabled && !denoiseModelReused) {//evaluate Noise
                 LUTf gamcurve (65536, 0);
                 float gam, gamthresh, gamslope;
                 ipf.RGB_denoise_infoGamCurve (params.dirpyrDenoise, imgsrc->isRAW(), gamcurve, gam, gamthresh, gamslope);
@@ -728,6 +822,10 @@ private:
                 params.dirpyrDenoise.chroma = chM / (autoNR * multip * adjustr);
                 params.dirpyrDenoise.redchro = maxr;
                 params.dirpyrDenoise.bluechro = maxb;
+
+                if (!denoiseModelKey.empty()) {
+                    DenoiseModelStore::getInstance()->put(denoiseModelKey, {params.dirpyrDenoise.chroma, params.dirpyrDenoise.redchro, params.dirpyrDenoise.bluechro, {}, {}, {}});
+                }
             }
 
             if (settings->verbose) {
@@ -791,6 +889,7 @@ private:
 
     void stage_denoise()
     {
+        PROCTRACE ("stage_denoise");
         procparams::ProcParams& params = job->pparams;
         //ImProcFunctions ipf (&params, true);
         ImProcFunctions &ipf = * (ipf_p.get());
@@ -844,6 +943,11 @@ private:
         }
 
 //  delete calclum;
+        free_denoise_info();
+    }
+
+    void free_denoise_info()
+    {
         delete [] ch_M;
         delete [] max_r;
         delete [] max_b;
@@ -854,10 +958,27 @@ private:
         delete [] ry;
         delete [] sk;
         delete [] pcsk;
+        ch_M = max_r = max_b = min_r = min_b = lumL = chromC = ry = sk = pcsk = nullptr;
+    }
+
+    // Frees what the stages run so far have allocated, when the job is cancelled before stage_finish
+    Imagefloat *stage_cancel()
+    {
+        free_denoise_info();
+        delete baseImg;
+        baseImg = nullptr;
+
+        if (!job->initialImage) {
+            ii->decreaseRef ();
+        }
+
+        delete job;
+        return nullptr;
     }
 
     void stage_transform()
     {
+        PROCTRACE ("stage_transform");
         procparams::ProcParams& params = job->pparams;
         //ImProcFunctions ipf (&params, true);
         ImProcFunctions &ipf = * (ipf_p.get());
@@ -891,6 +1012,7 @@ private:
 
     Imagefloat *stage_finish()
     {
+        PROCTRACE ("stage_finish");
         procparams::ProcParams& params = job->pparams;
         //ImProcFunctions ipf (&params, true);
         ImProcFunctions &ipf = * (ipf_p.get());
@@ -956,8 +1078,6 @@ private:
             CurveFactory::curveToning (params.colorToning.cl2curve, cl2Toningcurve, 1);
         }
 
-        labView = new LabImage (fw, fh);
-
         if (params.blackwhite.enabled) {
             CurveFactory::curveBW (params.blackwhite.beforeCurve, params.blackwhite.afterCurve, hist16, dummy, customToneCurvebw1, customToneCurvebw2, 1);
         }
@@ -992,6 +1112,12 @@ private:
 
         LUTu histToneCurve;
 
+        if (settings->exportStripHeight > 0 && can_process_in_strips()) {
+            return stage_output (stage_finish_strips (satLimit, satLimitOpacity, opautili, dcpProf, as));
+        }
+
+        labView = new LabImage (fw, fh);
+
         ipf.rgbProc (baseImg, labView, nullptr, curve1, curve2, curve, params.toneCurve.saturation, rCurve, gCurve, bCurve, satLimit, satLimitOpacity, ctColorCurve, ctOpacityCurve, opautili, clToningcurve, cl2Toningcurve, customToneCurve1, customToneCurve2, customToneCurvebw1, customToneCurvebw2, rrm, ggm, bbm, autor, autog, autob, expcomp, hlcompr, hlcomprthresh, dcpProf, as, histToneCurve, options.chunkSizeRGB, options.measure);
 
         if (settings->verbose) {
@@ -1194,6 +1320,10 @@ private:
             pl->setProgress (0.60);
         }
 
+        if (!job->outputs.empty()) {
+            return stage_branches();
+        }
+
         int imw, imh;
         double tmpScale = ipf.resizeScale (&params, fw, fh, imw, imh);
         bool labResize = params.resize.enabled && params.resize.method != "Nearest" && (tmpScale != 1.0 || params.prsharpening.enabled);
@@ -1248,9 +1378,6 @@ private:
             }
         }
 
-        cmsHPROFILE jprof = nullptr;
-        constexpr bool customGamma = false;
-        constexpr bool useLCMS = false;
         bool bwonly = params.blackwhite.enabled && !params.colorToning.enabled && !autili && !butili && !params.colorappearance.enabled;
 
         ///////////// Custom output gamma has been removed, the user now has to create
@@ -1283,10 +1410,201 @@ private:
             }
         }
 
+        return stage_output (readyImg);
+    }
+
+    /* Branch point of the jobs with additional outputs: the crop, resize, post-resize sharpening, output profile
+     * and metadata of each output are processed from labView, the result of the shared part of the pipeline.
+     * The crop is done once for all the outputs, and the Lanczos resizes together, each one from the smallest
+     * larger output when it is at least twice as large. The additional outputs are kept in extraOutputs. */
+    Imagefloat *stage_branches()
+    {
+        PROCTRACE ("stage_branches");
+
+        // the parameters of the job with the tail settings of each output
+        std::vector<procparams::ProcParams> outputParams (1, job->pparams);
+
+        for (const auto& output : job->outputs) {
+            outputParams.push_back (ProcessingJob::getOutputParams (job->pparams, output));
+        }
+
+        const procparams::CropParams& crop = job->pparams.crop;
+        const std::size_t outputs = outputParams.size();
+
+        std::vector<std::unique_ptr<ImProcFunctions>> ipfs;
+        std::vector<char> labResize (outputs);
+        std::vector<std::unique_ptr<LabImage>> resized (outputs);
+        std::vector<std::pair<LabImage*, float>> resizes;
+        std::vector<std::size_t> resizedOutputs;
+
+        for (std::size_t i = 0; i < outputs; i++) {
+            const procparams::ProcParams& params = outputParams[i];
+            ipfs.emplace_back (new ImProcFunctions (&params, true));
+
+            int imw, imh;
+            const double tmpScale = ipfs[i]->resizeScale (&params, fw, fh, imw, imh);
+            labResize[i] = params.resize.enabled && params.resize.method != "Nearest" && (tmpScale != 1.0 || params.prsharpening.enabled);
+
+            const int srcW = crop.enabled ? crop.w : labView->W;
+            const int srcH = crop.enabled ? crop.h : labView->H;
+
+            if (labResize[i] && (srcW != imw || srcH != imh) && (params.resize.allowUpscaling || (srcW >= imw && srcH >= imh))) {
+                resized[i].reset (new LabImage (imw, imh));
+                resizes.emplace_back (resized[i].get(), tmpScale);
+                resizedOutputs.push_back (i);
+            }
+        }
+
+        // crop lab data, once for all the outputs resized in Lab
+        std::unique_ptr<LabImage> cropped;
+
+        if (crop.enabled && std::find (labResize.begin(), labResize.end(), true) != labResize.end()) {
+            cropped.reset (new LabImage (crop.w, crop.h));
+
+            for (int row = 0; row < crop.h; row++) {
+                for (int col = 0; col < crop.w; col++) {
+                    cropped->L[row][col] = labView->L[row + crop.y][col + crop.x];
+                    cropped->a[row][col] = labView->a[row + crop.y][col + crop.x];
+                    cropped->b[row][col] = labView->b[row + crop.y][col + crop.x];
+                }
+            }
+        }
+
+        const LabImage* const resizeSource = cropped ? cropped.get() : labView;
+
+        if (!resizes.empty()) {
+            ipfs[0]->Lanczos (resizeSource, resizes);
+        }
+
+        if (pl) {
+            pl->setProgress (0.65);
+        }
+
+        std::vector<Imagefloat*> readyImgs;
+
+        for (std::size_t i = 0; i < outputs; i++) {
+            procparams::ProcParams& params = outputParams[i];
+            ImProcFunctions& ipf = *ipfs[i];
+
+            LabImage* lab = labView;
+            int cx = 0, cy = 0, cw = labView->W, ch = labView->H;
+
+            if (labResize[i]) {
+                if (resized[i]) {
+                    lab = resized[i].get();
+                } else if (cropped) {
+                    lab = cropped.get();
+                }
+
+                cw = lab->W;
+                ch = lab->H;
+
+                if (params.prsharpening.enabled) {
+                    if (!resized[i]) {
+                        // the sharpening works in place, the shared image is kept for the next outputs
+                        resized[i].reset (new LabImage (lab->W, lab->H));
+                        resized[i]->CopyFrom (lab);
+                        lab = resized[i].get();
+                    }
+
+                    for (int row = 0; row < ch; row++) {
+                        for (int col = 0; col < cw; col++) {
+                            lab->L[row][col] = lab->L[row][col] < 0.f ? 0.f : lab->L[row][col];
+                        }
+                    }
+
+                    ipf.sharpening (lab, params.prsharpening);
+                }
+            } else if (crop.enabled) {
+                cx = crop.x;
+                cy = crop.y;
+                cw = crop.w;
+                ch = crop.h;
+            }
+
+            Imagefloat* readyImg = ipf.lab2rgbOut (lab, cx, cy, cw, ch, params.icm);
+
+            // the resized image isn't needed anymore once all the resizes are done
+            resized[i].reset();
+
+            if (params.blackwhite.enabled && !params.colorToning.enabled && !autili && !butili && !params.colorappearance.enabled) {
+                // force BW r=g=b
+                for (int row = 0; row < ch; row++) {
+                    for (int col = 0; col < cw; col++) {
+                        readyImg->r (row, col) = readyImg->g (row, col);
+                        readyImg->b (row, col) = readyImg->g (row, col);
+                    }
+                }
+            }
+
+            readyImgs.push_back (finish_output (readyImg, params, ipf));
+        }
+
+        cropped.reset();
+        delete labView;
+        labView = nullptr;
+
+        extraOutputs.assign (readyImgs.begin() + 1, readyImgs.end());
+
+        if (!job->initialImage) {
+            ii->decreaseRef ();
+        }
+
+        delete job;
+
+        if (pl) {
+            pl->setProgress (0.75);
+        }
+
+        return readyImgs[0];
+    }
+
+    // Nearest neighbour resize, metadata and output profile of the processed image, then releases the job
+    Imagefloat *stage_output (Imagefloat *readyImg)
+    {
         if (pl) {
             pl->setProgress (0.70);
         }
 
+        readyImg = finish_output (readyImg, job->pparams, * (ipf_p.get()));
+
+//    t2.set();
+//    if( settings->verbose )
+//           printf("Total:- %d usec\n", t2.etime(t1));
+
+        if (!job->initialImage) {
+            ii->decreaseRef ();
+        }
+
+        delete job;
+
+        if (pl) {
+            pl->setProgress (0.75);
+        }
+
+        /*  curve1.reset();curve2.reset();
+            curve.reset();
+            satcurve.reset();
+            lhskcurve.reset();
+
+            rCurve.reset();
+            gCurve.reset();
+            bCurve.reset();
+            hist16.reset();
+            hist16C.reset();
+        */
+        return readyImg;
+    }
+
+    // Nearest neighbour resize, metadata and output profile of an output image processed with params
+    Imagefloat *finish_output (Imagefloat *readyImg, procparams::ProcParams& params, ImProcFunctions &ipf)
+    {
+        int imw, imh;
+        const double tmpScale = ipf.resizeScale (&params, fw, fh, imw, imh);
+        cmsHPROFILE jprof = nullptr;
+        constexpr bool customGamma = false;
+        constexpr bool useLCMS = false;
+
         if (tmpScale != 1.0 && params.resize.method == "Nearest" &&
             (params.resize.allowUpscaling || (readyImg->getWidth() >= imw && readyImg->getHeight() >= imh))) { // resize rgb data (gamma applied)
             Imagefloat* tempImage = new Imagefloat (imw, imh);
@@ -1344,36 +1662,204 @@ private:
             }
         }
 
-//    t2.set();
-//    if( settings->verbose )
-//           printf("Total:- %d usec\n", t2.etime(t1));
+        return readyImg;
+    }
 
-        if (!job->initialImage) {
-            ii->decreaseRef ();
+    // true if all the enabled tools between rgbProc and the output profile conversion only need a bounded neighbourhood of each pixel
+    bool can_process_in_strips()
+    {
+        const procparams::ProcParams& params = job->pparams;
+
+        int imw, imh;
+        const double tmpScale = ipf_p->resizeScale (&params, fw, fh, imw, imh);
+        const bool labResize = params.resize.enabled && params.resize.method != "Nearest" && (tmpScale != 1.0 || params.prsharpening.enabled);
+
+        return !labResize
+               && job->outputs.empty()
+               && params.labCurve.contrast == 0 // uses the histogram of the whole image
+               && ! (params.blackwhite.enabled && params.blackwhite.autoc)
+               && ! (params.colorToning.enabled && params.colorToning.method == "LabRegions")
+               && !params.epd.enabled
+               && !params.impulseDenoise.enabled
+               && !params.defringe.enabled
+               && !params.sharpenEdge.enabled
+               && !params.sharpenMicro.enabled
+               && ! (params.dirpyrequalizer.enabled && params.dirpyrequalizer.cbdlMethod == "aft")
+               && !params.wavelet.enabled
+               && !params.colorappearance.enabled
+               // the guided filter subsamples on a grid starting at the first row of the strip
+               && ! (params.sh.enabled && (params.sh.shadows || params.sh.highlights));
+    }
+
+    // rows needed above and below a strip to get the result of the full image at its border
+    int strip_overlap()
+    {
+        const procparams::SharpeningParams& sharpening = job->pparams.sharpening;
+        const procparams::LocalContrastParams& localContrast = job->pparams.localContrast;
+
+        if (!sharpening.enabled && !localContrast.enabled) {
+            return 0;
         }
 
-        delete job;
+        // the gaussian blurs of the successive tools add up as variances
+        double variance = 0.0;
 
-        if (pl) {
-            pl->setProgress (0.75);
+        if (localContrast.enabled) {
+            // blur at the end of rgbProc, of sigma radius / scale with a scale of 1 when exporting
+            variance += SQR (localContrast.radius);
         }
 
-        /*  curve1.reset();curve2.reset();
-            curve.reset();
-            satcurve.reset();
-            lhskcurve.reset();
+        if (sharpening.enabled) {
+            // the blur of the contrast mask (sigma 2, 2 pixels for the gradient)
+            variance += 4.0 + SQR (sharpening.blurradius);
+
+            if (sharpening.method == "rld") {
+                variance += 2.0 * sharpening.deconviter * SQR (sharpening.deconvradius);
+            } else {
+                variance += SQR (sharpening.radius) + (sharpening.edgesonly ? SQR (sharpening.edges_radius) : 0.0);
+            }
+        }
+
+        return 4 + static_cast<int> (std::ceil (4.0 * std::sqrt (variance)));
+    }
+
+    /* Runs the end of the pipeline, from rgbProc to the output profile conversion, on horizontal strips
+     * of baseImg with an overlap for the neighbourhood operators, so that no full size LabImage is needed.
+     * The output of a strip is written back into baseImg once the next strip has read its overlap. */
+    Imagefloat *stage_finish_strips (float satLimit, float satLimitOpacity, bool opautili, DCPProfile *dcpProf, const DCPProfile::ApplyState &as)
+    {
+        PROCTRACE ("stage_finish_strips");
+        procparams::ProcParams& params = job->pparams;
+        ImProcFunctions &ipf = * (ipf_p.get());
+
+        // curve1 and curve2 are the highlight and shadow curves of rgbProc, the a and b curves need their own tables
+        LUTf acurve (65536);
+        LUTf bcurve (65536);
+        bool utili, clcutili, ccutili, cclutili;
+        CurveFactory::complexLCurve (params.labCurve.brightness, params.labCurve.contrast, params.labCurve.lcurve, hist16, lumacurve, dummy, 1, utili);
+        CurveFactory::curveCL (clcutili, params.labCurve.clcurve, clcurve, 1);
+        CurveFactory::complexsgnCurve (autili, butili, ccutili, cclutili, params.labCurve.acurve, params.labCurve.bcurve, params.labCurve.cccurve,
+                                       params.labCurve.lccurve, acurve, bcurve, satcurve, lhskcurve, 1);
+
+        const bool bwonly = params.blackwhite.enabled && !params.colorToning.enabled && !autili && !butili && !params.colorappearance.enabled;
+
+        int cx = 0, cy = 0, cw = fw, ch = fh;
+
+        if (params.crop.enabled) {
+            cx = params.crop.x;
+            cy = params.crop.y;
+            cw = params.crop.w;
+            ch = params.crop.h;
+        }
+
+        const int border = strip_overlap();
+        const int stripHeight = std::max ({settings->exportStripHeight, border, 16});
+
+        if (settings->verbose) {
+            printf ("Processing %dx%d in strips of %d rows with an overlap of %d rows\n", fw, fh, stripHeight, border);
+        }
+
+        // without crop, the output is written in place
+        Imagefloat* const readyImg = params.crop.enabled ? new Imagefloat (cw, ch) : baseImg;
+        std::unique_ptr<Imagefloat> pending;
+        int pendingRow = 0;
+
+        const auto flushPending =
+            [&]()
+            {
+                if (!pending) {
+                    return;
+                }
+
+#ifdef _OPENMP
+                #pragma omp parallel for
+#endif
+
+                for (int i = 0; i < pending->getHeight(); ++i) {
+                    std::copy (pending->r (i), pending->r (i) + cw, readyImg->r (pendingRow - cy + i));
+                    std::copy (pending->g (i), pending->g (i) + cw, readyImg->g (pendingRow - cy + i));
+                    std::copy (pending->b (i), pending->b (i) + cw, readyImg->b (pendingRow - cy + i));
+                }
+
+                pending.reset();
+            };
+
+        for (int y0 = cy; y0 < cy + ch; y0 += stripHeight) {
+            const int y1 = std::min (y0 + stripHeight, cy + ch);
+            const int top = std::max (y0 - border, 0);
+            const int bottom = std::min (y1 + border, fh);
+
+            std::unique_ptr<LabImage> lab;
+            {
+                Imagefloat working (fw, bottom - top);
+
+#ifdef _OPENMP
+                #pragma omp parallel for
+#endif
+
+                for (int i = top; i < bottom; ++i) {
+                    std::copy (baseImg->r (i), baseImg->r (i) + fw, working.r (i - top));
+                    std::copy (baseImg->g (i), baseImg->g (i) + fw, working.g (i - top));
+                    std::copy (baseImg->b (i), baseImg->b (i) + fw, working.b (i - top));
+                }
+
+                // the rows of the previous strip have been read, its output can replace them
+                flushPending();
+
+                lab.reset (new LabImage (fw, bottom - top));
+                double rrm, ggm, bbm;
+                float autor = -9000.f, autog, autob;
+                LUTu histToneCurve;
+                ipf.rgbProc (&working, lab.get(), nullptr, curve1, curve2, curve, params.toneCurve.saturation, rCurve, gCurve, bCurve, satLimit, satLimitOpacity, ctColorCurve, ctOpacityCurve, opautili, clToningcurve, cl2Toningcurve, customToneCurve1, customToneCurve2, customToneCurvebw1, customToneCurvebw2, rrm, ggm, bbm, autor, autog, autob, expcomp, hlcompr, hlcomprthresh, dcpProf, as, histToneCurve, options.chunkSizeRGB, options.measure);
+            }
+
+            ipf.chromiLuminanceCurve (nullptr, 1, lab.get(), lab.get(), acurve, bcurve, satcurve, lhskcurve, clcurve, lumacurve, utili, autili, butili, ccutili, cclutili, clcutili, dummy, dummy);
+            ipf.vibrance (lab.get());
+
+            if (params.sharpening.enabled) {
+                ipf.sharpening (lab.get(), params.sharpening);
+            }
+
+            ipf.softLight (lab.get());
+
+            pending.reset (ipf.lab2rgbOut (lab.get(), cx, y0 - top, cw, y1 - y0, params.icm));
+            pendingRow = y0;
+
+            if (bwonly) { //force BW r=g=b
+                for (int i = 0; i < pending->getHeight(); ++i) {
+                    std::copy (pending->g (i), pending->g (i) + cw, pending->r (i));
+                    std::copy (pending->g (i), pending->g (i) + cw, pending->b (i));
+                }
+            }
+
+            if (pl) {
+                pl->setProgress (0.55 + 0.15 * (y1 - cy) / ch);
+            }
+        }
+
+        flushPending();
+
+        if (readyImg != baseImg) {
+            delete baseImg;
+        }
+
+        baseImg = nullptr;
+
+        // if clut was used and size of clut cache == 1 we free the memory used by the clutstore (default clut cache size = 1 for 32 bit OS)
+        if (params.filmSimulation.enabled && !params.filmSimulation.clutFilename.empty() && options.clutCacheSize == 1) {
+            CLUTStore::getInstance().clearCache();
+        }
+
+        if (settings->verbose) {
+            printf ("Output profile_: \"%s\"\n", params.icm.outputProfile.c_str());
+        }
 
-            rCurve.reset();
-            gCurve.reset();
-            bCurve.reset();
-            hist16.reset();
-            hist16C.reset();
-        */
         return readyImg;
     }
 
     void stage_early_resize()
     {
+        PROCTRACE ("stage_early_resize");
         procparams::ProcParams& params = job->pparams;
         //ImProcFunctions ipf (&params, true);
         ImProcFunctions &ipf = * (ipf_p.get());
@@ -1510,6 +1996,7 @@ private:
     int& errorCode;
     ProgressListener* pl;
     bool flush;
+    const CancellationToken* cancellation;
 
     // internal state
     std::unique_ptr<ImProcFunctions> ipf_p;
@@ -1550,6 +2037,7 @@ private:
     ColorTemp currWB;
     Imagefloat *baseImg;
     LabImage* labView;
+    std::vector<Imagefloat*> extraOutputs;
 
     LUTu hist16;
 
@@ -1582,20 +2070,73 @@ private:
 } // namespace
 
 
-IImagefloat* processImage (ProcessingJob* pjob, int& errorCode, ProgressListener* pl, bool flush)
+std::vector<IImagefloat*> processImageOutputs (ProcessingJob* pjob, int& errorCode, ProgressListener* pl, bool flush, const CancellationToken* cancellation)
+{
+    const auto process = [&]() {
+        std::vector<IImagefloat*> result;
+        ImageProcessor proc (pjob, errorCode, pl, flush, cancellation);
+        Imagefloat* const image = proc();
+
+        if (image) {
+            result.push_back (image);
+
+            for (auto output : proc.takeExtraOutputs()) {
+                result.push_back (output);
+            }
+        }
+
+        return result;
+    };
+
+    if (settings->processingTraceDirectory.empty()) {
+        return process();
+    }
+
+    // the job is deleted during the processing
+    ProcessingJobImpl* const job = static_cast<ProcessingJobImpl*> (pjob);
+    const Glib::ustring fname = job->initialImage ? job->initialImage->getFileName() : job->fname;
+
+    ProcessingTrace trace;
+    std::vector<IImagefloat*> result;
+
+    {
+        ProcessingTrace::Attach attach (trace);
+        PROCTRACE ("processImage");
+        result = process();
+    }
+
+    // the checksum of the full path keeps apart the inputs of the same name from different folders
+    const Glib::ustring traceName = Glib::path_get_basename (fname) + "." + Glib::Checksum::compute_checksum (Glib::Checksum::CHECKSUM_MD5, fname).substr (0, 8) + ".trace.json";
+    const Glib::ustring traceFile = Glib::build_filename (settings->processingTraceDirectory, traceName);
+
+    if (trace.save (traceFile, fname)) {
+        printf ("Could not save the processing trace to %s\n", traceFile.c_str());
+    }
+
+    return result;
+}
+
+IImagefloat* processImage (ProcessingJob* pjob, int& errorCode, ProgressListener* pl, bool flush, const CancellationToken* cancellation)
 {
-    ImageProcessor proc (pjob, errorCode, pl, flush);
-    return proc();
+    const std::vector<IImagefloat*> images = processImageOutputs (pjob, errorCode, pl, flush, cancellation);
+
+    // the additional outputs of the job, if any, aren't wanted by the caller
+    for (std::size_t i = 1; i < images.size(); i++) {
+        delete images[i];
+    }
+
+    return images.empty() ? nullptr : images[0];
 }
 
-void batchProcessingThread (ProcessingJob* job, BatchProcessingListener* bpl)
+void batchProcessingThread (ProcessingJob* job, BatchProcessingListener* bpl, const CancellationToken* cancellation)
 {
 
     ProcessingJob* currentJob = job;
 
     while (currentJob) {
         int errorCode;
-        IImagefloat* img = processImage (currentJob, errorCode, bpl, true);
+        // img is nullptr without error code if the job has been cancelled, imageReady() then skips it
+        IImagefloat* img = processImage (currentJob, errorCode, bpl, true, cancellation);
 
         if (errorCode) {
             bpl->error (M ("MAIN_MSG_CANNOTLOAD"));
@@ -1611,11 +2152,11 @@ void batchProcessingThread (ProcessingJob* job, BatchProcessingListener* bpl)
     }
 }
 
-void startBatchProcessing (ProcessingJob* job, BatchProcessingListener* bpl)
+void startBatchProcessing (ProcessingJob* job, BatchProcessingListener* bpl, const CancellationToken* cancellation)
 {
 
     if (bpl) {
-        Glib::Thread::create (sigc::bind (sigc::ptr_fun (batchProcessingThread), job, bpl), 0, true, true, Glib::THREAD_PRIORITY_LOW);
+        Glib::Thread::create (sigc::bind (sigc::ptr_fun (batchProcessingThread), job, bpl, cancellation), 0, true, true, Glib::THREAD_PRIORITY_LOW);
     }
 
 }
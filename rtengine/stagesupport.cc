@@ -0,0 +1,173 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "stagesupport.h"
+
+#include "procparams.h"
+
+namespace
+{
+
+// the transform and the resampling of the crop read a couple of pixels around each output pixel
+constexpr int minBorder = 4;
+
+// gaussian blurs are truncated at 3 sigma
+int gaussSupport(double sigma)
+{
+    return std::ceil(3.0 * sigma);
+}
+
+// the guided filter averages twice with a box of radius r on a grid subsampled by subsampling,
+// and resamples its input to that grid and its output back with bilinear interpolation
+int guidedFilterSupport(int r, int subsampling)
+{
+    return 2 * r + 3 * subsampling;
+}
+
+}
+
+namespace rtengine
+{
+
+std::vector<StageSupport> getStageSupports(const procparams::ProcParams& params, int skip)
+{
+    std::vector<StageSupport> supports;
+
+    // the denoise decomposes its tiles in wavelets down to their coarsest level
+    if (params.dirpyrDenoise.enabled && skip == 1) {
+        supports.push_back({"denoise", true, 0});
+    }
+
+    // the ambient light comes from the preview, but the transmission map is computed on patches which
+    // are a fraction of the whole image
+    if (params.dehaze.enabled) {
+        supports.push_back({"dehaze", true, 0});
+    }
+
+    // the luminance gain of the whole image is computed once and cached, see Crop::update
+    if (params.fattal.enabled) {
+        supports.push_back({"fattal", false, 0});
+    }
+
+    if (params.dirpyrequalizer.enabled) {
+        supports.push_back({"cbdl", true, 0});
+    }
+
+    if (params.colorappearance.enabled) {
+        supports.push_back({"ciecam", true, 0});
+    }
+
+    if (params.colorToning.enabled && params.colorToning.method == "LabRegions") {
+        // the masks of the regions are smoothed by guided filters, see ImProcFunctions::labColorCorrectionRegions.
+        // The largest one is the L mask filter, its subsampling is at most 5.
+        int radius = 0;
+
+        for (const auto& region : params.colorToning.labregions) {
+            const double blur = region.maskBlur < 0.0 ? -1.0 / region.maskBlur : 1.0 + region.maskBlur;
+            const int r2 = std::max(int(25.0 / skip * blur + 0.5), 1);
+            radius = std::max(radius, guidedFilterSupport(r2, 5) * skip);
+        }
+
+        supports.push_back({"color toning regions", false, radius});
+    }
+
+    if (params.sh.enabled) {
+        // one guided filter per pass, see ImProcFunctions::shadowsHighlights. Its radius is scaled
+        // to the crop, its subsampling of 4 isn't.
+        const int passes = (params.sh.highlights > 0) + (params.sh.shadows > 0);
+        const int radius = guidedFilterSupport(params.sh.radius * 10 / skip, 4) * skip;
+
+        if (passes > 0) {
+            supports.push_back({"shadows/highlights", false, passes * radius});
+        }
+    }
+
+    if (params.localContrast.enabled) {
+        supports.push_back({"local contrast", false, gaussSupport(params.localContrast.radius)});
+    }
+
+    if (params.epd.enabled) {
+        supports.push_back({"tone mapping", true, 0});
+    }
+
+    if (params.wavelet.enabled) {
+        supports.push_back({"wavelets", true, 0});
+    }
+
+    // the following stages only run at 100%
+    if (skip == 1) {
+        if (params.impulseDenoise.enabled) {
+            supports.push_back({"impulse denoise", false, gaussSupport(2.0) + 2});
+        }
+
+        if (params.defringe.enabled) {
+            supports.push_back({"defringe", false, gaussSupport(params.defringe.radius) + 2});
+        }
+
+        if (params.sharpenEdge.enabled) {
+            supports.push_back({"sharpen edges", false, 2 * params.sharpenEdge.passes});
+        }
+
+        if (params.sharpenMicro.enabled) {
+            supports.push_back({"microcontrast", false, 2});
+        }
+
+        if (params.sharpening.enabled) {
+            int radius;
+
+            if (params.sharpening.method == "rld") {
+                // each iteration blurs the estimate again
+                radius = gaussSupport(params.sharpening.deconvradius) * std::max(params.sharpening.deconviter, 1);
+            } else {
+                radius = gaussSupport(params.sharpening.radius);
+
+                if (params.sharpening.edgesonly) {
+                    radius += gaussSupport(params.sharpening.edges_radius);
+                }
+
+                if (params.sharpening.halocontrol) {
+                    radius += 1;
+                }
+            }
+
+            supports.push_back({"sharpening", false, radius});
+        }
+    }
+
+    return supports;
+}
+
+int getCropBorder(const procparams::ProcParams& params, int skip, int maxBorder)
+{
+    // the stages are chained, so their supports add up
+    int radius = 0;
+
+    for (const auto& support : getStageSupports(params, skip)) {
+        if (support.global) {
+            return maxBorder;
+        }
+
+        radius += support.radius;
+    }
+
+    return std::min(minBorder + (radius + skip - 1) / skip, maxBorder);
+}
+
+}
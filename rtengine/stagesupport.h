@@ -0,0 +1,52 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+
+namespace rtengine
+{
+
+namespace procparams
+{
+
+class ProcParams;
+
+}
+
+/**
+ * @brief Spatial support of a processing stage of the detail crops
+ *
+ * An output pixel of a local stage depends on the input pixels at most 'radius' pixels away (at full
+ * scale). An output pixel of a global stage depends on the whole image, or on so large a neighborhood
+ * that a crop can only approximate it.
+ */
+struct StageSupport {
+    const char* name;
+    bool global;
+    int radius;
+};
+
+/** @return the support of the stages enabled by params that run in a detail crop displayed at 1/skip */
+std::vector<StageSupport> getStageSupports(const procparams::ProcParams& params, int skip);
+
+/** @return the border (in crop pixels) to add around a detail crop so that its local stages are exact,
+  * at most maxBorder. Global stages always get maxBorder. */
+int getCropBorder(const procparams::ProcParams& params, int skip, int maxBorder);
+
+}
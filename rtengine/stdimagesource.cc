@@ -24,6 +24,7 @@
 #include "imageio.h"
 #include "mytime.h"
 #include "procparams.h"
+#include "proctrace.h"
 
 #undef THREAD_PRIORITY_NORMAL
 
@@ -106,6 +107,7 @@ void StdImageSource::getSampleFormat (const Glib::ustring &fname, IIOSampleForma
  */
 int StdImageSource::load (const Glib::ustring &fname)
 {
+    PROCTRACE("load");
 
     fileName = fname;
 
@@ -193,6 +195,7 @@ int StdImageSource::load (const Glib::ustring &fname)
 
 void StdImageSource::getImage (const ColorTemp &ctemp, int tran, Imagefloat* image, const PreviewProps &pp, const ToneCurveParams &hrp, const RAWParams &raw)
 {
+    PROCTRACE("getImage");
 
     // the code will use OpenMP as of now.
 
@@ -0,0 +1,101 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "threadbudget.h"
+
+namespace rtengine
+{
+
+ThreadBudget* ThreadBudget::getInstance()
+{
+    static ThreadBudget instance;
+    return &instance;
+}
+
+ThreadBudget::ThreadBudget() :
+    size(0),
+    available(0)
+{
+    init(0);
+}
+
+void ThreadBudget::init(int threads)
+{
+#ifdef _OPENMP
+
+    if (threads <= 0) {
+        threads = omp_get_max_threads();
+    }
+
+#else
+    threads = 1;
+#endif
+
+    MyMutex::MyLock lock(mutex);
+    // the leases in progress give their threads back to the new budget
+    available += threads - size;
+    size = threads;
+}
+
+int ThreadBudget::acquire(int wanted)
+{
+    MyMutex::MyLock lock(mutex);
+
+    const int threads = std::max(1, std::min(wanted, available));
+    available -= threads;
+    return threads;
+}
+
+void ThreadBudget::release(int threads)
+{
+    MyMutex::MyLock lock(mutex);
+
+    available += threads;
+}
+
+ThreadBudget::Lease::Lease(int maxThreads) :
+    threads(ThreadBudget::getInstance()->acquire(maxThreads))
+{
+}
+
+ThreadBudget::Lease::~Lease()
+{
+    ThreadBudget::getInstance()->release(threads);
+}
+
+int ThreadBudget::Lease::getThreads() const
+{
+    return threads;
+}
+
+void ThreadBudget::Lease::split(int numTasks, int& outerThreads, int& nestedThreads, int maxOuterThreads) const
+{
+    if (maxOuterThreads > 0) {
+        numTasks = std::min(numTasks, maxOuterThreads);
+    }
+
+    outerThreads = std::max(1, std::min(numTasks, threads));
+    nestedThreads = std::max(1, threads / outerThreads);
+}
+
+}
@@ -0,0 +1,76 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "noncopyable.h"
+
+#include "../rtgui/threadutils.h"
+
+namespace rtengine
+{
+
+/**
+ * @brief Engine wide budget of the threads of the tiled stages
+ *
+ * Denoise and wavelets process their tiles with an outer OpenMP team whose threads start nested teams.
+ * Each batch of tiles leases its threads from this budget and splits them between both levels, so the
+ * images processed at the same time share the cores instead of each of them using all of them, and the
+ * threads given back by an image are used by the next batches of the others.
+ */
+class ThreadBudget :
+    public NonCopyable
+{
+public:
+    class Lease;
+
+    static ThreadBudget* getInstance();
+
+    /** @param threads size of the budget, 0 for the number of threads OpenMP uses by default */
+    void init(int threads);
+
+private:
+    ThreadBudget();
+
+    int acquire(int wanted);
+    void release(int threads);
+
+    int size;
+    int available;
+    MyMutex mutex;
+};
+
+class ThreadBudget::Lease :
+    public NonCopyable
+{
+public:
+    /** Leases up to maxThreads threads, at least one even when the budget is exhausted */
+    explicit Lease(int maxThreads);
+    ~Lease();
+
+    int getThreads() const;
+
+    /** Splits the leased threads to process numTasks tasks: up to one outer thread per task and at most
+      * maxOuterThreads of them (0 for no limit), the remaining threads spread over the nested teams
+      * started by the outer threads */
+    void split(int numTasks, int& outerThreads, int& nestedThreads, int maxOuterThreads = 0) const;
+
+private:
+    const int threads;
+};
+
+}
@@ -66,6 +66,8 @@
 #include <fftw3.h>
 
 #include "array2D.h"
+#include "cancellation.h"
+#include "fftwplans.h"
 #include "improcfun.h"
 #include "settings.h"
 #include "iccstore.h"
@@ -75,6 +77,7 @@
 #include "rt_algo.h"
 #include "rescale.h"
 #include "procparams.h"
+#include "proctrace.h"
 
 namespace rtengine
 {
@@ -84,7 +87,6 @@ namespace rtengine
  ******************************************************************************/
 
 extern const Settings *settings;
-extern MyMutex *fftwMutex;
 
 using namespace std;
 
@@ -421,7 +423,8 @@ void tmo_fattal02 (size_t width,
                    float beta,
                    float noise,
                    int detail_level,
-                   bool multithread)
+                   bool multithread,
+                   const CancellationToken* cancellation)
 {
 // #ifdef TIMER_PROFILING
 //     msec_timer stop_watch;
@@ -568,6 +571,14 @@ void tmo_fattal02 (size_t width,
         delete gradients[i];
     }
 
+    // RT - stop before the most expensive steps when the result isn't needed any more, L is then undefined
+    if (cancellation && cancellation->isCancelled()) {
+        delete FI;
+        delete H;
+        delete fullH;
+        return;
+    }
+
     /** - RT - bring back the FI image to the input size if it was downscaled */
     if (fullH) {
         delete H;
@@ -639,11 +650,15 @@ void tmo_fattal02 (size_t width,
 
     //delete Gx; // RT - reused as temp buffer in solve_pde_fft, deleted later
 
-    // solve pde and exponentiate (ie recover compressed image)
-    {
-        MyMutex::MyLock lock (*fftwMutex);
-        solve_pde_fft (FI, &L, Gx, multithread);
+    // RT
+    if (cancellation && cancellation->isCancelled()) {
+        delete Gx;
+        delete FI;
+        return;
     }
+
+    // solve pde and exponentiate (ie recover compressed image)
+    solve_pde_fft (FI, &L, Gx, multithread);
     delete Gx;
     delete FI;
 
@@ -721,6 +736,16 @@ void tmo_fattal02 (size_t width,
 // for both solvers.
 
 
+// number of threads used to execute the fft plans
+int fftThreads (bool multithread)
+{
+#ifdef _OPENMP
+    return multithread ? omp_get_max_threads() : 1;
+#else
+    return 1;
+#endif
+}
+
 // returns T = EVy A EVx^tr
 // note, modifies input data
 void transform_ev2normal (Array2Df *A, Array2Df *T, bool multithread)
@@ -760,11 +785,9 @@ void transform_ev2normal (Array2Df *A, Array2Df *T, bool multithread)
     // fftwf_free(in);
 
     // executes 2d discrete cosine transform
-    fftwf_plan p;
-    p = fftwf_plan_r2r_2d (height, width, A->data(), T->data(),
-                           FFTW_REDFT00, FFTW_REDFT00, FFTW_ESTIMATE);
-    fftwf_execute (p);
-    fftwf_destroy_plan (p);
+    // the plan is kept for the next images of the same size
+    const FFTWPlans::Plan p = FFTWPlans::getInstance()->getDCT2D (width, height, A->data(), T->data(), fftThreads (multithread));
+    fftwf_execute_r2r (p.get(), A->data(), T->data());
 }
 
 
@@ -776,11 +799,9 @@ void transform_normal2ev (Array2Df *A, Array2Df *T, bool multithread)
     assert ((int)T->getCols() == width && (int)T->getRows() == height);
 
     // executes 2d discrete cosine transform
-    fftwf_plan p;
-    p = fftwf_plan_r2r_2d (height, width, A->data(), T->data(),
-                           FFTW_REDFT00, FFTW_REDFT00, FFTW_ESTIMATE);
-    fftwf_execute (p);
-    fftwf_destroy_plan (p);
+    // the plan is kept for the next images of the same size
+    const FFTWPlans::Plan p = FFTWPlans::getInstance()->getDCT2D (width, height, A->data(), T->data(), fftThreads (multithread));
+    fftwf_execute_r2r (p.get(), A->data(), T->data());
 
     // need to scale the output matrix to get the right transform
     float factor = (1.0f / ((height - 1) * (width - 1)));
@@ -871,17 +892,7 @@ void solve_pde_fft (Array2Df *F, Array2Df *U, Array2Df *buf, bool multithread)/*
     assert ((int)U->getCols() == width && (int)U->getRows() == height);
     assert (buf->getCols() == width && buf->getRows() == height);
 
-    // activate parallel execution of fft routines
-#ifdef RT_FFTW3F_OMP
-
-    if (multithread) {
-        fftwf_init_threads();
-        fftwf_plan_with_nthreads ( omp_get_max_threads() );
-    }
-
-// #else
-//   fftwf_plan_with_nthreads( 2 );
-#endif
+    // parallel execution of the fft routines is set up by the plans, see fftThreads()
 
     // in general there might not be a solution to the Poisson pde
     // with Neumann boundary conditions unless the boundary satisfies
@@ -1049,10 +1060,40 @@ inline int find_fast_dim (int dim)
 
 void ImProcFunctions::ToneMapFattal02 (Imagefloat *rgb)
 {
-    if (!params->fattal.enabled) {
+    array2D<float> gain;
+
+    if (!ToneMapFattal02Gain (rgb, gain)) {
+        // rgb is left untouched
         return;
     }
+
+    const int w = rgb->getWidth();
+    const int h = rgb->getHeight();
+
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic,16) if(multiThread)
+#endif
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            rgb->r(y, x) *= gain[y][x];
+            rgb->g(y, x) *= gain[y][x];
+            rgb->b(y, x) *= gain[y][x];
+
+            assert(std::isfinite(rgb->r(y, x)));
+            assert(std::isfinite(rgb->g(y, x)));
+            assert(std::isfinite(rgb->b(y, x)));
+        }
+    }
+}
+
+
+bool ImProcFunctions::ToneMapFattal02Gain (const Imagefloat *rgb, array2D<float> &gain)
+{
+    if (!params->fattal.enabled) {
+        return false;
+    }
     
+    PROCTRACE("ToneMapFattal02");
     BENCHFUN
     const int detail_level = 3;
 
@@ -1068,13 +1109,14 @@ void ImProcFunctions::ToneMapFattal02 (Imagefloat *rgb)
 
     // sanity check
     if (alpha <= 0 || beta <= 0) {
-        return;
+        return false;
     }
 
     int w = rgb->getWidth();
     int h = rgb->getHeight();
 
     Array2Df Yr (w, h);
+    gain (w, h);
 
     constexpr float epsilon = 1e-4f;
     constexpr float luminance_noise_floor = 65.535f;
@@ -1129,7 +1171,11 @@ void ImProcFunctions::ToneMapFattal02 (Imagefloat *rgb)
     }
 
     rescale_nearest (Yr, L, multiThread);
-    tmo_fattal02 (w2, h2, L, L, alpha, beta, noise, detail_level, multiThread);
+    tmo_fattal02 (w2, h2, L, L, alpha, beta, noise, detail_level, multiThread, cancellation);
+
+    if (isCancelled()) {
+        return false;
+    }
 
     const float hr = float(h2) / float(h);
     const float wr = float(w2) / float(w);
@@ -1148,16 +1194,11 @@ void ImProcFunctions::ToneMapFattal02 (Imagefloat *rgb)
             int xx = x * wr + 1;
 
             float Y = std::max(Yr(x, y), epsilon);
-            float l = std::max(L(xx, yy), epsilon) * (scale / Y);
-            rgb->r(y, x) *= l;
-            rgb->g(y, x) *= l;
-            rgb->b(y, x) *= l;
-
-            assert(std::isfinite(rgb->r(y, x)));
-            assert(std::isfinite(rgb->g(y, x)));
-            assert(std::isfinite(rgb->b(y, x)));
+            gain[y][x] = std::max(L(xx, yy), epsilon) * (scale / Y);
         }
     }
+
+    return true;
 }
 
 
@@ -0,0 +1,107 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+
+#include "warpmap.h"
+
+namespace
+{
+
+// largest multiple of step not above value, also for negative values
+int floorToStep(int value, int step)
+{
+    return value >= 0 ? value / step * step : -((step - 1 - value) / step * step);
+}
+
+}
+
+namespace rtengine
+{
+
+constexpr int WarpMap::step;
+constexpr std::size_t WarpMapCache::maxEntries;
+
+WarpMap::WarpMap(int x, int y, int w, int h, int planes) :
+    x0(floorToStep(x, step)),
+    y0(floorToStep(y, step)),
+    // a node on both sides of the last pixel
+    gridW((x + w - 1 - x0) / step + 2),
+    gridH((y + h - 1 - y0) / step + 2),
+    data(planes, std::vector<float>(gridW * gridH))
+{
+}
+
+bool WarpMap::contains(int x, int y, int w, int h) const
+{
+    return x >= x0 && y >= y0 && x + w - 1 < x0 + (gridW - 1) * step && y + h - 1 < y0 + (gridH - 1) * step;
+}
+
+void WarpMap::getRow(int plane, int x, int y, int w, float* row) const
+{
+    const int j = (y - y0) / step;
+    const float fy = static_cast<float>(y - y0 - j * step) / step;
+    const float* const top = &data[plane][j * gridW];
+    const float* const bottom = top + gridW;
+
+    for (int k = 0; k < w;) {
+        // the pixels of the row between the nodes i and i + 1 are linear in x
+        const int i = (x + k - x0) / step;
+        const int end = std::min(w, x0 + (i + 1) * step - x);
+        const float left = top[i] + (bottom[i] - top[i]) * fy;
+        const float right = top[i + 1] + (bottom[i + 1] - top[i + 1]) * fy;
+        const float slope = (right - left) / step;
+        const int offset = x0 + i * step - x;
+
+        for (; k < end; ++k) {
+            row[k] = left + slope * (k - offset);
+        }
+    }
+}
+
+WarpMapCache* WarpMapCache::getInstance()
+{
+    static WarpMapCache instance;
+    return &instance;
+}
+
+std::shared_ptr<const WarpMap> WarpMapCache::get(const WarpMapKey& key, int x, int y, int w, int h)
+{
+    MyMutex::MyLock lock(mutex);
+
+    for (auto iter = entries.begin(); iter != entries.end(); ++iter) {
+        if (iter->first == key && iter->second->contains(x, y, w, h)) {
+            entries.splice(entries.begin(), entries, iter);
+            return entries.front().second;
+        }
+    }
+
+    return nullptr;
+}
+
+void WarpMapCache::put(const WarpMapKey& key, const std::shared_ptr<const WarpMap>& map)
+{
+    MyMutex::MyLock lock(mutex);
+
+    entries.emplace_front(key, map);
+
+    if (entries.size() > maxEntries) {
+        entries.pop_back();
+    }
+}
+
+}
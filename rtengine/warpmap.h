@@ -0,0 +1,124 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <list>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "noncopyable.h"
+
+#include "../rtgui/threadutils.h"
+
+namespace rtengine
+{
+
+/**
+ * @brief Identity of a geometric mapping: the lens correction and the parameters of the transform
+ */
+struct WarpMapKey {
+    std::string lens;           // lens, camera and lens correction
+    std::vector<double> values; // everything else the mapping depends on
+
+    bool operator ==(const WarpMapKey& other) const
+    {
+        return lens == other.lens && values == other.values;
+    }
+};
+
+/**
+ * @brief Mapping of the output pixels of a transform to their position in the source image
+ *
+ * The mapping (lens correction, perspective, rotation, distortion, CA) is smooth, so it is evaluated on a
+ * grid with a node every 'step' pixels only and bilinearly interpolated in between. The grid covers a
+ * rectangle of the output in absolute coordinates (including the crop offset), so a detail crop can reuse
+ * the map of the whole image or of a larger crop. Each node holds planes of values: the x and y source
+ * coordinates of each channel, and optionally a multiplier (the vignetting correction).
+ */
+class WarpMap :
+    public NonCopyable
+{
+public:
+    static constexpr int step = 8;
+
+    /** Creates a map covering the output pixels [x, x + w) x [y, y + h), with planes values per node */
+    WarpMap(int x, int y, int w, int h, int planes);
+
+    bool contains(int x, int y, int w, int h) const;
+
+    int getGridWidth() const
+    {
+        return gridW;
+    }
+    int getGridHeight() const
+    {
+        return gridH;
+    }
+    /** @return absolute output coordinates of the node (i, j) */
+    int getNodeX(int i) const
+    {
+        return x0 + i * step;
+    }
+    int getNodeY(int j) const
+    {
+        return y0 + j * step;
+    }
+    float* getNode(int plane, int i, int j)
+    {
+        return &data[plane][j * gridW + i];
+    }
+
+    /** Interpolates the values of plane for the output pixels [x, x + w) of row y (absolute coordinates) */
+    void getRow(int plane, int x, int y, int w, float* row) const;
+
+private:
+    int x0;
+    int y0;
+    int gridW;
+    int gridH;
+    std::vector<std::vector<float>> data;
+};
+
+/**
+ * @brief Cache of the last warp maps
+ *
+ * The export reuses the map of the previous image of the same lens and settings, the detail crops the
+ * map of the previous update while the transform parameters don't change.
+ */
+class WarpMapCache :
+    public NonCopyable
+{
+public:
+    static WarpMapCache* getInstance();
+
+    /** @return a map of key covering the output pixels [x, x + w) x [y, y + h), nullptr if there is none */
+    std::shared_ptr<const WarpMap> get(const WarpMapKey& key, int x, int y, int w, int h);
+    void put(const WarpMapKey& key, const std::shared_ptr<const WarpMap>& map);
+
+private:
+    static constexpr std::size_t maxEntries = 4;
+
+    WarpMapCache() = default;
+
+    std::list<std::pair<WarpMapKey, std::shared_ptr<const WarpMap>>> entries; // most recently used first
+    MyMutex mutex;
+};
+
+}
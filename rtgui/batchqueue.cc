@@ -40,7 +40,7 @@
 using namespace std;
 using namespace rtengine;
 
-BatchQueue::BatchQueue (FileCatalog* aFileCatalog) : processing(nullptr), fileCatalog(aFileCatalog), sequence(0), listener(nullptr)
+BatchQueue::BatchQueue (FileCatalog* aFileCatalog) : processing(nullptr), savingEntry(nullptr), fileCatalog(aFileCatalog), sequence(0), listener(nullptr)
 {
 
     location = THLOC_BATCHQUEUE;
@@ -100,6 +100,10 @@ BatchQueue::~BatchQueue ()
 
     idle_register.destroy();
 
+    discardPrefetchedImage ();
+    waitPendingSave ();
+    delete savingEntry;
+
     MYWRITERLOCK(l, entryRW);
 
     // The listener merges parameters with old values, so delete afterwards
@@ -416,8 +420,11 @@ void BatchQueue::cancelItems (const std::vector<ThumbBrowserEntryBase*>& items)
 
             const auto entry = static_cast<BatchQueueEntry*> (item);
 
-            if (entry->processing)
+            if (entry->processing) {
+                // the entry is removed by imageReady() once the processing has stopped
+                cancellation.cancel ();
                 continue;
+            }
 
             const auto pos = std::find (fd.begin (), fd.end (), entry);
 
@@ -585,6 +592,7 @@ void BatchQueue::startProcessing ()
             next->processing = true;
             next->sequence = sequence = 1;
             processing = next;
+            cancellation.reset ();
 
             // remove from selection
             if (processing->selected) {
@@ -602,8 +610,11 @@ void BatchQueue::startProcessing ()
             // remove button set
             next->removeButtonSet ();
 
+            usePrefetchedImage (next);
+            prefetchNext ();
+
             // start batch processing
-            rtengine::startBatchProcessing (next->job, this);
+            rtengine::startBatchProcessing (next->job, this, &cancellation);
             queue_draw ();
 
             notifyListener();
@@ -637,6 +648,9 @@ void BatchQueue::setProgressState(bool inProcessing)
 
 void BatchQueue::error(const Glib::ustring& descr)
 {
+    // the queue stops, so the previous image has to be on the disk, or back in the queue, before reporting it
+    const Glib::ustring saveError = finishPendingSave ();
+
     if (processing && processing->processing) {
         // restore failed thumb
         BatchQueueButtonSet* bqbs = new BatchQueueButtonSet (processing);
@@ -651,10 +665,12 @@ void BatchQueue::error(const Glib::ustring& descr)
     if (listener) {
         BatchQueueListener* const bql = listener;
 
+        const Glib::ustring message = saveError.empty() ? descr : saveError + "\n" + descr;
+
         idle_register.add(
-            [bql, descr]() -> bool
+            [bql, message]() -> bool
             {
-                bql->queueSizeChanged(0, false, true, descr);
+                bql->queueSizeChanged(0, false, true, message);
                 return false;
             }
         );
@@ -663,6 +679,12 @@ void BatchQueue::error(const Glib::ustring& descr)
 
 rtengine::ProcessingJob* BatchQueue::imageReady(rtengine::IImagefloat* img)
 {
+    // The previous image has been saved while this one was processed. Its file has to be
+    // on the disk before a unique name can be computed for the current one. If it couldn't
+    // be saved, the current image is still saved but the queue stops, as when the save of
+    // the current image fails.
+    Glib::ustring saveError = finishPendingSave ();
+
     // save image img
     Glib::ustring fname;
     SaveFormat saveFormat;
@@ -686,57 +708,36 @@ rtengine::ProcessingJob* BatchQueue::imageReady(rtengine::IImagefloat* img)
 
     //printf ("fname=%s, %s\n", fname.c_str(), removeExtension(fname).c_str());
 
-    if (img && fname != "") {
-        int err = 0;
-
-        if (saveFormat.format == "tif") {
-            err = img->saveAsTIFF (fname, saveFormat.tiffBits, saveFormat.tiffFloat, saveFormat.tiffUncompressed);
-        } else if (saveFormat.format == "png") {
-            err = img->saveAsPNG (fname, saveFormat.pngBits);
-        } else if (saveFormat.format == "jpg") {
-            err = img->saveAsJPEG (fname, saveFormat.jpegQuality, saveFormat.jpegSubSamp);
-        }
-
-        img->free ();
-
-        if (err) {
-            throw Glib::FileError(Glib::FileError::FAILED, M("MAIN_MSG_CANNOTSAVE") + "\n" + fname);
-        }
-
-        if (saveFormat.saveParams) {
-            // We keep the extension to avoid overwriting the profile when we have
-            // the same output filename with different extension
-            //processing->params.save (removeExtension(fname) + paramFileExtension);
-            processing->params->save (fname + ".out" + paramFileExtension);
-        }
+    // the entry is deleted below, the saving thread works on its own copies
+    rtengine::procparams::ProcParams params = *processing->params;
+    ::Thumbnail* const thumbnail = processing->thumbnail;
 
-        if (processing->thumbnail) {
-            processing->thumbnail->imageDeveloped ();
-            processing->thumbnail->imageRemovedFromQueue ();
-        }
+    if (thumbnail) {
+        thumbnail->increaseRef ();
     }
 
     // save temporary params file name: delete as last thing
     Glib::ustring processedParams = processing->savedParamsFile;
 
-    // delete from the queue
+    // remove from the queue, the entry is deleted once its image has been saved
     bool remove_button_set = false;
 
     {
         MYWRITERLOCK(l, entryRW);
 
-        delete processing;
+        savingEntry = processing;
         processing = nullptr;
 
         fd.erase (fd.begin());
 
         // return next job
-        if (!fd.empty() && listener && listener->canStartNext ()) {
+        if (!fd.empty() && saveError.empty() && listener && listener->canStartNext ()) {
             BatchQueueEntry* next = static_cast<BatchQueueEntry*>(fd[0]);
             // tag it as selected and set sequence
             next->processing = true;
             next->sequence = ++sequence;
             processing = next;
+            cancellation.reset ();
 
             // remove from selection
             if (processing->selected) {
@@ -760,9 +761,73 @@ rtengine::ProcessingJob* BatchQueue::imageReady(rtengine::IImagefloat* img)
         processing->removeButtonSet ();
     }
 
-    if (saveBatchQueue ()) {
-        ::g_remove (processedParams.c_str ());
+    if (processing) {
+        usePrefetchedImage (processing);
+        prefetchNext ();
+    } else {
+        discardPrefetchedImage ();
+    }
+
+    const bool queueSaved = saveBatchQueue ();
+
+    // encode and write the image in the background, while the next one is processed
+    pendingSave = std::async(std::launch::async, [img, fname, saveFormat, params, thumbnail, processedParams, queueSaved]() mutable -> Glib::ustring {
+        Glib::ustring error;
+
+        if (img && fname != "") {
+            int err = 0;
+
+            if (saveFormat.format == "tif") {
+                err = img->saveAsTIFF (fname, saveFormat.tiffBits, saveFormat.tiffFloat, saveFormat.tiffUncompressed);
+            } else if (saveFormat.format == "png") {
+                err = img->saveAsPNG (fname, saveFormat.pngBits);
+            } else if (saveFormat.format == "jpg") {
+                err = img->saveAsJPEG (fname, saveFormat.jpegQuality, saveFormat.jpegSubSamp);
+            }
+
+            img->free ();
+
+            if (err) {
+                error = M("MAIN_MSG_CANNOTSAVE") + "\n" + fname;
+            } else {
+                if (saveFormat.saveParams) {
+                    // We keep the extension to avoid overwriting the profile when we have
+                    // the same output filename with different extension
+                    //params.save (removeExtension(fname) + paramFileExtension);
+                    params.save (fname + ".out" + paramFileExtension);
+                }
+
+                if (thumbnail) {
+                    thumbnail->imageDeveloped ();
+                    thumbnail->imageRemovedFromQueue ();
+                }
+            }
+        } else if (!img && thumbnail) {
+            // the processing has been cancelled
+            thumbnail->imageRemovedFromQueue ();
+        }
+
+        if (thumbnail) {
+            thumbnail->decreaseRef ();
+        }
+
+        if (error.empty() && queueSaved) {
+            ::g_remove (processedParams.c_str ());
+        }
+
+        return error;
+    });
+
+    if (!processing) {
+        // the queue is empty or stopped, so the last image has to be on the disk before reporting it
+        const Glib::ustring lastSaveError = finishPendingSave ();
+
+        if (!lastSaveError.empty()) {
+            saveError += saveError.empty() ? lastSaveError : "\n" + lastSaveError;
+        }
+    }
 
+    if (queueSaved) {
         // Delete all files in directory batch when finished, just to be sure to remove zombies
         auto isEmpty = false;
 
@@ -789,11 +854,129 @@ rtengine::ProcessingJob* BatchQueue::imageReady(rtengine::IImagefloat* img)
     }
 
     redraw ();
-    notifyListener ();
+
+    if (saveError.empty()) {
+        notifyListener ();
+    } else if (listener) {
+        BatchQueueListener* const bql = listener;
+
+        int qsize = 0;
+        {
+            MYREADERLOCK(l, entryRW);
+            qsize = fd.size();
+        }
+
+        idle_register.add(
+            [bql, qsize, saveError]() -> bool
+            {
+                bql->queueSizeChanged(qsize, false, true, saveError);
+                return false;
+            }
+        );
+    }
 
     return processing ? processing->job : nullptr;
 }
 
+void BatchQueue::prefetchNext ()
+{
+    if (prefetchedImage.valid()) {
+        return;
+    }
+
+    Glib::ustring fileName;
+    bool isRaw;
+
+    {
+        MYREADERLOCK(l, entryRW);
+
+        // fd[0] is the entry being processed
+        if (fd.size() < 2 || !fd[1]->thumbnail) {
+            return;
+        }
+
+        fileName = fd[1]->filename;
+        isRaw = fd[1]->thumbnail->getType() == FT_Raw;
+    }
+
+    prefetchedFileName = fileName;
+    prefetchedImage = std::async(std::launch::async, [fileName, isRaw]() -> rtengine::InitialImage* {
+        int errorCode = 0;
+        return rtengine::InitialImage::load (fileName, isRaw, &errorCode);
+    });
+}
+
+void BatchQueue::usePrefetchedImage (BatchQueueEntry* entry)
+{
+    if (!prefetchedImage.valid()) {
+        return;
+    }
+
+    rtengine::InitialImage* const ii = prefetchedImage.get();
+
+    if (ii) {
+        // the queue may have been reordered or the entry cancelled in the meantime
+        if (prefetchedFileName == entry->filename) {
+            const bool fast = entry->job->fastPipeline();
+            rtengine::ProcessingJob::destroy (entry->job);
+            entry->job = rtengine::ProcessingJob::create (ii, *entry->params, fast);
+        }
+
+        // the job holds its own reference
+        ii->decreaseRef ();
+    }
+}
+
+void BatchQueue::discardPrefetchedImage ()
+{
+    if (prefetchedImage.valid()) {
+        rtengine::InitialImage* const ii = prefetchedImage.get();
+
+        if (ii) {
+            ii->decreaseRef ();
+        }
+    }
+}
+
+Glib::ustring BatchQueue::waitPendingSave ()
+{
+    return pendingSave.valid() ? pendingSave.get() : Glib::ustring();
+}
+
+Glib::ustring BatchQueue::finishPendingSave ()
+{
+    if (!pendingSave.valid()) {
+        return Glib::ustring();
+    }
+
+    const Glib::ustring saveError = waitPendingSave ();
+    BatchQueueEntry* const entry = savingEntry;
+    savingEntry = nullptr;
+
+    if (saveError.empty()) {
+        delete entry;
+        return saveError;
+    }
+
+    // put the entry which couldn't be saved back into the queue, after the processed one, the caller stops the queue
+    entry->processing = false;
+    entry->job = rtengine::ProcessingJob::create(entry->filename, entry->thumbnail && entry->thumbnail->getType() == FT_Raw, *entry->params);
+
+    BatchQueueButtonSet* bqbs = new BatchQueueButtonSet (entry);
+    bqbs->setButtonListener (this);
+    entry->addButtonSet (bqbs);
+
+    {
+        MYWRITERLOCK(l, entryRW);
+
+        fd.insert (std::find_if (fd.begin (), fd.end (), [] (const ThumbBrowserEntryBase* fdEntry) { return !fdEntry->processing; }), entry);
+    }
+
+    saveBatchQueue ();
+
+    return saveError;
+}
+
 // Calculates automatic filename of processed batch entry, but just the base name
 // example output: "c:\out\converted\dsc0121"
 Glib::ustring BatchQueue::calcAutoFileNameBase (const Glib::ustring& origFileName, int sequence)
@@ -18,10 +18,12 @@
 #ifndef _BATCHQUEUE_
 #define _BATCHQUEUE_
 
+#include <future>
 #include <set>
 
 #include <gtkmm.h>
 
+#include "../rtengine/cancellation.h"
 #include "../rtengine/rtengine.h"
 
 #include "batchqueueentry.h"
@@ -98,10 +100,23 @@ private:
     Glib::ustring getTempFilenameForParams( const Glib::ustring &filename );
     bool saveBatchQueue ();
     void notifyListener ();
+    void prefetchNext ();
+    void usePrefetchedImage (BatchQueueEntry* entry);
+    void discardPrefetchedImage ();
+    Glib::ustring waitPendingSave ();
+    Glib::ustring finishPendingSave (); // deletes the saved entry, or puts it back into the queue and returns the error
 
     using ThumbBrowserBase::redrawNeeded;
 
     BatchQueueEntry* processing;  // holds the currently processed image
+    rtengine::CancellationToken cancellation; // set to drop the processed image when it is removed from the queue
+
+    // The image following the processed one is decoded in advance, and the previous result is saved
+    // while the current one is processed, so loading and encoding overlap with the (multithreaded) processing
+    std::future<rtengine::InitialImage*> prefetchedImage;
+    Glib::ustring prefetchedFileName;
+    std::future<Glib::ustring> pendingSave; // returns the error message, if any
+    BatchQueueEntry* savingEntry; // the entry of the image being saved, out of the queue
     FileCatalog* fileCatalog;
     int sequence; // holds the current sequence index
 
@@ -34,16 +34,16 @@ CacheImageData::CacheImageData ()
 }
 
 /*
- * Load the General, DateTime, ExifInfo, File info and ExtraRawInfo sections of the image data file
+ * Load the General, DateTime, ExifInfo, File info and ExtraRawInfo sections of the image data
  */
-int CacheImageData::load (const Glib::ustring& fname)
+int CacheImageData::load (const std::string& keyData)
 {
     setlocale(LC_NUMERIC, "C"); // to set decimal point to "."
 
     Glib::KeyFile keyFile;
 
     try {
-        if (keyFile.load_from_file (fname)) {
+        if (keyFile.load_from_data (keyData)) {
 
             if (keyFile.has_group ("General")) {
                 if (keyFile.has_key ("General", "MD5")) {
@@ -195,11 +195,11 @@ int CacheImageData::load (const Glib::ustring& fname)
         }
     } catch (Glib::Error &err) {
         if (options.rtSettings.verbose) {
-            printf("CacheImageData::load / Error code %d while reading values from \"%s\":\n%s\n", err.code(), fname.c_str(), err.what().c_str());
+            printf("CacheImageData::load / Error code %d while reading values:\n%s\n", err.code(), err.what().c_str());
         }
     } catch (...) {
         if (options.rtSettings.verbose) {
-            printf("CacheImageData::load / Unknown exception while trying to load \"%s\"!\n", fname.c_str());
+            printf("CacheImageData::load / Unknown exception while trying to load the values!\n");
         }
     }
 
@@ -207,36 +207,23 @@ int CacheImageData::load (const Glib::ustring& fname)
 }
 
 /*
- * Save the General, DateTime, ExifInfo, File info and ExtraRawInfo sections of the image data file
+ * Save the General, DateTime, ExifInfo, File info and ExtraRawInfo sections of the image data
  */
-int CacheImageData::save (const Glib::ustring& fname)
+int CacheImageData::save (std::string& keyData)
 {
 
-    Glib::ustring keyData;
+    keyData.clear ();
 
     try {
 
     Glib::KeyFile keyFile;
 
-    try {
-        keyFile.load_from_file (fname);
-    } catch (Glib::Error&) {}
-
     keyFile.set_string  ("General", "MD5", md5);
     keyFile.set_string  ("General", "Version", RTVERSION);
     keyFile.set_boolean ("General", "Supported", supported);
     keyFile.set_integer ("General", "Format", format);
     keyFile.set_boolean ("General", "RecentlySaved", recentlySaved);
 
-    // remove the old implementation of Rank and InTrash from cache
-    if (keyFile.has_key ("General", "Rank")) {
-        keyFile.remove_key("General", "Rank");
-    }
-
-    if (keyFile.has_key ("General", "InTrash")) {
-        keyFile.remove_key("General", "InTrash");
-    }
-
     if (timeValid) {
         keyFile.set_integer ("DateTime", "Year", year);
         keyFile.set_integer ("DateTime", "Month", month);
@@ -272,35 +259,19 @@ int CacheImageData::save (const Glib::ustring& fname)
         keyFile.set_integer ("ExtraRawInfo", "SensorType", sensortype);
     }
 
-    keyData = keyFile.to_data ();
+    keyData = keyFile.to_data ().raw ();
 
     } catch (Glib::Error &err) {
         if (options.rtSettings.verbose) {
-            printf("CacheImageData::save / Error code %d while reading values from \"%s\":\n%s\n", err.code(), fname.c_str(), err.what().c_str());
+            printf("CacheImageData::save / Error code %d while writing values:\n%s\n", err.code(), err.what().c_str());
         }
     } catch (...) {
         if (options.rtSettings.verbose) {
-            printf("CacheImageData::save / Unknown exception while trying to save \"%s\"!\n", fname.c_str());
+            printf("CacheImageData::save / Unknown exception while trying to save the values!\n");
         }
     }
 
-    if (keyData.empty ()) {
-        return 1;
-    }
-
-    FILE *f = g_fopen (fname.c_str (), "wt");
-
-    if (!f) {
-        if (options.rtSettings.verbose) {
-            printf("CacheImageData::save / Error: unable to open file \"%s\" with write access!\n", fname.c_str());
-        }
-
-        return 1;
-    } else {
-        fprintf (f, "%s", keyData.c_str ());
-        fclose (f);
-        return 0;
-    }
+    return keyData.empty () ? 1 : 0;
 }
 
 rtengine::procparams::IPTCPairs CacheImageData::getIPTCData(unsigned int frame) const
@@ -80,8 +80,8 @@ public:
 
     CacheImageData ();
 
-    int load (const Glib::ustring& fname);
-    int save (const Glib::ustring& fname);
+    int load (const std::string& keyData);
+    int save (std::string& keyData);
 
     //-------------------------------------------------------------------------
     // FramesMetaData interface
@@ -37,7 +37,10 @@ namespace
 {
 
 constexpr int cacheDirMode = 0777;
-constexpr const char* cacheDirs[] = { "profiles", "images", "aehistograms", "embprofiles", "data" };
+constexpr const char* cacheDirs[] = { "profiles" };
+// the thumbnails' data was stored in separate files before the thumbnail pack
+constexpr const char* legacyCacheDirs[] = { "images", "aehistograms", "embprofiles", "data" };
+constexpr const char* thumbnailPackName = "thumbnails.pack";
 
 }
 
@@ -57,14 +60,25 @@ void CacheManager::init ()
     auto error = g_mkdir_with_parents (baseDir.c_str(), cacheDirMode);
 
     for (const auto& cacheDir : cacheDirs) {
-        if (strncmp(cacheDir, "aehistograms", 12)) {  // don't create aehistograms folder.
-            error |= g_mkdir_with_parents (Glib::build_filename (baseDir, cacheDir).c_str(), cacheDirMode);
-        }
+        error |= g_mkdir_with_parents (Glib::build_filename (baseDir, cacheDir).c_str(), cacheDirMode);
     }
 
     if (error != 0 && options.rtSettings.verbose) {
         std::cerr << "Failed to create all cache directories: " << g_strerror(errno) << std::endl;
     }
+
+    const auto packName = Glib::build_filename (baseDir, thumbnailPackName);
+
+    if (!Glib::file_test (packName, Glib::FILE_TEST_EXISTS)) {
+        for (const auto& legacyDir : legacyCacheDirs) {
+            deleteDir (legacyDir);
+            g_rmdir (Glib::build_filename (baseDir, legacyDir).c_str ());
+        }
+    }
+
+    if (!thumbnailPack.open (packName) && options.rtSettings.verbose) {
+        std::cerr << "Failed to open the thumbnail cache '" << packName << "'" << std::endl;
+    }
 }
 
 Thumbnail* CacheManager::getEntry (const Glib::ustring& fname)
@@ -95,13 +109,12 @@ Thumbnail* CacheManager::getEntry (const Glib::ustring& fname)
         return nullptr;
     }
 
-    const auto cacheName = getCacheFileName ("data", fname, ".txt", md5);
-
     // let's see if we have it in the cache
     {
         CacheImageData imageData;
 
-        const auto error = imageData.load (cacheName);
+        const auto keyData = readCacheData (fname, md5, CachePack::Section::IMAGE_DATA);
+        const auto error = keyData ? imageData.load (std::string (keyData.getData (), keyData.getSize ())) : 1;
         if (error == 0 && imageData.supported) {
 
             thumbnail.reset (new Thumbnail (this, fname, &imageData));
@@ -183,14 +196,12 @@ void CacheManager::renameEntry (const std::string& oldfilename, const std::strin
 
     const auto newmd5 = getMD5 (newfilename);
 
-    auto error = g_rename (getCacheFileName ("profiles", oldfilename, paramFileExtension, oldmd5).c_str (), getCacheFileName ("profiles", newfilename, paramFileExtension, newmd5).c_str ());
-    error |= g_rename (getCacheFileName ("images", oldfilename, ".rtti", oldmd5).c_str (), getCacheFileName ("images", newfilename, ".rtti", newmd5).c_str ());
-    error |= g_rename (getCacheFileName ("aehistograms", oldfilename, "", oldmd5).c_str (), getCacheFileName ("aehistograms", newfilename, "", newmd5).c_str ());
-    error |= g_rename (getCacheFileName ("embprofiles", oldfilename, ".icc", oldmd5).c_str (), getCacheFileName ("embprofiles", newfilename, ".icc", newmd5).c_str ());
-    error |= g_rename (getCacheFileName ("data", oldfilename, ".txt", oldmd5).c_str (), getCacheFileName ("data", newfilename, ".txt", newmd5).c_str ());
+    thumbnailPack.rename (getPackKey (oldfilename, oldmd5), getPackKey (newfilename, newmd5));
+
+    const auto error = g_rename (getCacheFileName ("profiles", oldfilename, paramFileExtension, oldmd5).c_str (), getCacheFileName ("profiles", newfilename, paramFileExtension, newmd5).c_str ());
 
     if (error != 0 && options.rtSettings.verbose) {
-        std::cerr << "Failed to rename all files for cache entry '" << oldfilename << "': " << g_strerror(errno) << std::endl;
+        std::cerr << "Failed to rename the profile of cache entry '" << oldfilename << "': " << g_strerror(errno) << std::endl;
     }
 
     // check if it is opened
@@ -222,6 +233,7 @@ void CacheManager::closeCache () const
     MyMutex::MyLock lock (mutex);
 
     applyCacheSizeLimitation ();
+    thumbnailPack.compact ();
 }
 
 void CacheManager::clearAll () const
@@ -231,16 +243,15 @@ void CacheManager::clearAll () const
     for (const auto& cacheDir : cacheDirs) {
         deleteDir (cacheDir);
     }
+
+    thumbnailPack.clear ();
 }
 
 void CacheManager::clearImages () const
 {
     MyMutex::MyLock lock (mutex);
 
-    deleteDir ("data");
-    deleteDir ("images");
-    deleteDir ("aehistograms");
-    deleteDir ("embprofiles");
+    thumbnailPack.clear ();
 }
 
 void CacheManager::clearProfiles () const
@@ -274,20 +285,18 @@ void CacheManager::deleteFiles (const Glib::ustring& fname, const std::string& m
         return;
     }
 
-    auto error = g_remove (getCacheFileName ("images", fname, ".rtti", md5).c_str ());
-    error |= g_remove (getCacheFileName ("aehistograms", fname, "", md5).c_str ());
-    error |= g_remove (getCacheFileName ("embprofiles", fname, ".icc", md5).c_str ());
+    const auto key = getPackKey (fname, md5);
 
     if (purgeData) {
-        error |= g_remove (getCacheFileName ("data", fname, ".txt", md5).c_str ());
-    }
-
-    if (purgeProfile) {
-        error |= g_remove (getCacheFileName ("profiles", fname, paramFileExtension, md5).c_str ());
+        thumbnailPack.remove (key);
+    } else {
+        thumbnailPack.remove (key, CachePack::Section::THUMBNAIL_IMAGE);
+        thumbnailPack.remove (key, CachePack::Section::AE_HISTOGRAM);
+        thumbnailPack.remove (key, CachePack::Section::EMBEDDED_PROFILE);
     }
 
-    if (error != 0 && options.rtSettings.verbose) {
-        std::cerr << "Failed to delete all files for cache entry '" << fname << "': " << g_strerror(errno) << std::endl;
+    if (purgeProfile && g_remove (getCacheFileName ("profiles", fname, paramFileExtension, md5).c_str ()) != 0 && options.rtSettings.verbose) {
+        std::cerr << "Failed to delete the profile of cache entry '" << fname << "': " << g_strerror(errno) << std::endl;
     }
 }
 
@@ -327,6 +336,21 @@ std::string CacheManager::getMD5 (const Glib::ustring& fname)
     return {};
 }
 
+CachePack::Blob CacheManager::readCacheData (const Glib::ustring& fname, const Glib::ustring& md5, CachePack::Section section) const
+{
+    return thumbnailPack.get (getPackKey (fname, md5), section);
+}
+
+bool CacheManager::writeCacheData (const Glib::ustring& fname, const Glib::ustring& md5, CachePack::Section section, const std::string& data) const
+{
+    return thumbnailPack.put (getPackKey (fname, md5), section, data);
+}
+
+std::string CacheManager::getPackKey (const Glib::ustring& fname, const Glib::ustring& md5)
+{
+    return Glib::path_get_basename (fname) + '.' + md5.raw ();
+}
+
 Glib::ustring CacheManager::getCacheFileName (const Glib::ustring& subDir,
                                               const Glib::ustring& fname,
                                               const Glib::ustring& fext,
@@ -339,67 +363,16 @@ Glib::ustring CacheManager::getCacheFileName (const Glib::ustring& subDir,
 
 void CacheManager::applyCacheSizeLimitation () const
 {
-    // first count files without fetching file name and timestamp.
-    std::size_t numFiles = 0;
-    try {
-
-        const auto dirName = Glib::build_filename (baseDir, "data");
-        const auto dir = Gio::File::create_for_path (dirName);
-
-        auto enumerator = dir->enumerate_children ("");
-
-        while (numFiles <= options.maxCacheEntries && enumerator->next_file ()) {
-            ++numFiles;
-        }
-
-    } catch (Glib::Exception&) {}
-
-    if (numFiles <= options.maxCacheEntries) {
-        return;
-    }
-
-    using FNameMTime = std::pair<Glib::ustring, Glib::TimeVal>;
-    std::vector<FNameMTime> files;
-
-    try {
-
-        const auto dirName = Glib::build_filename (baseDir, "data");
-        const auto dir = Gio::File::create_for_path (dirName);
-
-        auto enumerator = dir->enumerate_children ("standard::name,time::modified");
-
-        while (auto file = enumerator->next_file ()) {
-            files.emplace_back (file->get_name (), file->modification_time ());
-        }
-
-    } catch (Glib::Exception&) {}
-
-    if (files.size () <= options.maxCacheEntries) {
+    if (thumbnailPack.getEntryCount () <= options.maxCacheEntries) {
         return;
     }
 
-    std::sort (files.begin (), files.end (), [] (const FNameMTime& lhs, const FNameMTime& rhs)
-    {
-        return lhs.second < rhs.second;
-    });
-
-    auto cacheEntries = files.size ();
+    // least recently written first
+    const auto keys = thumbnailPack.getKeys ();
 
-    for (auto entry = files.begin (); cacheEntries-- > options.maxCacheEntries; ++entry) {
+    auto cacheEntries = keys.size ();
 
-        const auto& name = entry->first;
-
-        constexpr auto md5_size = 32;
-        const auto name_size = name.size();
-
-        if (name_size < md5_size + 5) {
-            continue;
-        }
-
-        const auto fname = name.substr (0, name_size - md5_size - 5);
-        const auto md5 = name.substr (name_size - md5_size - 4, md5_size);
-
-        deleteFiles (fname, md5, true, false);
+    for (auto entry = keys.begin (); cacheEntries-- > options.maxCacheEntries; ++entry) {
+        thumbnailPack.remove (*entry);
     }
 }
-
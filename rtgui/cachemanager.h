@@ -26,6 +26,7 @@
 
 #include "../rtengine/noncopyable.h"
 
+#include "cachepack.h"
 #include "threadutils.h"
 
 class Thumbnail;
@@ -37,6 +38,7 @@ private:
     using Entries = std::map<std::string, Thumbnail*>;
     Entries openEntries;
     Glib::ustring    baseDir;
+    mutable CachePack thumbnailPack;
     mutable MyMutex  mutex;
 
     void deleteDir   (const Glib::ustring& dirName) const;
@@ -44,6 +46,8 @@ private:
 
     void applyCacheSizeLimitation () const;
 
+    static std::string getPackKey (const Glib::ustring& fname, const Glib::ustring& md5);
+
 public:
     static CacheManager* getInstance ();
 
@@ -63,6 +67,10 @@ public:
 
     static std::string getMD5 (const Glib::ustring& fname);
 
+    // the thumbnails' data, stored in the thumbnail pack of the cache directory
+    CachePack::Blob readCacheData (const Glib::ustring& fname, const Glib::ustring& md5, CachePack::Section section) const;
+    bool writeCacheData (const Glib::ustring& fname, const Glib::ustring& md5, CachePack::Section section, const std::string& data) const;
+
     Glib::ustring    getCacheFileName (const Glib::ustring& subDir,
                                        const Glib::ustring& fname,
                                        const Glib::ustring& fext,
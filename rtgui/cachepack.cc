@@ -0,0 +1,770 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include <glib/gstdio.h>
+#include <zlib.h>
+
+#ifdef WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+#include "cachepack.h"
+
+#include "../rtengine/filelock.h"
+
+namespace
+{
+
+// The pack starts with the magic, the version and the generation, followed by the records. Each record is made of a
+// RecordHeader, the key and the payload, the key and the payload starting on 16 bytes boundaries.
+constexpr char packMagic[8] = {'R', 'T', 'T', 'H', 'P', 'A', 'C', 'K'};
+constexpr std::uint32_t packVersion = 2;
+constexpr std::uint64_t packHeaderSize = 16;
+
+constexpr std::uint32_t recordMagic = 0x52435452; // "RTCR"
+constexpr std::uint32_t allSections = 0xffffffff;
+constexpr std::uint32_t deletedFlag = 1;
+constexpr std::uint32_t maxKeySize = 4096;
+constexpr std::uint64_t alignment = 16;
+
+// dead records are only compacted away once they take that much room
+constexpr std::uint64_t minCompactionSize = 16 * 1024 * 1024;
+
+struct RecordHeader {
+    std::uint32_t magic;
+    std::uint32_t section;
+    std::uint32_t flags;
+    std::uint32_t keySize;
+    std::uint64_t payloadSize;
+    std::int64_t time;
+    std::uint32_t reserved;
+    std::uint32_t crc;      // of the fields above, of the key and of the payload
+};
+
+static_assert(sizeof(RecordHeader) == 40, "unexpected padding in RecordHeader");
+
+std::uint64_t align(std::uint64_t size)
+{
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+std::uint64_t getPayloadOffset(std::uint64_t keySize)
+{
+    return align(sizeof(RecordHeader) + keySize);
+}
+
+std::uint64_t getRecordSize(std::uint64_t keySize, std::uint64_t payloadSize)
+{
+    return align(getPayloadOffset(keySize) + payloadSize);
+}
+
+std::uint32_t getRecordCrc(const RecordHeader& header, const char* key, const char* data)
+{
+    uLong crc = crc32(0L, Z_NULL, 0);
+    crc = crc32(crc, reinterpret_cast<const Bytef*>(&header), offsetof(RecordHeader, crc));
+    crc = crc32(crc, reinterpret_cast<const Bytef*>(key), header.keySize);
+
+    // crc32() takes the length as an uInt
+    for (std::uint64_t done = 0; done < header.payloadSize;) {
+        const uInt length = std::min<std::uint64_t>(header.payloadSize - done, 1 << 30);
+        crc = crc32(crc, reinterpret_cast<const Bytef*>(data + done), length);
+        done += length;
+    }
+
+    return crc;
+}
+
+std::int64_t getTime()
+{
+    return g_get_real_time() / G_USEC_PER_SEC;
+}
+
+bool writeBytes(FILE* f, const void* data, std::size_t size)
+{
+    return !size || fwrite(data, 1, size, f) == size;
+}
+
+// The generation is drawn anew each time the pack is created or replaced, so that the instances
+// which indexed a former pack notice it
+bool writePackHeader(FILE* f, std::uint32_t generation)
+{
+    char header[packHeaderSize] = {};
+    memcpy(header, packMagic, sizeof(packMagic));
+    memcpy(header + sizeof(packMagic), &packVersion, sizeof(packVersion));
+    memcpy(header + sizeof(packMagic) + sizeof(packVersion), &generation, sizeof(generation));
+    return writeBytes(f, header, sizeof(header));
+}
+
+bool readPackHeader(const GMappedFile* mapping, std::uint32_t& generation)
+{
+    const char* const contents = g_mapped_file_get_contents(const_cast<GMappedFile*>(mapping));
+    std::uint32_t version = 0;
+
+    if (g_mapped_file_get_length(const_cast<GMappedFile*>(mapping)) < packHeaderSize || memcmp(contents, packMagic, sizeof(packMagic))) {
+        return false;
+    }
+
+    memcpy(&version, contents + sizeof(packMagic), sizeof(version));
+    memcpy(&generation, contents + sizeof(packMagic) + sizeof(version), sizeof(generation));
+
+    return version == packVersion;
+}
+
+bool writeRecord(FILE* f, const std::string& key, std::uint32_t section, std::uint32_t flags, std::int64_t time, const char* data, std::uint64_t size)
+{
+    static const char padding[alignment] = {};
+
+    RecordHeader header = {recordMagic, section, flags, static_cast<std::uint32_t>(key.size()), size, time, 0, 0};
+    header.crc = getRecordCrc(header, key.data(), data);
+
+    const std::uint64_t payloadOffset = getPayloadOffset(key.size());
+
+    return writeBytes(f, &header, sizeof(header))
+           && writeBytes(f, key.data(), key.size())
+           && writeBytes(f, padding, payloadOffset - sizeof(header) - key.size())
+           && writeBytes(f, data, size)
+           && writeBytes(f, padding, getRecordSize(key.size(), size) - payloadOffset - size);
+}
+
+bool truncateFile(FILE* f, std::uint64_t size)
+{
+    if (fflush(f)) {
+        return false;
+    }
+
+#ifdef WIN32
+    return !_chsize_s(_fileno(f), size);
+#else
+    return !ftruncate(fileno(f), size);
+#endif
+}
+
+bool getFileEnd(FILE* f, std::uint64_t& end)
+{
+#ifdef WIN32
+    const bool found = !_fseeki64(f, 0, SEEK_END);
+    const __int64 position = _ftelli64(f);
+#else
+    const bool found = !fseeko(f, 0, SEEK_END);
+    const off_t position = ftello(f);
+#endif
+
+    if (!found || position < 0) {
+        return false;
+    }
+
+    end = position;
+    return true;
+}
+
+#ifdef WIN32
+HANDLE getHandle(FILE* f)
+{
+    return reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(f)));
+}
+
+// Windows locks are mandatory, so the users lock covers a byte far beyond the end of any pack
+OVERLAPPED getUsersLockRange()
+{
+    OVERLAPPED overlapped = {};
+    overlapped.OffsetHigh = MAXDWORD;
+    return overlapped;
+}
+#endif
+
+// Every instance holds a shared lock on the pack it has open
+void lockUser(FILE* f)
+{
+#ifdef WIN32
+    OVERLAPPED overlapped = getUsersLockRange();
+    LockFileEx(getHandle(f), 0, 0, 1, 0, &overlapped);
+#else
+    flock(fileno(f), LOCK_SH);
+#endif
+}
+
+// Whether no other instance has the pack open. The lock of the pack has to be held, as the shared
+// lock of the caller is briefly released.
+bool isOnlyUser(FILE* f)
+{
+#ifdef WIN32
+    OVERLAPPED overlapped = getUsersLockRange();
+    UnlockFileEx(getHandle(f), 0, 1, 0, &overlapped);
+    const bool alone = LockFileEx(getHandle(f), LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY, 0, 1, 0, &overlapped);
+
+    if (alone) {
+        UnlockFileEx(getHandle(f), 0, 1, 0, &overlapped);
+    }
+#else
+    const bool alone = !flock(fileno(f), LOCK_EX | LOCK_NB);
+#endif
+
+    lockUser(f);
+    return alone;
+}
+
+}
+
+CachePack::Blob::Blob() :
+    data(nullptr),
+    size(0)
+{
+}
+
+CachePack::Blob::Blob(const std::shared_ptr<GMappedFile>& mapping, const char* data, std::size_t size) :
+    mapping(mapping),
+    data(data),
+    size(size)
+{
+}
+
+const char* CachePack::Blob::getData() const
+{
+    return data;
+}
+
+std::size_t CachePack::Blob::getSize() const
+{
+    return size;
+}
+
+CachePack::Blob::operator bool() const
+{
+    return data != nullptr;
+}
+
+CachePack::CachePack() :
+    file(nullptr),
+    lockFile(nullptr),
+    generation(0),
+    fileSize(0),
+    liveSize(0)
+{
+}
+
+CachePack::~CachePack()
+{
+    close();
+}
+
+bool CachePack::open(const Glib::ustring& fname)
+{
+    MyMutex::MyLock lock(mutex);
+
+    release();
+
+    if (lockFile) {
+        fclose(lockFile);
+    }
+
+    fileName = fname;
+    // the pack itself is replaced when it is rewritten, its lock lives in a file of its own
+    lockFile = g_fopen((fname + ".lock").c_str(), "ab");
+
+    const rtengine::FileLock packLock(lockFile);
+    return load();
+}
+
+void CachePack::close()
+{
+    MyMutex::MyLock lock(mutex);
+
+    release();
+    index.clear();
+    fileSize = 0;
+    liveSize = 0;
+
+    if (lockFile) {
+        fclose(lockFile);
+        lockFile = nullptr;
+    }
+}
+
+CachePack::Blob CachePack::get(const std::string& key, Section section) const
+{
+    MyMutex::MyLock lock(mutex);
+
+    const auto entry = index.find(key);
+
+    if (entry == index.end()) {
+        return {};
+    }
+
+    const Location& location = entry->second.sections[static_cast<std::size_t>(section)];
+
+    if (!location.offset) {
+        return {};
+    }
+
+    // the section may have been appended after the pack was mapped
+    if (!mapping || location.offset + location.size > g_mapped_file_get_length(mapping.get())) {
+        if (!remap() || location.offset + location.size > g_mapped_file_get_length(mapping.get())) {
+            return {};
+        }
+    }
+
+    // The mapping is made from the file name. If the pack has been replaced, the index doesn't describe it,
+    // the next write reloads it.
+    std::uint32_t mappedGeneration;
+
+    if (!readPackHeader(mapping.get(), mappedGeneration) || mappedGeneration != generation) {
+        return {};
+    }
+
+    const char* const contents = g_mapped_file_get_contents(mapping.get());
+
+    if (!location.verified) {
+        const std::uint64_t recordOffset = location.offset - getPayloadOffset(key.size());
+        RecordHeader header;
+        memcpy(&header, contents + recordOffset, sizeof(header));
+
+        if (
+            header.magic != recordMagic
+            || header.keySize != key.size()
+            || header.payloadSize != location.size
+            || memcmp(contents + recordOffset + sizeof(header), key.data(), key.size())
+            || header.crc != getRecordCrc(header, key.data(), contents + location.offset)
+        ) {
+            return {};
+        }
+
+        location.verified = true;
+    }
+
+    return Blob(mapping, contents + location.offset, location.size);
+}
+
+bool CachePack::put(const std::string& key, Section section, const char* data, std::size_t size)
+{
+    if (!size) {
+        remove(key, section);
+        return true;
+    }
+
+    MyMutex::MyLock lock(mutex);
+    const rtengine::FileLock packLock(lockFile);
+
+    return sync() && append(key, static_cast<std::uint32_t>(section), 0, data, size);
+}
+
+bool CachePack::put(const std::string& key, Section section, const std::string& data)
+{
+    return put(key, section, data.data(), data.size());
+}
+
+void CachePack::remove(const std::string& key, Section section)
+{
+    MyMutex::MyLock lock(mutex);
+    const rtengine::FileLock packLock(lockFile);
+
+    if (!sync()) {
+        return;
+    }
+
+    const auto entry = index.find(key);
+
+    if (entry != index.end() && entry->second.sections[static_cast<std::size_t>(section)].offset) {
+        append(key, static_cast<std::uint32_t>(section), deletedFlag, nullptr, 0);
+    }
+}
+
+void CachePack::remove(const std::string& key)
+{
+    MyMutex::MyLock lock(mutex);
+    const rtengine::FileLock packLock(lockFile);
+
+    if (sync() && index.count(key)) {
+        append(key, allSections, deletedFlag, nullptr, 0);
+    }
+}
+
+void CachePack::rename(const std::string& oldKey, const std::string& newKey)
+{
+    MyMutex::MyLock lock(mutex);
+    const rtengine::FileLock packLock(lockFile);
+
+    if (!sync() || !remap()) {
+        return;
+    }
+
+    const auto entry = index.find(oldKey);
+
+    if (entry == index.end() || oldKey == newKey) {
+        return;
+    }
+
+    // copies, as the appends below update the index and may remap the pack
+    const Entry oldEntry = entry->second;
+    const auto oldMapping = mapping;
+    const char* const contents = g_mapped_file_get_contents(oldMapping.get());
+
+    for (std::uint32_t i = 0; i < sectionCount; ++i) {
+        const Location& location = oldEntry.sections[i];
+
+        if (location.offset) {
+            append(newKey, i, 0, contents + location.offset, location.size);
+        }
+    }
+
+    append(oldKey, allSections, deletedFlag, nullptr, 0);
+}
+
+void CachePack::clear()
+{
+    MyMutex::MyLock lock(mutex);
+    const rtengine::FileLock packLock(lockFile);
+
+    if (!sync()) {
+        return;
+    }
+
+    if (!isOnlyUser(file) || !rewrite(false)) {
+        // the pack can't be replaced while other instances use it, delete the entries one by one instead
+        std::vector<std::string> keys;
+        keys.reserve(index.size());
+
+        for (const auto& entry : index) {
+            keys.push_back(entry.first);
+        }
+
+        for (const auto& key : keys) {
+            append(key, allSections, deletedFlag, nullptr, 0);
+        }
+    }
+}
+
+std::size_t CachePack::getEntryCount() const
+{
+    MyMutex::MyLock lock(mutex);
+
+    return index.size();
+}
+
+std::vector<std::string> CachePack::getKeys() const
+{
+    std::vector<std::pair<std::int64_t, std::string>> entries;
+
+    {
+        MyMutex::MyLock lock(mutex);
+
+        entries.reserve(index.size());
+
+        for (const auto& entry : index) {
+            entries.emplace_back(entry.second.time, entry.first);
+        }
+    }
+
+    std::sort(entries.begin(), entries.end());
+
+    std::vector<std::string> keys;
+    keys.reserve(entries.size());
+
+    for (auto& entry : entries) {
+        keys.push_back(std::move(entry.second));
+    }
+
+    return keys;
+}
+
+void CachePack::compact()
+{
+    MyMutex::MyLock lock(mutex);
+    const rtengine::FileLock packLock(lockFile);
+
+    if (!sync()) {
+        return;
+    }
+
+    const std::uint64_t deadSize = fileSize - packHeaderSize - liveSize;
+
+    // the other instances would keep using the replaced pack
+    if (deadSize > liveSize && deadSize > minCompactionSize && isOnlyUser(file)) {
+        rewrite(true);
+    }
+}
+
+bool CachePack::load()
+{
+    release();
+    index.clear();
+    fileSize = 0;
+    liveSize = 0;
+
+    // the pack is kept open by every instance using it, see isOnlyUser()
+    file = g_fopen(fileName.c_str(), "ab");
+
+    if (!file) {
+        return false;
+    }
+
+    lockUser(file);
+
+    if (remap() && readPackHeader(mapping.get(), generation)) {
+        fileSize = packHeaderSize;
+
+        if (indexTail() || (isOnlyUser(file) && rewrite(true))) {
+            return true;
+        }
+    }
+
+    // Missing, incompatible or unrecoverable pack, start a new one unless another instance still uses it
+    if (!isOnlyUser(file)) {
+        release();
+        index.clear();
+        return false;
+    }
+
+    mapping.reset();
+    index.clear();
+    liveSize = 0;
+    generation = g_random_int();
+
+    if (!truncateFile(file, 0) || !writePackHeader(file, generation) || fflush(file)) {
+        release();
+        return false;
+    }
+
+    fileSize = packHeaderSize;
+
+    return true;
+}
+
+bool CachePack::remap() const
+{
+    mapping.reset();
+
+    GMappedFile* const mappedFile = g_mapped_file_new(fileName.c_str(), FALSE, nullptr);
+
+    if (!mappedFile) {
+        return false;
+    }
+
+    mapping.reset(mappedFile, g_mapped_file_unref);
+    return true;
+}
+
+bool CachePack::sync()
+{
+    if (!file) {
+        return false;
+    }
+
+    std::uint32_t mappedGeneration;
+
+    if (!remap() || !readPackHeader(mapping.get(), mappedGeneration) || mappedGeneration != generation) {
+        // the pack has been deleted or replaced meanwhile
+        return load();
+    }
+
+    return indexTail() || load();
+}
+
+bool CachePack::indexTail()
+{
+    const std::uint64_t length = g_mapped_file_get_length(mapping.get());
+
+    if (length <= fileSize) {
+        return length == fileSize;
+    }
+
+    fileSize = scan(fileSize);
+
+    if (fileSize == length) {
+        return true;
+    }
+
+    // The appends are serialized by the lock, so a damaged tail has been left by a crash during a write.
+    // No instance indexes it, so it is cut back even if others have the pack open.
+    mapping.reset(); // Windows can't truncate a mapped file
+    return truncateFile(file, fileSize);
+}
+
+std::uint64_t CachePack::scan(std::uint64_t offset)
+{
+    const char* const contents = g_mapped_file_get_contents(mapping.get());
+    const std::uint64_t length = g_mapped_file_get_length(mapping.get());
+
+    while (offset + sizeof(RecordHeader) <= length) {
+        RecordHeader header;
+        memcpy(&header, contents + offset, sizeof(header));
+
+        if (header.magic != recordMagic || header.keySize > maxKeySize || getPayloadOffset(header.keySize) > length - offset) {
+            break;
+        }
+
+        if (header.payloadSize > length || getRecordSize(header.keySize, header.payloadSize) > length - offset) {
+            break;
+        }
+
+        const char* const key = contents + offset + sizeof(header);
+
+        if (header.crc != getRecordCrc(header, key, contents + offset + getPayloadOffset(header.keySize))) {
+            break;
+        }
+
+        apply(std::string(key, header.keySize), header.section, header.flags, header.time, offset + getPayloadOffset(header.keySize), header.payloadSize);
+        offset += getRecordSize(header.keySize, header.payloadSize);
+    }
+
+    return offset;
+}
+
+void CachePack::apply(const std::string& key, std::uint32_t section, std::uint32_t flags, std::int64_t time, std::uint64_t offset, std::uint64_t size)
+{
+    if (flags & deletedFlag) {
+        const auto entry = index.find(key);
+
+        if (entry == index.end()) {
+            return;
+        }
+
+        bool empty = true;
+
+        for (std::uint32_t i = 0; i < sectionCount; ++i) {
+            Location& location = entry->second.sections[i];
+
+            if (location.offset && (section == allSections || section == i)) {
+                liveSize -= getRecordSize(key.size(), location.size);
+                location = {};
+            }
+
+            empty = empty && !location.offset;
+        }
+
+        if (empty) {
+            index.erase(entry);
+        }
+    } else if (section < sectionCount) {
+        Entry& entry = index[key];
+        Location& location = entry.sections[section];
+
+        if (location.offset) {
+            liveSize -= getRecordSize(key.size(), location.size);
+        }
+
+        location = {offset, size, false};
+        liveSize += getRecordSize(key.size(), size);
+        entry.time = std::max(entry.time, time);
+    }
+}
+
+bool CachePack::append(const std::string& key, std::uint32_t section, std::uint32_t flags, const char* data, std::size_t size)
+{
+    if (!file || key.empty() || key.size() > maxKeySize) {
+        return false;
+    }
+
+    const std::int64_t time = getTime();
+    std::uint64_t end = 0;
+    const bool written = getFileEnd(file, end) && end == fileSize && writeRecord(file, key, section, flags, time, data, size) && !fflush(file);
+
+    if (!written) {
+        // the pack may now end with a partial record, reloading it cuts it back
+        release();
+        load();
+        return false;
+    }
+
+    apply(key, section, flags, time, end + getPayloadOffset(key.size()), size);
+    fileSize = end + getRecordSize(key.size(), size);
+
+    return true;
+}
+
+bool CachePack::rewrite(bool keepEntries)
+{
+    if (keepEntries && !remap()) {
+        return false;
+    }
+
+    const Glib::ustring tmpName = fileName + ".tmp";
+    FILE* const f = g_fopen(tmpName.c_str(), "wb");
+
+    if (!f) {
+        return false;
+    }
+
+    Index newIndex;
+    std::uint64_t newSize = packHeaderSize;
+    const std::uint32_t newGeneration = g_random_int();
+    bool written = writePackHeader(f, newGeneration);
+
+    if (keepEntries) {
+        const char* const contents = g_mapped_file_get_contents(mapping.get());
+
+        for (const auto& entry : index) {
+            for (std::uint32_t i = 0; written && i < sectionCount; ++i) {
+                const Location& location = entry.second.sections[i];
+
+                if (location.offset) {
+                    written = writeRecord(f, entry.first, i, 0, entry.second.time, contents + location.offset, location.size);
+
+                    Entry& newEntry = newIndex[entry.first];
+                    newEntry.time = entry.second.time;
+                    newEntry.sections[i] = {newSize + getPayloadOffset(entry.first.size()), location.size, false};
+                    newSize += getRecordSize(entry.first.size(), location.size);
+                }
+            }
+        }
+    }
+
+    if (fclose(f) || !written) {
+        g_remove(tmpName.c_str());
+        return false;
+    }
+
+    // Windows can't replace a file which is still open
+    release();
+
+    const bool renamed = !g_rename(tmpName.c_str(), fileName.c_str());
+
+    if (renamed) {
+        index = std::move(newIndex);
+        generation = newGeneration;
+        fileSize = newSize;
+        liveSize = newSize - packHeaderSize;
+    } else {
+        g_remove(tmpName.c_str());
+    }
+
+    remap();
+    file = g_fopen(fileName.c_str(), "ab");
+
+    if (file) {
+        lockUser(file);
+    }
+
+    return renamed && file != nullptr;
+}
+
+void CachePack::release()
+{
+    if (file) {
+        fclose(file);
+        file = nullptr;
+    }
+
+    mapping.reset();
+}
@@ -0,0 +1,155 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <glib.h>
+#include <glibmm/ustring.h>
+
+#include "../rtengine/noncopyable.h"
+
+#include "threadutils.h"
+
+/**
+ * @brief Single file container for the cached data of the file browser's thumbnails
+ *
+ * The pack is an append-only sequence of records, each one holding a section (image data, thumbnail
+ * image...) of a cache entry. Writing a section appends a new record superseding the previous one,
+ * deleting appends a tombstone. When the pack is opened, the index of the live records is built by
+ * walking the record headers of the memory mapped file, and the sections are then read straight from
+ * the mapping instead of opening one file per section and thumbnail.
+ *
+ * A record is only indexed once it has been completely written. The CRC of a record covers its payload too,
+ * and is checked again the first time a section is read. A damaged tail (crash during a write...) is cut back.
+ * A pack with too many dead records is rewritten into a temporary file which then replaces the pack.
+ *
+ * Several instances of RawTherapee may use the same pack. Opening the pack and writing to it are serialized
+ * by a lock on "<pack>.lock", and the records written by the other instances are indexed before each write.
+ * Each instance holds a shared lock on the pack while it has it open, and the pack is only replaced when no
+ * other instance holds one. A generation stamp in the header of the pack tells whether it has been replaced
+ * anyway since it was indexed.
+ */
+class CachePack :
+    public rtengine::NonCopyable
+{
+public:
+    enum class Section {
+        IMAGE_DATA,         // General, DateTime, ExifInfo... groups written by CacheImageData
+        THUMBNAIL_DATA,     // LiveThumbData group written by rtengine::Thumbnail
+        THUMBNAIL_IMAGE,
+        AE_HISTOGRAM,
+        EMBEDDED_PROFILE
+    };
+
+    /**
+     * @brief Read-only view of a section, pointing into the mapping of the pack
+     *
+     * The blob keeps the mapping alive, so it stays valid even if the pack is remapped or rewritten meanwhile.
+     */
+    class Blob
+    {
+    public:
+        Blob ();
+
+        const char* getData () const;
+        std::size_t getSize () const;
+        explicit operator bool () const;
+
+    private:
+        friend class CachePack;
+
+        Blob (const std::shared_ptr<GMappedFile>& mapping, const char* data, std::size_t size);
+
+        std::shared_ptr<GMappedFile> mapping;
+        const char* data;
+        std::size_t size;
+    };
+
+    CachePack ();
+    ~CachePack ();
+
+    /** Opens the pack, creating it if it doesn't exist or if it has been written by an incompatible version.
+      * @return true on success */
+    bool open (const Glib::ustring& fname);
+    void close ();
+
+    Blob get (const std::string& key, Section section) const;
+    /** Writing an empty section removes it */
+    bool put (const std::string& key, Section section, const char* data, std::size_t size);
+    bool put (const std::string& key, Section section, const std::string& data);
+    void remove (const std::string& key, Section section);
+    void remove (const std::string& key);
+    void rename (const std::string& oldKey, const std::string& newKey);
+    void clear ();
+
+    std::size_t getEntryCount () const;
+    /** @return the keys of all entries, least recently written first */
+    std::vector<std::string> getKeys () const;
+
+    /** Rewrites the pack without its dead records if they take more room than the live ones */
+    void compact ();
+
+private:
+    static constexpr std::size_t sectionCount = 5;
+
+    struct Location {
+        std::uint64_t offset;   // of the payload in the pack, 0 if the section is missing
+        std::uint64_t size;
+        mutable bool verified;  // the CRC of the record has been checked by get()
+    };
+
+    struct Entry {
+        std::int64_t time;      // of the last write, in seconds since the epoch
+        Location sections[sectionCount];
+    };
+
+    using Index = std::unordered_map<std::string, Entry>;
+
+    // all of these expect the mutex to be locked, and all but remap() the lock of the pack
+    bool load ();
+    bool remap () const;
+    /** Indexes the records appended by the other instances, reloads the pack if it has been replaced
+      * @return false if the pack can't be written to */
+    bool sync ();
+    /** Indexes the records from fileSize on in the mapping, and cuts a damaged tail back */
+    bool indexTail ();
+    /** Indexes the records from offset on
+      * @return the end of the last valid record */
+    std::uint64_t scan (std::uint64_t offset);
+    void apply (const std::string& key, std::uint32_t section, std::uint32_t flags, std::int64_t time, std::uint64_t offset, std::uint64_t size);
+    bool append (const std::string& key, std::uint32_t section, std::uint32_t flags, const char* data, std::size_t size);
+    bool rewrite (bool keepEntries);
+    void release ();
+
+    Glib::ustring fileName;
+    FILE* file;
+    FILE* lockFile;
+    std::uint32_t generation;   // of the indexed pack
+    mutable std::shared_ptr<GMappedFile> mapping;
+    Index index;
+    std::uint64_t fileSize;
+    std::uint64_t liveSize;     // size of the records referenced by the index
+    mutable MyMutex mutex;
+};
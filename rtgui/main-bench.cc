@@ -0,0 +1,514 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Offline benchmark of the main processing kernels.
+ *
+ * Synthetic Bayer and X-Trans mosaics are generated in-process, so the results
+ * do not depend on a downloaded file and are comparable from one build to the next.
+ * Each kernel is run once to warm up, then timed over the requested number of runs,
+ * for each image size and thread count. Results are written as JSON.
+ */
+
+#ifdef __GNUC__
+#if defined(__FAST_MATH__)
+#error Using the -ffast-math CFLAG is known to lead to problems. Disable it to compile RawTherapee.
+#endif
+#endif
+
+#include "config.h"
+#include <giomm.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <locale.h>
+#include <tiffio.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "options.h"
+#include "version.h"
+
+#include "../rtengine/array2D.h"
+#include "../rtengine/boxblur.h"
+#include "../rtengine/curves.h"
+#include "../rtengine/gauss.h"
+#include "../rtengine/imagefloat.h"
+#include "../rtengine/improcfun.h"
+#include "../rtengine/labimage.h"
+#include "../rtengine/procparams.h"
+#include "../rtengine/rawimagesource.h"
+
+extern Options options;
+
+// stores path to data files
+Glib::ustring argv0;
+Glib::ustring creditsPath;
+Glib::ustring licensePath;
+Glib::ustring argv1;
+
+namespace
+{
+
+using namespace rtengine;
+using namespace rtengine::procparams;
+
+// same layout as RawImage::setSyntheticLayout()
+constexpr int xtransLayout[6][6] = {
+    {1, 1, 0, 1, 1, 2},
+    {1, 1, 2, 1, 1, 0},
+    {2, 0, 1, 0, 2, 1},
+    {1, 1, 2, 1, 1, 0},
+    {1, 1, 0, 1, 1, 2},
+    {0, 2, 1, 2, 0, 1}
+};
+
+struct Result {
+    std::string kernel;
+    std::string variant;
+    int width;
+    int height;
+    int threads;
+    std::vector<double> times; // ms
+};
+
+/* Deterministic test scene in [0;1]: smooth gradients, fine periodic detail (to make the
+ * demosaicers work on aliasing), hard edged patches and a reproducible noise floor */
+float scene(int x, int y, int c, int W, int H)
+{
+    const float fx = static_cast<float>(x) / W;
+    const float fy = static_cast<float>(y) / H;
+    float v = 0.15f + 0.35f * fx * (c == 0 ? 1.f : 0.5f) + 0.25f * fy * (c == 2 ? 1.f : 0.5f);
+    v += 0.1f * std::sin((x * (c + 1) + y * 0.7f) * 0.05f) * std::cos(y * 0.013f);
+
+    if (((x / 97) + (y / 61)) % 5 == 0) {
+        v += c == 1 ? 0.25f : -0.1f;
+    }
+
+    uint32_t hash = static_cast<uint32_t>(x) * 73856093u ^ static_cast<uint32_t>(y) * 19349663u ^ static_cast<uint32_t>(c) * 83492791u;
+    hash ^= hash >> 13;
+    hash *= 0x5bd1e995u;
+    hash ^= hash >> 15;
+    v += ((hash & 0xffff) / 65535.f - 0.5f) * 0.02f;
+
+    return std::max(0.f, std::min(v, 1.f));
+}
+
+void fillMosaic(array2D<float>& mosaic, bool xtrans)
+{
+    const int W = mosaic.width();
+    const int H = mosaic.height();
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+
+    for (int y = 0; y < H; ++y) {
+        for (int x = 0; x < W; ++x) {
+            // RGGB for Bayer
+            const int c = xtrans ? xtransLayout[y % 6][x % 6] : (y & 1) + (x & 1);
+            mosaic[y][x] = 65535.f * scene(x, y, c, W, H);
+        }
+    }
+}
+
+void fillRGB(Imagefloat* img)
+{
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+
+    for (int y = 0; y < img->getHeight(); ++y) {
+        for (int x = 0; x < img->getWidth(); ++x) {
+            img->r(y, x) = 65535.f * scene(x, y, 0, img->getWidth(), img->getHeight());
+            img->g(y, x) = 65535.f * scene(x, y, 1, img->getWidth(), img->getHeight());
+            img->b(y, x) = 65535.f * scene(x, y, 2, img->getWidth(), img->getHeight());
+        }
+    }
+}
+
+void fillLab(LabImage* lab)
+{
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+
+    for (int y = 0; y < lab->H; ++y) {
+        for (int x = 0; x < lab->W; ++x) {
+            lab->L[y][x] = 32768.f * scene(x, y, 1, lab->W, lab->H);
+            lab->a[y][x] = 20000.f * (scene(x, y, 0, lab->W, lab->H) - 0.5f);
+            lab->b[y][x] = 20000.f * (scene(x, y, 2, lab->W, lab->H) - 0.5f);
+        }
+    }
+}
+
+// runs 'prepare' (not timed) and 'run' once to warm up, then 'runs' times, and returns the timings of 'run'
+std::vector<double> measure(int runs, const std::function<void()>& prepare, const std::function<void()>& run)
+{
+    std::vector<double> times;
+
+    for (int i = 0; i <= runs; ++i) {
+        prepare();
+        const auto start = std::chrono::steady_clock::now();
+        run();
+        const auto stop = std::chrono::steady_clock::now();
+
+        if (i > 0) {
+            times.push_back(std::chrono::duration<double, std::milli>(stop - start).count());
+        }
+    }
+
+    return times;
+}
+
+bool parseList(const char* arg, std::vector<double>& values)
+{
+    values.clear();
+    std::string str(arg);
+    std::size_t pos = 0;
+
+    while (pos <= str.size()) {
+        const std::size_t end = std::min(str.find(',', pos), str.size());
+        char* stop = nullptr;
+        const std::string item = str.substr(pos, end - pos);
+        const double value = std::strtod(item.c_str(), &stop);
+
+        if (item.empty() || *stop || value <= 0.0) {
+            return false;
+        }
+
+        values.push_back(value);
+        pos = end + 1;
+    }
+
+    return !values.empty();
+}
+
+std::string escape(const std::string& str)
+{
+    std::string res;
+
+    for (const char c : str) {
+        if (c == '"' || c == '\\') {
+            res += '\\';
+        }
+
+        res += c;
+    }
+
+    return res;
+}
+
+int writeResults(const Glib::ustring& fname, const std::vector<Result>& results, int runs)
+{
+    FILE* const f = fopen(fname.c_str(), "wt");
+
+    if (!f) {
+        return 1;
+    }
+
+#ifdef _OPENMP
+    const int maxThreads = omp_get_num_procs();
+#else
+    const int maxThreads = 1;
+#endif
+
+    fprintf(f, "{\n\"version\":\"%s\",\n\"processors\":%d,\n\"runs\":%d,\n\"results\":[", escape(RTVERSION).c_str(), maxThreads, runs);
+
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const Result& res = results[i];
+        std::vector<double> sorted = res.times;
+        std::sort(sorted.begin(), sorted.end());
+        double sum = 0.0;
+
+        for (const double t : sorted) {
+            sum += t;
+        }
+
+        const std::size_t n = sorted.size();
+        const double median = n % 2 ? sorted[n / 2] : 0.5 * (sorted[n / 2 - 1] + sorted[n / 2]);
+
+        fprintf(f, "%s\n{\"kernel\":\"%s\",\"variant\":\"%s\",\"width\":%d,\"height\":%d,\"threads\":%d,"
+                "\"min_ms\":%.3f,\"median_ms\":%.3f,\"mean_ms\":%.3f,\"max_ms\":%.3f}",
+                i ? "," : "", escape(res.kernel).c_str(), escape(res.variant).c_str(), res.width, res.height, res.threads,
+                sorted.front(), median, sum / n, sorted.back());
+    }
+
+    fprintf(f, "\n]\n}\n");
+
+    return fclose(f) ? 1 : 0;
+}
+
+void printHelp(const char* name)
+{
+    std::cout << "Usage:" << std::endl
+              << "  " << name << " [-s <sizes>] [-t <threads>] [-r <runs>] [-k <kernel>] [-o <file>]" << std::endl << std::endl
+              << "  -s <sizes>    Comma separated list of image sizes in megapixels (default: 2,8,24)." << std::endl
+              << "  -t <threads>  Comma separated list of thread counts (default: 1 and the number of processors)." << std::endl
+              << "  -r <runs>     Number of timed runs of each kernel, after one warm-up run (default: 3)." << std::endl
+              << "  -k <kernel>   Only run the kernels whose name contains <kernel>." << std::endl
+              << "  -o <file>     Write the results as JSON to <file> (default: benchmark.json). The JSON never goes to" << std::endl
+              << "                stdout, which gets the StopWatch timings of a build with WITH_BENCHMARK." << std::endl << std::endl
+              << "Kernels: demosaic_bayer, demosaic_xtrans, gaussianBlur, boxblur, RGB_denoise, ip_wavelet, Lanczos" << std::endl;
+}
+
+}
+
+int main (int argc, char **argv)
+{
+    setlocale (LC_ALL, "");
+    setlocale (LC_NUMERIC, "C"); // to set decimal point to "."
+
+    Gio::init ();
+
+    argv0 = DATA_SEARCH_PATH;
+    creditsPath = CREDITS_SEARCH_PATH;
+    licensePath = LICENCE_SEARCH_PATH;
+    options.rtSettings.lensfunDbDirectory = LENSFUN_DB_PATH;
+
+    std::vector<double> sizes = {2.0, 8.0, 24.0};
+#ifdef _OPENMP
+    std::vector<double> threadCounts = {1.0};
+
+    if (omp_get_num_procs() > 1) {
+        threadCounts.push_back(omp_get_num_procs());
+    }
+
+#else
+    std::vector<double> threadCounts = {1.0};
+#endif
+    int runs = 3;
+    std::string kernelFilter;
+    Glib::ustring outputFile = "benchmark.json";
+
+    for (int iArg = 1; iArg < argc; ++iArg) {
+        const std::string arg(argv[iArg]);
+
+        if (arg == "-h" || arg == "--help") {
+            printHelp(argv[0]);
+            return 0;
+        }
+
+        if (arg.size() != 2 || arg[0] != '-' || iArg + 1 >= argc) {
+            std::cerr << "Invalid argument: " << arg << std::endl;
+            printHelp(argv[0]);
+            return -1;
+        }
+
+        const char* const value = argv[++iArg];
+        bool ok = true;
+
+        switch (arg[1]) {
+            case 's':
+                ok = parseList(value, sizes);
+                break;
+
+            case 't':
+                ok = parseList(value, threadCounts);
+                break;
+
+            case 'r':
+                runs = std::atoi(value);
+                ok = runs > 0;
+                break;
+
+            case 'k':
+                kernelFilter = value;
+                break;
+
+            case 'o':
+                outputFile = Glib::filename_to_utf8(value);
+                break;
+
+            default:
+                ok = false;
+        }
+
+        if (!ok) {
+            std::cerr << "Invalid value for " << arg << ": " << value << std::endl;
+            return -1;
+        }
+    }
+
+    try {
+        Options::load (true);
+    } catch (Options::Error &e) {
+        std::cerr << std::endl
+                  << "FATAL ERROR:" << std::endl
+                  << e.get_msg() << std::endl;
+        return -2;
+    }
+
+    rtengine::setPaths();
+    TIFFSetWarningHandler (nullptr);
+
+    const auto selected = [&kernelFilter](const std::string& kernel)
+    {
+        return kernelFilter.empty() || kernel.find(kernelFilter) != std::string::npos;
+    };
+
+    std::vector<Result> results;
+
+    for (const double megapixels : sizes) {
+        // 3:2 frame, dimensions multiple of the X-Trans period
+        const int W = std::max(6, static_cast<int>(std::sqrt(megapixels * 1.0e6 * 1.5)) / 6 * 6);
+        const int H = std::max(6, W * 2 / 3 / 6 * 6);
+
+        array2D<float> bayer(W, H);
+        array2D<float> xtrans(W, H);
+        fillMosaic(bayer, false);
+        fillMosaic(xtrans, true);
+
+        Imagefloat rgb(W, H);
+        Imagefloat rgbDst(W, H);
+        fillRGB(&rgb);
+
+        LabImage lab(W, H);
+        LabImage labWork(W, H);
+        LabImage labHalf(W / 2, H / 2);
+        fillLab(&lab);
+
+        array2D<float> plane(W, H, lab.L, ARRAY2D_BYREFERENCE);
+        array2D<float> planeDst(W, H);
+
+        for (const double threadCount : threadCounts) {
+            const int threads = static_cast<int>(threadCount);
+#ifdef _OPENMP
+            omp_set_num_threads(threads);
+#endif
+
+            const auto run = [&](const std::string& kernel, const std::string& variant, const std::function<void()>& prepare, const std::function<void()>& func)
+            {
+                if (!selected(kernel)) {
+                    return;
+                }
+
+                std::cerr << kernel << (variant.empty() ? "" : " " + variant) << ", " << W << "x" << H << ", " << threads << " thread(s)" << std::endl;
+                results.push_back({kernel, variant, W, H, threads, measure(runs, prepare, func)});
+            };
+
+            const auto noPrepare = []() {};
+
+            for (const bool isXtrans : {false, true}) {
+                const std::string kernel = isXtrans ? "demosaic_xtrans" : "demosaic_bayer";
+                const std::vector<const char*>& methods = isXtrans ? RAWParams::XTransSensor::getMethodStrings() : RAWParams::BayerSensor::getMethodStrings();
+
+                if (!selected(kernel)) {
+                    continue;
+                }
+
+                RawImageSource src;
+                src.setSyntheticRaw(isXtrans ? xtrans : bayer, isXtrans);
+
+                for (const char* method : methods) {
+                    const Glib::ustring methodString(method);
+
+                    // pixelshift needs several frames and 'none' is no demosaicer
+                    if (methodString == RAWParams::BayerSensor::getMethodString(RAWParams::BayerSensor::Method::PIXELSHIFT)
+                            || methodString == RAWParams::BayerSensor::getMethodString(RAWParams::BayerSensor::Method::NONE)
+                            || methodString == RAWParams::XTransSensor::getMethodString(RAWParams::XTransSensor::Method::NONE)) {
+                        continue;
+                    }
+
+                    RAWParams raw;
+                    raw.bayersensor.method = methodString;
+                    raw.xtranssensor.method = methodString;
+                    double contrastThreshold = 0.0;
+                    run(kernel, method, noPrepare, [&]() {
+                        src.demosaic(raw, false, contrastThreshold);
+                    });
+                }
+            }
+
+            for (const double sigma : {2.0, 30.0}) {
+                run("gaussianBlur", "sigma=" + std::to_string(static_cast<int>(sigma)), noPrepare, [&]() {
+#ifdef _OPENMP
+                    #pragma omp parallel
+#endif
+                    gaussianBlur(plane, planeDst, W, H, sigma);
+                });
+            }
+
+            run("boxblur", "radius=16", noPrepare, [&]() {
+                boxblur<float, float>(plane, planeDst, 16, 16, W, H);
+            });
+
+            {
+                ProcParams params;
+                params.dirpyrDenoise.enabled = true;
+                ImProcFunctions ipf(&params, true);
+                NoiseCurve noiseLCurve;
+                NoiseCurve noiseCCurve;
+                params.dirpyrDenoise.getCurves(noiseLCurve, noiseCCurve);
+
+                int numtiles_W, numtiles_H, tilewidth, tileheight, tileWskip, tileHskip;
+                ipf.Tile_calc(1024, 128, 2, W, H, numtiles_W, numtiles_H, tilewidth, tileheight, tileWskip, tileHskip);
+                const int nbtl = std::max(9, numtiles_W * numtiles_H);
+                std::vector<float> ch_M(nbtl), max_r(nbtl), max_b(nbtl);
+
+                run("RGB_denoise", "", noPrepare, [&]() {
+                    float nresi, highresi;
+                    ipf.RGB_denoise(2, &rgb, &rgbDst, nullptr, ch_M.data(), max_r.data(), max_b.data(), true, params.dirpyrDenoise, 0.0, noiseLCurve, noiseCCurve, nresi, highresi);
+                });
+            }
+
+            {
+                ProcParams params;
+                params.wavelet.enabled = true;
+                ImProcFunctions ipf(&params, true);
+                WavCurve wavCLVCurve;
+                WavOpacityCurveRG waOpacityCurveRG;
+                WavOpacityCurveBY waOpacityCurveBY;
+                WavOpacityCurveW waOpacityCurveW;
+                WavOpacityCurveWL waOpacityCurveWL;
+                params.wavelet.getCurves(wavCLVCurve, waOpacityCurveRG, waOpacityCurveBY, waOpacityCurveW, waOpacityCurveWL);
+                LUTf wavclCurve(65536, 0);
+                bool wavcontlutili = false;
+                CurveFactory::curveWavContL(wavcontlutili, params.wavelet.wavclCurve, wavclCurve, 1);
+
+                run("ip_wavelet", "", [&]() {
+                    labWork.CopyFrom(&lab);
+                }, [&]() {
+                    ipf.ip_wavelet(&labWork, &labWork, 2, params.wavelet, wavCLVCurve, waOpacityCurveRG, waOpacityCurveBY, waOpacityCurveW, waOpacityCurveWL, wavclCurve, 1);
+                });
+            }
+
+            {
+                ProcParams params;
+                ImProcFunctions ipf(&params, true);
+
+                run("Lanczos", "scale=0.5", noPrepare, [&]() {
+                    ipf.Lanczos(&lab, &labHalf, 0.5f);
+                });
+            }
+        }
+    }
+
+    if (writeResults(outputFile, results, runs)) {
+        std::cerr << "Could not write " << outputFile << std::endl;
+        return -2;
+    }
+
+    return 0;
+}
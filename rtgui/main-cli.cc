@@ -27,17 +27,26 @@
 #include <gtkmm.h>
 #include <giomm.h>
 #include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 #include <tiffio.h>
 #include "rtwindow.h"
 #include <cstring>
 #include <cstdlib>
 #include <locale.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "options.h"
 #include "../rtengine/icons.h"
+#include "../rtengine/memorybudget.h"
 #include "soundman.h"
 #include "rtimage.h"
 #include "version.h"
 #include "extprog.h"
+#include "threadutils.h"
 
 #ifndef WIN32
 #include <glibmm/fileutils.h>
@@ -257,6 +266,9 @@ int processLineParams ( int argc, char **argv )
     std::vector<Glib::ustring> inputFiles;
     Glib::ustring outputPath = "";
     std::vector<rtengine::procparams::PartialProfile*> processingParams;
+    std::vector<rtengine::procparams::PartialProfile*> variantParams;
+    std::vector<Glib::ustring> variantNames;
+    std::vector<Glib::ustring> variantTypes; // empty for the format of the main output
     bool outputDirectory = false;
     bool leaveUntouched = false;
     bool overwriteFiles = false;
@@ -271,7 +283,7 @@ int processLineParams ( int argc, char **argv )
     int bits = -1;
     bool isFloat = false;
     std::string outputType = "";
-    unsigned errors = 0;
+    unsigned int numJobs = 1;
 
     for ( int iArg = 1; iArg < argc; iArg++) {
         Glib::ustring currParam (argv[iArg]);
@@ -335,6 +347,52 @@ int processLineParams ( int argc, char **argv )
 
                     break;
 
+                case 'V': // additional output of each input, processed from the same run of the pipeline
+                    if ( iArg + 1 < argc ) {
+                        iArg++;
+                        Glib::ustring fname (fname_to_utf8 (argv[iArg]));
+#if ECLIPSE_ARGS
+                        fname = fname.substr (1, fname.length() - 2);
+#endif
+
+                        if (fname.at (0) == '-') {
+                            std::cerr << "Error: filename missing next to the -V switch." << std::endl;
+                            deleteProcParams (processingParams);
+                            deleteProcParams (variantParams);
+                            return -3;
+                        }
+
+                        // optional output format of the variant, after a colon
+                        Glib::ustring type;
+                        const Glib::ustring::size_type colon = fname.find_last_of (':');
+
+                        if (colon != Glib::ustring::npos) {
+                            const Glib::ustring suffix = fname.substr (colon + 1);
+
+                            if (suffix == "jpg" || suffix == "tif" || suffix == "png") {
+                                type = suffix;
+                                fname = fname.substr (0, colon);
+                            }
+                        }
+
+                        rtengine::procparams::PartialProfile* currentParams = new rtengine::procparams::PartialProfile (true);
+
+                        if (! (currentParams->load ( fname ))) {
+                            variantParams.push_back (currentParams);
+                            // the name of the variant is appended to the name of the output file
+                            const Glib::ustring name = Glib::path_get_basename (fname);
+                            variantNames.push_back (name.substr (0, name.find_last_of ('.')));
+                            variantTypes.push_back (type);
+                        } else {
+                            std::cerr << "Error: \"" << fname << "\" not found." << std::endl;
+                            deleteProcParams (processingParams);
+                            deleteProcParams (variantParams);
+                            return -3;
+                        }
+                    }
+
+                    break;
+
                 case 'S':
                     skipIfNoSidecar = true;
 
@@ -428,6 +486,61 @@ int processLineParams ( int argc, char **argv )
                     fast_export = true;
                     break;
 
+                case 'T': // directory receiving the processing traces
+                    if ( iArg + 1 < argc ) {
+                        iArg++;
+                        Glib::ustring traceDir (fname_to_utf8 (argv[iArg]));
+#if ECLIPSE_ARGS
+                        traceDir = traceDir.substr (1, traceDir.length() - 2);
+#endif
+
+                        if (!Glib::file_test (traceDir, Glib::FILE_TEST_IS_DIR)) {
+                            std::cerr << "Error: \"" << traceDir << "\" is not a folder." << std::endl;
+                            deleteProcParams (processingParams);
+                            return -3;
+                        }
+
+                        options.rtSettings.processingTraceDirectory = traceDir;
+                    }
+
+                    break;
+
+                case 'm': {
+                    const int jobs = currParam.size() > 2 ? atoi (currParam.substr (2).c_str()) : 0;
+
+                    if (jobs < 1) {
+                        std::cerr << "Error: the -m switch requires a number of concurrent jobs greater than 0!" << std::endl;
+                        deleteProcParams (processingParams);
+                        return -3;
+                    }
+
+                    numJobs = jobs;
+                    break;
+                }
+
+                case 'M': {
+                    // only digits, atoi() would read -Mfoo as 0, i.e. no limit
+                    const Glib::ustring value = currParam.substr (2);
+                    const bool valid = !value.empty() && value.size() <= 9 && value.find_first_not_of ("0123456789") == Glib::ustring::npos;
+                    const int budget = valid ? atoi (value.c_str()) : -1;
+
+                    if (budget < 0) {
+                        std::cerr << "Error: the -M switch requires a memory budget in MiB, 0 for no limit!" << std::endl;
+                        deleteProcParams (processingParams);
+                        return -3;
+                    }
+
+                    // the engine is already initialized
+                    options.rtSettings.memoryBudget = budget;
+                    rtengine::MemoryBudget::getInstance()->init (budget);
+                    break;
+                }
+
+                case 'N':
+                    // read by the processing of each job, no need to reinitialize the engine
+                    options.rtSettings.reuseDenoiseModels = true;
+                    break;
+
                 case 'c': // MUST be last option
                     while (iArg + 1 < argc) {
                         iArg++;
@@ -534,7 +647,7 @@ int processLineParams ( int argc, char **argv )
                     std::cout << "  " << Glib::path_get_basename (argv[0]) << " <other options> -c <dir>|<files>   Convert files in batch with your own settings." << std::endl;
                     std::cout << std::endl;
                     std::cout << "Options:" << std::endl;
-                    std::cout << "  " << Glib::path_get_basename (argv[0]) << "[-o <output>|-O <output>] [-q] [-a] [-s|-S] [-p <one.pp3> [-p <two.pp3> ...] ] [-d] [ -j[1-100] -js<1-3> | -t[z] -b<8|16|16f|32> | -n -b<8|16> ] [-Y] [-f] -c <input>" << std::endl;
+                    std::cout << "  " << Glib::path_get_basename (argv[0]) << "[-o <output>|-O <output>] [-q] [-a] [-s|-S] [-p <one.pp3> [-p <two.pp3> ...] ] [-V <variant.pp3>[:jpg|tif|png] ...] [-d] [ -j[1-100] -js<1-3> | -t[z] -b<8|16|16f|32> | -n -b<8|16> ] [-Y] [-f] [-m<N>] [-M<MiB>] [-N] [-T <dir>] -c <input>" << std::endl;
                     std::cout << std::endl;
                     std::cout << "  -c <files>       Specify one or more input files or folders." << std::endl;
                     std::cout << "                   When specifying folders, Rawtherapee will look for image file types which comply" << std::endl;
@@ -554,6 +667,12 @@ int processLineParams ( int argc, char **argv )
                     std::cout << "  -p <file.pp3>    Specify processing profile to be used for all conversions." << std::endl;
                     std::cout << "                   You can specify as many sets of \"-p <file.pp3>\" options as you like," << std::endl;
                     std::cout << "                   each will be built on top of the previous one, as explained below." << std::endl;
+                    std::cout << "  -V <file.pp3>[:jpg|tif|png]" << std::endl;
+                    std::cout << "                   Also save the image with the resize, post-resize sharpening, output profile" << std::endl;
+                    std::cout << "                   and metadata settings of <file.pp3> applied, to <output>_<file>.<ext>." << std::endl;
+                    std::cout << "                   The variant is saved in the format of the main output unless one is given after a colon," << std::endl;
+                    std::cout << "                   with the -j, -js, -b and -t settings that apply to that format, e.g. -V web.pp3:jpg." << std::endl;
+                    std::cout << "                   Can be repeated, all the variants are processed from a single run of the pipeline." << std::endl;
                     std::cout << "  -d               Use the default raw or non-raw processing profile as set in" << std::endl;
                     std::cout << "                   Preferences > Image Processing > Default Processing Profile" << std::endl;
                     std::cout << "  -j[1-100]        Specify output to be JPEG (default, if -t and -n are not set)." << std::endl;
@@ -576,6 +695,15 @@ int processLineParams ( int argc, char **argv )
                     std::cout << "                   Compression is hard-coded to PNG_FILTER_PAETH, Z_RLE." << std::endl;
                     std::cout << "  -Y               Overwrite output if present." << std::endl;
                     std::cout << "  -f               Use the custom fast-export processing pipeline." << std::endl;
+                    std::cout << "  -m<N>            Process N images concurrently (default: 1)." << std::endl;
+                    std::cout << "                   The available processor threads are split evenly between the N jobs." << std::endl;
+                    std::cout << "  -M<MiB>          Limit the memory used by denoise and wavelets of all the jobs to <MiB> (0 = no limit)." << std::endl;
+                    std::cout << "                   They process smaller tiles or fewer tiles at a time to stay within the limit." << std::endl;
+                    std::cout << "  -N               Reuse the chroma noise estimated by the automatic denoise for the images of the" << std::endl;
+                    std::cout << "                   same camera, ISO and exposure, e.g. the frames of a burst. The estimations are kept" << std::endl;
+                    std::cout << "                   in the cache directory for the next runs." << std::endl;
+                    std::cout << "  -T <dir>         Save the duration and the process CPU time and memory use of each processing step into <dir>," << std::endl;
+                    std::cout << "                   one <input>.<hash>.trace.json file per image, viewable in chrome://tracing or Perfetto." << std::endl;
                     std::cout << std::endl;
                     std::cout << "Your " << pparamsExt << " files can be incomplete, RawTherapee will build the final values as follows:" << std::endl;
                     std::cout << "  1- A new processing profile is created using neutral values," << std::endl;
@@ -622,6 +750,8 @@ int processLineParams ( int argc, char **argv )
         }
     }
 
+    const bool bitsSet = bits != -1;
+
     if (bits == -1) {
         if (outputType == "jpg") {
             bits = 8;
@@ -668,14 +798,41 @@ int processLineParams ( int argc, char **argv )
         }
     }
 
-    for ( size_t iFile = 0; iFile < inputFiles.size(); iFile++) {
+    if ( outputType.empty() ) {
+        outputType = "jpg";
+    }
+
+    // format of the main output, the variants with their own format take the settings which apply to it
+    const SaveFormat mainFormat (
+        outputType,
+        outputType == "png" ? bits : (bitsSet && bits == 16 ? 16 : 8),
+        outputType == "jpg" ? compression : 92,
+        subsampling,
+        outputType == "tif" || bitsSet ? bits : 16,
+        isFloat,
+        outputType == "tif" ? compression == 0 : true,
+        copyParamsFile
+    );
+    std::vector<SaveFormat> variantFormats;
+
+    for (const auto& type : variantTypes) {
+        variantFormats.push_back (mainFormat);
+
+        if (!type.empty()) {
+            variantFormats.back().format = type;
+        }
+    }
+
+    // Serializes console output and the (non reentrant) dynamic profile lookup between concurrent jobs
+    MyMutex cliMutex;
+    std::atomic<unsigned> errors (0);
 
+    const auto processFile = [&] (const Glib::ustring& inputFile, std::ostream& out, std::ostream& err)
+    {
         // Has to be reinstanciated at each profile to have a ProcParams object with default values
         rtengine::procparams::ProcParams currentParams;
 
-        Glib::ustring inputFile = inputFiles[iFile];
-        std::cout << "Output is " << bits << "-bit " << (isFloat ? "floating-point" : "integer") << "." << std::endl;
-        std::cout << "Processing: " << inputFile << std::endl;
+        out << "Output is " << bits << "-bit " << (isFloat ? "floating-point" : "integer") << "." << std::endl;
 
         rtengine::InitialImage* ii = nullptr;
         rtengine::ProcessingJob* job = nullptr;
@@ -684,10 +841,6 @@ int processLineParams ( int argc, char **argv )
 
         Glib::ustring outputFile;
 
-        if ( outputType.empty() ) {
-            outputType = "jpg";
-        }
-
         if ( outputPath.empty() ) {
             Glib::ustring s = inputFile;
             Glib::ustring::size_type ext = s.find_last_of ('.');
@@ -707,13 +860,36 @@ int processLineParams ( int argc, char **argv )
         }
 
         if ( inputFile == outputFile) {
-            std::cerr << "Cannot overwrite: " << inputFile << std::endl;
-            continue;
+            err << "Cannot overwrite: " << inputFile << std::endl;
+            return;
         }
 
         if ( !overwriteFiles && Glib::file_test ( outputFile, Glib::FILE_TEST_EXISTS ) ) {
-            std::cerr << outputFile  << " already exists: use -Y option to overwrite. This image has been skipped." << std::endl;
-            continue;
+            err << outputFile  << " already exists: use -Y option to overwrite. This image has been skipped." << std::endl;
+            return;
+        }
+
+        // output files of the variants, next to the main one
+        std::vector<Glib::ustring> variantFiles;
+
+        for (const auto& name : variantNames) {
+            if (leaveUntouched) {
+                variantFiles.push_back (outputFile);
+                continue;
+            }
+
+            const Glib::ustring::size_type ext = outputFile.find_last_of ('.');
+            variantFiles.push_back (outputFile.substr (0, ext) + "_" + name + "." + variantFormats[variantFiles.size()].format);
+
+            if ( inputFile == variantFiles.back() ) {
+                err << "Cannot overwrite: " << inputFile << std::endl;
+                return;
+            }
+
+            if ( !overwriteFiles && Glib::file_test ( variantFiles.back(), Glib::FILE_TEST_EXISTS ) ) {
+                err << variantFiles.back() << " already exists: use -Y option to overwrite. This image has been skipped." << std::endl;
+                return;
+            }
         }
 
         // Load the image
@@ -728,29 +904,41 @@ int processLineParams ( int argc, char **argv )
 
         if (!ii) {
             errors++;
-            std::cerr << "Error loading file: " << inputFile << std::endl;
-            continue;
+            err << "Error loading file: " << inputFile << std::endl;
+            return;
         }
 
         if (useDefault) {
             if (isRaw) {
                 if (options.defProfRaw == DEFPROFILE_DYNAMIC) {
-                    rawParams->deleteInstance();
-                    delete rawParams;
-                    rawParams = ProfileStore::getInstance()->loadDynamicProfile (ii->getMetaData());
+                    rtengine::procparams::PartialProfile* dynamicParams;
+                    {
+                        MyMutex::MyLock lock (cliMutex);
+                        dynamicParams = ProfileStore::getInstance()->loadDynamicProfile (ii->getMetaData());
+                    }
+                    out << "  Merging default raw processing profile." << std::endl;
+                    dynamicParams->applyTo (&currentParams);
+                    dynamicParams->deleteInstance();
+                    delete dynamicParams;
+                } else {
+                    out << "  Merging default raw processing profile." << std::endl;
+                    rawParams->applyTo (&currentParams);
                 }
-
-                std::cout << "  Merging default raw processing profile." << std::endl;
-                rawParams->applyTo (&currentParams);
             } else {
                 if (options.defProfImg == DEFPROFILE_DYNAMIC) {
-                    imgParams->deleteInstance();
-                    delete imgParams;
-                    imgParams = ProfileStore::getInstance()->loadDynamicProfile (ii->getMetaData());
+                    rtengine::procparams::PartialProfile* dynamicParams;
+                    {
+                        MyMutex::MyLock lock (cliMutex);
+                        dynamicParams = ProfileStore::getInstance()->loadDynamicProfile (ii->getMetaData());
+                    }
+                    out << "  Merging default non-raw processing profile." << std::endl;
+                    dynamicParams->applyTo (&currentParams);
+                    dynamicParams->deleteInstance();
+                    delete dynamicParams;
+                } else {
+                    out << "  Merging default non-raw processing profile." << std::endl;
+                    imgParams->applyTo (&currentParams);
                 }
-
-                std::cout << "  Merging default non-raw processing profile." << std::endl;
-                imgParams->applyTo (&currentParams);
             }
         }
 
@@ -765,15 +953,15 @@ int processLineParams ( int argc, char **argv )
 
                 // the "load" method don't reset the procparams values anymore, so values found in the procparam file override the one of currentParams
                 if ( !Glib::file_test ( sideProcessingParams, Glib::FILE_TEST_EXISTS ) || currentParams.load ( sideProcessingParams )) {
-                    std::cerr << "Warning: sidecar file requested but not found for: " << sideProcessingParams << std::endl;
+                    err << "Warning: sidecar file requested but not found for: " << sideProcessingParams << std::endl;
                 } else {
                     sideCarFound = true;
-                    std::cout << "  Merging sidecar procparams." << std::endl;
+                    out << "  Merging sidecar procparams." << std::endl;
                 }
             }
 
             if ( processingParams.size() > i  ) {
-                std::cout << "  Merging procparams #" << i << std::endl;
+                out << "  Merging procparams #" << i << std::endl;
                 processingParams[i]->applyTo (&currentParams);
             }
 
@@ -783,52 +971,119 @@ int processLineParams ( int argc, char **argv )
         if ( sideProcParams && !sideCarFound && skipIfNoSidecar ) {
             delete ii;
             errors++;
-            std::cerr << "Error: no sidecar procparams found for: " << inputFile << std::endl;
-            continue;
+            err << "Error: no sidecar procparams found for: " << inputFile << std::endl;
+            return;
         }
 
         job = rtengine::ProcessingJob::create (ii, currentParams, fast_export);
 
         if ( !job ) {
             errors++;
-            std::cerr << "Error creating processing for: " << inputFile << std::endl;
+            err << "Error creating processing for: " << inputFile << std::endl;
             ii->decreaseRef();
-            continue;
+            return;
+        }
+
+        std::vector<rtengine::procparams::ProcParams> outputParams (1, currentParams);
+
+        for (size_t iVariant = 0; iVariant < variantParams.size(); iVariant++) {
+            out << "  Adding variant " << variantNames[iVariant] << std::endl;
+            rtengine::procparams::ProcParams variant = currentParams;
+            variantParams[iVariant]->applyTo (&variant);
+            // only the tail settings of the variant are used, so are they in its sidecar
+            outputParams.push_back (rtengine::ProcessingJob::getOutputParams (currentParams, variant));
+            job->addOutput (outputParams.back());
         }
 
         // Process image
-        rtengine::IImagefloat* resultImage = rtengine::processImage (job, errorCode, nullptr);
+        const std::vector<rtengine::IImagefloat*> resultImages = rtengine::processImageOutputs (job, errorCode, nullptr);
 
-        if ( !resultImage ) {
+        if ( resultImages.empty() ) {
             errors++;
-            std::cerr << "Error processing: " << inputFile << std::endl;
+            err << "Error processing: " << inputFile << std::endl;
             rtengine::ProcessingJob::destroy ( job );
-            continue;
+            return;
         }
 
-        // save image to disk
-        if ( outputType == "jpg" ) {
-            errorCode = resultImage->saveAsJPEG ( outputFile, compression, subsampling );
-        } else if ( outputType == "tif" ) {
-            errorCode = resultImage->saveAsTIFF ( outputFile, bits, isFloat, compression == 0  );
-        } else if ( outputType == "png" ) {
-            errorCode = resultImage->saveAsPNG ( outputFile, bits );
-        } else {
-            errorCode = resultImage->saveToFile (outputFile);
-        }
+        for (size_t iImage = 0; iImage < resultImages.size(); iImage++) {
+            rtengine::IImagefloat* const resultImage = resultImages[iImage];
+            const Glib::ustring& imageFile = iImage == 0 ? outputFile : variantFiles[iImage - 1];
+            const SaveFormat& format = iImage == 0 ? mainFormat : variantFormats[iImage - 1];
+
+            // save image to disk
+            if ( format.format == "jpg" ) {
+                errorCode = resultImage->saveAsJPEG ( imageFile, format.jpegQuality, format.jpegSubSamp );
+            } else if ( format.format == "tif" ) {
+                errorCode = resultImage->saveAsTIFF ( imageFile, format.tiffBits, format.tiffFloat, format.tiffUncompressed );
+            } else if ( format.format == "png" ) {
+                errorCode = resultImage->saveAsPNG ( imageFile, format.pngBits );
+            } else {
+                errorCode = resultImage->saveToFile (imageFile);
+            }
 
-        if (errorCode) {
-            errors++;
-            std::cerr << "Error saving to: " << outputFile << std::endl;
-        } else {
-            if ( copyParamsFile ) {
-                Glib::ustring outputProcessingParams = outputFile + paramFileExtension;
-                currentParams.save ( outputProcessingParams );
+            if (errorCode) {
+                errors++;
+                err << "Error saving to: " << imageFile << std::endl;
+            } else {
+                if ( copyParamsFile ) {
+                    Glib::ustring outputProcessingParams = imageFile + paramFileExtension;
+                    outputParams[iImage].save ( outputProcessingParams );
+                }
             }
+
+            resultImage->free();
         }
 
         ii->decreaseRef();
-        resultImage->free();
+    };
+
+    if (numJobs > inputFiles.size()) {
+        numJobs = inputFiles.size();
+    }
+
+    if (numJobs <= 1) {
+        for ( size_t iFile = 0; iFile < inputFiles.size(); iFile++) {
+            std::cout << "Processing: " << inputFiles[iFile] << std::endl;
+            processFile (inputFiles[iFile], std::cout, std::cerr);
+        }
+    } else {
+        // Split the OpenMP thread budget between the concurrent jobs, each job processes one image at a time
+        int threadsPerJob = 1;
+#ifdef _OPENMP
+        threadsPerJob = std::max (1, omp_get_max_threads() / static_cast<int> (numJobs));
+#endif
+        std::cout << "Running " << numJobs << " jobs with " << threadsPerJob << " thread(s) each." << std::endl;
+
+        std::atomic<size_t> nextFile (0);
+        std::vector<std::thread> workers;
+
+        for (unsigned int iJob = 0; iJob < numJobs; ++iJob) {
+            workers.emplace_back ([&, threadsPerJob] () {
+#ifdef _OPENMP
+                // only affects the parallel regions started by this thread
+                omp_set_num_threads (threadsPerJob);
+#endif
+
+                for (size_t iFile = nextFile++; iFile < inputFiles.size(); iFile = nextFile++) {
+                    {
+                        MyMutex::MyLock lock (cliMutex);
+                        std::cout << "Processing: " << inputFiles[iFile] << std::endl;
+                    }
+
+                    // buffer the messages of this image so they don't interleave with the other jobs
+                    std::ostringstream out, err;
+                    processFile (inputFiles[iFile], out, err);
+
+                    MyMutex::MyLock lock (cliMutex);
+                    std::cout << "Finished: " << inputFiles[iFile] << std::endl << out.str() << std::flush;
+                    std::cerr << err.str() << std::flush;
+                }
+            });
+        }
+
+        for (auto& worker : workers) {
+            worker.join();
+        }
     }
 
     if (imgParams) {
@@ -842,6 +1097,7 @@ int processLineParams ( int argc, char **argv )
     }
 
     deleteProcParams (processingParams);
+    deleteProcParams (variantParams);
 
     return errors > 0 ? -2 : 0;
 }
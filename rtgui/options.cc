@@ -636,6 +636,15 @@ void Options::setDefaults()
     cropAutoFit = false;
 
     rtSettings.thumbnail_inspector_mode = rtengine::Settings::ThumbnailInspectorMode::JPEG;
+    rtSettings.processingTraceDirectory = "";
+    rtSettings.exportStripHeight = 0;
+    rtSettings.demosaicCacheSize = 0;
+    rtSettings.threadBudget = 0;
+    rtSettings.previewStageCacheSize = 256;
+    rtSettings.progressivePreview = true;
+    rtSettings.bufferPoolSize = 512;
+    rtSettings.memoryBudget = 0;
+    rtSettings.reuseDenoiseModels = false;
 }
 
 Options* Options::copyFrom(Options* other)
@@ -1113,6 +1122,42 @@ void Options::readFromFile(Glib::ustring fname)
                 if (keyFile.has_key("Performance", "ThumbnailInspectorMode")) {
                     rtSettings.thumbnail_inspector_mode = static_cast<rtengine::Settings::ThumbnailInspectorMode>(keyFile.get_integer("Performance", "ThumbnailInspectorMode"));
                 }
+
+                if (keyFile.has_key("Performance", "ProcessingTraceDirectory")) {
+                    rtSettings.processingTraceDirectory = keyFile.get_string("Performance", "ProcessingTraceDirectory");
+                }
+
+                if (keyFile.has_key("Performance", "ExportStripHeight")) {
+                    rtSettings.exportStripHeight = std::max(0, keyFile.get_integer("Performance", "ExportStripHeight"));
+                }
+
+                if (keyFile.has_key("Performance", "DemosaicCacheSize")) {
+                    rtSettings.demosaicCacheSize = std::max(0, keyFile.get_integer("Performance", "DemosaicCacheSize"));
+                }
+
+                if (keyFile.has_key("Performance", "ThreadBudget")) {
+                    rtSettings.threadBudget = std::max(0, keyFile.get_integer("Performance", "ThreadBudget"));
+                }
+
+                if (keyFile.has_key("Performance", "PreviewStageCacheSize")) {
+                    rtSettings.previewStageCacheSize = std::max(0, keyFile.get_integer("Performance", "PreviewStageCacheSize"));
+                }
+
+                if (keyFile.has_key("Performance", "ProgressivePreview")) {
+                    rtSettings.progressivePreview = keyFile.get_boolean("Performance", "ProgressivePreview");
+                }
+
+                if (keyFile.has_key("Performance", "BufferPoolSize")) {
+                    rtSettings.bufferPoolSize = std::max(0, keyFile.get_integer("Performance", "BufferPoolSize"));
+                }
+
+                if (keyFile.has_key("Performance", "MemoryBudget")) {
+                    rtSettings.memoryBudget = std::max(0, keyFile.get_integer("Performance", "MemoryBudget"));
+                }
+
+                if (keyFile.has_key("Performance", "ReuseDenoiseModels")) {
+                    rtSettings.reuseDenoiseModels = keyFile.get_boolean("Performance", "ReuseDenoiseModels");
+                }
             }
 
             if (keyFile.has_group("GUI")) {
@@ -1987,6 +2032,15 @@ void Options::saveToFile(Glib::ustring fname)
         keyFile.set_integer("Performance", "ChunkSizeXT", chunkSizeXT);
         keyFile.set_integer("Performance", "ChunkSizeCA", chunkSizeCA);
         keyFile.set_integer("Performance", "ThumbnailInspectorMode", int(rtSettings.thumbnail_inspector_mode));
+        keyFile.set_string("Performance", "ProcessingTraceDirectory", rtSettings.processingTraceDirectory);
+        keyFile.set_integer("Performance", "ExportStripHeight", rtSettings.exportStripHeight);
+        keyFile.set_integer("Performance", "DemosaicCacheSize", rtSettings.demosaicCacheSize);
+        keyFile.set_integer("Performance", "ThreadBudget", rtSettings.threadBudget);
+        keyFile.set_integer("Performance", "PreviewStageCacheSize", rtSettings.previewStageCacheSize);
+        keyFile.set_boolean("Performance", "ProgressivePreview", rtSettings.progressivePreview);
+        keyFile.set_integer("Performance", "BufferPoolSize", rtSettings.bufferPoolSize);
+        keyFile.set_integer("Performance", "MemoryBudget", rtSettings.memoryBudget);
+        keyFile.set_boolean("Performance", "ReuseDenoiseModels", rtSettings.reuseDenoiseModels);
 
         keyFile.set_string("Output", "Format", saveFormat.format);
         keyFile.set_integer("Output", "JpegQuality", saveFormat.jpegQuality);
@@ -2340,6 +2394,10 @@ void Options::load(bool lightweight)
         printf("Cache directory (cacheBaseDir) = %s\n", cacheBaseDir.c_str());
     }
 
+    options.rtSettings.demosaicCacheDirectory = Glib::build_filename(cacheBaseDir, "demosaiced");
+    options.rtSettings.fftwWisdomFile = Glib::build_filename(cacheBaseDir, "fftw_wisdom");
+    options.rtSettings.denoiseModelFile = Glib::build_filename(cacheBaseDir, "denoise_models");
+
     // Update profile's path and recreate it if necessary
     options.updatePaths();
 
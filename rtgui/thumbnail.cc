@@ -179,7 +179,7 @@ void Thumbnail::_generateThumbnailImage ()
         _saveThumbnail ();
         cfs.supported = true;
 
-        cfs.save (getCacheFileName ("data", ".txt"));
+        saveCacheImageData ();
 
         generateExifDateTimeStrings ();
     }
@@ -525,7 +525,7 @@ void Thumbnail::imageDeveloped ()
 {
 
     cfs.recentlySaved = true;
-    cfs.save (getCacheFileName ("data", ".txt"));
+    saveCacheImageData ();
 
     if (options.saveParamsCache) {
         pparams->save (getCacheFileName ("profiles", paramFileExtension));
@@ -844,10 +844,10 @@ int Thumbnail::infoFromImage (const Glib::ustring& fname, std::unique_ptr<rtengi
 /*
  * Read all thumbnail's data from the cache; build and save them if doesn't exist - NON PROTECTED
  * This includes:
- *  - image's bitmap (*.rtti)
+ *  - image's bitmap
  *  - auto exposure's histogram (full thumbnail only)
  *  - embedded profile (full thumbnail only)
- *  - LiveThumbData section of the data file
+ *  - LiveThumbData section of the thumbnail data
  */
 void Thumbnail::_loadThumbnail(bool firstTrial)
 {
@@ -859,14 +859,18 @@ void Thumbnail::_loadThumbnail(bool firstTrial)
     tpp->isRaw = (cfs.format == (int) FT_Raw);
 
     // load supplementary data
-    bool succ = tpp->readData (getCacheFileName ("data", ".txt"));
+    const auto thumbnailData = readCacheData (CachePack::Section::THUMBNAIL_DATA);
+    bool succ = thumbnailData && tpp->readData (std::string (thumbnailData.getData (), thumbnailData.getSize ()));
 
     if (succ) {
         tpp->getAutoWBMultipliers(cfs.redAWBMul, cfs.greenAWBMul, cfs.blueAWBMul);
     }
 
     // thumbnail image
-    succ = succ && tpp->readImage (getCacheFileName ("images", ""));
+    if (succ) {
+        const auto image = readCacheData (CachePack::Section::THUMBNAIL_IMAGE);
+        succ = tpp->readImage (image.getData (), image.getSize ());
+    }
 
     if (!succ && firstTrial) {
         _generateThumbnailImage ();
@@ -887,11 +891,13 @@ void Thumbnail::_loadThumbnail(bool firstTrial)
     if ( cfs.thumbImgType == CacheImageData::FULL_THUMBNAIL ) {
         if(!tpp->isAeValid()) {
             // load aehistogram
-            tpp->readAEHistogram (getCacheFileName ("aehistograms", ""));
+            const auto aeHistogram = readCacheData (CachePack::Section::AE_HISTOGRAM);
+            tpp->readAEHistogram (aeHistogram.getData (), aeHistogram.getSize ());
         }
 
         // load embedded profile
-        tpp->readEmbProfile (getCacheFileName ("embprofiles", ".icc"));
+        const auto embProfile = readCacheData (CachePack::Section::EMBEDDED_PROFILE);
+        tpp->readEmbProfile (embProfile.getData (), embProfile.getSize ());
 
         tpp->init ();
     }
@@ -904,10 +910,10 @@ void Thumbnail::_loadThumbnail(bool firstTrial)
 /*
  * Read all thumbnail's data from the cache; build and save them if doesn't exist - MUTEX PROTECTED
  * This includes:
- *  - image's bitmap (*.rtti)
+ *  - image's bitmap
  *  - auto exposure's histogram (full thumbnail only)
  *  - embedded profile (full thumbnail only)
- *  - LiveThumbData section of the data file
+ *  - LiveThumbData section of the thumbnail data
  */
 void Thumbnail::loadThumbnail (bool firstTrial)
 {
@@ -918,10 +924,10 @@ void Thumbnail::loadThumbnail (bool firstTrial)
 /*
  * Save thumbnail's data to the cache - NON PROTECTED
  * This includes:
- *  - image's bitmap (*.rtti)
+ *  - image's bitmap
  *  - auto exposure's histogram (full thumbnail only)
  *  - embedded profile (full thumbnail only)
- *  - LiveThumbData section of the data file
+ *  - LiveThumbData section of the thumbnail data
  */
 void Thumbnail::_saveThumbnail ()
 {
@@ -930,29 +936,34 @@ void Thumbnail::_saveThumbnail ()
         return;
     }
 
-    g_remove (getCacheFileName ("images", ".rtti").c_str ());
+    // the write functions leave the buffer empty on failure, which removes the section from the cache
+    std::string buffer;
 
     // save thumbnail image
-    tpp->writeImage (getCacheFileName ("images", ""));
+    tpp->writeImage (buffer);
+    writeCacheData (CachePack::Section::THUMBNAIL_IMAGE, buffer);
 
     if(!tpp->isAeValid()) {
         // save aehistogram
-        tpp->writeAEHistogram (getCacheFileName ("aehistograms", ""));
+        tpp->writeAEHistogram (buffer);
+        writeCacheData (CachePack::Section::AE_HISTOGRAM, buffer);
     }
     // save embedded profile
-    tpp->writeEmbProfile (getCacheFileName ("embprofiles", ".icc"));
+    tpp->writeEmbProfile (buffer);
+    writeCacheData (CachePack::Section::EMBEDDED_PROFILE, buffer);
 
     // save supplementary data
-    tpp->writeData (getCacheFileName ("data", ".txt"));
+    tpp->writeData (buffer);
+    writeCacheData (CachePack::Section::THUMBNAIL_DATA, buffer);
 }
 
 /*
  * Save thumbnail's data to the cache - MUTEX PROTECTED
  * This includes:
- *  - image's bitmap (*.rtti)
+ *  - image's bitmap
  *  - auto exposure's histogram (full thumbnail only)
  *  - embedded profile (full thumbnail only)
- *  - LiveThumbData section of the data file
+ *  - LiveThumbData section of the thumbnail data
  */
 void Thumbnail::saveThumbnail ()
 {
@@ -978,7 +989,7 @@ void Thumbnail::updateCache (bool updatePParams, bool updateCacheImageData)
     }
 
     if (updateCacheImageData) {
-        cfs.save (getCacheFileName ("data", ".txt"));
+        saveCacheImageData ();
     }
 }
 
@@ -996,6 +1007,28 @@ Glib::ustring Thumbnail::getCacheFileName (const Glib::ustring& subdir, const Gl
     return cachemgr->getCacheFileName (subdir, fname, fext, cfs.md5);
 }
 
+CachePack::Blob Thumbnail::readCacheData (CachePack::Section section) const
+{
+    return cachemgr->readCacheData (fname, cfs.md5, section);
+}
+
+void Thumbnail::writeCacheData (CachePack::Section section, const std::string& data) const
+{
+    cachemgr->writeCacheData (fname, cfs.md5, section, data);
+}
+
+/*
+ * Save the CacheImageData values, i.e. the General, DateTime, ExifInfo, File info and ExtraRawInfo sections
+ */
+void Thumbnail::saveCacheImageData ()
+{
+    std::string keyData;
+
+    if (cfs.save (keyData) == 0) {
+        writeCacheData (CachePack::Section::IMAGE_DATA, keyData);
+    }
+}
+
 void Thumbnail::setFileName (const Glib::ustring &fn)
 {
 
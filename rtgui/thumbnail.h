@@ -78,6 +78,9 @@ class Thumbnail
     void            generateExifDateTimeStrings ();
 
     Glib::ustring    getCacheFileName (const Glib::ustring& subdir, const Glib::ustring& fext) const;
+    CachePack::Blob  readCacheData (CachePack::Section section) const;
+    void             writeCacheData (CachePack::Section section, const std::string& data) const;
+    void             saveCacheImageData ();
 
 public:
     Thumbnail (CacheManager* cm, const Glib::ustring& fname, CacheImageData* cf);